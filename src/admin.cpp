@@ -0,0 +1,268 @@
+#include "admin.h"
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "response_generator.h"
+#include "text_util.h"
+
+namespace {
+
+const char* reasonPhrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+    }
+    return "Error";
+}
+
+// Milliseconds left until deadline, for poll(); 0 once it has passed
+int remainingMs(std::chrono::steady_clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+bool waitFor(int fd, short events, std::chrono::steady_clock::time_point deadline) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    int ready;
+    do {
+        ready = poll(&pfd, 1, remainingMs(deadline));
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+
+} // namespace
+
+AdminServer::AdminServer(RuntimeConfig& config, const LatencyDistributionCache* histograms)
+    : config_(config)
+    , stop_fd_(-1) {
+    if (histograms) {
+        distributions_.addHistograms(*histograms);
+    }
+}
+
+AdminServer::~AdminServer() {
+    stop();
+}
+
+bool AdminServer::start(const ListenAddress& address) {
+    if (!sockets_.bind(address) || !sockets_.listen()) {
+        error_message_ = "Admin listener: " + sockets_.getErrorMessage();
+        sockets_.closeAll();
+        return false;
+    }
+    stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd_ < 0) {
+        error_message_ = std::string("eventfd failed: ") + strerror(errno);
+        sockets_.closeAll();
+        return false;
+    }
+    thread_ = std::thread(&AdminServer::run, this);
+    return true;
+}
+
+void AdminServer::stop() {
+    if (thread_.joinable()) {
+        uint64_t one = 1;
+        ssize_t written = write(stop_fd_, &one, sizeof(one));
+        (void)written;
+        thread_.join();
+    }
+    if (stop_fd_ >= 0) {
+        close(stop_fd_);
+        stop_fd_ = -1;
+    }
+    sockets_.closeAll();
+}
+
+const std::string& AdminServer::getErrorMessage() const {
+    return error_message_;
+}
+
+void AdminServer::run() {
+    struct pollfd fds[2];
+    fds[0].fd = sockets_.getListenFd();
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd_;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        // Woken at least once a second to free what the loop has moved past
+        int ready = poll(fds, 2, 1000);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            break;
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            int fd;
+            while ((fd = sockets_.acceptConnection()) >= 0) {
+                serve(fd);
+                close(fd);
+            }
+        }
+        config_.reclaim();
+    }
+}
+
+void AdminServer::serve(int fd) {
+    HttpParser parser;
+    std::string body;
+    int status = 0;
+    std::string reply;
+    if (readRequest(fd, parser, body, status)) {
+        status = handle(parser.getRequest(), body, reply);
+    } else if (status == 0) {
+        return;
+    }
+
+    HttpResponse response = ResponseGenerator::createOkResponse(
+        reply.empty() ? reasonPhrase(status) : reply);
+    response.status_code = status;
+    response.reason_phrase = reasonPhrase(status);
+    response.headers["Content-Type"] = status == 200 ? "application/json" : "text/plain";
+    ResponseGenerator generator;
+    std::string out = generator.serializeHead(response) + response.body;
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(REQUEST_TIMEOUT_MS);
+    size_t sent = 0;
+    while (sent < out.length()) {
+        ssize_t n = send(fd, out.data() + sent, out.length() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EAGAIN && waitFor(fd, POLLOUT, deadline)) {
+            continue;
+        } else {
+            return;
+        }
+    }
+}
+
+bool AdminServer::readRequest(int fd, HttpParser& parser, std::string& body, int& status) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(REQUEST_TIMEOUT_MS);
+    char buffer[4096];
+    size_t expected = 0;
+    bool head_done = false;
+
+    while (!head_done || body.length() < expected) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EAGAIN) {
+            if (!waitFor(fd, POLLIN, deadline)) {
+                status = 408;
+                return false;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+
+        if (head_done) {
+            body.append(buffer, static_cast<size_t>(n));
+            continue;
+        }
+        HttpParser::ParseResult result = parser.parse(buffer, static_cast<size_t>(n));
+        if (result == HttpParser::ParseResult::INCOMPLETE) {
+            continue;
+        }
+        if (result != HttpParser::ParseResult::COMPLETE) {
+            status = 400;
+            return false;
+        }
+
+        head_done = true;
+        const HttpRequest& request = parser.getRequest();
+        if (!request.getHeader("Transfer-Encoding").empty()) {
+            status = 411;
+            return false;
+        }
+        std::string length = request.getHeader("Content-Length");
+        expected = std::strtoull(length.c_str(), nullptr, 10);
+        if (expected > MAX_BODY) {
+            status = 413;
+            return false;
+        }
+        body = parser.getRawData().substr(parser.getHeaderLength());
+    }
+    body.resize(expected);
+    return true;
+}
+
+int AdminServer::handle(const HttpRequest& request, const std::string& body, std::string& reply) {
+    size_t query = request.path.find('?');
+    std::string path = request.path.substr(0, query);
+    if (path == "/config" && request.method == "GET") {
+        reply = config_.current().toJson();
+        return 200;
+    }
+    if (path != "/config/default" && path != "/config/chaos" && path != "/config/scenario") {
+        return 404;
+    }
+    if (request.method != "PUT" && request.method != "POST") {
+        return 405;
+    }
+
+    // Everything the request does not change is shared with the current one
+    auto next = std::make_unique<ConfigSnapshot>(config_.current());
+    if (path == "/config/default") {
+        next->has_default = !request.query_params.empty();
+        next->default_query = query == std::string::npos ? "" : request.path.substr(query + 1);
+        next->default_command = TestCommand();
+        if (next->has_default) {
+            CommandInterpreter interpreter(&distributions_, &scripts_);
+            next->default_command = interpreter.interpret(request.query_params);
+            auto behavior = request.query_params.find("behavior");
+            bool known = behavior == request.query_params.end() ||
+                         behavior->second ==
+                             CommandInterpreter::behaviorName(next->default_command.behavior);
+            if (!known || !interpreter.isValid(next->default_command)) {
+                reply = "Invalid default behavior: " + next->default_query;
+                return 400;
+            }
+            if (!interpreter.getErrorMessage().empty()) {
+                reply = "Invalid default behavior: " + interpreter.getErrorMessage();
+                return 400;
+            }
+        }
+    } else if (path == "/config/chaos") {
+        next->chaos_spec = trim(body, " \t\r\n");
+        next->chaos.reset();
+        if (!next->chaos_spec.empty()) {
+            auto chaos = std::make_shared<ChaosMix>();
+            if (!chaos->parse(next->chaos_spec, &distributions_, &scripts_)) {
+                reply = chaos->getErrorMessage();
+                return 400;
+            }
+            next->chaos = std::move(chaos);
+        }
+    } else {
+        next->router.reset();
+        if (!trim(body, " \t\r\n").empty()) {
+            auto router = std::make_shared<ScenarioRouter>();
+            if (!router->loadString(body, &distributions_, &scripts_)) {
+                reply = router->getErrorMessage();
+                return 400;
+            }
+            next->router = std::move(router);
+        }
+    }
+
+    config_.publish(std::move(next));
+    reply = config_.current().toJson();
+    return 200;
+}
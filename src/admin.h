@@ -0,0 +1,65 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <string>
+#include <thread>
+#include "socket_manager.h"
+#include "http_parser.h"
+#include "runtime_config.h"
+
+// --admin: a listener of its own (host:port or unix:<path>) through which
+// the default behavior, the chaos mix and the scenario table are changed
+// at runtime. It is served by one thread, one request at a time, so
+// parsing a large scenario never holds up the event loop; the loop only
+// sees the result when it is published to RuntimeConfig.
+//
+//   GET /config                    the current snapshot as JSON
+//   PUT /config/default?<query>    behavior for plain requests; no query clears
+//   PUT /config/chaos              body: a --chaos spec; empty clears
+//   PUT /config/scenario           body: a scenario document; empty clears
+//
+// POST works wherever PUT does. Every change answers with the new snapshot.
+// dist= and script= resolve through caches of the admin thread's own,
+// holding the same histograms as the loop's; the tables and programs they
+// build reach the loop inside the published snapshot. A change where they
+// do not resolve is answered with 400.
+class AdminServer {
+public:
+    static constexpr size_t MAX_BODY = size_t(16) << 20;
+    static constexpr int REQUEST_TIMEOUT_MS = 5000;
+
+    // histograms: the cache whose --latency-histogram entries dist=empirical
+    // may name (may be null); they are copied, nothing is shared
+    explicit AdminServer(RuntimeConfig& config,
+                         const LatencyDistributionCache* histograms = nullptr);
+    ~AdminServer();
+
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+    // Binds the address and starts the thread
+    bool start(const ListenAddress& address);
+    // Closes the listener and joins the thread; also done by the destructor
+    void stop();
+
+    // Applies one request, with body already read; returns the status code
+    // and the response body in reply
+    int handle(const HttpRequest& request, const std::string& body, std::string& reply);
+
+    const std::string& getErrorMessage() const;
+
+private:
+    RuntimeConfig& config_;
+    LatencyDistributionCache distributions_;  // only the admin thread uses these
+    ScriptCache scripts_;
+    SocketManager sockets_;
+    int stop_fd_;       // eventfd that wakes the thread to exit
+    std::thread thread_;
+    std::string error_message_;
+
+    void run();
+    void serve(int fd);
+    bool readRequest(int fd, HttpParser& parser, std::string& body, int& status);
+};
+
+#endif // ADMIN_H
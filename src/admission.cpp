@@ -0,0 +1,109 @@
+#include "admission.h"
+#include <algorithm>
+#include <sstream>
+
+Admission::Admission(size_t max_connections, size_t memory_budget, size_t max_header_size)
+    : max_connections_(max_connections)
+    , memory_budget_(memory_budget)
+    , max_header_size_(max_header_size)
+    , connections_(0)
+    , peak_connections_(0)
+    , memory_(0)
+    , peak_memory_(0)
+    , paused_(false)
+    , pauses_(0)
+    , rejected_headers_(0) {
+}
+
+void Admission::open() {
+    connections_++;
+    peak_connections_ = std::max(peak_connections_, connections_);
+}
+
+void Admission::close(size_t charged) {
+    connections_--;
+    memory_ -= charged;
+}
+
+void Admission::charge(size_t& charged, size_t holding) {
+    memory_ = memory_ - charged + holding;
+    charged = holding;
+    peak_memory_ = std::max(peak_memory_, memory_);
+}
+
+bool Admission::admits() const {
+    if (max_connections_ > 0 && connections_ >= max_connections_) {
+        return false;
+    }
+    // A head just under the limit can leave the parser's buffer with up
+    // to twice that allocated
+    size_t reserve = CONNECTION_MEMORY + 2 * max_header_size_;
+    return memory_budget_ == 0 || memory_ + reserve <= memory_budget_;
+}
+
+void Admission::setPaused(bool paused) {
+    if (paused && !paused_) {
+        pauses_++;
+    }
+    paused_ = paused;
+}
+
+bool Admission::paused() const {
+    return paused_;
+}
+
+void Admission::rejectHeaders() {
+    rejected_headers_++;
+}
+
+size_t Admission::maxConnections() const {
+    return max_connections_;
+}
+
+size_t Admission::memoryBudget() const {
+    return memory_budget_;
+}
+
+size_t Admission::maxHeaderSize() const {
+    return max_header_size_;
+}
+
+size_t Admission::connections() const {
+    return connections_;
+}
+
+size_t Admission::peakConnections() const {
+    return peak_connections_;
+}
+
+size_t Admission::memory() const {
+    return memory_;
+}
+
+size_t Admission::peakMemory() const {
+    return peak_memory_;
+}
+
+uint64_t Admission::pauses() const {
+    return pauses_;
+}
+
+uint64_t Admission::rejectedHeaders() const {
+    return rejected_headers_;
+}
+
+std::string Admission::toJson() const {
+    std::ostringstream oss;
+    oss << "{\"connections\":" << connections_
+        << ",\"peak_connections\":" << peak_connections_
+        << ",\"max_connections\":" << max_connections_
+        << ",\"memory_bytes\":" << memory_
+        << ",\"peak_memory_bytes\":" << peak_memory_
+        << ",\"memory_budget\":" << memory_budget_
+        << ",\"max_header_size\":" << max_header_size_
+        << ",\"accepting\":" << (paused_ ? "false" : "true")
+        << ",\"pauses\":" << pauses_
+        << ",\"rejected_headers\":" << rejected_headers_
+        << "}";
+    return oss.str();
+}
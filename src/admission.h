@@ -0,0 +1,70 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// --max-connections and --memory-budget. Every connection is charged for
+// the memory it holds (ConnectionHandler::memoryUsage()); when another
+// connection would not fit, main() stops accepting until enough of them
+// close, so the kernel's accept queue pushes back on clients instead of
+// every open connection slowing down or failing together.
+//
+// The budget is checked at admission: connections already open finish
+// what they started, so usage can pass it by what they grow by after
+// being admitted, which --max-header-size bounds for the request head.
+class Admission {
+public:
+    // Charged to every connection before it holds anything: the handler
+    // and what it allocates around a request (command, headers, source)
+    static constexpr size_t CONNECTION_MEMORY = 16384;
+
+    // A max_connections or memory_budget of 0 is no limit
+    Admission(size_t max_connections, size_t memory_budget, size_t max_header_size);
+
+    // A connection opens, and closes with what charge() last left it at
+    void open();
+    void close(size_t charged);
+
+    // Moves a connection's charge from charged to holding
+    void charge(size_t& charged, size_t holding);
+
+    // Room for one more connection: under max_connections, and the budget
+    // can take a new connection at its largest request head
+    bool admits() const;
+
+    // Whether main() has stopped accepting; each pause is counted
+    void setPaused(bool paused);
+    bool paused() const;
+
+    void rejectHeaders();
+
+    size_t maxConnections() const;
+    size_t memoryBudget() const;
+    size_t maxHeaderSize() const;
+
+    size_t connections() const;
+    size_t peakConnections() const;
+    size_t memory() const;
+    size_t peakMemory() const;
+    uint64_t pauses() const;
+    uint64_t rejectedHeaders() const;
+
+    // Limits, usage and high-water marks, for GET /__stitch/usage
+    std::string toJson() const;
+
+private:
+    size_t max_connections_;
+    size_t memory_budget_;
+    size_t max_header_size_;
+    size_t connections_;
+    size_t peak_connections_;
+    size_t memory_;
+    size_t peak_memory_;
+    bool paused_;
+    uint64_t pauses_;
+    uint64_t rejected_headers_;
+};
+
+#endif // ADMISSION_H
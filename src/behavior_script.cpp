@@ -0,0 +1,333 @@
+#include "behavior_script.h"
+#include <algorithm>
+#include "text_util.h"
+
+namespace {
+
+const char* const OP_NAMES[] = {
+    "SEND_LINES", "SEND_HEAD", "SEND_BYTES", "SEND_BODY", "SEND_REST", "RATE",
+    "WAIT", "CLOSE", "RESET", "STALL", "REPEAT", "END_REPEAT"
+};
+
+constexpr uint64_t MAX_REPEAT = 1000000;
+
+// Arguments share a word with the opcode
+bool parseNumber(const std::string& text, uint64_t& out) {
+    return parseUnsigned(text, out, BehaviorScript::ARG_MASK);
+}
+
+// 200, 200ms, 1500us, 5s
+bool parseDuration(const std::string& text, uint64_t& us) {
+    uint64_t scale = 1000;
+    std::string number = text;
+    if (number.size() > 2 && number.compare(number.size() - 2, 2, "ms") == 0) {
+        number.resize(number.size() - 2);
+    } else if (number.size() > 2 && number.compare(number.size() - 2, 2, "us") == 0) {
+        number.resize(number.size() - 2);
+        scale = 1;
+    } else if (number.size() > 1 && number.back() == 's') {
+        number.pop_back();
+        scale = 1000000;
+    }
+    uint64_t value;
+    if (!parseNumber(number, value) || value > BehaviorScript::MAX_WAIT_US / scale) {
+        return false;
+    }
+    us = value * scale;
+    return true;
+}
+
+uint64_t encode(BehaviorScript::Op op, uint64_t arg) {
+    return (static_cast<uint64_t>(op) << 56) | arg;
+}
+
+} // namespace
+
+std::shared_ptr<const BehaviorScript> BehaviorScript::compile(const std::string& source,
+                                                              std::string& error) {
+    if (source.length() > MAX_SOURCE) {
+        error = "Script longer than " + std::to_string(MAX_SOURCE) + " bytes";
+        return nullptr;
+    }
+
+    auto script = std::make_shared<BehaviorScript>();
+    script->source_ = source;
+    bool in_repeat = false;
+
+    size_t start = 0;
+    while (start <= source.length()) {
+        size_t comma = source.find(',', start);
+        if (comma == std::string::npos) {
+            comma = source.length();
+        }
+        std::string step = trim(source.substr(start, comma - start));
+        start = comma + 1;
+        if (step.empty()) {
+            continue;
+        }
+
+        size_t colon = step.find(':');
+        std::string name = step.substr(0, colon);
+        bool has_arg = colon != std::string::npos;
+        std::string text = has_arg ? step.substr(colon + 1) : "";
+        uint64_t value = 0;
+        bool ok = true;
+
+        if (name == "status" && !has_arg) {
+            script->code_.push_back(encode(Op::SEND_LINES, 1));
+        } else if (name == "headers") {
+            ok = !has_arg || (parseNumber(text, value) && value > 0);
+            script->code_.push_back(has_arg ? encode(Op::SEND_LINES, value) : encode(Op::SEND_HEAD, 0));
+        } else if (name == "body" && !has_arg) {
+            script->code_.push_back(encode(Op::SEND_REST, 0));
+        } else if (name == "body" && !text.empty() && text.back() == '%') {
+            // Percent kept as per-mille so 12.5% works too
+            std::string number = text.substr(0, text.length() - 1);
+            size_t dot = number.find('.');
+            uint64_t whole = 0;
+            uint64_t tenths = 0;
+            ok = parseNumber(number.substr(0, dot), whole) &&
+                 (dot == std::string::npos ||
+                  (number.length() == dot + 2 && parseNumber(number.substr(dot + 1), tenths))) &&
+                 whole * 10 + tenths <= 1000;
+            script->code_.push_back(encode(Op::SEND_BODY, whole * 10 + tenths));
+        } else if (name == "body" || name == "bytes") {
+            ok = parseNumber(text, value);
+            script->code_.push_back(encode(Op::SEND_BYTES, value));
+        } else if (name == "rate") {
+            ok = parseNumber(text, value);
+            script->code_.push_back(encode(Op::RATE, value));
+        } else if (name == "wait" || name == "pause") {
+            ok = parseDuration(text, value);
+            script->code_.push_back(encode(Op::WAIT, value));
+        } else if ((name == "close" || name == "reset" || name == "stall") && !has_arg) {
+            script->code_.push_back(encode(name == "close" ? Op::CLOSE
+                                           : name == "reset" ? Op::RESET : Op::STALL, 0));
+        } else if (name == "repeat") {
+            if (in_repeat) {
+                error = "Nested repeat";
+                return nullptr;
+            }
+            ok = parseNumber(text, value) && value <= MAX_REPEAT;
+            in_repeat = true;
+            script->code_.push_back(encode(Op::REPEAT, value));
+        } else if (name == "end" && !has_arg) {
+            if (!in_repeat) {
+                error = "end without repeat";
+                return nullptr;
+            }
+            in_repeat = false;
+            script->code_.push_back(encode(Op::END_REPEAT, 0));
+        } else {
+            error = "Unknown script step: " + step;
+            return nullptr;
+        }
+
+        if (!ok) {
+            error = "Bad argument in script step: " + step;
+            return nullptr;
+        }
+        if (script->code_.size() > MAX_INSTRUCTIONS) {
+            error = "Script has more than " + std::to_string(MAX_INSTRUCTIONS) + " steps";
+            return nullptr;
+        }
+    }
+
+    if (in_repeat) {
+        error = "repeat without end";
+        return nullptr;
+    }
+    if (script->code_.empty()) {
+        error = "Empty script";
+        return nullptr;
+    }
+    return script;
+}
+
+const std::string& BehaviorScript::source() const {
+    return source_;
+}
+
+size_t BehaviorScript::size() const {
+    return code_.size();
+}
+
+BehaviorScript::Op BehaviorScript::op(uint64_t instruction) {
+    return static_cast<Op>(instruction >> 56);
+}
+
+uint64_t BehaviorScript::arg(uint64_t instruction) {
+    return instruction & ARG_MASK;
+}
+
+uint64_t BehaviorScript::at(size_t pc) const {
+    return code_[pc];
+}
+
+std::string BehaviorScript::disassemble() const {
+    std::string out;
+    for (uint64_t instruction : code_) {
+        out += OP_NAMES[static_cast<size_t>(op(instruction))];
+        out += " " + std::to_string(arg(instruction)) + "\n";
+    }
+    return out;
+}
+
+std::shared_ptr<const BehaviorScript> ScriptCache::get(const std::string& source,
+                                                       std::string& error) {
+    uint64_t key = hash(source);
+    auto it = cache_.find(key);
+    if (it != cache_.end() && it->second->source() == source) {
+        return it->second;
+    }
+
+    std::shared_ptr<const BehaviorScript> script = BehaviorScript::compile(source, error);
+    if (!script) {
+        return nullptr;
+    }
+
+    // Like the distribution cache: start over rather than grow without
+    // bound; running connections keep their programs
+    if (cache_.size() >= MAX_ENTRIES) {
+        cache_.clear();
+    }
+    cache_[key] = script;
+    return script;
+}
+
+size_t ScriptCache::size() const {
+    return cache_.size();
+}
+
+uint64_t ScriptCache::hash(const std::string& source) {
+    // FNV-1a
+    uint64_t value = 14695981039346656037ULL;
+    for (char c : source) {
+        value ^= static_cast<uint8_t>(c);
+        value *= 1099511628211ULL;
+    }
+    return value;
+}
+
+ScriptRunner::ScriptRunner()
+    : pc_(0)
+    , loop_start_(0)
+    , loop_left_(0)
+    , target_(0)
+    , line_step_(false)
+    , lines_(0)
+    , rate_(0)
+    , wait_us_(0) {
+}
+
+void ScriptRunner::start(std::shared_ptr<const BehaviorScript> script) {
+    script_ = std::move(script);
+    pc_ = 0;
+    loop_start_ = 0;
+    loop_left_ = 0;
+    target_ = 0;
+    line_step_ = false;
+    lines_ = 0;
+    rate_ = 0;
+    wait_us_ = 0;
+}
+
+bool ScriptRunner::active() const {
+    return script_ != nullptr;
+}
+
+ScriptRunner::Action ScriptRunner::next(uint64_t sent, uint64_t header_bytes, uint64_t length) {
+    using Op = BehaviorScript::Op;
+    while (true) {
+        line_step_ = false;
+        lines_ = 0;
+        if (pc_ >= script_->size()) {
+            target_ = UINT64_MAX;
+            return Action::FINISH;
+        }
+
+        uint64_t instruction = script_->at(pc_++);
+        uint64_t arg = BehaviorScript::arg(instruction);
+        switch (BehaviorScript::op(instruction)) {
+            case Op::SEND_LINES:
+                line_step_ = true;
+                lines_ = arg;
+                target_ = header_bytes;
+                break;
+            case Op::SEND_HEAD:
+                target_ = header_bytes;
+                break;
+            case Op::SEND_BYTES:
+                target_ = sent + std::min(arg, UINT64_MAX - sent);
+                break;
+            case Op::SEND_BODY:
+                if (length == UINT64_MAX || length < header_bytes) {
+                    target_ = UINT64_MAX;
+                } else {
+                    uint64_t body = length - header_bytes;
+                    target_ = header_bytes + body / 1000 * arg + body % 1000 * arg / 1000;
+                }
+                break;
+            case Op::SEND_REST:
+                target_ = UINT64_MAX;
+                break;
+            case Op::RATE:
+                rate_ = arg;
+                return Action::RATE;
+            case Op::WAIT:
+                wait_us_ = arg;
+                return Action::WAIT;
+            case Op::CLOSE:
+                return Action::CLOSE;
+            case Op::RESET:
+                return Action::RESET;
+            case Op::STALL:
+                return Action::STALL;
+            case Op::REPEAT:
+                loop_left_ = arg;
+                loop_start_ = pc_;
+                if (loop_left_ == 0) {
+                    // Skip the body; compile() guarantees an end follows
+                    while (BehaviorScript::op(script_->at(pc_)) != Op::END_REPEAT) {
+                        pc_++;
+                    }
+                    pc_++;
+                }
+                continue;
+            case Op::END_REPEAT:
+                if (--loop_left_ > 0) {
+                    pc_ = loop_start_;
+                }
+                continue;
+        }
+
+        target_ = std::min(target_, length);
+        if (sending(sent)) {
+            return Action::SEND;
+        }
+    }
+}
+
+bool ScriptRunner::sending(uint64_t sent) const {
+    return sent < target_ && (!line_step_ || lines_ > 0);
+}
+
+uint64_t ScriptRunner::target() const {
+    return target_;
+}
+
+uint64_t ScriptRunner::lines() const {
+    return lines_;
+}
+
+void ScriptRunner::linesSent(uint64_t count) {
+    lines_ -= std::min(lines_, count);
+}
+
+uint64_t ScriptRunner::rate() const {
+    return rate_;
+}
+
+uint64_t ScriptRunner::waitUs() const {
+    return wait_us_;
+}
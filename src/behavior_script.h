@@ -0,0 +1,130 @@
+#ifndef BEHAVIOR_SCRIPT_H
+#define BEHAVIOR_SCRIPT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+// A script= program compiled to bytecode: one 64-bit word per instruction,
+// the opcode in the top byte and its argument in the rest.
+//
+// Source is a comma-separated list of steps:
+//   status            send the next line (the status line, when first)
+//   headers[:n]       send n more lines of the head; without n, the rest of it
+//   body[:n|:p%]      send n bytes, or up to p percent of the body; without
+//                     an argument, everything left
+//   bytes:n           send n bytes, wherever they fall
+//   rate:n            send at n bytes per second from here on; 0 = unlimited
+//   wait:t, pause:t   pause for t (ms by default, or with us, ms or s)
+//   close             close the connection (FIN)
+//   reset             abort the connection (RST)
+//   stall             stop sending and keep the connection open
+//   repeat:n ... end  run the steps in between n times (not nested)
+// Whatever is left when the program ends is sent normally.
+class BehaviorScript {
+public:
+    enum class Op : uint8_t {
+        SEND_LINES,     // arg: lines, never past the head
+        SEND_HEAD,
+        SEND_BYTES,     // arg: bytes from the current position
+        SEND_BODY,      // arg: per-mille of the body, from its start
+        SEND_REST,
+        RATE,           // arg: bytes per second
+        WAIT,           // arg: microseconds
+        CLOSE,
+        RESET,
+        STALL,
+        REPEAT,         // arg: times
+        END_REPEAT
+    };
+
+    static constexpr uint64_t ARG_MASK = (uint64_t(1) << 56) - 1;
+    static constexpr size_t MAX_SOURCE = 4096;
+    static constexpr size_t MAX_INSTRUCTIONS = 256;
+    static constexpr uint64_t MAX_WAIT_US = 3600ULL * 1000000;
+
+    // nullptr (and error set) for a script that does not compile
+    static std::shared_ptr<const BehaviorScript> compile(const std::string& source,
+                                                         std::string& error);
+
+    const std::string& source() const;
+    size_t size() const;
+
+    static Op op(uint64_t instruction);
+    static uint64_t arg(uint64_t instruction);
+    uint64_t at(size_t pc) const;
+
+    // One line per instruction, for tests
+    std::string disassemble() const;
+
+private:
+    std::string source_;
+    std::vector<uint64_t> code_;
+};
+
+// Compiled scripts by a hash of their source, so a script that arrives on
+// every request is compiled once
+class ScriptCache {
+public:
+    static constexpr size_t MAX_ENTRIES = 256;
+
+    std::shared_ptr<const BehaviorScript> get(const std::string& source, std::string& error);
+    size_t size() const;
+
+    static uint64_t hash(const std::string& source);
+
+private:
+    std::unordered_map<uint64_t, std::shared_ptr<const BehaviorScript>> cache_;
+};
+
+// One connection's run of a script: a program counter and a few registers.
+// The handler asks next() what to do whenever the current step is done.
+class ScriptRunner {
+public:
+    enum class Action {
+        SEND,       // Send up to target(), or lines() more lines
+        RATE,       // rate() changed
+        WAIT,       // Pause for waitUs()
+        CLOSE,
+        RESET,
+        STALL,
+        FINISH      // Program over: send the rest normally
+    };
+
+    ScriptRunner();
+
+    void start(std::shared_ptr<const BehaviorScript> script);
+    bool active() const;
+
+    // Runs instructions until one needs the connection. sent and
+    // header_bytes are response offsets; length may be UNKNOWN (UINT64_MAX).
+    Action next(uint64_t sent, uint64_t header_bytes, uint64_t length);
+
+    // Whether the current send step still has bytes to go
+    bool sending(uint64_t sent) const;
+
+    // Response offset the current send step stops at
+    uint64_t target() const;
+
+    // Line ends still to send for a line step; 0 otherwise
+    uint64_t lines() const;
+    void linesSent(uint64_t count);
+
+    uint64_t rate() const;
+    uint64_t waitUs() const;
+
+private:
+    std::shared_ptr<const BehaviorScript> script_;
+    size_t pc_;
+    size_t loop_start_;
+    uint64_t loop_left_;
+    uint64_t target_;
+    bool line_step_;
+    uint64_t lines_;
+    uint64_t rate_;
+    uint64_t wait_us_;
+};
+
+#endif // BEHAVIOR_SCRIPT_H
@@ -0,0 +1,239 @@
+#include "body_pattern.h"
+#include <algorithm>
+#include <cstring>
+#include "text_util.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define STITCH_HAVE_AVX2_KERNEL 1
+#endif
+
+namespace {
+
+// Murmur3 finalizer: a bijection on 32 bits with full avalanche
+inline uint32_t fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Key for the 2^32 words that share the high half of their index
+inline uint32_t regionKey(uint64_t seed, uint32_t region) {
+    return fmix32(fmix32(region + static_cast<uint32_t>(seed >> 32)) ^
+                  static_cast<uint32_t>(seed));
+}
+
+inline void storeWord(char* out, uint32_t word) {
+    // Little-endian on every host; compilers merge this into one store
+    out[0] = static_cast<char>(word);
+    out[1] = static_cast<char>(word >> 8);
+    out[2] = static_cast<char>(word >> 16);
+    out[3] = static_cast<char>(word >> 24);
+}
+
+// count words starting at low index first, none of them wrapping past 2^32
+using FillWords = void (*)(char* out, uint32_t first, uint32_t key, uint64_t count);
+
+void fillWordsScalar(char* out, uint32_t first, uint32_t key, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        storeWord(out + i * 4, fmix32(static_cast<uint32_t>(first + i) ^ key));
+    }
+}
+
+#ifdef STITCH_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+inline __m256i fmix32x8(__m256i h, __m256i m1, __m256i m2) {
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, m1);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, m2);
+    return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+}
+
+// 32 words per iteration in four independent lanes of eight, so the
+// multiplier latency overlaps; the same arithmetic as fillWordsScalar
+__attribute__((target("avx2")))
+void fillWordsAvx2(char* out, uint32_t first, uint32_t key, uint64_t count) {
+    const __m256i key_vec = _mm256_set1_epi32(static_cast<int>(key));
+    const __m256i m1 = _mm256_set1_epi32(static_cast<int>(0x85ebca6bu));
+    const __m256i m2 = _mm256_set1_epi32(static_cast<int>(0xc2b2ae35u));
+    const __m256i step = _mm256_set1_epi32(8);
+    const __m256i step4 = _mm256_set1_epi32(32);
+    __m256i index0 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)),
+                                      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i index1 = _mm256_add_epi32(index0, step);
+    __m256i index2 = _mm256_add_epi32(index1, step);
+    __m256i index3 = _mm256_add_epi32(index2, step);
+
+    uint64_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i* block = reinterpret_cast<__m256i*>(out + i * 4);
+        _mm256_storeu_si256(block, fmix32x8(_mm256_xor_si256(index0, key_vec), m1, m2));
+        _mm256_storeu_si256(block + 1, fmix32x8(_mm256_xor_si256(index1, key_vec), m1, m2));
+        _mm256_storeu_si256(block + 2, fmix32x8(_mm256_xor_si256(index2, key_vec), m1, m2));
+        _mm256_storeu_si256(block + 3, fmix32x8(_mm256_xor_si256(index3, key_vec), m1, m2));
+        index0 = _mm256_add_epi32(index0, step4);
+        index1 = _mm256_add_epi32(index1, step4);
+        index2 = _mm256_add_epi32(index2, step4);
+        index3 = _mm256_add_epi32(index3, step4);
+    }
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4),
+                            fmix32x8(_mm256_xor_si256(index0, key_vec), m1, m2));
+        index0 = _mm256_add_epi32(index0, step);
+    }
+    fillWordsScalar(out + i * 4, static_cast<uint32_t>(first + i), key, count - i);
+}
+#endif
+
+FillWords selectKernel() {
+#ifdef STITCH_HAVE_AVX2_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return fillWordsAvx2;
+    }
+#endif
+    return fillWordsScalar;
+}
+
+FillWords kernel() {
+    static const FillWords selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+BodyPattern::BodyPattern(uint64_t seed)
+    : seed_(seed) {
+}
+
+void BodyPattern::fill(uint64_t offset, char* out, size_t length) const {
+    size_t done = 0;
+
+    // Bytes before the first word boundary
+    while (done < length && (offset + done) % 4 != 0) {
+        uint64_t position = offset + done;
+        out[done++] = static_cast<char>(word(seed_, position / 4) >> (8 * (position % 4)));
+    }
+
+    // Whole words, one 2^32-word region at a time
+    FillWords fill_words = kernel();
+    while (length - done >= 4) {
+        uint64_t index = (offset + done) / 4;
+        uint32_t low = static_cast<uint32_t>(index);
+        uint64_t words = std::min<uint64_t>((length - done) / 4, (uint64_t(1) << 32) - low);
+        fill_words(out + done, low, regionKey(seed_, static_cast<uint32_t>(index >> 32)), words);
+        done += words * 4;
+    }
+
+    while (done < length) {
+        uint64_t position = offset + done;
+        out[done++] = static_cast<char>(word(seed_, position / 4) >> (8 * (position % 4)));
+    }
+}
+
+uint64_t BodyPattern::seed() const {
+    return seed_;
+}
+
+uint32_t BodyPattern::word(uint64_t seed, uint64_t index) {
+    return fmix32(static_cast<uint32_t>(index) ^
+                  regionKey(seed, static_cast<uint32_t>(index >> 32)));
+}
+
+std::string BodyPattern::describe(uint64_t seed, uint64_t offset, uint64_t length) {
+    return "seed=" + std::to_string(seed) + "; offset=" + std::to_string(offset) +
+           "; length=" + std::to_string(length);
+}
+
+bool BodyPattern::parseDescription(const std::string& value, uint64_t& seed, uint64_t& offset,
+                                   uint64_t& length) {
+    bool have_seed = false;
+    bool have_length = false;
+    offset = 0;
+
+    size_t pos = 0;
+    while (pos < value.length()) {
+        size_t end = value.find(';', pos);
+        if (end == std::string::npos) {
+            end = value.length();
+        }
+        std::string field = value.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t first = field.find_first_not_of(' ');
+        size_t last = field.find_last_not_of(' ');
+        if (first == std::string::npos) {
+            continue;
+        }
+        field = field.substr(first, last - first + 1);
+
+        size_t equals = field.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string key = field.substr(0, equals);
+        std::string number = field.substr(equals + 1);
+        if (key == "seed") {
+            have_seed = parseUnsigned(number, seed);
+        } else if (key == "offset") {
+            if (!parseUnsigned(number, offset)) {
+                return false;
+            }
+        } else if (key == "length") {
+            have_length = parseUnsigned(number, length);
+        }
+    }
+    return have_seed && have_length;
+}
+
+bool BodyPattern::vectorized() {
+#ifdef STITCH_HAVE_AVX2_KERNEL
+    return kernel() == fillWordsAvx2;
+#else
+    return false;
+#endif
+}
+
+PatternVerifier::PatternVerifier(uint64_t seed, uint64_t offset)
+    : pattern_(seed)
+    , start_(offset)
+    , position_(offset)
+    , mismatch_(NO_MISMATCH) {
+}
+
+bool PatternVerifier::update(const char* data, size_t length) {
+    char expected[16 * 1024];
+
+    while (length > 0) {
+        size_t take = std::min(length, sizeof(expected));
+        if (mismatch_ == NO_MISMATCH) {
+            pattern_.fill(position_, expected, take);
+            if (memcmp(expected, data, take) != 0) {
+                size_t i = 0;
+                while (expected[i] == data[i]) {
+                    ++i;
+                }
+                mismatch_ = position_ + i;
+            }
+        }
+        position_ += take;
+        data += take;
+        length -= take;
+    }
+    return ok();
+}
+
+bool PatternVerifier::ok() const {
+    return mismatch_ == NO_MISMATCH;
+}
+
+uint64_t PatternVerifier::bytesChecked() const {
+    return position_ - start_;
+}
+
+uint64_t PatternVerifier::firstMismatch() const {
+    return mismatch_;
+}
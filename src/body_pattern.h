@@ -0,0 +1,62 @@
+#ifndef BODY_PATTERN_H
+#define BODY_PATTERN_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Seekable pseudo-random body bytes. The body is a sequence of 32-bit
+// little-endian words, word i being a hash of i and the seed, so any byte
+// range can be produced (or checked) without generating what comes before
+// it. Two seeds give unrelated bodies; within 16 GiB no word repeats.
+class BodyPattern {
+public:
+    explicit BodyPattern(uint64_t seed);
+
+    // Write body bytes [offset, offset + length) to out
+    void fill(uint64_t offset, char* out, size_t length) const;
+
+    uint64_t seed() const;
+
+    // Word at index (body offset / 4)
+    static uint32_t word(uint64_t seed, uint64_t index);
+
+    // X-Stitch-Pattern header value describing a body: "seed=<n>; offset=<n>;
+    // length=<n>", offset being where the body starts within the pattern
+    static std::string describe(uint64_t seed, uint64_t offset, uint64_t length);
+    static bool parseDescription(const std::string& value, uint64_t& seed, uint64_t& offset,
+                                 uint64_t& length);
+
+    // Whether fill() uses the AVX2 kernel on this CPU
+    static bool vectorized();
+
+private:
+    uint64_t seed_;
+};
+
+// Checks a received body against the pattern as it arrives, in pieces of
+// any size.
+class PatternVerifier {
+public:
+    static constexpr uint64_t NO_MISMATCH = UINT64_MAX;
+
+    // offset: pattern offset of the first byte that will be passed in
+    PatternVerifier(uint64_t seed, uint64_t offset = 0);
+
+    // Returns false once any byte so far differed from the pattern
+    bool update(const char* data, size_t length);
+
+    bool ok() const;
+    uint64_t bytesChecked() const;
+
+    // Pattern offset of the first wrong byte, or NO_MISMATCH
+    uint64_t firstMismatch() const;
+
+private:
+    BodyPattern pattern_;
+    uint64_t start_;
+    uint64_t position_;
+    uint64_t mismatch_;
+};
+
+#endif // BODY_PATTERN_H
@@ -0,0 +1,82 @@
+#include "byte_range.h"
+#include <algorithm>
+#include <strings.h>
+#include "text_util.h"
+
+RangeRequest::Result RangeRequest::parse(const std::string& header, uint64_t length,
+                                         std::vector<ByteRange>& ranges) {
+    ranges.clear();
+
+    std::string value = trim(header);
+    if (value.length() < 6 || strncasecmp(value.c_str(), "bytes=", 6) != 0) {
+        return Result::IGNORED;
+    }
+
+    size_t specs = 0;
+    size_t pos = 6;
+    while (pos <= value.length()) {
+        size_t comma = value.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = value.length();
+        }
+        std::string spec = trim(value.substr(pos, comma - pos));
+        pos = comma + 1;
+
+        // Empty list elements are allowed by the list syntax
+        if (spec.empty()) {
+            continue;
+        }
+        if (++specs > MAX_RANGES) {
+            ranges.clear();
+            return Result::IGNORED;
+        }
+
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos) {
+            ranges.clear();
+            return Result::IGNORED;
+        }
+        std::string first_text = spec.substr(0, dash);
+        std::string last_text = spec.substr(dash + 1);
+
+        uint64_t first = 0;
+        uint64_t last = 0;
+        if (first_text.empty()) {
+            // Suffix range: the final last_text bytes
+            if (!parseUnsigned(last_text, last)) {
+                ranges.clear();
+                return Result::IGNORED;
+            }
+            if (last == 0 || length == 0) {
+                continue;
+            }
+            ranges.push_back({length - std::min(last, length), length - 1});
+            continue;
+        }
+
+        if (!parseUnsigned(first_text, first)) {
+            ranges.clear();
+            return Result::IGNORED;
+        }
+        if (last_text.empty()) {
+            last = UINT64_MAX;
+        } else if (!parseUnsigned(last_text, last) || last < first) {
+            ranges.clear();
+            return Result::IGNORED;
+        }
+        if (first >= length) {
+            continue;
+        }
+        ranges.push_back({first, std::min(last, length - 1)});
+    }
+
+    if (specs == 0) {
+        return Result::IGNORED;
+    }
+    return ranges.empty() ? Result::UNSATISFIABLE : Result::SATISFIABLE;
+}
+
+std::string RangeRequest::contentRange(const ByteRange& range, uint64_t length) {
+    return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" +
+           std::to_string(length);
+}
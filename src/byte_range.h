@@ -0,0 +1,37 @@
+#ifndef BYTE_RANGE_H
+#define BYTE_RANGE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Inclusive byte range of a representation, as in Content-Range
+struct ByteRange {
+    uint64_t first;
+    uint64_t last;
+
+    uint64_t length() const { return last - first + 1; }
+};
+
+// Range request header (RFC 9110 section 14.2) resolved against a body
+// length. Only the bytes unit is understood.
+class RangeRequest {
+public:
+    enum class Result {
+        IGNORED,        // No header, another unit, bad syntax or too many ranges: send 200
+        SATISFIABLE,    // Send 206 with ranges
+        UNSATISFIABLE   // Send 416
+    };
+
+    // Requests with more ranges than this are answered in full
+    static constexpr size_t MAX_RANGES = 64;
+
+    // Ranges come back in request order, clamped to the body and not
+    // coalesced; unsatisfiable ranges among satisfiable ones are dropped
+    static Result parse(const std::string& header, uint64_t length, std::vector<ByteRange>& ranges);
+
+    // "bytes 0-99/1000"
+    static std::string contentRange(const ByteRange& range, uint64_t length);
+};
+
+#endif // BYTE_RANGE_H
@@ -0,0 +1,237 @@
+#include "chaos_mix.h"
+#include <map>
+#include <cstdlib>
+#include "behavior_script.h"
+#include "text_util.h"
+
+namespace {
+
+// Parameter that "behavior=value" sets for each behavior
+const char* primaryParameter(BehaviorType behavior) {
+    switch (behavior) {
+        case BehaviorType::ERROR_RESPONSE:       return "code";
+        case BehaviorType::SLOW_RESPONSE:        return "delay";
+        case BehaviorType::SLOW_HEADERS:
+        case BehaviorType::SLOW_BODY:            return "rate";
+        case BehaviorType::CLOSE_AFTER_PARTIAL:  return "bytes";
+        case BehaviorType::WRONG_CONTENT_LENGTH: return "length";
+        default:                                 return nullptr;
+    }
+}
+
+} // namespace
+
+ChaosMix::ChaosMix() {
+}
+
+bool ChaosMix::parse(const std::string& spec, LatencyDistributionCache* distributions,
+                     ScriptCache* scripts) {
+    CommandInterpreter interpreter(distributions, scripts);
+    std::vector<TestCommand> commands;
+    std::vector<double> weights;
+
+    size_t pos = 0;
+    while (pos <= spec.length()) {
+        size_t comma = spec.find(',', pos);
+        size_t end = (comma == std::string::npos) ? spec.length() : comma;
+        std::string entry = trim(spec.substr(pos, end - pos));
+
+        if (!entry.empty()) {
+            TestCommand cmd;
+            double weight = 0.0;
+            if (!parseEntry(entry, interpreter, cmd, weight)) {
+                return false;
+            }
+            commands.push_back(cmd);
+            weights.push_back(weight);
+        }
+
+        if (comma == std::string::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+
+    double total = 0.0;
+    for (double weight : weights) {
+        total += weight;
+    }
+    if (commands.empty() || total <= 0.0) {
+        error_message_ = "Chaos mix needs at least one entry with a positive weight";
+        return false;
+    }
+
+    commands_ = std::move(commands);
+    buildAliasTable(weights);
+    error_message_.clear();
+    return true;
+}
+
+const TestCommand& ChaosMix::pick(Xoshiro256& rng) const {
+    uint64_t r = rng.next();
+
+    // High half picks the column (multiply-shift instead of modulo), low
+    // half decides between the column and its alias
+    uint64_t column = ((r >> 32) * thresholds_.size()) >> 32;
+    uint64_t draw = r & 0xFFFFFFFFULL;
+
+    size_t index = draw < thresholds_[column] ? column : aliases_[column];
+    return commands_[index];
+}
+
+bool ChaosMix::empty() const {
+    return commands_.empty();
+}
+
+size_t ChaosMix::size() const {
+    return commands_.size();
+}
+
+const std::string& ChaosMix::getErrorMessage() const {
+    return error_message_;
+}
+
+bool ChaosMix::parseEntry(const std::string& entry, CommandInterpreter& interpreter,
+                          TestCommand& cmd, double& weight) {
+    size_t colon = entry.rfind(':');
+    if (colon == std::string::npos) {
+        error_message_ = "Chaos entry '" + entry + "' is missing ':weight'";
+        return false;
+    }
+
+    std::string weight_str = trim(entry.substr(colon + 1));
+    char* end = nullptr;
+    weight = std::strtod(weight_str.c_str(), &end);
+    if (weight_str.empty() || end != weight_str.c_str() + weight_str.length() || weight < 0.0) {
+        error_message_ = "Chaos entry '" + entry + "' has an invalid weight";
+        return false;
+    }
+
+    // Parameters past the first '&' are taken as they are
+    std::map<std::string, std::string> params;
+    std::string name = trim(entry.substr(0, colon));
+    size_t amp = name.find('&');
+    while (amp != std::string::npos) {
+        size_t next = name.find('&', amp + 1);
+        std::string param = name.substr(amp + 1, next == std::string::npos ? next : next - amp - 1);
+        size_t equals = param.find('=');
+        std::string key = trim(param.substr(0, equals));
+        if (key.empty() || key == "behavior") {
+            error_message_ = "Chaos entry '" + entry + "' has an invalid parameter '" + param + "'";
+            return false;
+        }
+        params[key] = equals == std::string::npos ? "" : trim(param.substr(equals + 1));
+        amp = next;
+    }
+    name = trim(name.substr(0, name.find('&')));
+
+    std::string value;
+    size_t equals = name.find('=');
+    if (equals != std::string::npos) {
+        value = trim(name.substr(equals + 1));
+        name = trim(name.substr(0, equals));
+    }
+
+    TestCommand probe = interpreter.interpret({{"behavior", name}});
+
+    // Unknown names fall back to NORMAL in the interpreter; reject them here
+    if (name != CommandInterpreter::behaviorName(probe.behavior)) {
+        error_message_ = "Chaos entry '" + entry + "' has an unknown behavior";
+        return false;
+    }
+
+    if (!value.empty()) {
+        const char* parameter = primaryParameter(probe.behavior);
+        if (parameter == nullptr) {
+            error_message_ = "Behavior '" + name + "' does not take a value";
+            return false;
+        }
+        params[parameter] = value;
+    }
+    params["behavior"] = name;
+
+    cmd = interpreter.interpret(params);
+    if (!interpreter.isValid(cmd)) {
+        error_message_ = "Chaos entry '" + entry + "' has invalid parameters";
+        return false;
+    }
+    if (!interpreter.getErrorMessage().empty()) {
+        error_message_ = "Chaos entry '" + entry + "': " + interpreter.getErrorMessage();
+        return false;
+    }
+
+    return true;
+}
+
+void ChaosMix::buildAliasTable(const std::vector<double>& weights) {
+    size_t n = weights.size();
+    double total = 0.0;
+    for (double weight : weights) {
+        total += weight;
+    }
+
+    // Vose's method: scale probabilities so the average column holds 1.0,
+    // then pair each under-full column with an over-full one
+    std::vector<double> scaled(n);
+    std::vector<size_t> small;
+    std::vector<size_t> large;
+    for (size_t i = 0; i < n; ++i) {
+        scaled[i] = weights[i] * static_cast<double>(n) / total;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    thresholds_.assign(n, 0);
+    aliases_.assign(n, 0);
+
+    while (!small.empty() && !large.empty()) {
+        size_t under = small.back();
+        small.pop_back();
+        size_t over = large.back();
+
+        thresholds_[under] = static_cast<uint64_t>(scaled[under] * 4294967296.0);
+        aliases_[under] = static_cast<uint32_t>(over);
+
+        scaled[over] -= 1.0 - scaled[under];
+        if (scaled[over] < 1.0) {
+            large.pop_back();
+            small.push_back(over);
+        }
+    }
+
+    // Whatever is left is full up to rounding error
+    for (size_t i : large) {
+        thresholds_[i] = 4294967296ULL;
+        aliases_[i] = static_cast<uint32_t>(i);
+    }
+    for (size_t i : small) {
+        thresholds_[i] = 4294967296ULL;
+        aliases_[i] = static_cast<uint32_t>(i);
+    }
+}
+
+ChaosMixCache::ChaosMixCache(LatencyDistributionCache* distributions, ScriptCache* scripts)
+    : distributions_(distributions)
+    , scripts_(scripts) {
+}
+
+std::shared_ptr<const ChaosMix> ChaosMixCache::get(const std::string& spec) {
+    uint64_t key = ScriptCache::hash(spec);
+    auto it = cache_.find(key);
+    if (it != cache_.end() && it->second.spec == spec) {
+        return it->second.mix;
+    }
+
+    auto mix = std::make_shared<ChaosMix>();
+    if (!mix->parse(spec, distributions_, scripts_)) {
+        mix.reset();
+    }
+    if (cache_.size() >= MAX_ENTRIES) {
+        cache_.clear();
+    }
+    cache_[key] = Entry{spec, mix};
+    return mix;
+}
+
+size_t ChaosMixCache::size() const {
+    return cache_.size();
+}
@@ -0,0 +1,76 @@
+#ifndef CHAOS_MIX_H
+#define CHAOS_MIX_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include "command_interpreter.h"
+#include "prng.h"
+
+// Weighted mix of behaviors applied to requests that do not ask for one.
+//
+// Spec format: comma-separated "behavior[=value][&param=value...]:weight"
+// entries, e.g.
+//   normal:90,close_partial=100:5,slow=2000:3,error=503:2,slow&dist=empirical&hist=api:1
+// where value is the behavior's main parameter (code, delay, rate, bytes or
+// length) and further parameters are as in a query string. Weights are
+// relative and need not add up to 100.
+//
+// Entries are compiled into a Walker/Vose alias table, so pick() costs one
+// random draw and two array reads regardless of the number of entries and
+// never allocates.
+class ChaosMix {
+public:
+    ChaosMix();
+
+    // Parse a spec, replacing the current mix. dist= and script= resolve
+    // through the caches given, and an entry where they do not is an
+    // error. Returns false on error.
+    bool parse(const std::string& spec, LatencyDistributionCache* distributions = nullptr,
+               ScriptCache* scripts = nullptr);
+
+    const TestCommand& pick(Xoshiro256& rng) const;
+
+    bool empty() const;
+    size_t size() const;
+    const std::string& getErrorMessage() const;
+
+private:
+    std::vector<TestCommand> commands_;
+    std::vector<uint64_t> thresholds_;  // Keep column i if a 32-bit draw < threshold
+    std::vector<uint32_t> aliases_;     // Otherwise use this column
+    std::string error_message_;
+
+    bool parseEntry(const std::string& entry, CommandInterpreter& interpreter, TestCommand& cmd,
+                    double& weight);
+    void buildAliasTable(const std::vector<double>& weights);
+};
+
+// Mixes from per-request ?chaos= parameters, each spec compiled once so a
+// repeated one costs a lookup and pick(). Specs that do not parse are
+// remembered too. Like ScriptCache it starts over when full.
+class ChaosMixCache {
+public:
+    static constexpr size_t MAX_ENTRIES = 256;
+
+    explicit ChaosMixCache(LatencyDistributionCache* distributions = nullptr,
+                           ScriptCache* scripts = nullptr);
+
+    // The mix for spec, or nullptr if the spec is invalid
+    std::shared_ptr<const ChaosMix> get(const std::string& spec);
+    size_t size() const;
+
+private:
+    struct Entry {
+        std::string spec;
+        std::shared_ptr<const ChaosMix> mix;
+    };
+
+    LatencyDistributionCache* distributions_;
+    ScriptCache* scripts_;
+    std::unordered_map<uint64_t, Entry> cache_;
+};
+
+#endif // CHAOS_MIX_H
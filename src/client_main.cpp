@@ -0,0 +1,154 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "client_runner.h"
+#include "request_cases.h"
+#include "text_util.h"
+
+namespace {
+
+void printUsage(const char* prog_name) {
+    std::cout << "Usage: " << prog_name << " [options] <host:port>\n"
+              << "Sends malformed requests to a server or proxy and reports how it\n"
+              << "reacts to each kind.\n"
+              << "Options:\n"
+              << "  --cases <list>        Comma-separated case names (default: all\n"
+              << "                        but the drip cases)\n"
+              << "  --list                List the cases and exit\n"
+              << "  --requests <n>        Requests in total (default: 10000)\n"
+              << "  --duration <s>        Run for this long instead of --requests\n"
+              << "  --threads <n>         Client threads (default: 1)\n"
+              << "  --connections <n>     Concurrent connections per thread (default: 64)\n"
+              << "  --timeout <ms>        Wait this long for a reaction (default: 5000)\n"
+              << "  --drip-rate <n>       Bytes per second for drip cases (default: 10)\n"
+              << "  --host-header <host>  Host header value (default: the target)\n"
+              << "  --path <path>         Request target (default: /)\n"
+              << "  --oversize <bytes>    Length of oversized URIs and headers\n"
+              << "                        (default: 65536)\n"
+              << "  --help                Show this help message\n"
+              << "Exit status: 0 done, 1 bad options or the target could not be used\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    ClientOptions options;
+    std::string case_names;
+    std::string host_header;
+    std::string path = "/";
+    size_t oversize = RequestCases::DEFAULT_OVERSIZE;
+    bool list = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--requests" || arg == "--duration" || arg == "--threads" ||
+            arg == "--connections" || arg == "--timeout" || arg == "--drip-rate" ||
+            arg == "--oversize") {
+            uint64_t value = 0;
+            if (i + 1 >= argc || !parseUnsigned(argv[++i], value)) {
+                std::cerr << "Error: " << arg << " requires a number\n";
+                return 1;
+            }
+            if (arg == "--requests") {
+                options.requests = value;
+            } else if (arg == "--duration") {
+                options.requests = 0;
+                options.duration = std::chrono::seconds(value);
+            } else if (arg == "--threads") {
+                options.threads = value;
+            } else if (arg == "--connections") {
+                options.connections = value;
+            } else if (arg == "--timeout") {
+                options.timeout = std::chrono::milliseconds(value);
+            } else if (arg == "--drip-rate") {
+                options.drip_rate = value;
+            } else {
+                oversize = value;
+            }
+        } else if (arg == "--cases" || arg == "--host-header" || arg == "--path") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+            std::string value = argv[++i];
+            if (arg == "--cases") {
+                case_names = value;
+            } else if (arg == "--host-header") {
+                host_header = value;
+            } else {
+                path = value;
+            }
+        } else if (arg == "--list") {
+            list = true;
+        } else if (arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] != '-' && options.target.empty()) {
+            options.target = arg;
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<RequestCase> all = RequestCases::catalog(
+        host_header.empty() ? options.target : host_header, path, oversize);
+    if (list) {
+        for (const RequestCase& request_case : all) {
+            std::cout << std::left << std::setw(20) << request_case.name
+                      << request_case.summary << (request_case.drip ? " (drip)" : "") << "\n";
+        }
+        return 0;
+    }
+    if (options.target.empty()) {
+        std::cerr << "Error: no target given\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Drip cases hold a connection for the whole timeout, so they only run
+    // when asked for
+    std::vector<RequestCase> cases;
+    if (case_names.empty()) {
+        for (const RequestCase& request_case : all) {
+            if (!request_case.drip) {
+                cases.push_back(request_case);
+            }
+        }
+    } else {
+        std::string error;
+        if (!RequestCases::select(all, case_names, cases, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+
+    ClientRunner runner(cases, options);
+    if (!runner.run()) {
+        std::cerr << runner.getErrorMessage() << "\n";
+        return 1;
+    }
+
+    uint64_t total = 0;
+    std::cout << std::left << std::setw(20) << "case" << std::right << std::setw(10) << "requests"
+              << std::setw(12) << "mean_ms" << "  reactions\n";
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const CaseTally& tally = runner.getTallies()[i];
+        total += tally.requests;
+        double mean_ms = tally.requests > 0
+            ? static_cast<double>(tally.latency_us) / static_cast<double>(tally.requests) / 1000.0
+            : 0.0;
+        std::cout << std::left << std::setw(20) << cases[i].name << std::right << std::setw(10)
+                  << tally.requests << std::setw(12) << std::fixed << std::setprecision(2)
+                  << mean_ms << "  " << tally.describe() << "\n";
+    }
+
+    double seconds = static_cast<double>(runner.getElapsed().count()) / 1e6;
+    std::cout << total << " requests in " << std::setprecision(2) << seconds << " s ("
+              << std::setprecision(0) << (seconds > 0 ? static_cast<double>(total) / seconds : 0.0)
+              << "/s)\n";
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include "client_runner.h"
+#include "upstream.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// One thread's connections. Each slot carries one request from connect to
+// reaction, then starts the next.
+class Worker {
+public:
+    Worker(const std::vector<RequestCase>& cases, const ClientOptions& options,
+           size_t first_case, uint64_t quota, Clock::time_point stop_at)
+        : cases_(cases)
+        , options_(options)
+        , next_case_(first_case)
+        , quota_(quota)
+        , stop_at_(stop_at)
+        , started_(0)
+        , tallies_(cases.size())
+        , epoll_fd_(-1) {
+        drip_interval_ = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) /
+                         static_cast<int64_t>(std::max<uint64_t>(options.drip_rate, 1));
+    }
+
+    ~Worker() {
+        for (Slot& slot : slots_) {
+            if (slot.fd >= 0) {
+                ::close(slot.fd);
+            }
+        }
+        if (epoll_fd_ >= 0) {
+            ::close(epoll_fd_);
+        }
+    }
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    bool run(std::string& error) {
+        if (!pool_.configure(options_.target)) {
+            error = pool_.getErrorMessage();
+            return false;
+        }
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0) {
+            error = "Cannot create epoll instance";
+            return false;
+        }
+
+        slots_.resize(std::max<size_t>(options_.connections, 1));
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            start(i);
+        }
+
+        std::vector<struct epoll_event> events(slots_.size());
+        while (active() > 0) {
+            int n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), 10);
+            for (int i = 0; i < n; ++i) {
+                size_t index = events[static_cast<size_t>(i)].data.u64;
+                if (slots_[index].fd >= 0) {
+                    pump(index);
+                }
+            }
+
+            // Drips and timeouts are due by the clock, not by events
+            Clock::time_point now = Clock::now();
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                Slot& slot = slots_[i];
+                if (slot.fd < 0) {
+                    continue;
+                }
+                if (now >= slot.deadline) {
+                    finish(i, Reaction::TIMEOUT, 0);
+                } else if (slot.dripping && now >= slot.next_drip) {
+                    drip(i, now);
+                }
+            }
+        }
+        return true;
+    }
+
+    const std::vector<CaseTally>& getTallies() const {
+        return tallies_;
+    }
+
+private:
+    struct Slot {
+        int fd = -1;
+        size_t case_index = 0;
+        size_t sent = 0;
+        uint64_t dripped = 0;
+        bool dripping = false;
+        int send_error = 0;     // Saved, since the socket reports it only once
+        Clock::time_point started;
+        Clock::time_point deadline;
+        Clock::time_point next_drip;
+        UpstreamResponse response;
+    };
+
+    const std::vector<RequestCase>& cases_;
+    const ClientOptions& options_;
+    size_t next_case_;
+    uint64_t quota_;
+    Clock::time_point stop_at_;
+    uint64_t started_;
+    std::vector<CaseTally> tallies_;
+    Clock::duration drip_interval_;
+    UpstreamPool pool_{0};
+    int epoll_fd_;
+    std::vector<Slot> slots_;
+
+    size_t active() const {
+        return static_cast<size_t>(std::count_if(slots_.begin(), slots_.end(),
+                                                 [](const Slot& slot) { return slot.fd >= 0; }));
+    }
+
+    bool more() const {
+        if (quota_ > 0) {
+            return started_ < quota_;
+        }
+        return Clock::now() < stop_at_;
+    }
+
+    // Connects a slot for the next case, while there are requests left; a
+    // connect that fails outright is a reaction like any other
+    void start(size_t index) {
+        while (more()) {
+            Slot& slot = slots_[index];
+            slot.case_index = next_case_;
+            next_case_ = (next_case_ + 1) % cases_.size();
+            started_++;
+            slot.started = Clock::now();
+
+            int fd = pool_.acquire();
+            if (fd < 0) {
+                Reaction reaction = errno == ECONNREFUSED ? Reaction::REFUSED : Reaction::ERROR;
+                tallies_[slot.case_index].add(reaction, 0, 0);
+                continue;
+            }
+            slot.fd = fd;
+            slot.sent = 0;
+            slot.dripped = 0;
+            slot.dripping = false;
+            slot.send_error = 0;
+            slot.deadline = slot.started + options_.timeout;
+            slot.response.reset();
+
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = index;
+            // Registering reports the socket writable once it connects,
+            // which is when the first send happens
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+            return;
+        }
+    }
+
+    void pump(size_t index) {
+        Slot& slot = slots_[index];
+        const RequestCase& request_case = cases_[slot.case_index];
+
+        while (slot.send_error == 0 && slot.sent < request_case.bytes.size()) {
+            ssize_t n = send(slot.fd, request_case.bytes.data() + slot.sent,
+                             request_case.bytes.size() - slot.sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    break;
+                }
+                // The server may have answered before it stopped reading,
+                // so the reaction is whatever can still be read
+                slot.send_error = errno;
+                break;
+            }
+            slot.sent += static_cast<size_t>(n);
+            if (slot.sent == request_case.bytes.size() && request_case.drip) {
+                slot.dripping = true;
+                slot.next_drip = Clock::now() + drip_interval_;
+            }
+        }
+
+        char buffer[16384];
+        while (true) {
+            ssize_t n = recv(slot.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                switch (slot.response.parse(buffer, static_cast<size_t>(n))) {
+                    case UpstreamResponse::ParseResult::COMPLETE:
+                        finish(index, Reaction::STATUS, slot.response.getStatusCode());
+                        return;
+                    case UpstreamResponse::ParseResult::ERROR:
+                        finish(index, Reaction::BAD_RESPONSE, 0);
+                        return;
+                    case UpstreamResponse::ParseResult::INCOMPLETE:
+                        continue;
+                }
+            }
+            if (n == 0) {
+                finish(index, slot.send_error == 0 ? Reaction::CLOSED : failure(slot.send_error), 0);
+            } else if (errno != EAGAIN && errno != EINTR) {
+                finish(index, failure(errno), 0);
+            }
+            return;
+        }
+    }
+
+    static Reaction failure(int error) {
+        switch (error) {
+            case ECONNRESET:   return Reaction::RESET;
+            case ECONNREFUSED: return Reaction::REFUSED;
+            case EPIPE:        return Reaction::CLOSED;
+            default:           return Reaction::ERROR;
+        }
+    }
+
+    void drip(size_t index, Clock::time_point now) {
+        Slot& slot = slots_[index];
+        const std::string& repeat = cases_[slot.case_index].drip_repeat;
+        if (repeat.empty()) {
+            slot.dripping = false;
+            return;
+        }
+        char byte = repeat[slot.dripped % repeat.size()];
+        ssize_t n = send(slot.fd, &byte, 1, MSG_NOSIGNAL);
+        if (n == 1) {
+            slot.dripped++;
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            slot.dripping = false;
+            slot.send_error = errno;
+        }
+        slot.next_drip = now + drip_interval_;
+        pump(index);
+    }
+
+    void finish(size_t index, Reaction reaction, int status_code) {
+        Slot& slot = slots_[index];
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - slot.started);
+        tallies_[slot.case_index].add(reaction, status_code, static_cast<uint64_t>(latency.count()));
+
+        // An abortive close leaves no TIME_WAIT behind, which is what lets
+        // one client open tens of thousands of connections a second
+        struct linger abort = {1, 0};
+        setsockopt(slot.fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+        pool_.discard(slot.fd);
+        slot.fd = -1;
+        start(index);
+    }
+};
+
+} // namespace
+
+const char* reactionName(Reaction reaction) {
+    switch (reaction) {
+        case Reaction::STATUS:       return "status";
+        case Reaction::CLOSED:       return "closed";
+        case Reaction::RESET:        return "reset";
+        case Reaction::TIMEOUT:      return "timeout";
+        case Reaction::REFUSED:      return "refused";
+        case Reaction::BAD_RESPONSE: return "bad_response";
+        case Reaction::ERROR:        return "error";
+    }
+    return "unknown";
+}
+
+CaseTally::CaseTally()
+    : requests(0)
+    , reactions{}
+    , latency_us(0) {
+}
+
+void CaseTally::add(Reaction reaction, int status_code, uint64_t latency) {
+    requests++;
+    reactions[static_cast<size_t>(reaction)]++;
+    if (reaction == Reaction::STATUS) {
+        statuses[status_code]++;
+    }
+    latency_us += latency;
+}
+
+void CaseTally::merge(const CaseTally& other) {
+    requests += other.requests;
+    for (size_t i = 0; i < REACTION_COUNT; ++i) {
+        reactions[i] += other.reactions[i];
+    }
+    for (const auto& entry : other.statuses) {
+        statuses[entry.first] += entry.second;
+    }
+    latency_us += other.latency_us;
+}
+
+std::string CaseTally::describe() const {
+    std::vector<std::pair<uint64_t, std::string>> statuses_seen;
+    for (const auto& entry : statuses) {
+        statuses_seen.emplace_back(entry.second, std::to_string(entry.first));
+    }
+    std::vector<std::pair<uint64_t, std::string>> others;
+    for (size_t i = 1; i < REACTION_COUNT; ++i) {
+        if (reactions[i] > 0) {
+            others.emplace_back(reactions[i], reactionName(static_cast<Reaction>(i)));
+        }
+    }
+
+    auto most_first = [](const std::pair<uint64_t, std::string>& a,
+                         const std::pair<uint64_t, std::string>& b) {
+        return a.first > b.first;
+    };
+    std::stable_sort(statuses_seen.begin(), statuses_seen.end(), most_first);
+    std::stable_sort(others.begin(), others.end(), most_first);
+
+    std::string out;
+    for (const auto& list : {statuses_seen, others}) {
+        for (const auto& entry : list) {
+            out += (out.empty() ? "" : " ") + entry.second + ":" + std::to_string(entry.first);
+        }
+    }
+    return out;
+}
+
+ClientOptions::ClientOptions()
+    : threads(1)
+    , connections(64)
+    , requests(10000)
+    , duration(0)
+    , timeout(5000)
+    , drip_rate(10) {
+}
+
+ClientRunner::ClientRunner(std::vector<RequestCase> cases, const ClientOptions& options)
+    : cases_(std::move(cases))
+    , options_(options)
+    , tallies_(cases_.size())
+    , elapsed_(0) {
+}
+
+bool ClientRunner::run() {
+    if (cases_.empty()) {
+        error_message_ = "No cases to send";
+        return false;
+    }
+    size_t threads = std::max<size_t>(options_.threads, 1);
+    Clock::time_point start = Clock::now();
+    Clock::time_point stop_at = start + options_.duration;
+
+    // The requests are split evenly; each thread starts at a different case
+    // so short runs still cover them all
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        uint64_t quota = options_.requests / threads + (i < options_.requests % threads ? 1 : 0);
+        if (options_.requests > 0 && quota == 0) {
+            break;
+        }
+        workers.push_back(std::make_unique<Worker>(cases_, options_, i % cases_.size(), quota,
+                                                   stop_at));
+    }
+    std::vector<std::string> errors(workers.size());
+    std::vector<std::thread> running;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        running.emplace_back([&workers, &errors, i]() {
+            if (!workers[i]->run(errors[i])) {
+                errors[i] = errors[i].empty() ? "Worker failed" : errors[i];
+            }
+        });
+    }
+    for (std::thread& thread : running) {
+        thread.join();
+    }
+    elapsed_ = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        if (!errors[i].empty()) {
+            error_message_ = errors[i];
+            return false;
+        }
+        for (size_t c = 0; c < cases_.size(); ++c) {
+            tallies_[c].merge(workers[i]->getTallies()[c]);
+        }
+    }
+    return true;
+}
+
+const std::vector<CaseTally>& ClientRunner::getTallies() const {
+    return tallies_;
+}
+
+const std::vector<RequestCase>& ClientRunner::getCases() const {
+    return cases_;
+}
+
+std::chrono::microseconds ClientRunner::getElapsed() const {
+    return elapsed_;
+}
+
+const std::string& ClientRunner::getErrorMessage() const {
+    return error_message_;
+}
@@ -0,0 +1,78 @@
+#ifndef CLIENT_RUNNER_H
+#define CLIENT_RUNNER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include "request_cases.h"
+
+// How the server under test answered one request
+enum class Reaction {
+    STATUS,         // A response head arrived
+    CLOSED,         // The connection ended before a response head
+    RESET,          // The connection was reset before a response head
+    TIMEOUT,        // Nothing decisive before the client's timeout
+    REFUSED,        // The connection was refused
+    BAD_RESPONSE,   // Bytes arrived that are not an HTTP/1.x response head
+    ERROR           // Any other socket error
+};
+
+static constexpr size_t REACTION_COUNT = 7;
+
+const char* reactionName(Reaction reaction);
+
+// Reactions to one case, added up
+struct CaseTally {
+    uint64_t requests;
+    uint64_t reactions[REACTION_COUNT];
+    std::map<int, uint64_t> statuses;
+    uint64_t latency_us;    // Sum over requests, from connect to reaction
+
+    CaseTally();
+
+    void add(Reaction reaction, int status_code, uint64_t latency);
+    void merge(const CaseTally& other);
+
+    // "400:998 closed:2": status codes, then other reactions, most common
+    // first within each
+    std::string describe() const;
+};
+
+struct ClientOptions {
+    std::string target;         // host:port of the server under test
+    size_t threads;
+    size_t connections;         // Concurrent connections per thread
+    uint64_t requests;          // Total, across threads; 0 runs for duration
+    std::chrono::milliseconds duration;
+    std::chrono::milliseconds timeout;
+    uint64_t drip_rate;         // Bytes per second for drip cases
+
+    ClientOptions();
+};
+
+// Sends cases round-robin, one request per connection, from several
+// threads each running its own epoll loop, and tallies the reactions
+class ClientRunner {
+public:
+    ClientRunner(std::vector<RequestCase> cases, const ClientOptions& options);
+
+    bool run();
+
+    // One tally per case, in case order
+    const std::vector<CaseTally>& getTallies() const;
+    const std::vector<RequestCase>& getCases() const;
+    std::chrono::microseconds getElapsed() const;
+
+    const std::string& getErrorMessage() const;
+
+private:
+    std::vector<RequestCase> cases_;
+    ClientOptions options_;
+    std::vector<CaseTally> tallies_;
+    std::chrono::microseconds elapsed_;
+    std::string error_message_;
+};
+
+#endif // CLIENT_RUNNER_H
@@ -1,21 +1,51 @@
 #include "command_interpreter.h"
 #include <algorithm>
+#include <cstdlib>
 
 TestCommand::TestCommand()
     : behavior(BehaviorType::NORMAL)
     , status_code(200)
     , reason_phrase("OK")
     , delay_ms(0)
+    , delay_us(0)
     , bytes_per_second(0)
     , bytes_before_close(0)
-    , body_content("OK") {
+    , body_content("OK")
+    , body_size(0)
+    , body_seeded(false)
+    , body_seed(0)
+    , fault(ResponseFault::NONE)
+    , fault_at(0)
+    , range_fault(RangeFault::NONE)
+    , encoding(ContentEncoding::IDENTITY)
+    , encoding_fault(EncodingFault::NONE)
+    , duplicate_headers(1)
+    , header_count(0)
+    , header_size(HeaderFloodSource::DEFAULT_VALUE_SIZE)
+    , request_body(RequestBodyMode::DISCARD)
+    , read_rate(0)
+    , tls_fault(TlsFault::NONE)
+    , sndbuf(0)
+    , nodelay(-1) {
 }
 
-CommandInterpreter::CommandInterpreter() {
+CommandInterpreter::CommandInterpreter()
+    : distributions_(nullptr)
+    , scripts_(nullptr) {
+}
+
+CommandInterpreter::CommandInterpreter(LatencyDistributionCache* distributions,
+                                       ScriptCache* scripts)
+    : distributions_(distributions)
+    , scripts_(scripts) {
 }
 
 TestCommand CommandInterpreter::interpret(const std::map<std::string, std::string>& query_params) {
     TestCommand cmd;
+    error_message_.clear();
+
+    // Body shape and faults combine with any behavior, including none
+    parseBodyOptions(query_params, cmd);
 
     // Check if behavior parameter exists
     auto behavior_it = query_params.find("behavior");
@@ -47,6 +77,19 @@ TestCommand CommandInterpreter::interpret(const std::map<std::string, std::strin
         case BehaviorType::SLOW_RESPONSE:
             cmd.delay_ms = parseInteger(
                 query_params.count("delay") ? query_params.at("delay") : "", 0);
+            cmd.delay_us = static_cast<int64_t>(cmd.delay_ms) * 1000;
+
+            // A distribution replaces the fixed delay; invalid distribution
+            // parameters fall back to it like other unparsable values
+            if (query_params.count("dist")) {
+                std::string error;
+                cmd.delay_distribution = distributions_ != nullptr
+                    ? distributions_->get(query_params, error)
+                    : LatencyDistribution::create(query_params, nullptr, error);
+                if (!cmd.delay_distribution) {
+                    error_message_ = "dist=: " + error;
+                }
+            }
             break;
 
         case BehaviorType::SLOW_HEADERS:
@@ -89,6 +132,10 @@ bool CommandInterpreter::isValid(const TestCommand& cmd) const {
     return true;
 }
 
+const std::string& CommandInterpreter::getErrorMessage() const {
+    return error_message_;
+}
+
 std::string CommandInterpreter::describe(const TestCommand& cmd) const {
     switch (cmd.behavior) {
         case BehaviorType::NORMAL:
@@ -109,6 +156,9 @@ std::string CommandInterpreter::describe(const TestCommand& cmd) const {
                    std::to_string(cmd.bytes_before_close) + " bytes";
 
         case BehaviorType::SLOW_RESPONSE:
+            if (cmd.delay_distribution) {
+                return "Delay response by a sample of " + cmd.delay_distribution->describe();
+            }
             return "Delay response by " + std::to_string(cmd.delay_ms) + " ms";
 
         case BehaviorType::SLOW_HEADERS:
@@ -139,6 +189,85 @@ std::string CommandInterpreter::describe(const TestCommand& cmd) const {
     }
 }
 
+const char* CommandInterpreter::faultName(ResponseFault fault) {
+    switch (fault) {
+        case ResponseFault::NONE:    return "none";
+        case ResponseFault::CLOSE:   return "close";
+        case ResponseFault::RESET:   return "reset";
+        case ResponseFault::STALL:   return "stall";
+        case ResponseFault::CORRUPT: return "corrupt";
+    }
+    return "unknown";
+}
+
+const char* CommandInterpreter::rangeFaultName(RangeFault fault) {
+    switch (fault) {
+        case RangeFault::NONE:        return "none";
+        case RangeFault::IGNORE:      return "ignore";
+        case RangeFault::WRONG_RANGE: return "wrong_range";
+        case RangeFault::OVERLAP:     return "overlap";
+        case RangeFault::MULTIPART:   return "multipart";
+    }
+    return "unknown";
+}
+
+const char* CommandInterpreter::encodingName(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::IDENTITY: return "identity";
+        case ContentEncoding::GZIP:     return "gzip";
+        case ContentEncoding::DEFLATE:  return "deflate";
+        case ContentEncoding::BROTLI:   return "br";
+    }
+    return "unknown";
+}
+
+const char* CommandInterpreter::encodingFaultName(EncodingFault fault) {
+    switch (fault) {
+        case EncodingFault::NONE:     return "none";
+        case EncodingFault::TRUNCATE: return "truncate";
+        case EncodingFault::CORRUPT:  return "corrupt";
+        case EncodingFault::CHECKSUM: return "checksum";
+        case EncodingFault::MISLABEL: return "mislabel";
+    }
+    return "unknown";
+}
+
+const char* CommandInterpreter::requestBodyModeName(RequestBodyMode mode) {
+    switch (mode) {
+        case RequestBodyMode::DISCARD: return "discard";
+        case RequestBodyMode::ECHO:    return "echo";
+        case RequestBodyMode::IGNORE:  return "ignore";
+    }
+    return "unknown";
+}
+
+const char* CommandInterpreter::tlsFaultName(TlsFault fault) {
+    switch (fault) {
+        case TlsFault::NONE:            return "none";
+        case TlsFault::NO_CLOSE_NOTIFY: return "no_close_notify";
+    }
+    return "unknown";
+}
+
+const char* CommandInterpreter::behaviorName(BehaviorType behavior) {
+    switch (behavior) {
+        case BehaviorType::NORMAL:               return "normal";
+        case BehaviorType::ERROR_RESPONSE:       return "error";
+        case BehaviorType::CLOSE_IMMEDIATELY:    return "close";
+        case BehaviorType::CLOSE_AFTER_HEADERS:  return "close_headers";
+        case BehaviorType::CLOSE_AFTER_PARTIAL:  return "close_partial";
+        case BehaviorType::SLOW_RESPONSE:        return "slow";
+        case BehaviorType::SLOW_HEADERS:         return "slow_headers";
+        case BehaviorType::SLOW_BODY:            return "slow_body";
+        case BehaviorType::INVALID_STATUS_LINE:  return "invalid_status";
+        case BehaviorType::INVALID_HEADERS:      return "invalid_headers";
+        case BehaviorType::WRONG_CONTENT_LENGTH: return "wrong_length";
+        case BehaviorType::MALFORMED_CHUNKING:   return "malformed_chunking";
+        case BehaviorType::TIMEOUT:              return "timeout";
+    }
+    return "unknown";
+}
+
 BehaviorType CommandInterpreter::parseBehavior(const std::string& behavior_str) {
     if (behavior_str == "error") {
         return BehaviorType::ERROR_RESPONSE;
@@ -182,3 +311,147 @@ int CommandInterpreter::parseInteger(const std::string& value, int default_value
         return default_value;
     }
 }
+
+void CommandInterpreter::parseBodyOptions(const std::map<std::string, std::string>& query_params,
+                                          TestCommand& cmd) {
+    auto unsignedParam = [&query_params](const char* name, uint64_t& out) {
+        auto it = query_params.find(name);
+        if (it == query_params.end() || it->second.empty() ||
+            it->second.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        out = std::strtoull(it->second.c_str(), nullptr, 10);
+        return true;
+    };
+
+    unsignedParam("size", cmd.body_size);
+    cmd.body_seeded = unsignedParam("body_seed", cmd.body_seed);
+
+    auto file_it = query_params.find("file");
+    if (file_it != query_params.end()) {
+        cmd.file = file_it->second;
+    }
+
+    // chunk_size= and chunk_fault= imply chunked=1
+    auto chunk_it = query_params.find("chunk_size");
+    if (chunk_it == query_params.end() || !cmd.chunks.parseSizes(chunk_it->second)) {
+        bool chunked = query_params.count("chunked") && query_params.at("chunked") != "0";
+        if (chunked || query_params.count("chunk_fault")) {
+            cmd.chunks.mode = ChunkPlan::Mode::FIXED;
+        }
+    }
+
+    auto chunk_fault_it = query_params.find("chunk_fault");
+    if (chunk_fault_it != query_params.end()) {
+        ChunkPlan::parseFault(chunk_fault_it->second, cmd.chunks.fault);
+    }
+    unsignedParam("chunk_seed", cmd.chunks.seed);
+    unsignedParam("chunk_fault_at", cmd.chunks.fault_chunk);
+    unsignedParam("trailer_bytes", cmd.chunks.trailer_bytes);
+
+    auto fault_it = query_params.find("fault");
+    if (fault_it != query_params.end()) {
+        for (ResponseFault fault : {ResponseFault::CLOSE, ResponseFault::RESET,
+                                    ResponseFault::STALL, ResponseFault::CORRUPT}) {
+            if (fault_it->second == faultName(fault)) {
+                cmd.fault = fault;
+            }
+        }
+        unsignedParam("fault_at", cmd.fault_at);
+    }
+
+    auto range_fault_it = query_params.find("range_fault");
+    if (range_fault_it != query_params.end()) {
+        for (RangeFault fault : {RangeFault::IGNORE, RangeFault::WRONG_RANGE,
+                                 RangeFault::OVERLAP, RangeFault::MULTIPART}) {
+            if (range_fault_it->second == rangeFaultName(fault)) {
+                cmd.range_fault = fault;
+            }
+        }
+    }
+
+    auto encoding_it = query_params.find("encoding");
+    if (encoding_it != query_params.end()) {
+        for (ContentEncoding encoding : {ContentEncoding::GZIP, ContentEncoding::DEFLATE,
+                                         ContentEncoding::BROTLI}) {
+            if (encoding_it->second == encodingName(encoding)) {
+                cmd.encoding = encoding;
+            }
+        }
+    }
+
+    auto encoding_fault_it = query_params.find("encoding_fault");
+    if (encoding_fault_it != query_params.end()) {
+        for (EncodingFault fault : {EncodingFault::TRUNCATE, EncodingFault::CORRUPT,
+                                    EncodingFault::CHECKSUM, EncodingFault::MISLABEL}) {
+            if (encoding_fault_it->second == encodingFaultName(fault)) {
+                cmd.encoding_fault = fault;
+            }
+        }
+    }
+
+    // Header floods; header_size= alone is one header of that size
+    bool sized = unsignedParam("header_size", cmd.header_size);
+    if (!unsignedParam("header_count", cmd.header_count) && sized) {
+        cmd.header_count = 1;
+    }
+    cmd.header_count = std::min(cmd.header_count, HeaderFloodSource::MAX_COUNT);
+    cmd.header_size = std::min(cmd.header_size, HeaderFloodSource::MAX_VALUE_SIZE);
+    if (unsignedParam("duplicate_headers", cmd.duplicate_headers)) {
+        cmd.duplicate_headers = std::min(cmd.duplicate_headers, HeaderFloodSource::MAX_COUNT);
+    }
+
+    // h.<Name>=<value> adds a header; names must be tokens and values may
+    // not end the line early
+    const std::string prefix = "h.";
+    for (auto it = query_params.lower_bound(prefix);
+         it != query_params.end() && it->first.compare(0, prefix.length(), prefix) == 0; ++it) {
+        std::string name = it->first.substr(prefix.length());
+        bool token = !name.empty() &&
+                     name.find_first_not_of("!#$%&'*+-.^_`|~0123456789"
+                                            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz") ==
+                         std::string::npos;
+        if (token && it->second.find_first_of("\r\n") == std::string::npos) {
+            cmd.headers.emplace_back(name, it->second);
+        }
+    }
+
+    auto request_body_it = query_params.find("request_body");
+    if (request_body_it != query_params.end()) {
+        for (RequestBodyMode mode : {RequestBodyMode::DISCARD, RequestBodyMode::ECHO,
+                                     RequestBodyMode::IGNORE}) {
+            if (request_body_it->second == requestBodyModeName(mode)) {
+                cmd.request_body = mode;
+            }
+        }
+    }
+    unsignedParam("read_rate", cmd.read_rate);
+
+    auto tls_fault_it = query_params.find("tls_fault");
+    if (tls_fault_it != query_params.end() &&
+        tls_fault_it->second == tlsFaultName(TlsFault::NO_CLOSE_NOTIFY)) {
+        cmd.tls_fault = TlsFault::NO_CLOSE_NOTIFY;
+    }
+
+    // Socket tuning the behavior would pick, overridden
+    if (unsignedParam("sndbuf", cmd.sndbuf)) {
+        cmd.sndbuf = std::min(cmd.sndbuf, TestCommand::MAX_SNDBUF);
+    }
+    auto nodelay_it = query_params.find("nodelay");
+    if (nodelay_it != query_params.end() &&
+        (nodelay_it->second == "0" || nodelay_it->second == "1")) {
+        cmd.nodelay = nodelay_it->second == "1" ? 1 : 0;
+    }
+
+    // A script steps whatever response the rest describes; each distinct
+    // source is compiled once, and one that does not compile is ignored
+    auto script_it = query_params.find("script");
+    if (script_it != query_params.end()) {
+        std::string error;
+        cmd.script = scripts_ != nullptr ? scripts_->get(script_it->second, error)
+                                         : BehaviorScript::compile(script_it->second, error);
+        if (!cmd.script) {
+            error_message_ = error;
+        }
+    }
+}
@@ -3,6 +3,12 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "latency_distribution.h"
+#include "behavior_script.h"
+#include "response_source.h"
 
 enum class BehaviorType {
     NORMAL,
@@ -20,14 +26,88 @@ enum class BehaviorType {
     TIMEOUT
 };
 
+// Fault applied once fault_at bytes of the response have been sent
+enum class ResponseFault {
+    NONE,
+    CLOSE,      // Close the connection cleanly (FIN)
+    RESET,      // Abort the connection (RST)
+    STALL,      // Stop sending but keep the connection open
+    CORRUPT     // Flip the byte at fault_at and carry on
+};
+
+// How a Range request is mishandled on purpose
+enum class RangeFault {
+    NONE,
+    IGNORE,         // Answer 200 with the whole body
+    WRONG_RANGE,    // Content-Range one byte off from the bytes actually sent
+    OVERLAP,        // multipart/byteranges, each part starting inside the previous one
+    MULTIPART       // multipart/byteranges even for a single range
+};
+
+// Content-Encoding of the body (encoding=)
+enum class ContentEncoding {
+    IDENTITY,
+    GZIP,
+    DEFLATE,    // zlib format, as HTTP's "deflate" coding specifies
+    BROTLI
+};
+
+// How an encoded body is broken on purpose
+enum class EncodingFault {
+    NONE,
+    TRUNCATE,   // Only the first half of the compressed stream
+    CORRUPT,    // One bit flipped in the middle of the compressed stream
+    CHECKSUM,   // The stream's trailing checksum is wrong
+    MISLABEL    // Content-Encoding names another coding
+};
+
+// What happens to a request body (request_body=)
+enum class RequestBodyMode {
+    DISCARD,    // Read and drop it before the behavior starts
+    ECHO,       // Send it back as the response body while it arrives
+    IGNORE      // Never read it; the response goes out regardless
+};
+
+// How a response over --tls-port ends on purpose
+enum class TlsFault {
+    NONE,
+    NO_CLOSE_NOTIFY     // Close the TCP connection without a close_notify alert
+};
+
 struct TestCommand {
+    static constexpr uint64_t MAX_SNDBUF = 1 << 30;
+
     BehaviorType behavior;
     int status_code;
     std::string reason_phrase;
     int delay_ms;
+    int64_t delay_us;   // Delay actually applied; sampled per request when
+                        // delay_distribution is set
+    std::shared_ptr<const LatencyDistribution> delay_distribution;
     int bytes_per_second;
     size_t bytes_before_close;
     std::string body_content;
+    uint64_t body_size;     // Synthetic body of this many bytes instead of
+                            // body_content; 0 = off
+    bool body_seeded;       // Synthetic body from BodyPattern(body_seed)
+    uint64_t body_seed;     // instead of the cyclic pattern
+    ChunkPlan chunks;       // Chunked transfer-encoding; mode OFF = Content-Length
+    std::string file;       // Corpus file to send as the body; empty = off
+    ResponseFault fault;
+    uint64_t fault_at;
+    RangeFault range_fault;
+    ContentEncoding encoding;
+    EncodingFault encoding_fault;
+    std::vector<std::pair<std::string, std::string>> headers;   // h.<Name>=<value>
+    uint64_t duplicate_headers; // Times each of headers is sent
+    uint64_t header_count;      // X-Stitch-Fill headers to add
+    uint64_t header_size;       // Value bytes of each of them
+    RequestBodyMode request_body;
+    uint64_t read_rate;         // Request body bytes per second; 0 = unlimited
+    std::shared_ptr<const BehaviorScript> script;   // script=: steps the send
+    TlsFault tls_fault;
+    uint64_t sndbuf;    // SO_SNDBUF for the response; 0 = chosen by behavior
+    int nodelay;        // TCP_NODELAY: 1, 0 (Nagle) or -1 = chosen by behavior
 
     TestCommand();
 };
@@ -35,12 +115,34 @@ struct TestCommand {
 class CommandInterpreter {
 public:
     CommandInterpreter();
+    explicit CommandInterpreter(LatencyDistributionCache* distributions,
+                                ScriptCache* scripts = nullptr);
     TestCommand interpret(const std::map<std::string, std::string>& query_params);
     bool isValid(const TestCommand& cmd) const;
+
+    // Why the last interpret() left out a dist= or script= it was given;
+    // empty when everything resolved. Requests are served without them,
+    // while configuration that names them is rejected.
+    const std::string& getErrorMessage() const;
     std::string describe(const TestCommand& cmd) const;
 
+    // Query-string name of a behavior (inverse of the behavior= mapping)
+    static const char* behaviorName(BehaviorType behavior);
+    static const char* faultName(ResponseFault fault);
+    static const char* rangeFaultName(RangeFault fault);
+    static const char* encodingName(ContentEncoding encoding);
+    static const char* encodingFaultName(EncodingFault fault);
+    static const char* requestBodyModeName(RequestBodyMode mode);
+    static const char* tlsFaultName(TlsFault fault);
+
 private:
+    LatencyDistributionCache* distributions_;
+    ScriptCache* scripts_;
+    std::string error_message_;
+
     BehaviorType parseBehavior(const std::string& behavior_str);
+    void parseBodyOptions(const std::map<std::string, std::string>& query_params,
+                          TestCommand& cmd);
     int parseInteger(const std::string& value, int default_value);
 };
 
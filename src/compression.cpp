@@ -0,0 +1,334 @@
+#include "compression.h"
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <cerrno>
+#include <cstring>
+#ifdef STITCH_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace {
+
+// Bytes asked of the input per peek
+constexpr size_t INPUT_WINDOW = 1 << 20;
+
+// Calls feed(data, length) for every byte input produces; false if the
+// input failed or feed did
+template <typename Feed>
+bool drain(ResponseSource& input, Feed feed) {
+    struct iovec segments[ResponseSource::MAX_SEGMENTS];
+    while (!input.done()) {
+        size_t count = input.peek(segments, ResponseSource::MAX_SEGMENTS, INPUT_WINDOW);
+        if (count == 0) {
+            return false;
+        }
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!feed(static_cast<const uint8_t*>(segments[i].iov_base), segments[i].iov_len)) {
+                return false;
+            }
+            bytes += segments[i].iov_len;
+        }
+        input.consume(bytes);
+    }
+    return true;
+}
+
+// window_bits selects the wrapper: 16 + 15 for gzip, 15 for zlib
+bool compressZlib(int window_bits, ResponseSource& input, std::string& out, std::string& error) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        error = "deflateInit2 failed";
+        return false;
+    }
+
+    uint8_t buffer[64 * 1024];
+    auto run = [&stream, &buffer, &out](const uint8_t* data, size_t length, int flush) {
+        stream.next_in = const_cast<uint8_t*>(data);
+        stream.avail_in = static_cast<uInt>(length);
+        do {
+            stream.next_out = buffer;
+            stream.avail_out = sizeof(buffer);
+            if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+                return false;
+            }
+            out.append(reinterpret_cast<const char*>(buffer), sizeof(buffer) - stream.avail_out);
+        } while (stream.avail_out == 0);
+        return true;
+    };
+
+    bool ok = drain(input, [&run](const uint8_t* data, size_t length) {
+        return run(data, length, Z_NO_FLUSH);
+    });
+    ok = ok && run(nullptr, 0, Z_FINISH);
+    deflateEnd(&stream);
+    if (!ok) {
+        error = input.failed() ? "body could not be read" : "deflate failed";
+    }
+    return ok;
+}
+
+#ifdef STITCH_HAVE_BROTLI
+bool compressBrotli(ResponseSource& input, std::string& out, std::string& error) {
+    BrotliEncoderState* state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (state == nullptr) {
+        error = "BrotliEncoderCreateInstance failed";
+        return false;
+    }
+    // Quality 5 is the usual on-the-fly setting; 11 is far too slow here
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, 5);
+
+    uint8_t buffer[64 * 1024];
+    auto run = [state, &buffer, &out](const uint8_t* data, size_t length,
+                                      BrotliEncoderOperation operation) {
+        size_t available_in = length;
+        const uint8_t* next_in = data;
+        do {
+            size_t available_out = sizeof(buffer);
+            uint8_t* next_out = buffer;
+            if (!BrotliEncoderCompressStream(state, operation, &available_in, &next_in,
+                                             &available_out, &next_out, nullptr)) {
+                return false;
+            }
+            out.append(reinterpret_cast<const char*>(buffer), sizeof(buffer) - available_out);
+        } while (available_in > 0 || BrotliEncoderHasMoreOutput(state) ||
+                 (operation == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(state)));
+        return true;
+    };
+
+    bool ok = drain(input, [&run](const uint8_t* data, size_t length) {
+        return run(data, length, BROTLI_OPERATION_PROCESS);
+    });
+    ok = ok && run(nullptr, 0, BROTLI_OPERATION_FINISH);
+    BrotliEncoderDestroyInstance(state);
+    if (!ok) {
+        error = input.failed() ? "body could not be read" : "brotli compression failed";
+    }
+    return ok;
+}
+#endif
+
+} // namespace
+
+bool Compressor::supports(ContentEncoding encoding) {
+#ifndef STITCH_HAVE_BROTLI
+    if (encoding == ContentEncoding::BROTLI) {
+        return false;
+    }
+#endif
+    return encoding != ContentEncoding::IDENTITY;
+}
+
+bool Compressor::compress(ContentEncoding encoding, ResponseSource& input, std::string& out,
+                          std::string& error) {
+    out.clear();
+    switch (encoding) {
+        case ContentEncoding::GZIP:
+            return compressZlib(16 + MAX_WBITS, input, out, error);
+        case ContentEncoding::DEFLATE:
+            return compressZlib(MAX_WBITS, input, out, error);
+        case ContentEncoding::BROTLI:
+#ifdef STITCH_HAVE_BROTLI
+            return compressBrotli(input, out, error);
+#else
+            break;
+#endif
+        case ContentEncoding::IDENTITY:
+            break;
+    }
+    error = std::string("unsupported encoding ") + CommandInterpreter::encodingName(encoding);
+    return false;
+}
+
+CompressionCache::CompressionCache(size_t threads, uint64_t capacity)
+    : thread_count_(threads)
+    , capacity_(capacity)
+    , event_fd_(-1)
+    , stopping_(false)
+    , outstanding_(0)
+    , bytes_(0)
+    , hits_(0)
+    , misses_(0) {
+}
+
+CompressionCache::~CompressionCache() {
+    stop();
+}
+
+bool CompressionCache::start() {
+    if (thread_count_ == 0) {
+        error_message_ = "Compression needs at least one worker thread";
+        return false;
+    }
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd_ < 0) {
+        error_message_ = std::string("eventfd failed: ") + strerror(errno);
+        return false;
+    }
+    for (size_t i = 0; i < thread_count_; ++i) {
+        workers_.emplace_back(&CompressionCache::work, this);
+    }
+    return true;
+}
+
+void CompressionCache::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    if (event_fd_ >= 0) {
+        close(event_fd_);
+        event_fd_ = -1;
+    }
+}
+
+int CompressionCache::getEventFd() const {
+    return event_fd_;
+}
+
+const std::string& CompressionCache::getErrorMessage() const {
+    return error_message_;
+}
+
+std::shared_ptr<const CompressionCache::Entry> CompressionCache::get(
+    const std::string& key, ContentEncoding encoding, uint64_t length,
+    const InputFactory& make_input) {
+    if (length > capacity_) {
+        return nullptr;
+    }
+
+    std::string slot_key = std::string(CommandInterpreter::encodingName(encoding)) + ":" + key;
+    auto it = slots_.find(slot_key);
+    if (it != slots_.end()) {
+        recent_.splice(recent_.begin(), recent_, it->second.recent);
+        hits_++;
+        return it->second.entry;
+    }
+
+    misses_++;
+    auto job = std::make_unique<Job>();
+    job->entry = std::make_shared<Entry>();
+    job->key = slot_key;
+    job->encoding = encoding;
+    job->input = make_input();
+    job->ok = false;
+
+    recent_.push_front(slot_key);
+    slots_[slot_key] = Slot{job->entry, recent_.begin()};
+    std::shared_ptr<const Entry> entry = job->entry;
+
+    outstanding_++;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(job));
+    }
+    wake_.notify_one();
+    return entry;
+}
+
+void CompressionCache::collect() {
+    if (outstanding_ == 0) {
+        return;
+    }
+
+    // Read the eventfd before taking the jobs: a job finishing in between
+    // leaves it readable, so the loop comes back for it
+    uint64_t signals = 0;
+    ssize_t n = read(event_fd_, &signals, sizeof(signals));
+    (void)n;
+
+    std::deque<std::unique_ptr<Job>> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished.swap(finished_);
+    }
+
+    for (std::unique_ptr<Job>& job : finished) {
+        outstanding_--;
+        auto it = slots_.find(job->key);
+        if (!job->ok) {
+            job->entry->state = Entry::State::FAILED;
+        } else {
+            job->entry->data = std::make_shared<const std::string>(std::move(job->output));
+            job->entry->state = Entry::State::READY;
+        }
+
+        // Failures are retried by the next request; results that could
+        // never fit are handed to their waiters but not kept
+        if (it != slots_.end() && it->second.entry == job->entry) {
+            if (!job->ok || job->entry->data->size() > capacity_) {
+                recent_.erase(it->second.recent);
+                slots_.erase(it);
+            } else {
+                bytes_ += job->entry->data->size();
+            }
+        }
+    }
+    evict();
+}
+
+void CompressionCache::evict() {
+    auto it = recent_.end();
+    while (bytes_ > capacity_ && it != recent_.begin()) {
+        --it;
+        auto slot = slots_.find(*it);
+        if (slot->second.entry->state != Entry::State::READY) {
+            continue;
+        }
+        // Responses still sending the body keep their own reference
+        bytes_ -= slot->second.entry->data->size();
+        slots_.erase(slot);
+        it = recent_.erase(it);
+    }
+}
+
+void CompressionCache::work() {
+    while (true) {
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        std::string error;
+        job->ok = Compressor::compress(job->encoding, *job->input, job->output, error);
+        job->input.reset();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_.push_back(std::move(job));
+        }
+        uint64_t one = 1;
+        ssize_t n = write(event_fd_, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+size_t CompressionCache::entries() const {
+    return slots_.size();
+}
+
+uint64_t CompressionCache::bytes() const {
+    return bytes_;
+}
+
+uint64_t CompressionCache::hits() const {
+    return hits_;
+}
+
+uint64_t CompressionCache::misses() const {
+    return misses_;
+}
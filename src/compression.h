@@ -0,0 +1,120 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include <cstdint>
+#include "command_interpreter.h"
+#include "response_source.h"
+
+// Content codings for encoding=. gzip and deflate come from zlib; br is
+// only available when libbrotlienc was found at build time.
+class Compressor {
+public:
+    static bool supports(ContentEncoding encoding);
+
+    // Compress everything input produces into out, streaming, so only the
+    // output is ever held in memory
+    static bool compress(ContentEncoding encoding, ResponseSource& input, std::string& out,
+                         std::string& error);
+};
+
+// Compressed bodies shared by every connection, so each body is compressed
+// once per coding. Lookups and results belong to the event loop thread;
+// compression runs on a pool of worker threads, which signal an eventfd in
+// the epoll set when a job is done. Least recently used bodies are evicted
+// once the cache holds more than its capacity.
+class CompressionCache {
+public:
+    struct Entry {
+        enum class State { PENDING, READY, FAILED };
+
+        State state;
+        std::shared_ptr<const std::string> data;    // READY: the compressed body
+
+        Entry() : state(State::PENDING) {}
+    };
+
+    using InputFactory = std::function<std::unique_ptr<ResponseSource>()>;
+
+    static constexpr size_t DEFAULT_THREADS = 2;
+    static constexpr uint64_t DEFAULT_CAPACITY = uint64_t(256) << 20;
+
+    CompressionCache(size_t threads = DEFAULT_THREADS, uint64_t capacity = DEFAULT_CAPACITY);
+    ~CompressionCache();
+
+    CompressionCache(const CompressionCache&) = delete;
+    CompressionCache& operator=(const CompressionCache&) = delete;
+
+    // Creates the eventfd and starts the workers
+    bool start();
+
+    // Readable when finished jobs are waiting for collect()
+    int getEventFd() const;
+    const std::string& getErrorMessage() const;
+
+    // The entry for body key in encoding. On a miss, make_input() is called
+    // and the body it returns is queued for compression; the entry stays
+    // PENDING until collect() publishes the result. Bodies of more than
+    // capacity bytes are not compressed at all: nullptr.
+    std::shared_ptr<const Entry> get(const std::string& key, ContentEncoding encoding,
+                                     uint64_t length, const InputFactory& make_input);
+
+    // Publishes finished jobs; cheap when none are outstanding
+    void collect();
+
+    size_t entries() const;
+    uint64_t bytes() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Job {
+        std::shared_ptr<Entry> entry;
+        std::string key;
+        ContentEncoding encoding;
+        std::unique_ptr<ResponseSource> input;
+        bool ok;
+        std::string output;
+    };
+
+    struct Slot {
+        std::shared_ptr<Entry> entry;
+        std::list<std::string>::iterator recent;
+    };
+
+    size_t thread_count_;
+    uint64_t capacity_;
+    int event_fd_;
+    std::string error_message_;
+
+    // Shared with the workers, under mutex_
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::unique_ptr<Job>> queue_;
+    std::deque<std::unique_ptr<Job>> finished_;
+    bool stopping_;
+    std::vector<std::thread> workers_;
+
+    // Event loop thread only
+    std::unordered_map<std::string, Slot> slots_;
+    std::list<std::string> recent_;     // Keys, most recently used first
+    size_t outstanding_;
+    uint64_t bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+
+    void work();
+    void evict();
+    void stop();
+};
+
+#endif // COMPRESSION_H
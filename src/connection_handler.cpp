@@ -1,23 +1,103 @@
 #include "connection_handler.h"
+#include "chaos_mix.h"
+#include "traffic_log.h"
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <strings.h>
 #include <cerrno>
 #include <cstring>
 
-ConnectionHandler::ConnectionHandler(int socket_fd)
+namespace {
+
+const char* const OUTCOME_PATH = "/__stitch/outcome";
+const char* const USAGE_PATH = "/__stitch/usage";
+
+std::string pathWithoutQuery(const std::string& path) {
+    size_t query_start = path.find('?');
+    return query_start == std::string::npos ? path : path.substr(0, query_start);
+}
+
+} // namespace
+
+ConnectionHandler::ConnectionHandler(int socket_fd, ServerContext* context, TlsContext* tls)
     : socket_fd_(socket_fd)
-    , state_(ConnectionState::READING_REQUEST)
+    , send_fd_(socket_fd)
+    , state_(tls != nullptr ? ConnectionState::HANDSHAKING : ConnectionState::READING_REQUEST)
+    , context_(context)
+    , interpreter_(context != nullptr ? context->distributions : nullptr,
+                   context != nullptr ? context->scripts : nullptr)
+    , generator_(context != nullptr ? context->corpus : nullptr)
+    , current_route_(nullptr)
+    , header_bytes_(0)
     , bytes_sent_(0)
-    , delay_duration_ms_(0) {
+    , fault_(ResponseFault::NONE)
+    , fault_at_(0)
+    , slice_remaining_(0)
+    , tuned_(false)
+    , corked_(false)
+    , body_active_(false)
+    , echoing_(false)
+    , read_slice_remaining_(0)
+    , read_paused_(false)
+    , upstream_fd_(-1)
+    , upstream_reused_(false)
+    , upstream_replayable_(false)
+    , upstream_request_sent_(0)
+    , forward_pending_(0)
+    , relaying_(false)
+    , deadline_(std::chrono::steady_clock::time_point::max())
+    , accepted_at_(std::chrono::steady_clock::now())
+    , tracking_outcome_(false)
+    , close_reason_(CloseReason::NONE)
+    , memory_charged_(0)
+    , overload_admitted_(false)
+    , config_generation_(0) {
+    if (tls != nullptr) {
+        tls_ = std::make_unique<TlsSession>(*tls, socket_fd);
+    }
+    if (context_ != nullptr && context_->admission != nullptr) {
+        parser_.setMaxHeaderSize(context_->admission->maxHeaderSize());
+        context_->admission->open();
+        updateMemory();
+    }
+    startTimeout(TimeoutCause::IDLE);
 }
 
 ConnectionHandler::~ConnectionHandler() {
-    if (socket_fd_ >= 0) {
+    stopTimeout();
+    finishOverload();
+    releaseConfig();
+    if (context_ != nullptr && context_->admission != nullptr) {
+        context_->admission->close(memory_charged_);
+    }
+    if (socket_fd_ >= 0 && !tls_) {
         ::close(socket_fd_);
     }
+    if (upstream_fd_ >= 0) {
+        context_->upstream->discard(upstream_fd_);
+    }
 }
 
 void ConnectionHandler::onReadable() {
+    if (tls_ && !driveTls()) {
+        return;
+    }
+    if (state_ == ConnectionState::READING_BODY) {
+        readBody();
+        return;
+    }
+    if (state_ == ConnectionState::PROXYING) {
+        proxy();
+        return;
+    }
+    if (echoing_ || relaying_) {
+        pumpBody();
+        return;
+    }
     if (state_ != ConnectionState::READING_REQUEST) {
         return;
     }
@@ -37,12 +117,21 @@ void ConnectionHandler::onReadable() {
 
     if (n == 0) {
         // Connection closed by peer
+        close_reason_ = CloseReason::PEER_CLOSED;
         state_ = ConnectionState::CLOSING;
         return;
     }
 
+    // The head has until --header-timeout from its first byte
+    if (parser_.getRawData().empty()) {
+        startTimeout(TimeoutCause::HEADER);
+    }
+
     // Feed data to parser
     HttpParser::ParseResult result = parser_.parse(buffer, static_cast<size_t>(n));
+    if (result != HttpParser::ParseResult::INCOMPLETE) {
+        stopTimeout();
+    }
 
     if (result == HttpParser::ParseResult::COMPLETE) {
         // Request fully parsed, process it
@@ -51,11 +140,29 @@ void ConnectionHandler::onReadable() {
     } else if (result == HttpParser::ParseResult::ERROR) {
         // Parse error, close connection
         state_ = ConnectionState::CLOSING;
+    } else if (result == HttpParser::ParseResult::TOO_LARGE) {
+        // Nothing more is read; the head so far goes with the parser
+        if (context_ != nullptr && context_->admission != nullptr) {
+            context_->admission->rejectHeaders();
+        }
+        rejectRequest(431, "Request Header Fields Too Large");
+        parser_.reset();
     }
     // If INCOMPLETE, wait for more data
 }
 
 void ConnectionHandler::onWritable() {
+    if (tls_ && !driveTls()) {
+        return;
+    }
+    if (state_ == ConnectionState::PROXYING) {
+        proxy();
+        return;
+    }
+    if (echoing_ || relaying_) {
+        pumpBody();
+        return;
+    }
     if (state_ != ConnectionState::SENDING_RESPONSE) {
         return;
     }
@@ -64,12 +171,21 @@ void ConnectionHandler::onWritable() {
 }
 
 void ConnectionHandler::onTimer() {
-    if (state_ == ConnectionState::WAITING) {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-            now - delay_start_).count();
+    if (timeout_.expired) {
+        timedOut();
+        return;
+    }
+    if (tls_ && !driveTls()) {
+        return;
+    }
+    if (state_ == ConnectionState::COMPRESSING &&
+        compressed_->state != CompressionCache::Entry::State::PENDING) {
+        startBehavior();
+        return;
+    }
 
-        if (elapsed >= delay_duration_ms_) {
+    if (state_ == ConnectionState::WAITING) {
+        if (std::chrono::steady_clock::now() >= deadline_) {
             // Delay complete, send response
             state_ = ConnectionState::SENDING_RESPONSE;
             sendResponse();
@@ -81,8 +197,45 @@ ConnectionState ConnectionHandler::getState() const {
     return state_;
 }
 
+std::chrono::steady_clock::time_point ConnectionHandler::getDeadline() const {
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (state_ == ConnectionState::WAITING) {
+        deadline = deadline_;
+    }
+    if (read_paused_ && !shouldClose()) {
+        deadline = std::min(deadline, read_deadline_);
+    }
+    return deadline;
+}
+
 bool ConnectionHandler::shouldClose() const {
-    return state_ == ConnectionState::CLOSED || state_ == ConnectionState::CLOSING;
+    // Over TLS, a closing connection first gets what it was sent encrypted
+    // and handed to the kernel, as a plain socket's send buffer would be
+    return state_ == ConnectionState::CLOSED ||
+           (state_ == ConnectionState::CLOSING && (!tls_ || tls_->drained()));
+}
+
+bool ConnectionHandler::driveTls() {
+    if (state_ == ConnectionState::HANDSHAKING) {
+        switch (tls_->handshake()) {
+            case TlsSession::Status::PENDING:
+                // A handshake stalled on purpose is not the client's doing
+                if (tls_->handshakeFault() == HandshakeFault::STALL) {
+                    stopTimeout();
+                }
+                return false;
+            case TlsSession::Status::FAILED:
+                state_ = ConnectionState::CLOSING;
+                return false;
+            case TlsSession::Status::DONE:
+                socket_fd_ = tls_->readFd();
+                send_fd_ = tls_->sendFd();
+                state_ = ConnectionState::READING_REQUEST;
+                break;
+        }
+    }
+    tls_->pump();
+    return state_ != ConnectionState::CLOSING;
 }
 
 int ConnectionHandler::getFd() const {
@@ -92,28 +245,506 @@ int ConnectionHandler::getFd() const {
 void ConnectionHandler::handleRequest() {
     const HttpRequest& request = parser_.getRequest();
 
-    // Interpret command from query parameters
-    current_command_ = interpreter_.interpret(request.query_params);
+    // Reserved paths answer questions about the server instead of testing
+    if (handleControlRequest(request)) {
+        return;
+    }
+    if (shedRequest(request)) {
+        return;
+    }
+
+    // Without framing it can follow there is no telling where the body ends
+    if (!request_body_.begin(request)) {
+        rejectRequest(400, "Bad Request");
+        return;
+    }
+
+    resolveCommand(request);
+
+    // Sample once per request and keep the result in the command so the
+    // applied delay is what gets recorded and reported
+    if (current_command_.delay_distribution) {
+        current_command_.delay_us = current_command_.delay_distribution->sampleUs(random());
+    }
+
+    if (context_ != nullptr && context_->recorder != nullptr) {
+        context_->recorder->record(parser_.getRawData(), elapsedUs(), current_command_);
+    }
+    beginOutcome(request);
+
+    // With --upstream the backend answers, and the behavior bends its answer
+    if (proxies()) {
+        beginProxy();
+        return;
+    }
+
+    beginBody(request);
+    if (state_ == ConnectionState::CLOSING) {
+        return;
+    }
+    if (body_active_ && !echoing_ && !request_body_.done()) {
+        // The behavior starts once the upload is gone
+        state_ = ConnectionState::READING_BODY;
+        startTimeout(TimeoutCause::BODY);
+        readBody();
+        return;
+    }
+    continueRequest();
+}
+
+void ConnectionHandler::continueRequest() {
+    // A body to compress that is not cached yet goes to the worker pool;
+    // the behavior starts once it is ready (see onTimer)
+    if (awaitCompression()) {
+        state_ = ConnectionState::COMPRESSING;
+        return;
+    }
+    startBehavior();
+}
+
+void ConnectionHandler::beginBody(const HttpRequest& request) {
+    // close hangs up on the upload along with everything else
+    body_active_ = current_command_.request_body != RequestBodyMode::IGNORE &&
+                   current_command_.behavior != BehaviorType::CLOSE_IMMEDIATELY;
+    echoing_ = body_active_ && ResponseGenerator::echoes(current_command_);
+    read_slice_remaining_ = readSliceBytes();
+    if (!body_active_) {
+        return;
+    }
+
+    // Whatever of the body came with the headers is already in memory
+    const std::string& raw = parser_.getRawData();
+    size_t header_length = parser_.getHeaderLength();
+    request_body_.feed(raw.data() + header_length, raw.length() - header_length,
+                       [this](const char* data, size_t length) {
+                           if (echoing_) {
+                               echo_prefix_.append(data, length);
+                           }
+                       });
+    if (request_body_.failed()) {
+        close_reason_ = CloseReason::BAD_REQUEST;
+        state_ = ConnectionState::CLOSING;
+        return;
+    }
+
+    continueUpload(request);
+}
+
+void ConnectionHandler::continueUpload(const HttpRequest& request) {
+    // Clients that asked wait for this; a final response first would tell
+    // them not to send the body at all
+    if (!request_body_.done() &&
+        strcasecmp(request.getHeader("Expect").c_str(), "100-continue") == 0) {
+        static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        ssize_t n = send(send_fd_, CONTINUE, sizeof(CONTINUE) - 1, MSG_NOSIGNAL);
+        (void)n;
+    }
+}
+
+uint64_t ConnectionHandler::readBody() {
+    uint64_t total = 0;
+    while (!request_body_.done()) {
+        if (read_paused_) {
+            if (std::chrono::steady_clock::now() < read_deadline_) {
+                return total;
+            }
+            read_paused_ = false;
+            if (state_ == ConnectionState::READING_BODY) {
+                startTimeout(TimeoutCause::BODY);
+            }
+        }
+        uint64_t budget = current_command_.read_rate > 0 ? read_slice_remaining_ : UINT64_MAX;
+
+        // Data goes through the pipe without entering user space; a full
+        // pipe (echo) reads as EAGAIN until the response drains it
+        if (!body_pipe_.open()) {
+            close_reason_ = CloseReason::SEND_ERROR;
+            state_ = ConnectionState::CLOSING;
+            return total;
+        }
+        ssize_t n = body_pipe_.readFrom(socket_fd_, request_body_,
+                                        static_cast<size_t>(std::min<uint64_t>(budget, SIZE_MAX)));
+        if (request_body_.failed()) {
+            close_reason_ = CloseReason::BAD_REQUEST;
+            state_ = ConnectionState::CLOSING;
+            return total;
+        }
+        if (n > 0 && !echoing_ && !body_pipe_.discard()) {
+            close_reason_ = CloseReason::SEND_ERROR;
+            state_ = ConnectionState::CLOSING;
+            return total;
+        }
 
+        if (n == 0) {
+            // The client gave up mid-upload
+            close_reason_ = CloseReason::PEER_CLOSED;
+            state_ = ConnectionState::CLOSING;
+            return total;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN) {
+                close_reason_ = CloseReason::PEER_CLOSED;
+                state_ = ConnectionState::CLOSING;
+            }
+            return total;
+        }
+        total += static_cast<uint64_t>(n);
+        if (state_ == ConnectionState::READING_BODY) {
+            startTimeout(TimeoutCause::BODY);
+        }
+
+        // read_rate= leaves the rest in the socket buffer, so the client's
+        // window closes as it would behind a slow upstream
+        if (current_command_.read_rate > 0) {
+            read_slice_remaining_ -= std::min(read_slice_remaining_, static_cast<uint64_t>(n));
+            if (read_slice_remaining_ == 0) {
+                read_slice_remaining_ = readSliceBytes();
+                read_paused_ = true;
+                stopTimeout();
+                read_deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(
+                    read_slice_remaining_ * 1000000 / current_command_.read_rate);
+            }
+        }
+    }
+
+    if (state_ == ConnectionState::READING_BODY) {
+        stopTimeout();
+        continueRequest();
+    }
+    return total;
+}
+
+void ConnectionHandler::pumpBody() {
+    // Reads (the request body, or the upstream response) and sends in turn
+    // until neither moves, so neither end of the pipe waits for an event
+    // while the other has room
+    while (!shouldClose()) {
+        uint64_t sent = bytes_sent_;
+        uint64_t read = relaying_ ? relayBody() : request_body_.done() ? 0 : readBody();
+        if (state_ == ConnectionState::SENDING_RESPONSE) {
+            sendResponse();
+        }
+        if (read == 0 && bytes_sent_ == sent) {
+            break;
+        }
+    }
+}
+
+void ConnectionHandler::rejectRequest(int status_code, const std::string& reason) {
+    current_command_ = TestCommand();
+    HttpResponse response = ResponseGenerator::createErrorResponse(status_code, reason);
+    std::string head = generator_.serializeHead(response);
+    uint64_t header_bytes = head.length();
+    startResponse(std::make_unique<StringSource>(head + response.body), header_bytes);
+    outcome_.status_code = status_code;
+    state_ = ConnectionState::SENDING_RESPONSE;
+    sendResponse();
+}
+
+bool ConnectionHandler::shedRequest(const HttpRequest& request) {
+    if (context_ == nullptr || context_->overload == nullptr) {
+        return false;
+    }
+
+    Overload& overload = *context_->overload;
+    Overload::Verdict verdict = overload.admit(std::chrono::steady_clock::now());
+    if (verdict == Overload::Verdict::SERVE) {
+        overload_admitted_ = true;
+        return false;
+    }
+
+    // The behavior asked for is not what happens to a shed request
+    current_command_ = TestCommand();
+    beginOutcome(request);
+    switch (verdict) {
+        case Overload::Verdict::STALL:
+            park();
+            return true;
+        case Overload::Verdict::RESET:
+            abortConnection();
+            return true;
+        case Overload::Verdict::UNAVAILABLE:
+        case Overload::Verdict::TOO_MANY:
+        case Overload::Verdict::SERVE:
+            break;
+    }
+
+    int status_code = verdict == Overload::Verdict::UNAVAILABLE ? 503 : 429;
+    HttpResponse response = ResponseGenerator::createErrorResponse(
+        status_code, status_code == 503 ? "Service Unavailable" : "Too Many Requests");
+    if (overload.retryAfter() > 0) {
+        response.headers["Retry-After"] = std::to_string(overload.retryAfter());
+    }
+    std::string head = generator_.serializeHead(response);
+    uint64_t header_bytes = head.length();
+    startResponse(std::make_unique<StringSource>(head + response.body), header_bytes);
+    outcome_.status_code = status_code;
+    state_ = ConnectionState::SENDING_RESPONSE;
+    sendResponse();
+    return true;
+}
+
+void ConnectionHandler::finishOverload() {
+    if (overload_admitted_) {
+        overload_admitted_ = false;
+        context_->overload->finish();
+    }
+}
+
+bool ConnectionHandler::proxies() const {
+    return context_ != nullptr && context_->upstream != nullptr &&
+           ResponseGenerator::relays(current_command_);
+}
+
+void ConnectionHandler::beginProxy() {
+    // The head goes as it came, less what only concerned this connection,
+    // followed by whatever of the body came with it (framing included)
+    const HttpRequest& request = parser_.getRequest();
+    const std::string& raw = parser_.getRawData();
+    size_t header_length = parser_.getHeaderLength();
+    upstream_request_ = UpstreamRequest::forwardHead(raw.data(), header_length);
+    size_t body_bytes = request_body_.feed(raw.data() + header_length, raw.length() - header_length,
+                                           [](const char*, size_t) {});
+    if (request_body_.failed()) {
+        close_reason_ = CloseReason::BAD_REQUEST;
+        state_ = ConnectionState::CLOSING;
+        return;
+    }
+    upstream_request_.append(raw, header_length, body_bytes);
+    upstream_replayable_ = request_body_.done();
+
+    continueUpload(request);
+    state_ = ConnectionState::PROXYING;
+    connectUpstream();
+}
+
+void ConnectionHandler::connectUpstream() {
+    upstream_fd_ = context_->upstream->acquire(&upstream_reused_);
+    if (upstream_fd_ < 0) {
+        rejectRequest(502, "Bad Gateway");
+        return;
+    }
+    upstream_request_sent_ = 0;
+    upstream_response_.reset();
+    proxy();
+}
+
+void ConnectionHandler::proxy() {
+    while (upstream_request_sent_ < upstream_request_.length()) {
+        ssize_t n = send(upstream_fd_, upstream_request_.data() + upstream_request_sent_,
+                         upstream_request_.length() - upstream_request_sent_, MSG_NOSIGNAL);
+        if (n < 0) {
+            // EAGAIN also covers a connect still in progress
+            if (errno != EAGAIN) {
+                failUpstream();
+                return;
+            }
+            break;
+        }
+        upstream_request_sent_ += static_cast<size_t>(n);
+    }
+    if (upstream_request_sent_ == upstream_request_.length() && !forwardBody()) {
+        return;
+    }
+
+    // The backend may answer before the upload is over; the answer wins
+    char buffer[4096];
+    while (true) {
+        ssize_t n = recv(upstream_fd_, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (n <= 0) {
+            failUpstream();
+            return;
+        }
+        switch (upstream_response_.parse(buffer, static_cast<size_t>(n))) {
+            case UpstreamResponse::ParseResult::INCOMPLETE:
+                break;
+            case UpstreamResponse::ParseResult::ERROR:
+                failUpstream();
+                return;
+            case UpstreamResponse::ParseResult::COMPLETE:
+                beginRelay();
+                return;
+        }
+    }
+}
+
+bool ConnectionHandler::forwardBody() {
+    // Body bytes, framing and all, go socket to pipe to socket; the framing
+    // is only peeked at to find where the body ends
+    while (true) {
+        if (body_pipe_.buffered() > 0) {
+            ssize_t n = splice(body_pipe_.readFd(), nullptr, upstream_fd_, nullptr,
+                               body_pipe_.buffered(), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno != EAGAIN) {
+                    failUpstream();
+                    return false;
+                }
+                return true;
+            }
+            body_pipe_.consumed(static_cast<size_t>(n));
+            continue;
+        }
+
+        if (forward_pending_ == 0) {
+            if (request_body_.done()) {
+                return true;
+            }
+            uint64_t available = request_body_.dataAvailable();
+            if (available > 0) {
+                request_body_.consumeData(available);
+                forward_pending_ = available;
+            } else {
+                char buffer[512];
+                ssize_t n = recv(socket_fd_, buffer, sizeof(buffer), MSG_PEEK);
+                if (n < 0 && errno == EAGAIN) {
+                    return true;
+                }
+                if (n <= 0) {
+                    close_reason_ = CloseReason::PEER_CLOSED;
+                    state_ = ConnectionState::CLOSING;
+                    return false;
+                }
+                forward_pending_ = request_body_.parseFraming(buffer, static_cast<size_t>(n));
+                if (request_body_.failed()) {
+                    close_reason_ = CloseReason::BAD_REQUEST;
+                    state_ = ConnectionState::CLOSING;
+                    return false;
+                }
+            }
+        }
+
+        if (!body_pipe_.open()) {
+            close_reason_ = CloseReason::SEND_ERROR;
+            state_ = ConnectionState::CLOSING;
+            return false;
+        }
+        ssize_t n = body_pipe_.fill(socket_fd_,
+                                    static_cast<size_t>(std::min<uint64_t>(forward_pending_, SIZE_MAX)));
+        if (n < 0 && errno == EAGAIN) {
+            return true;
+        }
+        if (n <= 0) {
+            close_reason_ = CloseReason::PEER_CLOSED;
+            state_ = ConnectionState::CLOSING;
+            return false;
+        }
+        forward_pending_ -= static_cast<uint64_t>(n);
+    }
+}
+
+void ConnectionHandler::beginRelay() {
+    const HttpRequest& request = parser_.getRequest();
+    if (!upstream_body_.beginResponse(upstream_response_.getStatusCode(), request.method == "HEAD",
+                                      upstream_response_.getTransferEncoding(),
+                                      upstream_response_.getContentLength())) {
+        failUpstream();
+        return;
+    }
+
+    // Body bytes that came with the head are sent from memory; framing
+    // is dropped, as the relay frames the body itself
+    const std::string& start = upstream_response_.getBodyStart();
+    upstream_body_.feed(start.data(), start.length(), [this](const char* data, size_t length) {
+        upstream_prefix_.append(data, length);
+    });
+    if (upstream_body_.failed()) {
+        failUpstream();
+        return;
+    }
+
+    relaying_ = true;
+    if (upstream_body_.done()) {
+        releaseUpstream();
+    }
+    continueRequest();
+
+    // More of the body may already be waiting, with no event to announce it
+    if (!shouldClose()) {
+        pumpBody();
+    }
+}
+
+uint64_t ConnectionHandler::relayBody() {
+    uint64_t total = 0;
+    while (upstream_fd_ >= 0 && !upstream_body_.done()) {
+        if (!upstream_pipe_.open()) {
+            close_reason_ = CloseReason::SEND_ERROR;
+            state_ = ConnectionState::CLOSING;
+            return total;
+        }
+        ssize_t n = upstream_pipe_.readFrom(upstream_fd_, upstream_body_, SIZE_MAX);
+        if (n == 0) {
+            upstream_body_.finish();
+        }
+        if (upstream_body_.failed() || (n < 0 && errno != EAGAIN)) {
+            // The client sees the body end where the backend's did
+            close_reason_ = CloseReason::UPSTREAM_ERROR;
+            state_ = ConnectionState::CLOSING;
+            return total;
+        }
+        if (n < 0) {
+            return total;
+        }
+        total += static_cast<uint64_t>(n);
+    }
+    if (upstream_fd_ >= 0) {
+        releaseUpstream();
+    }
+    return total;
+}
+
+void ConnectionHandler::releaseUpstream() {
+    // Only an exchange that finished on both sides leaves the connection
+    // ready for another request
+    bool reusable = upstream_body_.done() && upstream_body_.framing() != RequestBody::Framing::CLOSE &&
+                    upstream_response_.keepAlive() &&
+                    upstream_request_sent_ == upstream_request_.length() &&
+                    request_body_.done() && forward_pending_ == 0 && body_pipe_.buffered() == 0;
+    if (reusable) {
+        context_->upstream->release(upstream_fd_);
+    } else {
+        context_->upstream->discard(upstream_fd_);
+    }
+    upstream_fd_ = -1;
+}
+
+void ConnectionHandler::failUpstream() {
+    // The backend may have closed an idle connection just as it was taken
+    // from the pool; a request still held whole goes again on a new one
+    bool retry = upstream_reused_ && upstream_replayable_ && upstream_response_.empty();
+    releaseUpstream();
+    if (retry) {
+        connectUpstream();
+        return;
+    }
+    rejectRequest(502, "Bad Gateway");
+}
+
+void ConnectionHandler::startBehavior() {
     // Handle special behaviors that don't require a response
     switch (current_command_.behavior) {
         case BehaviorType::CLOSE_IMMEDIATELY:
+            close_reason_ = CloseReason::BEHAVIOR_CLOSE;
             state_ = ConnectionState::CLOSING;
             return;
 
         case BehaviorType::TIMEOUT:
             // Just wait forever (or until connection is closed)
             state_ = ConnectionState::WAITING;
-            delay_duration_ms_ = INT32_MAX;
-            delay_start_ = std::chrono::steady_clock::now();
+            deadline_ = std::chrono::steady_clock::time_point::max();
             return;
 
         case BehaviorType::SLOW_RESPONSE:
             // Delay before sending response
-            if (current_command_.delay_ms > 0) {
+            if (current_command_.delay_us > 0) {
+                prepareResponse();
                 state_ = ConnectionState::WAITING;
-                delay_duration_ms_ = current_command_.delay_ms;
-                delay_start_ = std::chrono::steady_clock::now();
+                deadline_ = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(current_command_.delay_us);
                 return;
             }
             break;
@@ -122,50 +753,170 @@ void ConnectionHandler::handleRequest() {
             break;
     }
 
-    // Generate response
+    prepareResponse();
+
+    // Start sending response
+    state_ = ConnectionState::SENDING_RESPONSE;
+    sendResponse();
+}
+
+bool ConnectionHandler::awaitCompression() {
+    compressed_.reset();
+    if (current_command_.encoding == ContentEncoding::IDENTITY || context_ == nullptr || relaying_ ||
+        context_->compression == nullptr ||
+        (current_route_ != nullptr && current_route_->has_response) ||
+        current_command_.behavior == BehaviorType::CLOSE_IMMEDIATELY ||
+        current_command_.behavior == BehaviorType::TIMEOUT) {
+        return false;
+    }
+
     HttpResponse response = generator_.generate(current_command_);
-    response_data_ = generator_.serialize(response);
-    bytes_sent_ = 0;
+    if (response.encoding == ContentEncoding::IDENTITY) {
+        return false;
+    }
+    compressed_ = context_->compression->get(
+        ResponseGenerator::bodyKey(response), response.encoding,
+        ResponseGenerator::rawBodyLength(response),
+        [this, &response] { return generator_.rawBody(response); });
+    return compressed_ && compressed_->state == CompressionCache::Entry::State::PENDING;
+}
 
-    // Check for close-after-headers behavior
-    if (current_command_.behavior == BehaviorType::CLOSE_AFTER_HEADERS) {
-        // Find end of headers
-        size_t headers_end = response_data_.find("\r\n\r\n");
-        if (headers_end != std::string::npos) {
-            // Truncate to just headers
-            response_data_.resize(headers_end + 4);
+void ConnectionHandler::prepareResponse() {
+    if (!relaying_ && current_route_ != nullptr && current_route_->has_response) {
+        // Serialized once when the scenario was loaded; the route outlives us
+        const std::string& response = current_route_->response;
+        size_t headers_end = response.find("\r\n\r\n");
+        startResponse(std::make_unique<MemorySource>(response.data(), response.length()),
+                      headers_end == std::string::npos ? response.length() : headers_end + 4);
+        outcome_.status_code = current_route_->response_status;
+    } else {
+        // Generate response; range handling is only defined for GET
+        const HttpRequest& request = parser_.getRequest();
+        HttpResponse response = relaying_
+            ? generator_.relay(current_command_, upstream_response_, upstream_body_.length())
+            : generator_.generate(current_command_,
+                                  request.method == "GET" ? request.getHeader("Range") : "");
+        // Without a compressed body (no cache, too large, failed) the body
+        // goes out as it is
+        if (compressed_ && compressed_->state == CompressionCache::Entry::State::READY) {
+            response.encoded = compressed_->data;
         }
-    }
+        // An echo keeps the request's length and type, or is chunked
+        // when the request was
+        if (response.echo_body && !relaying_) {
+            response.echo_length = request_body_.length();
+            std::string type = request.getHeader("Content-Type");
+            if (!type.empty()) {
+                response.headers["Content-Type"] = type;
+            }
+        }
+        std::unique_ptr<ResponseSource> head = generator_.streamHead(response);
+        uint64_t header_bytes = head->length();
 
-    // Check for partial close behavior
-    if (current_command_.behavior == BehaviorType::CLOSE_AFTER_PARTIAL) {
-        if (response_data_.length() > current_command_.bytes_before_close) {
-            response_data_.resize(current_command_.bytes_before_close);
+        auto source = std::make_unique<ConcatSource>();
+        source->append(std::move(head));
+        if (relaying_) {
+            source->append(std::make_unique<EchoSource>(std::move(upstream_prefix_),
+                                                        &upstream_body_, &upstream_pipe_));
+        } else if (response.echo_body) {
+            source->append(std::make_unique<EchoSource>(std::move(echo_prefix_), &request_body_,
+                                                        &body_pipe_));
+        } else {
+            source->append(generator_.streamBody(response));
         }
+        startResponse(std::move(source), header_bytes);
+        outcome_.status_code = response.status_code;
     }
+    // Randomly sized chunks of a huge body are not counted up front
+    uint64_t response_bytes = source_->length();
+    outcome_.response_bytes = response_bytes == ResponseSource::UNKNOWN_LENGTH ? 0 : response_bytes;
 
-    // Start sending response
-    state_ = ConnectionState::SENDING_RESPONSE;
-    sendResponse();
+    // Truncating behaviors are close faults at a fixed offset
+    if (current_command_.behavior == BehaviorType::CLOSE_AFTER_HEADERS) {
+        fault_ = ResponseFault::CLOSE;
+        fault_at_ = header_bytes_;
+    } else if (current_command_.behavior == BehaviorType::CLOSE_AFTER_PARTIAL) {
+        fault_ = ResponseFault::CLOSE;
+        fault_at_ = current_command_.bytes_before_close;
+    }
+}
+
+void ConnectionHandler::startResponse(std::unique_ptr<ResponseSource> source,
+                                      uint64_t header_bytes) {
+    source_ = std::move(source);
+    header_bytes_ = header_bytes;
+    bytes_sent_ = 0;
+    fault_ = current_command_.fault;
+    fault_at_ = current_command_.fault_at;
+    script_.start(current_command_.script);
+    slice_remaining_ = sliceBytes();
+    tuned_ = false;
 }
 
 void ConnectionHandler::sendResponse() {
-    while (bytes_sent_ < response_data_.length()) {
-        size_t remaining = response_data_.length() - bytes_sent_;
-        size_t to_send = remaining;
+    if (!source_) {
+        state_ = ConnectionState::CLOSING;
+        return;
+    }
+    if (!tuned_) {
+        tuneSocket();
+    }
 
-        // Handle slow send behaviors
-        if (current_command_.behavior == BehaviorType::SLOW_HEADERS ||
-            current_command_.behavior == BehaviorType::SLOW_BODY) {
-            if (current_command_.bytes_per_second > 0) {
-                // Limit send size for slow behavior
-                // (This is simplified; real implementation would use timers)
-                to_send = std::min(remaining, size_t(current_command_.bytes_per_second / 10));
-                if (to_send == 0) to_send = 1;
+    while (!source_->done()) {
+        if (fault_ != ResponseFault::NONE && bytes_sent_ >= fault_at_) {
+            if (!applyFault()) {
+                return;
             }
+            continue;
+        }
+
+        // An echo waits for more of the request body; what is written so
+        // far should not wait with it
+        if (source_->blocked()) {
+            setCork(false);
+            return;
         }
 
-        ssize_t n = send(socket_fd_, response_data_.data() + bytes_sent_, to_send, 0);
+        // A script decides where each send stops and what happens between
+        if (script_.active() && !script_.sending(bytes_sent_) && !runScript()) {
+            return;
+        }
+
+        uint64_t budget = UINT64_MAX;
+        if (fault_ != ResponseFault::NONE) {
+            budget = fault_at_ - bytes_sent_;
+        }
+        if (script_.active()) {
+            budget = std::min(budget, script_.target() - bytes_sent_);
+        }
+
+        // Only the paced part of the response is rate limited, and a slice
+        // never crosses the boundary between headers and body
+        bool paced = isPaced();
+        if (paced) {
+            budget = std::min(budget, slice_remaining_);
+        }
+        if (!script_.active() && current_command_.bytes_per_second > 0 &&
+            bytes_sent_ < header_bytes_ &&
+            (current_command_.behavior == BehaviorType::SLOW_HEADERS ||
+             current_command_.behavior == BehaviorType::SLOW_BODY)) {
+            budget = std::min(budget, header_bytes_ - bytes_sent_);
+        }
+
+        size_t max_bytes = static_cast<size_t>(std::min<uint64_t>(budget, SIZE_MAX));
+        uint64_t lines = script_.lines();
+        if (lines > 0) {
+            max_bytes = lineSpan(max_bytes, lines);
+        }
+
+        ssize_t n = sendNext(max_bytes);
+        if (n == 0) {
+            // A body that cannot be produced (a file shrank) ends the
+            // connection where it stands
+            close_reason_ = CloseReason::SEND_ERROR;
+            state_ = ConnectionState::CLOSING;
+            return;
+        }
 
         if (n < 0) {
             if (errno == EAGAIN) {
@@ -173,30 +924,539 @@ void ConnectionHandler::sendResponse() {
                 return;
             }
             // Error occurred
+            close_reason_ = (errno == EPIPE || errno == ECONNRESET)
+                ? CloseReason::PEER_CLOSED : CloseReason::SEND_ERROR;
             state_ = ConnectionState::CLOSING;
             return;
         }
 
-        bytes_sent_ += static_cast<size_t>(n);
+        if (bytes_sent_ == 0 && n > 0) {
+            outcome_.first_byte_us = elapsedUs();
+        }
+        if (script_.lines() > 0) {
+            // Only line ends that made it out count
+            lines = script_.lines();
+            lineSpan(static_cast<size_t>(n), lines);
+            script_.linesSent(lines);
+        }
+        source_->consume(static_cast<size_t>(n));
+        bytes_sent_ += static_cast<uint64_t>(n);
 
-        // For slow behaviors, break after each send to simulate slow sending
-        if ((current_command_.behavior == BehaviorType::SLOW_HEADERS ||
-             current_command_.behavior == BehaviorType::SLOW_BODY) &&
-            current_command_.bytes_per_second > 0) {
-            return;  // Wait for next onWritable() or timer event
+        // A used-up slice waits out the rest of its time window
+        if (paced) {
+            slice_remaining_ -= std::min<uint64_t>(slice_remaining_, static_cast<uint64_t>(n));
+            if (slice_remaining_ == 0) {
+                slice_remaining_ = sliceBytes();
+                state_ = ConnectionState::WAITING;
+                deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(
+                    slice_remaining_ * 1000000 / sendRate());
+                return;
+            }
         }
     }
 
+    // A fault placed exactly at the end still fires (e.g. reset instead of FIN)
+    if (fault_ != ResponseFault::NONE && bytes_sent_ >= fault_at_ && !applyFault()) {
+        return;
+    }
+
+    // Script steps after the last byte still run: a final wait, close or reset
+    if (script_.active() && !runScript()) {
+        return;
+    }
+
     // All data sent, close connection
+    setCork(false);
+    if (current_command_.behavior == BehaviorType::CLOSE_AFTER_HEADERS ||
+        current_command_.behavior == BehaviorType::CLOSE_AFTER_PARTIAL) {
+        close_reason_ = CloseReason::TRUNCATED;
+    } else {
+        close_reason_ = CloseReason::COMPLETED;
+    }
+    state_ = ConnectionState::CLOSING;
+}
+
+ssize_t ConnectionHandler::sendNext(size_t max_bytes) {
+    // File bodies go from the page cache to the socket without a copy
+    // (sendfile() has no MSG_NOSIGNAL; main() ignores SIGPIPE)
+    int file_fd;
+    uint64_t file_offset;
+    size_t file_length;
+    if (source_->peekFile(file_fd, file_offset, file_length, max_bytes)) {
+        off_t offset = static_cast<off_t>(file_offset);
+        return sendfile(send_fd_, file_fd, &offset, file_length);
+    }
+
+    // Echoed request bodies go from pipe to socket the same way
+    int pipe_fd;
+    size_t pipe_length;
+    if (source_->peekPipe(pipe_fd, pipe_length, max_bytes)) {
+        return splice(pipe_fd, nullptr, send_fd_, nullptr, pipe_length,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+
+    struct iovec segments[ResponseSource::MAX_SEGMENTS];
+    size_t count = source_->peek(segments, ResponseSource::MAX_SEGMENTS, max_bytes);
+    if (count == 0) {
+        return 0;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = segments;
+    message.msg_iovlen = count;
+
+    // MSG_NOSIGNAL: a client hanging up mid-response must not SIGPIPE the server
+    return sendmsg(send_fd_, &message, MSG_NOSIGNAL);
+}
+
+bool ConnectionHandler::applyFault() {
+    switch (fault_) {
+        case ResponseFault::CLOSE:
+            close_reason_ = CloseReason::TRUNCATED;
+            state_ = ConnectionState::CLOSING;
+            return false;
+
+        case ResponseFault::RESET:
+            abortConnection();
+            return false;
+
+        case ResponseFault::STALL:
+            state_ = ConnectionState::WAITING;
+            deadline_ = std::chrono::steady_clock::time_point::max();
+            return false;
+
+        case ResponseFault::CORRUPT: {
+            struct iovec segment;
+            if (source_->done() || source_->peek(&segment, 1, 1) == 0) {
+                fault_ = ResponseFault::NONE;
+                return true;
+            }
+            char flipped = static_cast<char>(*static_cast<const char*>(segment.iov_base) ^ 0x01);
+            ssize_t n = send(send_fd_, &flipped, 1, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN) {
+                    close_reason_ = (errno == EPIPE || errno == ECONNRESET)
+                        ? CloseReason::PEER_CLOSED : CloseReason::SEND_ERROR;
+                    state_ = ConnectionState::CLOSING;
+                }
+                return false;
+            }
+            if (bytes_sent_ == 0) {
+                outcome_.first_byte_us = elapsedUs();
+            }
+            source_->consume(1);
+            bytes_sent_ += 1;
+            fault_ = ResponseFault::NONE;
+            return true;
+        }
+
+        case ResponseFault::NONE:
+            break;
+    }
+    return true;
+}
+
+void ConnectionHandler::abortConnection() {
+    // Zero linger turns the close() into an RST
+    struct linger abort_linger;
+    abort_linger.l_onoff = 1;
+    abort_linger.l_linger = 0;
+    setsockopt(send_fd_, SOL_SOCKET, SO_LINGER, &abort_linger, sizeof(abort_linger));
+    close_reason_ = CloseReason::RESET;
     state_ = ConnectionState::CLOSING;
 }
 
-void ConnectionHandler::executeDelayedBehavior() {
-    // Handled by onTimer()
+bool ConnectionHandler::runScript() {
+    while (true) {
+        switch (script_.next(bytes_sent_, header_bytes_, source_->length())) {
+            case ScriptRunner::Action::SEND:
+                // Past the end of the response every send is already done
+                if (source_->done()) {
+                    continue;
+                }
+                return true;
+
+            case ScriptRunner::Action::FINISH:
+                return true;
+
+            case ScriptRunner::Action::RATE:
+                slice_remaining_ = sliceBytes();
+                continue;
+
+            case ScriptRunner::Action::WAIT:
+                state_ = ConnectionState::WAITING;
+                deadline_ = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(script_.waitUs());
+                return false;
+
+            case ScriptRunner::Action::CLOSE:
+                close_reason_ = source_->done() ? CloseReason::COMPLETED : CloseReason::TRUNCATED;
+                state_ = ConnectionState::CLOSING;
+                return false;
+
+            case ScriptRunner::Action::RESET:
+                abortConnection();
+                return false;
+
+            case ScriptRunner::Action::STALL:
+                state_ = ConnectionState::WAITING;
+                deadline_ = std::chrono::steady_clock::time_point::max();
+                return false;
+        }
+    }
+}
+
+size_t ConnectionHandler::lineSpan(size_t max_bytes, uint64_t& lines) {
+    // Line steps stop at the end of the head, which is always in memory
+    struct iovec segments[ResponseSource::MAX_SEGMENTS];
+    size_t count = source_->peek(segments, ResponseSource::MAX_SEGMENTS, max_bytes);
+    size_t span = 0;
+    uint64_t found = 0;
+    for (size_t i = 0; i < count && found < lines; ++i) {
+        const char* data = static_cast<const char*>(segments[i].iov_base);
+        size_t length = segments[i].iov_len;
+        const char* end = data + length;
+        const char* cursor = data;
+        while (found < lines) {
+            const void* newline = memchr(cursor, '\n', static_cast<size_t>(end - cursor));
+            if (newline == nullptr) {
+                cursor = end;
+                break;
+            }
+            cursor = static_cast<const char*>(newline) + 1;
+            found++;
+        }
+        span += static_cast<size_t>(cursor - data);
+    }
+    lines = found;
+    return span;
+}
+
+uint64_t ConnectionHandler::sendRate() const {
+    if (script_.active()) {
+        return script_.rate();
+    }
+    return current_command_.bytes_per_second > 0
+        ? static_cast<uint64_t>(current_command_.bytes_per_second) : 0;
+}
+
+bool ConnectionHandler::isPaced() const {
+    if (script_.active()) {
+        return script_.rate() > 0;
+    }
+    if (current_command_.bytes_per_second <= 0) {
+        return false;
+    }
+    if (current_command_.behavior == BehaviorType::SLOW_HEADERS) {
+        return bytes_sent_ < header_bytes_;
+    }
+    if (current_command_.behavior == BehaviorType::SLOW_BODY) {
+        return bytes_sent_ >= header_bytes_;
+    }
+    return false;
+}
+
+bool ConnectionHandler::isShaped() const {
+    // Timing or the cut-off point is what the test is about
+    return script_.active() || sendRate() > 0 || fault_ != ResponseFault::NONE;
+}
+
+void ConnectionHandler::tuneSocket() {
+    tuned_ = true;
+
+    // Options that do not apply (TCP ones on a Unix socket or a TLS bridge)
+    // fail harmlessly
+    bool shaped = isShaped();
+    int nodelay = current_command_.nodelay >= 0 ? current_command_.nodelay : 1;
+    setsockopt(send_fd_, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // A small buffer and low-water mark keep paced and cut-short bytes in
+    // the handler until they are due, rather than queued in the kernel
+    int sndbuf = current_command_.sndbuf > 0 ? static_cast<int>(current_command_.sndbuf)
+                                             : shaped ? SHAPED_SNDBUF : 0;
+    if (sndbuf > 0) {
+        setsockopt(send_fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    }
+    if (shaped) {
+        int lowat = SHAPED_NOTSENT_LOWAT;
+        setsockopt(send_fd_, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    } else if (nodelay != 0) {
+        // Head and body leave in full segments; nodelay=0 asks for Nagle
+        // and gets it unmixed
+        setCork(true);
+    }
+}
+
+void ConnectionHandler::setCork(bool cork) {
+    if (cork == corked_) {
+        return;
+    }
+    int value = cork ? 1 : 0;
+    if (setsockopt(send_fd_, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0) {
+        corked_ = cork;
+    }
+}
+
+uint64_t ConnectionHandler::sliceBytes() const {
+    // Ten slices per second, at least one byte each
+    return std::max<uint64_t>(1, sendRate() / 10);
+}
+
+uint64_t ConnectionHandler::readSliceBytes() const {
+    // Same slicing as sending
+    return std::max<uint64_t>(1, current_command_.read_rate / 10);
+}
+
+void ConnectionHandler::resolveCommand(const HttpRequest& request) {
+    // A replayed log decides everything until it runs out
+    if (context_ != nullptr && context_->replay != nullptr) {
+        TrafficRecord record;
+        if (context_->replay->next(record)) {
+            current_route_ = nullptr;
+            current_command_ = record.command;
+            return;
+        }
+    }
+
+    // With --admin the scenario, chaos mix and default come from the
+    // current snapshot; a listener's own scenario still wins
+    const ScenarioRouter* router = context_ != nullptr ? context_->router : nullptr;
+    const ChaosMix* chaos = context_ != nullptr ? context_->chaos : nullptr;
+    const ConfigSnapshot* config = nullptr;
+    if (context_ != nullptr && context_->config != nullptr) {
+        releaseConfig();
+        config = context_->config->pin();
+        config_generation_ = config->generation;
+        if (router == nullptr) {
+            router = config->router.get();
+        }
+        if (chaos == nullptr) {
+            chaos = config->chaos.get();
+        }
+    }
+
+    // A scenario route supplies a prebuilt command
+    current_route_ = router != nullptr ? router->resolve(request) : nullptr;
+    if (current_route_ != nullptr) {
+        current_command_ = current_route_->command;
+        return;
+    }
+
+    // An explicit behavior always wins over chaos
+    if (request.query_params.count("behavior") != 0) {
+        current_command_ = interpreter_.interpret(request.query_params);
+        return;
+    }
+
+    Xoshiro256& rng = random();
+
+    // A per-request mix is compiled once per spec; an invalid one is ignored
+    auto chaos_it = request.query_params.find("chaos");
+    if (chaos_it != request.query_params.end()) {
+        std::shared_ptr<const ChaosMix> mix;
+        if (context_ != nullptr && context_->chaos_mixes != nullptr) {
+            mix = context_->chaos_mixes->get(chaos_it->second);
+        } else {
+            auto parsed = std::make_shared<ChaosMix>();
+            if (parsed->parse(chaos_it->second)) {
+                mix = std::move(parsed);
+            }
+        }
+        if (mix) {
+            current_command_ = mix->pick(rng);
+            return;
+        }
+    }
+
+    if (chaos != nullptr) {
+        current_command_ = chaos->pick(rng);
+        return;
+    }
+
+    if (config != nullptr && config->has_default) {
+        current_command_ = config->default_command;
+        return;
+    }
+
+    current_command_ = interpreter_.interpret(request.query_params);
+}
+
+void ConnectionHandler::releaseConfig() {
+    if (config_generation_ != 0) {
+        context_->config->unpin(config_generation_);
+        config_generation_ = 0;
+    }
+}
+
+bool ConnectionHandler::handleControlRequest(const HttpRequest& request) {
+    if (context_ == nullptr) {
+        return false;
+    }
+
+    std::string path = pathWithoutQuery(request.path);
+    HttpResponse response;
+    if (path == USAGE_PATH && context_->admission != nullptr) {
+        response = ResponseGenerator::createOkResponse(context_->admission->toJson());
+        response.headers["Content-Type"] = "application/json";
+    } else if (path == OUTCOME_PATH && context_->outcomes != nullptr) {
+        auto id_it = request.query_params.find("id");
+        const OutcomeRecord* record = nullptr;
+        if (id_it != request.query_params.end()) {
+            record = context_->outcomes->find(id_it->second);
+        }
+
+        response = record != nullptr
+            ? ResponseGenerator::createOkResponse(OutcomeRegistry::toJson(*record))
+            : ResponseGenerator::createErrorResponse(404, "Not Found");
+        response.headers["Content-Type"] = record != nullptr ? "application/json" : "text/plain";
+    } else {
+        return false;
+    }
+
+    std::string head = generator_.serializeHead(response);
+    uint64_t header_bytes = head.length();
+    startResponse(std::make_unique<StringSource>(head + response.body), header_bytes);
+    state_ = ConnectionState::SENDING_RESPONSE;
+    sendResponse();
+    return true;
+}
+
+void ConnectionHandler::beginOutcome(const HttpRequest& request) {
+    if (context_ == nullptr || context_->outcomes == nullptr) {
+        return;
+    }
+
+    // The header wins over the query parameter so proxies that rewrite
+    // query strings can still be correlated
+    std::string id = request.getHeader("X-Stitch-Id");
+    if (id.empty()) {
+        auto id_it = request.query_params.find("id");
+        if (id_it != request.query_params.end()) {
+            id = id_it->second;
+        }
+    }
+
+    if (!OutcomeRegistry::isValidId(id)) {
+        return;
+    }
+
+    tracking_outcome_ = true;
+    memcpy(outcome_.id, id.c_str(), id.length() + 1);
+    outcome_.behavior = current_command_.behavior;
+    outcome_.accepted_at_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - elapsedUs();
+    outcome_.request_us = elapsedUs();
+    context_->outcomes->store(outcome_);
+}
+
+void ConnectionHandler::finishOutcome() {
+    if (!tracking_outcome_) {
+        return;
+    }
+    tracking_outcome_ = false;
+
+    outcome_.bytes_sent = bytes_sent_;
+    outcome_.close_us = elapsedUs();
+    outcome_.close_reason = close_reason_ == CloseReason::NONE
+        ? CloseReason::SHUTDOWN : close_reason_;
+    context_->outcomes->store(outcome_);
+}
+
+int64_t ConnectionHandler::elapsedUs() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - accepted_at_).count();
+}
+
+void ConnectionHandler::startTimeout(TimeoutCause cause) {
+    if (context_ != nullptr && context_->timeouts != nullptr) {
+        context_->timeouts->start(timeout_, cause, std::chrono::steady_clock::now());
+    }
+}
+
+void ConnectionHandler::stopTimeout() {
+    if (context_ != nullptr && context_->timeouts != nullptr) {
+        context_->timeouts->stop(timeout_);
+    }
+}
+
+void ConnectionHandler::timedOut() {
+    timeout_.expired = false;
+
+    // Nothing was asked yet, so there is nothing to answer
+    if (timeout_.cause == TimeoutCause::IDLE) {
+        state_ = ConnectionState::CLOSING;
+        return;
+    }
+    bool waiting = timeout_.cause == TimeoutCause::HEADER
+        ? state_ == ConnectionState::READING_REQUEST
+        : state_ == ConnectionState::READING_BODY;
+    if (waiting) {
+        rejectRequest(408, "Request Timeout");
+    }
+}
+
+Xoshiro256& ConnectionHandler::random() {
+    return (context_ != nullptr && context_->rng != nullptr) ? *context_->rng : fallback_rng_;
+}
+
+bool ConnectionHandler::idle() const {
+    return state_ == ConnectionState::READING_REQUEST && !tls_ && parser_.getRawData().empty();
+}
+
+bool ConnectionHandler::parked() const {
+    return state_ == ConnectionState::WAITING &&
+           deadline_ == std::chrono::steady_clock::time_point::max() && !tls_ &&
+           upstream_fd_ < 0 && (!body_active_ || request_body_.done()) && !echoing_ &&
+           !relaying_;
+}
+
+void ConnectionHandler::handOver() {
+    close_reason_ = CloseReason::HANDED_OVER;
+    closeConnection();
+}
+
+void ConnectionHandler::park() {
+    stopTimeout();
+    state_ = ConnectionState::WAITING;
+    deadline_ = std::chrono::steady_clock::time_point::max();
+}
+
+static_assert(sizeof(ConnectionHandler) < Admission::CONNECTION_MEMORY,
+              "CONNECTION_MEMORY no longer covers a handler");
+
+size_t ConnectionHandler::memoryUsage() const {
+    size_t bytes = Admission::CONNECTION_MEMORY + parser_.getRawData().capacity() +
+                   echo_prefix_.capacity() + upstream_request_.capacity() +
+                   upstream_prefix_.capacity() + body_pipe_.buffered() + upstream_pipe_.buffered();
+    if (tls_) {
+        bytes += tls_->memoryUsage();
+    }
+    return bytes;
+}
+
+void ConnectionHandler::updateMemory() {
+    if (context_ != nullptr && context_->admission != nullptr) {
+        context_->admission->charge(memory_charged_, memoryUsage());
+    }
 }
 
 void ConnectionHandler::closeConnection() {
-    if (socket_fd_ >= 0) {
+    finishOutcome();
+    finishOverload();
+    releaseConfig();
+    stopTimeout();
+
+    if (upstream_fd_ >= 0) {
+        releaseUpstream();
+    }
+
+    if (tls_) {
+        tls_->close(close_reason_ == CloseReason::RESET,
+                    current_command_.tls_fault != TlsFault::NO_CLOSE_NOTIFY);
+        socket_fd_ = -1;
+        send_fd_ = -1;
+    } else if (socket_fd_ >= 0) {
         ::close(socket_fd_);
         socket_fd_ = -1;
     }
@@ -2,14 +2,32 @@
 #define CONNECTION_HANDLER_H
 
 #include <chrono>
+#include <memory>
 #include "http_parser.h"
 #include "command_interpreter.h"
 #include "response_generator.h"
+#include "response_source.h"
+#include "outcome_registry.h"
+#include "scenario_router.h"
+#include "server_context.h"
+#include "compression.h"
+#include "request_body.h"
+#include "upstream.h"
+#include "behavior_script.h"
+#include "tls.h"
+#include "admission.h"
+#include "timeouts.h"
+#include "overload.h"
+#include "runtime_config.h"
 
 enum class ConnectionState {
+    HANDSHAKING,        // TLS handshake before the request
     READING_REQUEST,
+    READING_BODY,       // Discarding the request body before the behavior
+    PROXYING,           // Forwarding the request to --upstream until its response head
     PROCESSING_COMMAND,
     SENDING_RESPONSE,
+    COMPRESSING,        // Waiting for the worker pool to compress the body
     WAITING,
     CLOSING,
     CLOSED
@@ -17,7 +35,14 @@ enum class ConnectionState {
 
 class ConnectionHandler {
 public:
-    ConnectionHandler(int socket_fd);
+    // Socket tuning for shaped responses (paced, scripted or cut short), so
+    // the kernel holds little beyond what the handler meant to send
+    static constexpr int SHAPED_SNDBUF = 4096;
+    static constexpr int SHAPED_NOTSENT_LOWAT = 4096;
+
+    // With tls, the connection starts with a TLS handshake
+    ConnectionHandler(int socket_fd, ServerContext* context = nullptr,
+                      TlsContext* tls = nullptr);
     ~ConnectionHandler();
 
     void onReadable();
@@ -26,27 +51,164 @@ public:
 
     ConnectionState getState() const;
     bool shouldClose() const;
+
+    // When onTimer() next needs to run; time_point::max() if never
+    std::chrono::steady_clock::time_point getDeadline() const;
     int getFd() const;
     void closeConnection();
 
+    // --upgrade-socket: connections the next process can carry on with.
+    // idle() has not received a byte of its request yet; parked() waits
+    // forever (behavior=timeout, a stall) and will never send again.
+    bool idle() const;
+    bool parked() const;
+
+    // Closes our descriptor without ending the connection, which the
+    // process that took over holds a copy of
+    void handOver();
+
+    // A parked connection handed to us: held open, never answered
+    void park();
+
+    // Bytes the connection holds: Admission::CONNECTION_MEMORY, the request
+    // head, body bytes buffered in memory and in its pipes, TLS buffers
+    size_t memoryUsage() const;
+
+    // Charges --memory-budget for what the connection holds now; the event
+    // loop calls it after each round of events
+    void updateMemory();
+
 private:
     int socket_fd_;
+    int send_fd_;       // socket_fd_, or the TLS session's plaintext sending end
     ConnectionState state_;
+    ServerContext* context_;
 
     HttpParser parser_;
     CommandInterpreter interpreter_;
     ResponseGenerator generator_;
 
     TestCommand current_command_;
-    std::string response_data_;
-    size_t bytes_sent_;
+    const ScenarioRoute* current_route_;
+    std::unique_ptr<ResponseSource> source_;
+    std::shared_ptr<const CompressionCache::Entry> compressed_;
+    uint64_t header_bytes_;
+    uint64_t bytes_sent_;
+
+    // Pending fault and the response offset it fires at
+    ResponseFault fault_;
+    uint64_t fault_at_;
+
+    // slow_headers/slow_body pacing: bytes left in the current time slice
+    uint64_t slice_remaining_;
+
+    // script=: which step of the program the send is at
+    ScriptRunner script_;
 
-    std::chrono::steady_clock::time_point delay_start_;
-    int delay_duration_ms_;
+    // Socket options set for this response; fast responses are corked
+    // until the head and body are written
+    bool tuned_;
+    bool corked_;
 
+    // The request body: read while active, sent back while echoing;
+    // read_rate= pauses reading until read_deadline_ after each slice
+    RequestBody request_body_;
+    BodyPipe body_pipe_;
+    bool body_active_;
+    bool echoing_;
+    std::string echo_prefix_;   // Body bytes that came with the headers
+    uint64_t read_slice_remaining_;
+    bool read_paused_;
+    std::chrono::steady_clock::time_point read_deadline_;
+
+    // --upstream: the request goes out through upstream_request_ and then
+    // the body pipe; the response body comes back through upstream_pipe_
+    int upstream_fd_;
+    bool upstream_reused_;      // Came from the pool's idle connections
+    bool upstream_replayable_;  // upstream_request_ holds the whole request
+    std::string upstream_request_;
+    size_t upstream_request_sent_;
+    uint64_t forward_pending_;  // Request bytes parsed but not yet forwarded
+    UpstreamResponse upstream_response_;
+    RequestBody upstream_body_;
+    BodyPipe upstream_pipe_;
+    std::string upstream_prefix_;   // Body bytes that came with the head
+    bool relaying_;
+
+    std::chrono::steady_clock::time_point deadline_;
+    Xoshiro256 fallback_rng_;
+
+    // Per-request outcome, only tracked when the request carried an id
+    std::chrono::steady_clock::time_point accepted_at_;
+    OutcomeRecord outcome_;
+    bool tracking_outcome_;
+    CloseReason close_reason_;
+
+    // --tls-port: owns the socket, which the handler then reads and sends
+    // plaintext through
+    std::unique_ptr<TlsSession> tls_;
+
+    // What context_->admission was last charged for this connection
+    size_t memory_charged_;
+
+    // Clock on the client while reading: before the request, its head, and
+    // its body (READING_BODY only) in context_->timeouts
+    Timeouts::Entry timeout_;
+
+    // Counted in context_->overload's requests in flight until closed
+    bool overload_admitted_;
+
+    // Generation of the context_->config snapshot this request was resolved
+    // against, pinned until the connection closes; 0 if none
+    uint64_t config_generation_;
+
+    bool driveTls();
     void handleRequest();
+    void beginBody(const HttpRequest& request);
+    uint64_t readBody();
+    void pumpBody();
+    void continueRequest();
+    void continueUpload(const HttpRequest& request);
+    void rejectRequest(int status_code, const std::string& reason);
+    bool shedRequest(const HttpRequest& request);
+    void finishOverload();
+    void releaseConfig();
+    bool proxies() const;
+    void beginProxy();
+    void connectUpstream();
+    void proxy();
+    bool forwardBody();
+    void beginRelay();
+    uint64_t relayBody();
+    void releaseUpstream();
+    void failUpstream();
+    bool awaitCompression();
+    void startBehavior();
+    void prepareResponse();
     void sendResponse();
-    void executeDelayedBehavior();
+    void startResponse(std::unique_ptr<ResponseSource> source, uint64_t header_bytes);
+    ssize_t sendNext(size_t max_bytes);
+    bool applyFault();
+    void abortConnection();
+    bool runScript();
+    size_t lineSpan(size_t max_bytes, uint64_t& lines);
+    uint64_t sendRate() const;
+    bool isPaced() const;
+    bool isShaped() const;
+    void tuneSocket();
+    void setCork(bool cork);
+    uint64_t sliceBytes() const;
+    uint64_t readSliceBytes() const;
+    Xoshiro256& random();
+    void startTimeout(TimeoutCause cause);
+    void stopTimeout();
+    void timedOut();
+
+    void resolveCommand(const HttpRequest& request);
+    bool handleControlRequest(const HttpRequest& request);
+    void beginOutcome(const HttpRequest& request);
+    void finishOutcome();
+    int64_t elapsedUs() const;
 };
 
 #endif // CONNECTION_HANDLER_H
@@ -0,0 +1,172 @@
+#include "corpus.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+// Directory levels below the corpus root that are indexed
+constexpr int MAX_DEPTH = 16;
+
+struct ContentType {
+    const char* extension;
+    const char* type;
+};
+
+const ContentType CONTENT_TYPES[] = {
+    {"json", "application/json"},
+    {"html", "text/html"},
+    {"htm",  "text/html"},
+    {"txt",  "text/plain"},
+    {"css",  "text/css"},
+    {"js",   "application/javascript"},
+    {"xml",  "application/xml"},
+    {"jpg",  "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"png",  "image/png"},
+    {"gif",  "image/gif"},
+    {"webp", "image/webp"},
+    {"svg",  "image/svg+xml"},
+    {"mp4",  "video/mp4"},
+    {"m4s",  "video/iso.segment"},
+    {"ts",   "video/mp2t"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"mpd",  "application/dash+xml"},
+    {"gz",   "application/gzip"},
+};
+
+} // namespace
+
+Corpus::Corpus()
+    : total_bytes_(0) {
+}
+
+Corpus::~Corpus() {
+    closeAll();
+}
+
+bool Corpus::load(const std::string& dir) {
+    closeAll();
+
+    if (!scan(dir, "", 0)) {
+        closeAll();
+        return false;
+    }
+    return true;
+}
+
+const CorpusFile* Corpus::find(const std::string& name) const {
+    auto it = files_.find(name);
+    return it != files_.end() ? &it->second : nullptr;
+}
+
+size_t Corpus::size() const {
+    return files_.size();
+}
+
+uint64_t Corpus::totalBytes() const {
+    return total_bytes_;
+}
+
+const std::string& Corpus::getErrorMessage() const {
+    return error_message_;
+}
+
+const char* Corpus::contentTypeFor(const std::string& name) {
+    size_t dot = name.rfind('.');
+    size_t slash = name.rfind('/');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        const char* extension = name.c_str() + dot + 1;
+        for (const ContentType& entry : CONTENT_TYPES) {
+            if (strcasecmp(extension, entry.extension) == 0) {
+                return entry.type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool Corpus::scan(const std::string& dir, const std::string& prefix, int depth) {
+    DIR* handle = opendir(dir.c_str());
+    if (handle == nullptr) {
+        error_message_ = "Cannot open corpus directory " + dir + ": " + strerror(errno);
+        return false;
+    }
+
+    bool ok = true;
+    while (ok) {
+        errno = 0;
+        struct dirent* entry = readdir(handle);
+        if (entry == nullptr) {
+            if (errno != 0) {
+                error_message_ = "Cannot read corpus directory " + dir + ": " + strerror(errno);
+                ok = false;
+            }
+            break;
+        }
+
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        // O_NONBLOCK so a FIFO in the tree cannot hang startup
+        int fd = openat(dirfd(handle), name.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            error_message_ = "Cannot open corpus file " + dir + "/" + name + ": " + strerror(errno);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            ok = false;
+            break;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            ::close(fd);
+            if (depth < MAX_DEPTH) {
+                ok = scan(dir + "/" + name, prefix + name + "/", depth + 1);
+            }
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            ::close(fd);
+            continue;
+        }
+
+        if (files_.size() >= MAX_FILES) {
+            ::close(fd);
+            error_message_ = "Corpus " + dir + " has more than " +
+                             std::to_string(MAX_FILES) + " files";
+            ok = false;
+            break;
+        }
+
+        // Start pulling the file into the page cache now rather than on
+        // the first request for it
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+        CorpusFile file;
+        file.name = prefix + name;
+        file.fd = fd;
+        file.size = static_cast<uint64_t>(st.st_size);
+        file.content_type = contentTypeFor(name);
+        total_bytes_ += file.size;
+        files_.emplace(file.name, std::move(file));
+    }
+
+    closedir(handle);
+    return ok;
+}
+
+void Corpus::closeAll() {
+    for (auto& entry : files_) {
+        ::close(entry.second.fd);
+    }
+    files_.clear();
+    total_bytes_ = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+// One preopened file of the corpus. The descriptor stays open for the life
+// of the Corpus so requests never open() or stat() anything.
+struct CorpusFile {
+    std::string name;           // Path relative to the corpus directory
+    int fd;
+    uint64_t size;
+    const char* content_type;   // From the file extension
+};
+
+// Captured response bodies served with file=<name>. Everything under the
+// directory is opened and indexed by load(); files that change size
+// afterwards end the connection when they come up short.
+class Corpus {
+public:
+    // Files a corpus may hold, to stay well clear of the descriptor limit
+    static constexpr size_t MAX_FILES = 16384;
+
+    Corpus();
+    ~Corpus();
+
+    Corpus(const Corpus&) = delete;
+    Corpus& operator=(const Corpus&) = delete;
+
+    // Opens every regular file below dir, recursively
+    bool load(const std::string& dir);
+
+    // nullptr if name is not in the corpus
+    const CorpusFile* find(const std::string& name) const;
+
+    size_t size() const;
+    uint64_t totalBytes() const;
+    const std::string& getErrorMessage() const;
+
+    static const char* contentTypeFor(const std::string& name);
+
+private:
+    std::unordered_map<std::string, CorpusFile> files_;
+    uint64_t total_bytes_;
+    std::string error_message_;
+
+    bool scan(const std::string& dir, const std::string& prefix, int depth);
+    void closeAll();
+};
+
+#endif // CORPUS_H
@@ -0,0 +1,471 @@
+#include "handover.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const char* const REQUEST = "TAKEOVER";
+const char* const REQUEST_CONNECTIONS = "TAKEOVER connections";
+const char* const END = "END ";
+const char* const READY = "READY";
+
+// Largest message: a line per descriptor, each with an address
+constexpr size_t MAX_MESSAGE = Handover::MAX_FDS_PER_MESSAGE * 128;
+
+// sockaddr_un for path; @name is in the abstract namespace
+bool unixAddress(const std::string& path, struct sockaddr_un& addr, socklen_t& length) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.length());
+    length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.length() + 1);
+    if (path.front() == '@') {
+        addr.sun_path[0] = '\0';
+        length--;
+    }
+    return true;
+}
+
+void setTimeouts(int fd) {
+    struct timeval timeout;
+    timeout.tv_sec = Handover::TIMEOUT_MS / 1000;
+    timeout.tv_usec = (Handover::TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+pid_t peerPid(int fd) {
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0) {
+        return 0;
+    }
+    return credentials.pid;
+}
+
+void closeAll(const std::vector<Handover::Socket>& sockets) {
+    for (const Handover::Socket& socket : sockets) {
+        ::close(socket.fd);
+    }
+}
+
+} // namespace
+
+Handover::Handover()
+    : listen_fd_(-1)
+    , channel_(-1)
+    , peer_(0)
+    , stage_(Stage::IDLE)
+    , connections_(false) {
+}
+
+Handover::~Handover() {
+    closeChannel();
+    close();
+}
+
+bool Handover::takeOver(const std::string& path, bool connections, std::vector<Socket>& sockets) {
+    sockets.clear();
+    struct sockaddr_un addr;
+    socklen_t length;
+    if (!unixAddress(path, addr, length)) {
+        error_message_ = "Upgrade socket path must be 1 to " +
+                         std::to_string(sizeof(addr.sun_path) - 1) + " bytes: " + path;
+        return false;
+    }
+
+    channel_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (channel_ < 0) {
+        error_message_ = std::string("Cannot create upgrade socket: ") + strerror(errno);
+        return false;
+    }
+    if (connect(channel_, reinterpret_cast<struct sockaddr*>(&addr), length) < 0) {
+        // Nothing to take over: the first stitch on this path
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            closeChannel();
+            return true;
+        }
+        error_message_ = "Cannot connect to " + path + ": " + strerror(errno);
+        closeChannel();
+        return false;
+    }
+    setTimeouts(channel_);
+
+    std::vector<int> fds;
+    if (!sendMessage(connections ? REQUEST_CONNECTIONS : REQUEST, fds)) {
+        closeChannel();
+        return false;
+    }
+
+    // Batches of "<kind> <address>" lines, one per descriptor, then END
+    std::string text;
+    while (receiveMessage(text, fds)) {
+        // The pid comes with END: SO_PEERCRED would name whoever first
+        // listened on the control socket, which may have handed it on since
+        if (text.compare(0, strlen(END), END) == 0 && fds.empty()) {
+            peer_ = static_cast<pid_t>(std::strtol(text.c_str() + strlen(END), nullptr, 10));
+            return true;
+        }
+        size_t line_start = 0;
+        size_t taken = 0;
+        while (line_start < text.length() && taken < fds.size()) {
+            size_t line_end = text.find('\n', line_start);
+            if (line_end == std::string::npos || line_end < line_start + 2) {
+                break;
+            }
+            Socket socket;
+            socket.kind = static_cast<Kind>(text[line_start]);
+            socket.fd = fds[taken++];
+            socket.address = text.substr(line_start + 2, line_end - line_start - 2);
+            sockets.push_back(socket);
+            line_start = line_end + 1;
+        }
+        // Anything unaccounted for means the two processes disagree
+        if (taken != fds.size() || line_start != text.length()) {
+            for (size_t i = taken; i < fds.size(); i++) {
+                ::close(fds[i]);
+            }
+            error_message_ = "Malformed handover message from pid " + std::to_string(peer_);
+            break;
+        }
+    }
+
+    closeAll(sockets);
+    sockets.clear();
+    closeChannel();
+    return false;
+}
+
+pid_t Handover::peer() const {
+    return peer_;
+}
+
+bool Handover::confirm() {
+    if (channel_ < 0) {
+        return true;
+    }
+    bool sent = sendMessage(READY, std::vector<int>());
+    closeChannel();
+    return sent;
+}
+
+bool Handover::serve(const std::string& path, int control_fd) {
+    struct sockaddr_un addr;
+    socklen_t length;
+    if (!unixAddress(path, addr, length)) {
+        error_message_ = "Upgrade socket path must be 1 to " +
+                         std::to_string(sizeof(addr.sun_path) - 1) + " bytes: " + path;
+        return false;
+    }
+
+    if (control_fd < 0) {
+        control_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (control_fd < 0) {
+            error_message_ = std::string("Cannot create upgrade socket: ") + strerror(errno);
+            return false;
+        }
+
+        // A file nobody accepts on is left from a stitch that is gone
+        struct stat status;
+        if (path.front() != '@' && stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+            int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            if (probe >= 0 &&
+                connect(probe, reinterpret_cast<struct sockaddr*>(&addr), length) < 0 &&
+                errno == ECONNREFUSED) {
+                unlink(path.c_str());
+            }
+            if (probe >= 0) {
+                ::close(probe);
+            }
+        }
+        if (::bind(control_fd, reinterpret_cast<struct sockaddr*>(&addr), length) < 0 ||
+            ::listen(control_fd, 4) < 0) {
+            error_message_ = "Cannot listen on upgrade socket " + path + ": " + strerror(errno);
+            ::close(control_fd);
+            return false;
+        }
+    }
+
+    int flags = fcntl(control_fd, F_GETFL, 0);
+    if (flags >= 0) {
+        fcntl(control_fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    fcntl(control_fd, F_SETFD, FD_CLOEXEC);
+    listen_fd_ = control_fd;
+    path_ = path;
+    return true;
+}
+
+int Handover::getFd() const {
+    return listen_fd_;
+}
+
+bool Handover::accept(std::chrono::steady_clock::time_point now) {
+    error_message_.clear();
+    if (listen_fd_ < 0 || stage_ != Stage::IDLE) {
+        return false;
+    }
+    // Non-blocking: a peer that connects and says nothing only holds up
+    // the next upgrade, never the connections being served
+    channel_ = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (channel_ < 0) {
+        return false;
+    }
+    peer_ = peerPid(channel_);
+    stage_ = Stage::REQUEST;
+    connections_ = false;
+    deadline_ = now + std::chrono::milliseconds(TIMEOUT_MS);
+    return true;
+}
+
+Handover::Stage Handover::step(std::chrono::steady_clock::time_point now) {
+    std::string text;
+    std::vector<int> fds;
+    bool pending = false;
+
+    if (stage_ == Stage::REQUEST) {
+        if (receiveMessage(text, fds, &pending)) {
+            if (!fds.empty() || (text != REQUEST && text != REQUEST_CONNECTIONS)) {
+                for (int fd : fds) {
+                    ::close(fd);
+                }
+                error_message_ = "Unexpected upgrade request from pid " + std::to_string(peer_);
+                return fail();
+            }
+            connections_ = text == REQUEST_CONNECTIONS;
+            stage_ = Stage::OFFER;
+        } else if (!pending) {
+            return fail();
+        }
+    }
+
+    if (stage_ == Stage::SENDING) {
+        // SOCK_SEQPACKET sends a message whole or not at all
+        while (!outgoing_.empty() &&
+               sendMessage(outgoing_.front().first, outgoing_.front().second, &pending)) {
+            outgoing_.pop_front();
+        }
+        if (!outgoing_.empty() && !pending) {
+            return fail();
+        }
+        if (outgoing_.empty()) {
+            stage_ = Stage::CONFIRM;
+        }
+    }
+
+    // Until READY we still own everything: the copies we sent are the
+    // new process's to close if it gives up
+    if (stage_ == Stage::CONFIRM) {
+        if (receiveMessage(text, fds, &pending)) {
+            for (int fd : fds) {
+                ::close(fd);
+            }
+            if (text != READY) {
+                error_message_ = "Pid " + std::to_string(peer_) + " did not confirm the takeover";
+                return fail();
+            }
+            closeChannel();
+            stage_ = Stage::IDLE;
+            return Stage::DONE;
+        }
+        if (!pending) {
+            return fail();
+        }
+    }
+
+    if (stage_ != Stage::IDLE && stage_ != Stage::OFFER && now >= deadline_) {
+        error_message_ = "Pid " + std::to_string(peer_) + " did not complete the takeover within " +
+                         std::to_string(TIMEOUT_MS) + " ms";
+        return fail();
+    }
+    return stage_;
+}
+
+bool Handover::wantsConnections() const {
+    return connections_;
+}
+
+bool Handover::handOver(const std::vector<Socket>& sockets) {
+    error_message_.clear();
+    if (stage_ != Stage::OFFER) {
+        error_message_ = "No process is waiting to take over";
+        return false;
+    }
+
+    size_t next = 0;
+    while (next < sockets.size()) {
+        std::string text;
+        std::vector<int> fds;
+        while (next < sockets.size() && fds.size() < MAX_FDS_PER_MESSAGE) {
+            text += static_cast<char>(sockets[next].kind);
+            text += ' ';
+            text += sockets[next].address;
+            text += '\n';
+            fds.push_back(sockets[next].fd);
+            next++;
+        }
+        outgoing_.emplace_back(std::move(text), std::move(fds));
+    }
+    outgoing_.emplace_back(END + std::to_string(getpid()), std::vector<int>());
+    stage_ = Stage::SENDING;
+    return true;
+}
+
+int Handover::getChannelFd() const {
+    return channel_;
+}
+
+void Handover::release() {
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    path_.clear();
+}
+
+void Handover::close() {
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    if (!path_.empty() && path_.front() != '@') {
+        unlink(path_.c_str());
+    }
+    path_.clear();
+}
+
+std::vector<int> Handover::activatedSockets() {
+    // sd_listen_fds(): descriptors start at 3 (SD_LISTEN_FDS_START)
+    std::vector<int> fds;
+    const char* listen_pid = getenv("LISTEN_PID");
+    const char* listen_fds = getenv("LISTEN_FDS");
+    if (listen_pid != nullptr && listen_fds != nullptr &&
+        std::strtol(listen_pid, nullptr, 10) == getpid()) {
+        long count = std::strtol(listen_fds, nullptr, 10);
+        for (long i = 0; i < count; i++) {
+            int fd = 3 + static_cast<int>(i);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fds.push_back(fd);
+        }
+    }
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    return fds;
+}
+
+const std::string& Handover::getErrorMessage() const {
+    return error_message_;
+}
+
+bool Handover::sendMessage(const std::string& text, const std::vector<int>& fds, bool* pending) {
+    struct iovec segment;
+    segment.iov_base = const_cast<char*>(text.data());
+    segment.iov_len = text.length();
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &segment;
+    message.msg_iovlen = 1;
+
+    // cmsghdr-aligned room for the descriptors
+    std::vector<struct cmsghdr> control(
+        (CMSG_SPACE(sizeof(int) * fds.size()) + sizeof(struct cmsghdr) - 1) / sizeof(struct cmsghdr));
+    if (!fds.empty()) {
+        message.msg_control = control.data();
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+    }
+
+    ssize_t sent = sendmsg(channel_, &message, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EAGAIN && pending != nullptr) {
+        *pending = true;
+        return false;
+    }
+    if (sent != static_cast<ssize_t>(text.length())) {
+        error_message_ = std::string("Cannot send on upgrade socket: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool Handover::receiveMessage(std::string& text, std::vector<int>& fds, bool* pending) {
+    fds.clear();
+    text.resize(MAX_MESSAGE);
+    struct iovec segment;
+    segment.iov_base = &text[0];
+    segment.iov_len = text.length();
+
+    std::vector<struct cmsghdr> control(
+        (CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE) + sizeof(struct cmsghdr) - 1) /
+        sizeof(struct cmsghdr));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &segment;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size() * sizeof(struct cmsghdr);
+
+    ssize_t n = recvmsg(channel_, &message, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EAGAIN && pending != nullptr) {
+        *pending = true;
+        text.clear();
+        return false;
+    }
+    if (n <= 0) {
+        error_message_ = n == 0 ? "Upgrade peer closed the connection"
+                                : std::string("Cannot read from upgrade socket: ") + strerror(errno);
+        text.clear();
+        return false;
+    }
+    text.resize(static_cast<size_t>(n));
+
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr;
+         header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            size_t first = fds.size();
+            fds.resize(first + count);
+            memcpy(&fds[first], CMSG_DATA(header), sizeof(int) * count);
+        }
+    }
+    if ((message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+        for (int fd : fds) {
+            ::close(fd);
+        }
+        fds.clear();
+        error_message_ = "Handover message too large";
+        return false;
+    }
+    return true;
+}
+
+Handover::Stage Handover::fail() {
+    if (error_message_.empty()) {
+        error_message_ = "Pid " + std::to_string(peer_) + " did not complete the takeover";
+    }
+    outgoing_.clear();
+    closeChannel();
+    stage_ = Stage::IDLE;
+    return Stage::FAILED;
+}
+
+void Handover::closeChannel() {
+    if (channel_ >= 0) {
+        ::close(channel_);
+        channel_ = -1;
+    }
+}
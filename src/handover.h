@@ -0,0 +1,130 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Zero-downtime restarts. A stitch started with --upgrade-socket <path>
+// serves a control socket there; a new stitch given the same path connects
+// to it and is handed the old one's listening sockets (and, if it asks,
+// its idle and parked connections) over SCM_RIGHTS. The old process keeps
+// accepting until the new one confirms it is ready, so no connection is
+// refused in between, then stops and drains what it still has.
+//
+// Exchange, one SOCK_SEQPACKET message each:
+//   new -> old   "TAKEOVER" or "TAKEOVER connections"
+//   old -> new   "<kind> <address>\n" per descriptor attached, repeated
+//                in batches of up to MAX_FDS_PER_MESSAGE
+//   old -> new   "END <pid>"
+//   new -> old   "READY"
+//
+// The new process has nothing to serve yet and simply waits for each
+// message. The old one is serving: its side never blocks, and moves on a
+// step at a time from the event loop.
+class Handover {
+public:
+    enum class Kind : char {
+        CONTROL = 'C',      // The control socket itself, so the path never goes away
+        LISTENER = 'L',     // A listening socket; address is its ListenAddress
+        IDLE = 'I',         // A connection that has not sent its request yet
+        PARKED = 'P'        // A connection that will never be answered
+    };
+
+    struct Socket {
+        Kind kind;
+        int fd;
+        std::string address;    // LISTENER: the address it listens on
+    };
+
+    // Where the old process's side of an exchange is
+    enum class Stage {
+        IDLE,       // No exchange
+        REQUEST,    // Reading the new process's TAKEOVER
+        OFFER,      // TAKEOVER read: handOver() the sockets
+        SENDING,    // Sending the batches and END
+        CONFIRM,    // Waiting for READY
+        DONE,       // READY read: what was sent is the new process's
+        FAILED      // Given up (getErrorMessage()); nothing was given up
+    };
+
+    static constexpr size_t MAX_FDS_PER_MESSAGE = 250;     // SCM_MAX_FD is 253
+    static constexpr int TIMEOUT_MS = 5000;
+
+    Handover();
+    ~Handover();
+
+    Handover(const Handover&) = delete;
+    Handover& operator=(const Handover&) = delete;
+
+    // New process: takes over from the stitch serving path. True with
+    // sockets empty when nothing serves it (no file, or a stale one).
+    bool takeOver(const std::string& path, bool connections, std::vector<Socket>& sockets);
+    pid_t peer() const;
+
+    // New process, once its listeners are in the event loop: the old one
+    // stops accepting when it reads this
+    bool confirm();
+
+    // Serves path for the next upgrade, on the control socket handed over
+    // (control_fd) or, with -1, on a new one
+    bool serve(const std::string& path, int control_fd = -1);
+    int getFd() const;
+
+    // Old process: starts an exchange with a new process asking to take
+    // over. False if none is waiting or one is already under way, so with
+    // getFd() edge-triggered it is called every round, not only on a
+    // wakeup: one that asked mid-exchange has no other edge to come.
+    // getChannelFd() then belongs in the epoll set.
+    bool accept(std::chrono::steady_clock::time_point now);
+
+    // Moves the exchange on as far as it goes without waiting; called every
+    // round while one is under way. DONE and FAILED are returned once, and
+    // the exchange is over. One that has not finished TIMEOUT_MS after
+    // accept() fails.
+    Stage step(std::chrono::steady_clock::time_point now);
+
+    // At OFFER: whether the new process asked for connections
+    bool wantsConnections() const;
+
+    // At OFFER: queues sockets for the new process; step() sends them and
+    // waits for its confirm(). They must stay open, and connections among
+    // them untouched, until step() returns DONE or FAILED.
+    bool handOver(const std::vector<Socket>& sockets);
+
+    int getChannelFd() const;
+
+    // Stops serving without removing the socket file (the new process
+    // holds the control socket), or closes and removes it
+    void release();
+    void close();
+
+    // systemd socket activation: the LISTEN_FDS descriptors from fd 3 when
+    // LISTEN_PID is this process; the variables are cleared either way so
+    // children do not inherit them
+    static std::vector<int> activatedSockets();
+
+    const std::string& getErrorMessage() const;
+
+private:
+    std::string path_;
+    int listen_fd_;
+    int channel_;           // Connection to the other process mid-exchange
+    pid_t peer_;
+    Stage stage_;
+    bool connections_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::deque<std::pair<std::string, std::vector<int>>> outgoing_;    // Not yet sent
+    std::string error_message_;
+
+    // With pending, a full or empty non-blocking channel sets it instead
+    // of failing
+    bool sendMessage(const std::string& text, const std::vector<int>& fds, bool* pending = nullptr);
+    bool receiveMessage(std::string& text, std::vector<int>& fds, bool* pending = nullptr);
+    Stage fail();
+    void closeChannel();
+};
+
+#endif // HANDOVER_H
@@ -8,36 +8,75 @@ bool HttpRequest::isValid() const {
     return !method.empty() && !path.empty() && !http_version.empty();
 }
 
+std::string HttpRequest::getHeader(const std::string& name) const {
+    for (const auto& header : headers) {
+        if (header.first.length() == name.length() &&
+            std::equal(header.first.begin(), header.first.end(), name.begin(),
+                       [](char a, char b) {
+                           return std::tolower(static_cast<unsigned char>(a)) ==
+                                  std::tolower(static_cast<unsigned char>(b));
+                       })) {
+            return header.second;
+        }
+    }
+    return "";
+}
+
 // HttpParser implementation
 HttpParser::HttpParser()
     : state_(ParseResult::INCOMPLETE)
-    , headers_complete_(false) {
+    , headers_complete_(false)
+    , header_length_(0)
+    , max_header_size_(DEFAULT_MAX_HEADER_SIZE) {
+}
+
+void HttpParser::setMaxHeaderSize(size_t max_bytes) {
+    max_header_size_ = max_bytes;
+}
+
+const std::string& HttpParser::getRawData() const {
+    return buffer_;
+}
+
+size_t HttpParser::getHeaderLength() const {
+    return header_length_;
 }
 
 void HttpParser::reset() {
     request_ = HttpRequest();
-    buffer_.clear();
+    std::string().swap(buffer_);    // Gives back what a large head took
     state_ = ParseResult::INCOMPLETE;
     error_message_.clear();
     headers_complete_ = false;
+    header_length_ = 0;
 }
 
 HttpParser::ParseResult HttpParser::parse(const char* data, size_t length) {
-    if (state_ == ParseResult::COMPLETE || state_ == ParseResult::ERROR) {
+    if (state_ != ParseResult::INCOMPLETE) {
         return state_;
     }
 
-    // Append new data to buffer
+    // Append new data to buffer; what was searched before has no blank
+    // line in it, except perhaps one its last bytes start
+    size_t searched = buffer_.length() < 3 ? 0 : buffer_.length() - 3;
     buffer_.append(data, length);
 
     // Check if we have complete headers (terminated by \r\n\r\n)
-    size_t headers_end = findEndOfHeaders(buffer_);
+    size_t headers_end = findEndOfHeaders(buffer_, searched);
+    size_t header_bytes = headers_end == std::string::npos ? buffer_.length() : headers_end;
+    if (header_bytes > max_header_size_) {
+        error_message_ = "Request headers exceed " + std::to_string(max_header_size_) + " bytes";
+        state_ = ParseResult::TOO_LARGE;
+        return state_;
+    }
     if (headers_end == std::string::npos) {
         // Need more data
         state_ = ParseResult::INCOMPLETE;
         return state_;
     }
 
+    header_length_ = headers_end;
+
     // Extract the headers section
     std::string headers_section = buffer_.substr(0, headers_end);
 
@@ -190,9 +229,9 @@ std::string HttpParser::urlDecode(const std::string& str) {
     return result;
 }
 
-size_t HttpParser::findEndOfHeaders(const std::string& buffer) {
+size_t HttpParser::findEndOfHeaders(const std::string& buffer, size_t from) {
     // Look for \r\n\r\n
-    size_t pos = buffer.find("\r\n\r\n");
+    size_t pos = buffer.find("\r\n\r\n", from);
     if (pos != std::string::npos) {
         return pos + 4;  // Include the \r\n\r\n
     }
@@ -13,6 +13,9 @@ public:
     std::map<std::string, std::string> query_params;
 
     bool isValid() const;
+
+    // Case-insensitive header lookup, returns empty string if absent
+    std::string getHeader(const std::string& name) const;
 };
 
 class HttpParser {
@@ -20,18 +23,32 @@ public:
     enum class ParseResult {
         COMPLETE,       // Request fully parsed
         INCOMPLETE,     // Need more data
-        ERROR           // Parse error
+        ERROR,          // Parse error
+        TOO_LARGE       // Headers longer than the maximum header size
     };
 
+    static constexpr size_t DEFAULT_MAX_HEADER_SIZE = 65536;
+
     HttpParser();
 
+    // Bytes up to and including the blank line after the headers; a
+    // request whose headers do not end within them is TOO_LARGE
+    void setMaxHeaderSize(size_t max_bytes);
+
     // Feed data into parser, returns parse status
     ParseResult parse(const char* data, size_t length);
 
     // Get parsed request (only valid if parse returned COMPLETE)
     const HttpRequest& getRequest() const;
 
-    // Reset parser for next request
+    // Bytes fed to the parser since the last reset
+    const std::string& getRawData() const;
+
+    // Bytes of getRawData() up to and including the blank line after the
+    // headers; what follows is the start of the request body
+    size_t getHeaderLength() const;
+
+    // Reset parser for next request, freeing the buffered data
     void reset();
 
     // Get error message if parse failed
@@ -43,12 +60,14 @@ private:
     ParseResult state_;
     std::string error_message_;
     bool headers_complete_;
+    size_t header_length_;
+    size_t max_header_size_;
 
     bool parseRequestLine(const std::string& line);
     bool parseHeader(const std::string& line);
     void extractQueryParams(const std::string& path);
     std::string urlDecode(const std::string& str);
-    size_t findEndOfHeaders(const std::string& buffer);
+    size_t findEndOfHeaders(const std::string& buffer, size_t from);
 };
 
 #endif // HTTP_PARSER_H
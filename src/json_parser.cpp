@@ -0,0 +1,290 @@
+#include "json_parser.h"
+#include <cstdlib>
+#include <cctype>
+
+JsonValue::JsonValue()
+    : type(Type::NUL)
+    , boolean(false)
+    , number(0.0) {
+}
+
+const JsonValue* JsonValue::get(const std::string& key) const {
+    if (type != Type::OBJECT) {
+        return nullptr;
+    }
+
+    for (const auto& member : object) {
+        if (member.first == key) {
+            return &member.second;
+        }
+    }
+    return nullptr;
+}
+
+std::string JsonValue::toParamString() const {
+    switch (type) {
+        case Type::STRING:
+        case Type::NUMBER:
+            return string;
+        case Type::BOOLEAN:
+            return boolean ? "true" : "false";
+        default:
+            return "";
+    }
+}
+
+JsonParser::JsonParser()
+    : text_(nullptr)
+    , pos_(0) {
+}
+
+bool JsonParser::parse(const std::string& text, JsonValue& out) {
+    text_ = &text;
+    pos_ = 0;
+    error_message_.clear();
+    out = JsonValue();
+
+    if (!parseValue(out, 0)) {
+        return false;
+    }
+
+    skipWhitespace();
+    if (pos_ != text.length()) {
+        return fail("Trailing characters after document");
+    }
+    return true;
+}
+
+const std::string& JsonParser::getErrorMessage() const {
+    return error_message_;
+}
+
+bool JsonParser::parseValue(JsonValue& out, int depth) {
+    if (depth > MAX_DEPTH) {
+        return fail("Document nested too deeply");
+    }
+
+    skipWhitespace();
+    if (pos_ >= text_->length()) {
+        return fail("Unexpected end of input");
+    }
+
+    char c = (*text_)[pos_];
+    switch (c) {
+        case '{':
+            return parseObject(out, depth);
+        case '[':
+            return parseArray(out, depth);
+        case '"':
+            out.type = JsonValue::Type::STRING;
+            return parseString(out.string);
+        case 't':
+            out.type = JsonValue::Type::BOOLEAN;
+            out.boolean = true;
+            return parseLiteral("true");
+        case 'f':
+            out.type = JsonValue::Type::BOOLEAN;
+            out.boolean = false;
+            return parseLiteral("false");
+        case 'n':
+            out.type = JsonValue::Type::NUL;
+            return parseLiteral("null");
+        default:
+            if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+                return parseNumber(out);
+            }
+            return fail(std::string("Unexpected character '") + c + "'");
+    }
+}
+
+bool JsonParser::parseObject(JsonValue& out, int depth) {
+    out.type = JsonValue::Type::OBJECT;
+    ++pos_;  // '{'
+
+    skipWhitespace();
+    if (pos_ < text_->length() && (*text_)[pos_] == '}') {
+        ++pos_;
+        return true;
+    }
+
+    while (true) {
+        skipWhitespace();
+        if (pos_ >= text_->length() || (*text_)[pos_] != '"') {
+            return fail("Expected object key");
+        }
+
+        std::string key;
+        if (!parseString(key)) {
+            return false;
+        }
+
+        skipWhitespace();
+        if (pos_ >= text_->length() || (*text_)[pos_] != ':') {
+            return fail("Expected ':' after object key");
+        }
+        ++pos_;
+
+        out.object.emplace_back(key, JsonValue());
+        if (!parseValue(out.object.back().second, depth + 1)) {
+            return false;
+        }
+
+        skipWhitespace();
+        if (pos_ >= text_->length()) {
+            return fail("Unterminated object");
+        }
+        if ((*text_)[pos_] == ',') {
+            ++pos_;
+            continue;
+        }
+        if ((*text_)[pos_] == '}') {
+            ++pos_;
+            return true;
+        }
+        return fail("Expected ',' or '}' in object");
+    }
+}
+
+bool JsonParser::parseArray(JsonValue& out, int depth) {
+    out.type = JsonValue::Type::ARRAY;
+    ++pos_;  // '['
+
+    skipWhitespace();
+    if (pos_ < text_->length() && (*text_)[pos_] == ']') {
+        ++pos_;
+        return true;
+    }
+
+    while (true) {
+        out.array.emplace_back();
+        if (!parseValue(out.array.back(), depth + 1)) {
+            return false;
+        }
+
+        skipWhitespace();
+        if (pos_ >= text_->length()) {
+            return fail("Unterminated array");
+        }
+        if ((*text_)[pos_] == ',') {
+            ++pos_;
+            continue;
+        }
+        if ((*text_)[pos_] == ']') {
+            ++pos_;
+            return true;
+        }
+        return fail("Expected ',' or ']' in array");
+    }
+}
+
+bool JsonParser::parseString(std::string& out) {
+    ++pos_;  // opening quote
+    out.clear();
+
+    while (pos_ < text_->length()) {
+        char c = (*text_)[pos_++];
+
+        if (c == '"') {
+            return true;
+        }
+
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+
+        if (pos_ >= text_->length()) {
+            break;
+        }
+
+        char escape = (*text_)[pos_++];
+        switch (escape) {
+            case '"':  out += '"';  break;
+            case '\\': out += '\\'; break;
+            case '/':  out += '/';  break;
+            case 'b':  out += '\b'; break;
+            case 'f':  out += '\f'; break;
+            case 'n':  out += '\n'; break;
+            case 'r':  out += '\r'; break;
+            case 't':  out += '\t'; break;
+            case 'u': {
+                if (pos_ + 4 > text_->length()) {
+                    return fail("Truncated \\u escape");
+                }
+                std::string hex = text_->substr(pos_, 4);
+                char* end = nullptr;
+                unsigned long code = std::strtoul(hex.c_str(), &end, 16);
+                if (end != hex.c_str() + 4) {
+                    return fail("Invalid \\u escape");
+                }
+                pos_ += 4;
+
+                // Encode the code unit as UTF-8 (surrogate pairs are not
+                // combined; scenario files are expected to be ASCII)
+                if (code < 0x80) {
+                    out += static_cast<char>(code);
+                } else if (code < 0x800) {
+                    out += static_cast<char>(0xC0 | (code >> 6));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                } else {
+                    out += static_cast<char>(0xE0 | (code >> 12));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                return fail(std::string("Invalid escape '\\") + escape + "'");
+        }
+    }
+
+    return fail("Unterminated string");
+}
+
+bool JsonParser::parseNumber(JsonValue& out) {
+    size_t start = pos_;
+
+    if ((*text_)[pos_] == '-') {
+        ++pos_;
+    }
+    while (pos_ < text_->length()) {
+        char c = (*text_)[pos_];
+        if (std::isdigit(static_cast<unsigned char>(c)) || c == '.' ||
+            c == 'e' || c == 'E' || c == '+' || c == '-') {
+            ++pos_;
+        } else {
+            break;
+        }
+    }
+
+    out.type = JsonValue::Type::NUMBER;
+    out.string = text_->substr(start, pos_ - start);
+
+    char* end = nullptr;
+    out.number = std::strtod(out.string.c_str(), &end);
+    if (out.string.empty() || end != out.string.c_str() + out.string.length()) {
+        return fail("Invalid number '" + out.string + "'");
+    }
+    return true;
+}
+
+bool JsonParser::parseLiteral(const char* literal) {
+    std::string expected(literal);
+    if (text_->compare(pos_, expected.length(), expected) != 0) {
+        return fail("Invalid literal");
+    }
+    pos_ += expected.length();
+    return true;
+}
+
+void JsonParser::skipWhitespace() {
+    while (pos_ < text_->length() &&
+           std::isspace(static_cast<unsigned char>((*text_)[pos_]))) {
+        ++pos_;
+    }
+}
+
+bool JsonParser::fail(const std::string& message) {
+    error_message_ = message + " at offset " + std::to_string(pos_);
+    return false;
+}
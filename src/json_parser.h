@@ -0,0 +1,69 @@
+#ifndef JSON_PARSER_H
+#define JSON_PARSER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+class JsonValue {
+public:
+    enum class Type {
+        NUL,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    Type type;
+    bool boolean;
+    double number;
+    // String contents, or the literal token text for numbers so that
+    // values like "503" round-trip into query-style parameters unchanged
+    std::string string;
+    std::vector<JsonValue> array;
+    // Object members in document order
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    JsonValue();
+
+    // Object member lookup, returns nullptr if absent or not an object
+    const JsonValue* get(const std::string& key) const;
+
+    bool isString() const { return type == Type::STRING; }
+    bool isNumber() const { return type == Type::NUMBER; }
+    bool isObject() const { return type == Type::OBJECT; }
+    bool isArray() const { return type == Type::ARRAY; }
+
+    // Scalar rendered the way it would appear in a query string
+    std::string toParamString() const;
+};
+
+class JsonParser {
+public:
+    JsonParser();
+
+    // Parse a complete document, returns false on syntax error
+    bool parse(const std::string& text, JsonValue& out);
+
+    const std::string& getErrorMessage() const;
+
+private:
+    const std::string* text_;
+    size_t pos_;
+    std::string error_message_;
+
+    bool parseValue(JsonValue& out, int depth);
+    bool parseObject(JsonValue& out, int depth);
+    bool parseArray(JsonValue& out, int depth);
+    bool parseString(std::string& out);
+    bool parseNumber(JsonValue& out);
+    bool parseLiteral(const char* literal);
+    void skipWhitespace();
+    bool fail(const std::string& message);
+
+    static constexpr int MAX_DEPTH = 64;
+};
+
+#endif // JSON_PARSER_H
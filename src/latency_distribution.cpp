@@ -0,0 +1,332 @@
+#include "latency_distribution.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+// Names of every parameter that affects a distribution, in key order
+const char* const DISTRIBUTION_PARAMS[] = {
+    "dist", "min", "max", "mean", "stddev", "median", "sigma", "scale", "shape", "hist"
+};
+
+bool getDouble(const std::map<std::string, std::string>& params, const std::string& name,
+               double& out) {
+    auto it = params.find(name);
+    if (it == params.end() || it->second.empty()) {
+        return false;
+    }
+
+    char* end = nullptr;
+    double value = std::strtod(it->second.c_str(), &end);
+    if (end != it->second.c_str() + it->second.length() || !std::isfinite(value)) {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
+// Inverse of the standard normal CDF (Acklam's rational approximation,
+// relative error below 1.2e-9)
+double inverseNormalCdf(double p) {
+    static const double a[] = {
+        -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+        1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00
+    };
+    static const double b[] = {
+        -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+        6.680131188771972e+01, -1.328068155288572e+01
+    };
+    static const double c[] = {
+        -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+        -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00
+    };
+    static const double d[] = {
+        7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+        3.754408661907416e+00
+    };
+    const double p_low = 0.02425;
+
+    if (p <= 0.0) {
+        return -std::numeric_limits<double>::infinity();
+    }
+    if (p >= 1.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    if (p < p_low) {
+        double q = std::sqrt(-2.0 * std::log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+               ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    }
+
+    if (p <= 1.0 - p_low) {
+        double q = p - 0.5;
+        double r = q * q;
+        return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+               (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+    }
+
+    double q = std::sqrt(-2.0 * std::log(1.0 - p));
+    return -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+           ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+}
+
+} // namespace
+
+LatencyDistribution::LatencyDistribution() {
+}
+
+std::shared_ptr<const LatencyDistribution> LatencyDistribution::create(
+    const std::map<std::string, std::string>& params,
+    const std::map<std::string, std::vector<std::pair<double, double>>>* histograms,
+    std::string& error) {
+    auto dist_it = params.find("dist");
+    if (dist_it == params.end()) {
+        error = "Missing dist parameter";
+        return nullptr;
+    }
+    const std::string& dist = dist_it->second;
+
+    double min_ms = 0.0;
+    double max_ms = std::numeric_limits<double>::infinity();
+    getDouble(params, "min", min_ms);
+    getDouble(params, "max", max_ms);
+    min_ms = std::max(min_ms, 0.0);
+
+    // Quantile function in milliseconds
+    std::function<double(double)> quantile;
+
+    if (dist == "uniform") {
+        if (!std::isfinite(max_ms) || max_ms < min_ms) {
+            error = "uniform needs max >= min";
+            return nullptr;
+        }
+        double low = min_ms;
+        double span = max_ms - min_ms;
+        quantile = [low, span](double p) { return low + p * span; };
+    } else if (dist == "normal") {
+        double mean = 0.0;
+        double stddev = 0.0;
+        if (!getDouble(params, "mean", mean) || !getDouble(params, "stddev", stddev) ||
+            stddev < 0.0) {
+            error = "normal needs mean and stddev >= 0";
+            return nullptr;
+        }
+        quantile = [mean, stddev](double p) { return mean + stddev * inverseNormalCdf(p); };
+    } else if (dist == "lognormal") {
+        double median = 0.0;
+        double sigma = 0.0;
+        if (!getDouble(params, "median", median) || !getDouble(params, "sigma", sigma) ||
+            median <= 0.0 || sigma < 0.0) {
+            error = "lognormal needs median > 0 and sigma >= 0";
+            return nullptr;
+        }
+        double mu = std::log(median);
+        quantile = [mu, sigma](double p) { return std::exp(mu + sigma * inverseNormalCdf(p)); };
+    } else if (dist == "pareto") {
+        double scale = 0.0;
+        double shape = 0.0;
+        if (!getDouble(params, "scale", scale) || !getDouble(params, "shape", shape) ||
+            scale <= 0.0 || shape <= 0.0) {
+            error = "pareto needs scale > 0 and shape > 0";
+            return nullptr;
+        }
+        quantile = [scale, shape](double p) { return scale / std::pow(1.0 - p, 1.0 / shape); };
+    } else if (dist == "empirical") {
+        auto hist_it = params.find("hist");
+        if (hist_it == params.end() || histograms == nullptr ||
+            histograms->find(hist_it->second) == histograms->end()) {
+            error = "empirical needs hist=<name> of a loaded histogram";
+            return nullptr;
+        }
+        const auto& buckets = histograms->at(hist_it->second);
+
+        // Cumulative weights at each bucket's upper edge
+        std::vector<double> cumulative;
+        double total = 0.0;
+        for (const auto& bucket : buckets) {
+            total += bucket.second;
+            cumulative.push_back(total);
+        }
+        if (total <= 0.0) {
+            error = "histogram has no samples";
+            return nullptr;
+        }
+
+        quantile = [buckets, cumulative, total](double p) {
+            double target = p * total;
+            size_t i = static_cast<size_t>(
+                std::lower_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin());
+            if (i >= buckets.size()) {
+                i = buckets.size() - 1;
+            }
+            double lower_edge = (i == 0) ? 0.0 : buckets[i - 1].first;
+            double lower_weight = (i == 0) ? 0.0 : cumulative[i - 1];
+            double width = cumulative[i] - lower_weight;
+            double frac = width > 0.0 ? (target - lower_weight) / width : 1.0;
+            return lower_edge + frac * (buckets[i].first - lower_edge);
+        };
+    } else {
+        error = "Unknown dist '" + dist + "'";
+        return nullptr;
+    }
+
+    std::shared_ptr<LatencyDistribution> result(new LatencyDistribution());
+
+    auto tabulate = [&](double p) {
+        double ms = std::min(std::max(quantile(p), min_ms), max_ms);
+        return ms * 1000.0;
+    };
+
+    result->body_.resize(BODY_CELLS + 1);
+    for (size_t i = 0; i <= BODY_CELLS; ++i) {
+        result->body_[i] = tabulate(TAIL_START * static_cast<double>(i) / BODY_CELLS);
+    }
+
+    result->tail_.resize(TAIL_CELLS + 1);
+    for (size_t i = 0; i <= TAIL_CELLS; ++i) {
+        double p = TAIL_START + (1.0 - TAIL_START) * static_cast<double>(i) / TAIL_CELLS;
+        result->tail_[i] = tabulate(std::min(p, TAIL_END));
+    }
+
+    result->description_ = LatencyDistributionCache::makeKey(params);
+    return result;
+}
+
+bool LatencyDistribution::loadHistogram(const std::string& path,
+                                        std::vector<std::pair<double, double>>& buckets,
+                                        std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "Cannot open histogram file: " + path;
+        return false;
+    }
+
+    buckets.clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        double upper = 0.0;
+        double count = 0.0;
+        if (!(fields >> upper >> count) || upper < 0.0 || count < 0.0 ||
+            (!buckets.empty() && upper < buckets.back().first)) {
+            error = path + ":" + std::to_string(line_number) +
+                    ": expected ascending \"<upper_bound_ms> <count>\"";
+            return false;
+        }
+        buckets.emplace_back(upper, count);
+    }
+
+    if (buckets.empty()) {
+        error = "Histogram file has no buckets: " + path;
+        return false;
+    }
+    return true;
+}
+
+int64_t LatencyDistribution::sampleUs(Xoshiro256& rng) const {
+    return static_cast<int64_t>(std::llround(quantileUs(rng.nextDouble())));
+}
+
+double LatencyDistribution::quantileUs(double p) const {
+    p = std::min(std::max(p, 0.0), 1.0);
+
+    const std::vector<double>* table = &body_;
+    double x = 0.0;
+    if (p < TAIL_START) {
+        x = p / TAIL_START * BODY_CELLS;
+    } else {
+        table = &tail_;
+        x = (p - TAIL_START) / (1.0 - TAIL_START) * TAIL_CELLS;
+    }
+
+    size_t cells = table->size() - 1;
+    size_t i = std::min(static_cast<size_t>(x), cells - 1);
+    double frac = std::min(x - static_cast<double>(i), 1.0);
+    return (*table)[i] + ((*table)[i + 1] - (*table)[i]) * frac;
+}
+
+const std::string& LatencyDistribution::describe() const {
+    return description_;
+}
+
+LatencyDistributionCache::LatencyDistributionCache() {
+}
+
+bool LatencyDistributionCache::addHistogram(const std::string& name, const std::string& path) {
+    std::vector<std::pair<double, double>> buckets;
+    if (!LatencyDistribution::loadHistogram(path, buckets, error_message_)) {
+        return false;
+    }
+    histograms_[name] = buckets;
+    return true;
+}
+
+void LatencyDistributionCache::addHistograms(const LatencyDistributionCache& other) {
+    for (const auto& entry : other.histograms_) {
+        histograms_[entry.first] = entry.second;
+    }
+}
+
+std::shared_ptr<const LatencyDistribution> LatencyDistributionCache::get(
+    const std::map<std::string, std::string>& params, std::string& error) {
+    std::string key = makeKey(params);
+
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+        return it->second;
+    }
+
+    std::shared_ptr<const LatencyDistribution> dist =
+        LatencyDistribution::create(params, &histograms_, error);
+    if (!dist) {
+        return nullptr;
+    }
+
+    // Clients can send arbitrarily many parameter combinations; start over
+    // rather than grow without bound (running requests keep their tables)
+    if (cache_.size() >= MAX_ENTRIES) {
+        cache_.clear();
+    }
+    cache_[key] = dist;
+    return dist;
+}
+
+size_t LatencyDistributionCache::size() const {
+    return cache_.size();
+}
+
+const std::string& LatencyDistributionCache::getErrorMessage() const {
+    return error_message_;
+}
+
+std::string LatencyDistributionCache::makeKey(const std::map<std::string, std::string>& params) {
+    std::string key;
+    for (const char* name : DISTRIBUTION_PARAMS) {
+        auto it = params.find(name);
+        if (it != params.end()) {
+            if (!key.empty()) {
+                key += ' ';
+            }
+            key += name;
+            key += '=';
+            key += it->second;
+        }
+    }
+    return key;
+}
@@ -0,0 +1,91 @@
+#ifndef LATENCY_DISTRIBUTION_H
+#define LATENCY_DISTRIBUTION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include "prng.h"
+
+// Delay distribution sampled through a precomputed inverse-CDF table.
+//
+// The table has two parts: BODY_CELLS cells covering probabilities
+// [0, TAIL_START) and TAIL_CELLS cells covering [TAIL_START, TAIL_END], so
+// p99/p999/p9999 latencies get as much resolution as the median. A draw
+// picks a cell and interpolates linearly inside it, which is O(1) for
+// every distribution type, including empirical histograms.
+//
+// Parameters (milliseconds, fractions allowed):
+//   dist=uniform    min, max
+//   dist=normal     mean, stddev
+//   dist=lognormal  median, sigma
+//   dist=pareto     scale, shape
+//   dist=empirical  hist (name registered with addHistogram)
+// min/max also clamp every other distribution.
+class LatencyDistribution {
+public:
+    static constexpr size_t BODY_CELLS = 4096;
+    static constexpr size_t TAIL_CELLS = 1024;
+    static constexpr double TAIL_START = 0.99;
+    static constexpr double TAIL_END = 0.999999;
+
+    // Build from query-style parameters; returns nullptr and sets error
+    // if the parameters are unusable. Empirical distributions look up
+    // their histogram in histograms (may be null).
+    static std::shared_ptr<const LatencyDistribution> create(
+        const std::map<std::string, std::string>& params,
+        const std::map<std::string, std::vector<std::pair<double, double>>>* histograms,
+        std::string& error);
+
+    // Histogram file: one "<upper_bound_ms> <count>" bucket per line,
+    // ascending bounds, '#' comments; the first bucket starts at 0
+    static bool loadHistogram(const std::string& path,
+                              std::vector<std::pair<double, double>>& buckets,
+                              std::string& error);
+
+    int64_t sampleUs(Xoshiro256& rng) const;
+
+    // Value of the inverse CDF at p, in microseconds (table lookup)
+    double quantileUs(double p) const;
+
+    const std::string& describe() const;
+
+private:
+    std::vector<double> body_;  // BODY_CELLS + 1 quantiles, microseconds
+    std::vector<double> tail_;  // TAIL_CELLS + 1 quantiles, microseconds
+    std::string description_;
+
+    LatencyDistribution();
+};
+
+// Distributions keyed by their parameters so each table is built once,
+// plus the named empirical histograms loaded at startup.
+class LatencyDistributionCache {
+public:
+    static constexpr size_t MAX_ENTRIES = 256;
+
+    LatencyDistributionCache();
+
+    bool addHistogram(const std::string& name, const std::string& path);
+    // Takes every histogram other has loaded, so a second cache (the admin
+    // thread's) resolves the same dist=empirical names
+    void addHistograms(const LatencyDistributionCache& other);
+
+    // Returns nullptr (and sets error) for invalid parameters
+    std::shared_ptr<const LatencyDistribution> get(
+        const std::map<std::string, std::string>& params, std::string& error);
+
+    size_t size() const;
+    const std::string& getErrorMessage() const;
+
+    // Canonical cache key for the distribution parameters in params
+    static std::string makeKey(const std::map<std::string, std::string>& params);
+
+private:
+    std::map<std::string, std::vector<std::pair<double, double>>> histograms_;
+    std::map<std::string, std::shared_ptr<const LatencyDistribution>> cache_;
+    std::string error_message_;
+};
+
+#endif // LATENCY_DISTRIBUTION_H
@@ -1,11 +1,34 @@
 #include <iostream>
 #include <map>
+#include <unordered_set>
 #include <vector>
 #include <csignal>
 #include <cstring>
 #include <memory>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
 #include "socket_manager.h"
 #include "connection_handler.h"
+#include "outcome_registry.h"
+#include "scenario_router.h"
+#include "chaos_mix.h"
+#include "prng.h"
+#include "latency_distribution.h"
+#include "traffic_log.h"
+#include "corpus.h"
+#include "compression.h"
+#include "upstream.h"
+#include "tls.h"
+#include "handover.h"
+#include "admission.h"
+#include "timeouts.h"
+#include "overload.h"
+#include "runtime_config.h"
+#include "admin.h"
+#include "server_context.h"
 
 // Global flag for graceful shutdown
 static volatile bool running = true;
@@ -17,12 +40,108 @@ void signalHandler(int signal) {
     }
 }
 
+// One listening socket and what its connections get
+struct Listener {
+    ListenAddress address;
+    std::string scenario_file;      // Replaces --scenario on this listener
+    bool tls = false;
+    std::unique_ptr<ScenarioRouter> router;
+    int fd = -1;                    // Inherited socket, adopted instead of bound
+    bool own_path = true;           // Remove its socket file at shutdown
+};
+
+// --listen <address>[,scenario=<file>][,tls]
+bool parseListener(const std::string& spec, Listener& listener, std::string& error) {
+    size_t comma = spec.find(',');
+    if (!ListenAddress::parse(spec.substr(0, comma), listener.address, error)) {
+        return false;
+    }
+    while (comma != std::string::npos) {
+        size_t next = spec.find(',', comma + 1);
+        std::string option = spec.substr(comma + 1, next == std::string::npos
+                                                        ? std::string::npos : next - comma - 1);
+        if (option == "tls") {
+            listener.tls = true;
+        } else if (option.compare(0, 9, "scenario=") == 0 && option.length() > 9) {
+            listener.scenario_file = option.substr(9);
+        } else {
+            error = "Unknown listener option: " + option;
+            return false;
+        }
+        comma = next;
+    }
+    return true;
+}
+
 void printUsage(const char* prog_name) {
     std::cout << "Usage: " << prog_name << " [options]\n"
               << "Options:\n"
               << "  -p, --port <port>     Port to listen on (default: 8080)\n"
               << "  -h, --host <host>     Host to bind to (default: 0.0.0.0)\n"
+              << "  --listen <address>[,scenario=<file>][,tls]\n"
+              << "                        Listen on host:port, [host]:port or\n"
+              << "                        unix:<path> instead of --host/--port;\n"
+              << "                        repeat for more listeners\n"
+              << "  --backlog <n>         Accept queue length per listener (default: 511)\n"
+              << "  --accept-batch <n>    Connections accepted per listener per wakeup\n"
+              << "                        (default: 64)\n"
+              << "  --defer-accept <s>    TCP_DEFER_ACCEPT: hand over TCP connections\n"
+              << "                        once they have data, or after s seconds\n"
+              << "  --fastopen <n>        Enable TCP Fast Open with n pending requests\n"
+              << "  --max-connections <n> Stop accepting while n connections are open\n"
+              << "                        (default: 0, no limit)\n"
+              << "  --memory-budget <bytes>\n"
+              << "                        Stop accepting while connections hold this\n"
+              << "                        much memory (default: 0, no limit)\n"
+              << "  --max-header-size <bytes>\n"
+              << "                        Answer longer request heads with 431\n"
+              << "                        (default: 65536)\n"
+              << "  --idle-timeout <s>    Close connections that send no request for\n"
+              << "                        s seconds (default: 60, 0 disables)\n"
+              << "  --header-timeout <s>  Answer 408 to request heads not complete s\n"
+              << "                        seconds after their first byte (default: 60)\n"
+              << "  --body-timeout <s>    Answer 408 when a request body being read\n"
+              << "                        stops for s seconds (default: 60)\n"
+              << "  --overload <spec>     Shed load past limits, e.g.\n"
+              << "                        \"inflight=100,rate=500,action=reject\"\n"
               << "  -v, --verbose         Enable verbose logging\n"
+              << "  --outcomes <n>        Request outcome slots for X-Stitch-Id lookups\n"
+              << "                        (default: 65536, 0 disables)\n"
+              << "  --scenario <file>     Route path prefixes to behaviors from a JSON file\n"
+              << "  --chaos <spec>        Weighted behavior mix for plain requests,\n"
+              << "                        e.g. \"normal:90,close_partial=10:5,error=503:5\"\n"
+              << "  --seed <n>            Seed for chaos selection (default: random)\n"
+              << "  --latency-histogram <name>=<file>\n"
+              << "                        Load an empirical delay histogram for\n"
+              << "                        behavior=slow&dist=empirical&hist=<name>\n"
+              << "  --record <file>       Log every request and the command it got\n"
+              << "  --replay <file>       Answer requests with the commands from a\n"
+              << "                        --record log, in order\n"
+              << "  --corpus <dir>        Preopen the files below dir for file=<name>\n"
+              << "  --compress-threads <n>\n"
+              << "                        Worker threads compressing encoding= bodies\n"
+              << "                        (default: 2)\n"
+              << "  --compress-cache <bytes>\n"
+              << "                        Memory for compressed bodies; larger bodies\n"
+              << "                        are sent uncompressed (default: 268435456)\n"
+              << "  --upstream <host:port>\n"
+              << "                        Relay responses from this backend, with\n"
+              << "                        behaviors applied to them\n"
+              << "  --tls-port <port>     Also listen for HTTPS on this port\n"
+              << "  --tls-cert <file>     PEM certificate chain for --tls-port\n"
+              << "  --tls-key <file>      PEM private key for --tls-port\n"
+              << "  --tls-session-cache <n>\n"
+              << "                        TLS sessions kept for resumption\n"
+              << "                        (default: 20480, 0 disables)\n"
+              << "  --no-tls-tickets      Resume TLS sessions from the cache only\n"
+              << "  --upgrade-socket <path>\n"
+              << "                        Take over the listeners of the stitch serving\n"
+              << "                        path, if any, and serve it for the next one\n"
+              << "  --upgrade-connections Also take over its idle and parked connections\n"
+              << "  --drain-timeout <s>   After handing over, serve what is left for up\n"
+              << "                        to s seconds (default: 60)\n"
+              << "  --admin <address>     Accept new default behavior, chaos mix and\n"
+              << "                        scenario at runtime on host:port or unix:<path>\n"
               << "  --help                Show this help message\n";
 }
 
@@ -30,6 +149,40 @@ int main(int argc, char* argv[]) {
     std::string host = "0.0.0.0";
     int port = 8080;
     bool verbose = false;
+    size_t outcome_capacity = 65536;
+    std::string scenario_file;
+    std::string chaos_spec;
+    std::string overload_spec;
+    LatencyDistributionCache distributions;
+    std::string record_file;
+    std::string replay_file;
+    std::string corpus_dir;
+    size_t compress_threads = CompressionCache::DEFAULT_THREADS;
+    uint64_t compress_cache = CompressionCache::DEFAULT_CAPACITY;
+    std::string upstream_address;
+    int tls_port = 0;
+    std::string tls_cert;
+    std::string tls_key;
+    size_t tls_session_cache = TlsContext::DEFAULT_SESSION_CACHE;
+    bool tls_tickets = true;
+    std::vector<Listener> listeners;
+    int backlog = SocketManager::DEFAULT_BACKLOG;
+    size_t accept_batch = SocketManager::DEFAULT_ACCEPT_BATCH;
+    int defer_accept = 0;
+    int fast_open = 0;
+    size_t max_connections = 0;
+    size_t memory_budget = 0;
+    size_t max_header_size = HttpParser::DEFAULT_MAX_HEADER_SIZE;
+    int idle_timeout = 60;
+    int header_timeout = 60;
+    int body_timeout = 60;
+    std::string upgrade_socket;
+    std::string admin_spec;
+    ListenAddress admin_address;
+    bool upgrade_connections = false;
+    int drain_timeout = 60;
+    uint64_t seed = static_cast<uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
 
     // Parse command-line arguments
     for (int i = 1; i < argc; i++) {
@@ -49,8 +202,246 @@ int main(int argc, char* argv[]) {
                 std::cerr << "Error: " << arg << " requires an argument\n";
                 return 1;
             }
+        } else if (arg == "--listen") {
+            if (i + 1 < argc) {
+                Listener listener;
+                std::string error;
+                if (!parseListener(argv[++i], listener, error)) {
+                    std::cerr << "Error: " << error << "\n";
+                    return 1;
+                }
+                listeners.push_back(std::move(listener));
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--backlog") {
+            if (i + 1 < argc) {
+                backlog = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--accept-batch") {
+            if (i + 1 < argc) {
+                accept_batch = static_cast<size_t>(std::atol(argv[++i]));
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--defer-accept") {
+            if (i + 1 < argc) {
+                defer_accept = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--fastopen") {
+            if (i + 1 < argc) {
+                fast_open = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--max-connections") {
+            if (i + 1 < argc) {
+                max_connections = static_cast<size_t>(std::atol(argv[++i]));
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--memory-budget") {
+            if (i + 1 < argc) {
+                memory_budget = std::strtoull(argv[++i], nullptr, 10);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--max-header-size") {
+            if (i + 1 < argc) {
+                max_header_size = std::strtoull(argv[++i], nullptr, 10);
+                if (max_header_size == 0) {
+                    std::cerr << "Error: " << arg << " must be at least 1\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--idle-timeout") {
+            if (i + 1 < argc) {
+                idle_timeout = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--header-timeout") {
+            if (i + 1 < argc) {
+                header_timeout = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--body-timeout") {
+            if (i + 1 < argc) {
+                body_timeout = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--overload") {
+            if (i + 1 < argc) {
+                overload_spec = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
         } else if (arg == "-v" || arg == "--verbose") {
             verbose = true;
+        } else if (arg == "--outcomes") {
+            if (i + 1 < argc) {
+                outcome_capacity = static_cast<size_t>(std::atol(argv[++i]));
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--scenario") {
+            if (i + 1 < argc) {
+                scenario_file = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--chaos") {
+            if (i + 1 < argc) {
+                chaos_spec = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--seed") {
+            if (i + 1 < argc) {
+                seed = std::strtoull(argv[++i], nullptr, 10);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--latency-histogram") {
+            if (i + 1 < argc) {
+                std::string spec = argv[++i];
+                size_t equals = spec.find('=');
+                if (equals == std::string::npos || equals == 0) {
+                    std::cerr << "Error: " << arg << " expects <name>=<file>\n";
+                    return 1;
+                }
+                if (!distributions.addHistogram(spec.substr(0, equals), spec.substr(equals + 1))) {
+                    std::cerr << distributions.getErrorMessage() << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--record") {
+            if (i + 1 < argc) {
+                record_file = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--replay") {
+            if (i + 1 < argc) {
+                replay_file = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--corpus") {
+            if (i + 1 < argc) {
+                corpus_dir = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--compress-threads") {
+            if (i + 1 < argc) {
+                compress_threads = static_cast<size_t>(std::atol(argv[++i]));
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--compress-cache") {
+            if (i + 1 < argc) {
+                compress_cache = std::strtoull(argv[++i], nullptr, 10);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--upstream") {
+            if (i + 1 < argc) {
+                upstream_address = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--tls-port") {
+            if (i + 1 < argc) {
+                tls_port = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--tls-cert") {
+            if (i + 1 < argc) {
+                tls_cert = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--tls-key") {
+            if (i + 1 < argc) {
+                tls_key = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--tls-session-cache") {
+            if (i + 1 < argc) {
+                tls_session_cache = static_cast<size_t>(std::atol(argv[++i]));
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--no-tls-tickets") {
+            tls_tickets = false;
+        } else if (arg == "--upgrade-socket") {
+            if (i + 1 < argc) {
+                upgrade_socket = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--admin") {
+            if (i + 1 < argc) {
+                admin_spec = argv[++i];
+                std::string error;
+                if (!ListenAddress::parse(admin_spec, admin_address, error)) {
+                    std::cerr << "Error: " << arg << ": " << error << "\n";
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
+        } else if (arg == "--upgrade-connections") {
+            upgrade_connections = true;
+        } else if (arg == "--drain-timeout") {
+            if (i + 1 < argc) {
+                drain_timeout = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: " << arg << " requires an argument\n";
+                return 1;
+            }
         } else if (arg == "--help") {
             printUsage(argv[0]);
             return 0;
@@ -61,43 +452,435 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // systemd socket activation: each socket is a listener, with the options
+    // of the --listen that names its address, if one does
+    for (int fd : Handover::activatedSockets()) {
+        Listener inherited;
+        std::string error;
+        if (!ListenAddress::fromSocket(fd, inherited.address, error)) {
+            std::cerr << "Error: " << error << "\n";
+            return 1;
+        }
+        auto match = std::find_if(listeners.begin(), listeners.end(),
+                                  [&inherited](const Listener& listener) {
+                                      return listener.fd < 0 && listener.address == inherited.address;
+                                  });
+        if (match == listeners.end()) {
+            listeners.push_back(std::move(inherited));
+            match = listeners.end() - 1;
+        }
+        match->fd = fd;
+        match->own_path = false;        // systemd's socket file
+    }
+
+    // Without --listen, --host and --port make the one plain listener;
+    // --tls-port adds a TLS listener on the same host
+    auto hostListener = [&host](int listener_port, bool listener_tls) {
+        Listener listener;
+        listener.address.family = host.find(':') != std::string::npos ? AF_INET6 : AF_INET;
+        listener.address.host = host;
+        listener.address.port = listener_port;
+        listener.tls = listener_tls;
+        return listener;
+    };
+    if (listeners.empty()) {
+        listeners.push_back(hostListener(port, false));
+    }
+    if (tls_port > 0) {
+        listeners.push_back(hostListener(tls_port, true));
+    }
+
+    // Compile the scenarios before binding so a bad file fails fast; they
+    // share the distributions and scripts of the requests
+    ScriptCache scripts;
+    std::unique_ptr<ScenarioRouter> router;
+    if (!scenario_file.empty()) {
+        router = std::make_unique<ScenarioRouter>();
+        if (!router->loadFile(scenario_file, &distributions, &scripts)) {
+            std::cerr << router->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+    for (Listener& listener : listeners) {
+        if (!listener.scenario_file.empty()) {
+            listener.router = std::make_unique<ScenarioRouter>();
+            if (!listener.router->loadFile(listener.scenario_file, &distributions, &scripts)) {
+                std::cerr << listener.router->getErrorMessage() << "\n";
+                return 1;
+            }
+        }
+    }
+
+    std::unique_ptr<ChaosMix> chaos;
+    if (!chaos_spec.empty()) {
+        chaos = std::make_unique<ChaosMix>();
+        if (!chaos->parse(chaos_spec, &distributions, &scripts)) {
+            std::cerr << chaos->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Overload> overload;
+    if (!overload_spec.empty()) {
+        overload = std::make_unique<Overload>();
+        if (!overload->parse(overload_spec)) {
+            std::cerr << overload->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<TrafficReplayer> replay;
+    if (!replay_file.empty()) {
+        replay = std::make_unique<TrafficReplayer>();
+        if (!replay->open(replay_file)) {
+            std::cerr << replay->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Corpus> corpus;
+    if (!corpus_dir.empty()) {
+        corpus = std::make_unique<Corpus>();
+        if (!corpus->load(corpus_dir)) {
+            std::cerr << corpus->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<TrafficRecorder> recorder;
+    if (!record_file.empty()) {
+        recorder = std::make_unique<TrafficRecorder>();
+        if (!recorder->open(record_file)) {
+            std::cerr << recorder->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<UpstreamPool> upstream;
+    if (!upstream_address.empty()) {
+        upstream = std::make_unique<UpstreamPool>();
+        if (!upstream->configure(upstream_address)) {
+            std::cerr << upstream->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<TlsContext> tls;
+    if (std::any_of(listeners.begin(), listeners.end(),
+                    [](const Listener& listener) { return listener.tls; })) {
+        if (tls_cert.empty() || tls_key.empty()) {
+            std::cerr << "Error: TLS listeners require --tls-cert and --tls-key\n";
+            return 1;
+        }
+        tls = std::make_unique<TlsContext>();
+        if (!tls->load(tls_cert, tls_key, tls_session_cache, tls_tickets)) {
+            std::cerr << tls->getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
     std::cout << "Stitch HTTP Negative Testing Utility\n";
-    std::cout << "Starting server on " << host << ":" << port << "\n";
+    std::cout << "Starting server on " << listeners.front().address.toString() << "\n";
 
     // Set up signal handlers
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    // sendfile() and OpenSSL's writes have no MSG_NOSIGNAL; a client that
+    // hangs up must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    // Shared services for all connections; the outcome table and the
+    // workers are ready before a takeover starts the clock
+    std::unique_ptr<OutcomeRegistry> outcomes;
+    if (outcome_capacity > 0) {
+        outcomes = std::make_unique<OutcomeRegistry>(outcome_capacity);
+    }
+    CompressionCache compression(compress_threads, compress_cache);
+    if (!compression.start()) {
+        std::cerr << "Failed to start compression: " << compression.getErrorMessage() << "\n";
+        return 1;
+    }
+
+    // Everything slow is done: take over from the stitch on
+    // --upgrade-socket, which keeps accepting until we confirm
+    auto takeover_start = std::chrono::steady_clock::now();
+    Handover handover;
+    std::vector<Handover::Socket> handed_over;
+    if (!upgrade_socket.empty() &&
+        !handover.takeOver(upgrade_socket, upgrade_connections, handed_over)) {
+        std::cerr << handover.getErrorMessage() << "\n";
+        return 1;
+    }
+
+    // Its listeners replace binding ours where the addresses match; the
+    // ones our configuration dropped are closed
+    int control_fd = -1;
+    size_t taken_listeners = 0;
+    for (const Handover::Socket& socket : handed_over) {
+        if (socket.kind == Handover::Kind::CONTROL) {
+            control_fd = socket.fd;
+            continue;
+        }
+        if (socket.kind != Handover::Kind::LISTENER) {
+            continue;
+        }
+        ListenAddress address;
+        std::string error;
+        auto match = listeners.end();
+        if (ListenAddress::parse(socket.address, address, error)) {
+            match = std::find_if(listeners.begin(), listeners.end(),
+                                 [&address](const Listener& listener) {
+                                     return listener.fd < 0 && listener.address == address;
+                                 });
+        }
+        if (match == listeners.end()) {
+            ::close(socket.fd);
+            continue;
+        }
+        match->fd = socket.fd;
+        taken_listeners++;
+    }
 
     // Create socket manager
     SocketManager socket_mgr;
 
-    // Bind and listen
-    if (!socket_mgr.bind(host, port)) {
-        std::cerr << "Failed to bind to " << host << ":" << port << "\n";
-        return 1;
+    // Bind and listen; listener numbers follow the order of listeners
+    for (const Listener& listener : listeners) {
+        bool bound = listener.fd >= 0 ? socket_mgr.adopt(listener.fd, listener.own_path)
+                                      : socket_mgr.bind(listener.address);
+        if (!bound) {
+            std::cerr << socket_mgr.getErrorMessage() << "\n";
+            return 1;
+        }
     }
 
-    if (!socket_mgr.listen()) {
-        std::cerr << "Failed to listen on socket\n";
+    socket_mgr.setDeferAccept(defer_accept);
+    socket_mgr.setFastOpen(fast_open);
+    socket_mgr.setAcceptBatch(accept_batch);
+    if (!socket_mgr.listen(backlog)) {
+        std::cerr << socket_mgr.getErrorMessage() << "\n";
         return 1;
     }
 
     // Initialize epoll
-    if (!socket_mgr.initEpoll()) {
+    if (!socket_mgr.initEpoll() || !socket_mgr.initTimer()) {
         std::cerr << "Failed to initialize epoll\n";
         return 1;
     }
 
-    std::cout << "Server listening on " << host << ":" << port << "\n";
+    // Workers wake the loop through an eventfd when a body is compressed
+    if (!socket_mgr.addToEpoll(compression.getEventFd(), EPOLLIN)) {
+        std::cerr << "Failed to start compression: " << compression.getErrorMessage() << "\n";
+        return 1;
+    }
+
+    // Backend connections are in the epoll set, so their progress wakes the loop
+    if (upstream) {
+        upstream->setWatcher([&socket_mgr](int fd) {
+            socket_mgr.addToEpoll(fd, EPOLLIN | EPOLLOUT);
+        });
+    }
+
+    // So do both ends of the socketpairs that carry TLS plaintext
+    if (tls) {
+        tls->setWatcher([&socket_mgr](int fd) {
+            socket_mgr.addToEpoll(fd, EPOLLIN | EPOLLOUT);
+        });
+    }
+
+    // The control socket came with the takeover, or is new
+    if (!upgrade_socket.empty() &&
+        (!handover.serve(upgrade_socket, control_fd) ||
+         !socket_mgr.addToEpoll(handover.getFd(), EPOLLIN))) {
+        std::cerr << handover.getErrorMessage() << "\n";
+        return 1;
+    }
+
+    for (const Listener& listener : listeners) {
+        std::cout << "Server listening on " << listener.address.toString()
+                  << (listener.tls ? " (TLS)" : "")
+                  << (listener.fd < 0 ? "" : listener.own_path ? " (taken over)" : " (activated)")
+                  << "\n";
+        if (listener.router) {
+            std::cout << "Loaded " << listener.router->size() << " scenario routes from "
+                      << listener.scenario_file << " for " << listener.address.toString() << "\n";
+        }
+    }
+    if (router) {
+        std::cout << "Loaded " << router->size() << " scenario routes from " << scenario_file << "\n";
+    }
+    if (chaos) {
+        std::cout << "Chaos mix: " << chaos_spec << "\n";
+    }
+    if (overload) {
+        std::cout << "Overload: " << overload_spec << "\n";
+    }
+    if (corpus) {
+        std::cout << "Corpus: " << corpus->size() << " files, " << corpus->totalBytes()
+                  << " bytes from " << corpus_dir << "\n";
+    }
+    if (recorder) {
+        std::cout << "Recording traffic to " << record_file << "\n";
+    }
+    if (replay) {
+        std::cout << "Replaying decisions from " << replay_file << "\n";
+    }
+    if (upstream) {
+        std::cout << "Relaying responses from " << upstream->getAddress() << "\n";
+    }
+    std::cout << "Random seed: " << seed << "\n";
     std::cout << "Press Ctrl+C to stop\n\n";
 
-    // Map of file descriptors to connection handlers
+    ServerContext context;
+    context.outcomes = outcomes.get();
+    context.router = router.get();
+
+    // Always seeded and printed so per-request chaos runs can be replayed
+    Xoshiro256 rng(seed);
+    context.chaos = chaos.get();
+    ChaosMixCache chaos_mixes(&distributions, &scripts);
+    context.chaos_mixes = &chaos_mixes;
+    context.rng = &rng;
+    context.distributions = &distributions;
+    context.recorder = recorder.get();
+    context.replay = replay.get();
+    context.corpus = corpus.get();
+    context.compression = &compression;
+    context.upstream = upstream.get();
+    context.scripts = &scripts;
+    Admission admission(max_connections, memory_budget, max_header_size);
+    context.admission = &admission;
+    Timeouts timeouts{std::chrono::seconds(idle_timeout), std::chrono::seconds(header_timeout),
+                      std::chrono::seconds(body_timeout)};
+    context.timeouts = &timeouts;
+    context.overload = overload.get();
+
+    // --admin: --scenario and --chaos become the first snapshot, which the
+    // admin thread replaces as changes come in
+    std::unique_ptr<RuntimeConfig> config;
+    if (!admin_spec.empty()) {
+        auto initial = std::make_unique<ConfigSnapshot>();
+        initial->chaos_spec = chaos ? chaos_spec : "";
+        initial->chaos = std::move(chaos);
+        initial->router = std::move(router);
+        config = std::make_unique<RuntimeConfig>(std::move(initial));
+        context.router = nullptr;
+        context.chaos = nullptr;
+        context.config = config.get();
+    }
+
+    // Each listener's connections see the shared services, and the
+    // listener's own scenario in place of --scenario if it has one
+    std::vector<ServerContext> listener_contexts(listeners.size(), context);
+    for (size_t i = 0; i < listeners.size(); i++) {
+        if (listeners[i].router) {
+            listener_contexts[i].router = listeners[i].router.get();
+        }
+    }
+
+    // Overflow counters are system-wide; the summary reports what changed
+    uint64_t listen_overflows = 0;
+    uint64_t listen_drops = 0;
+    bool have_listen_drops = SocketManager::readListenDrops(listen_overflows, listen_drops);
+
+    // Map of file descriptors to connection handlers, and the listener
+    // each came in on, which a handover passes along
     std::map<int, std::unique_ptr<ConnectionHandler>> connections;
+    std::map<int, size_t> connection_listeners;
+
+    // Connections handed over carry on here: idle ones are read as if just
+    // accepted, parked ones stay parked
+    size_t taken_connections = 0;
+    for (const Handover::Socket& socket : handed_over) {
+        if (socket.kind != Handover::Kind::IDLE && socket.kind != Handover::Kind::PARKED) {
+            continue;
+        }
+        ListenAddress address;
+        std::string error;
+        ListenAddress::parse(socket.address, address, error);
+        size_t listener = 0;
+        while (listener < listeners.size() && !(listeners[listener].address == address)) {
+            listener++;
+        }
+        if (listener == listeners.size() || listeners[listener].tls) {
+            // Its listener is gone from our configuration
+            ::close(socket.fd);
+            continue;
+        }
+        auto handler = std::make_unique<ConnectionHandler>(socket.fd, &listener_contexts[listener]);
+        if (socket.kind == Handover::Kind::PARKED) {
+            handler->park();
+        }
+        connections[socket.fd] = std::move(handler);
+        connection_listeners[socket.fd] = listener;
+        socket_mgr.addToEpoll(socket.fd, EPOLLIN | EPOLLOUT | EPOLLET);
+        taken_connections++;
+    }
+
+    // We accept from here on; the old process stops and drains
+    if (handover.peer() != 0) {
+        if (!handover.confirm()) {
+            std::cerr << "Warning: " << handover.getErrorMessage() << "\n";
+        }
+        auto takeover_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - takeover_start).count();
+        std::cout << "Took over " << taken_listeners << " listeners and " << taken_connections
+                  << " connections from pid " << handover.peer() << " in " << takeover_us
+                  << " us\n";
+    }
+
+    // After a takeover, the old process lets go of the admin address as
+    // it hands over; until then binding it can fail
+    std::unique_ptr<AdminServer> admin;
+    if (config) {
+        admin = std::make_unique<AdminServer>(*config, &distributions);
+        bool started = admin->start(admin_address);
+        for (int attempt = 0; !started && handover.peer() != 0 && attempt < 50; attempt++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            started = admin->start(admin_address);
+        }
+        if (!started) {
+            std::cerr << admin->getErrorMessage() << "\n";
+            return 1;
+        }
+        std::cout << "Admin listening on " << admin_address.toString() << "\n";
+    }
+
+    // At a limit the listeners leave the epoll set, and new connections
+    // wait in the accept queues until enough have closed
+    auto admit = [&]() {
+        bool pause = !admission.admits();
+        if (pause == admission.paused()) {
+            return;
+        }
+        if (pause) {
+            socket_mgr.pauseAccepting();
+        } else {
+            socket_mgr.resumeAccepting();
+        }
+        admission.setPaused(pause);
+        if (verbose) {
+            std::cout << (pause ? "Accepts paused: " : "Accepts resumed: ")
+                      << admission.connections() << " connections, " << admission.memory()
+                      << " bytes\n";
+        }
+    };
+    admit();
+
+    // Connections offered to a new process mid-handover are left alone
+    // until it confirms or gives up, so only one process ever serves them
+    std::unordered_set<int> offered;
+    size_t handed_listeners = 0;
+
+    // After a handover the old process only finishes what it has
+    bool draining = false;
+    auto drain_deadline = std::chrono::steady_clock::time_point::max();
 
     // Main event loop
     while (running) {
-        // Wait for events (100ms timeout to check running flag)
-        int n_events = socket_mgr.waitForEvents(100);
+        // Wait for events (100ms timeout to check running flag); not at all
+        // while the accept queue holds connections a batch left behind
+        int n_events = socket_mgr.waitForEvents(socket_mgr.acceptBacklogged() ? 0 : 100);
 
         if (n_events < 0) {
             if (errno == EINTR) {
@@ -112,33 +895,120 @@ int main(int argc, char* argv[]) {
         // Note: We need to manually access epoll events since our API is simplified
         // In a real implementation, we'd improve the SocketManager API
 
-        // For now, let's check if the listen socket is ready
-        if (n_events > 0) {
+        // For now, let's check if the listen socket is ready, or still holds
+        // connections from the last round
+        if (n_events > 0 || socket_mgr.acceptPending()) {
             // Try to accept new connections
-            int client_fd = socket_mgr.acceptConnection();
+            size_t listener = 0;
+            int client_fd = socket_mgr.acceptConnection(&listener);
             while (client_fd >= 0) {
                 if (verbose) {
-                    std::cout << "Accepted new connection: fd=" << client_fd << "\n";
+                    std::cout << "Accepted new connection: fd=" << client_fd << " on "
+                              << listeners[listener].address.toString() << "\n";
+                }
+
+                // action=reset: while over a limit, new connections get an
+                // RST before their request is read
+                if (overload && overload->resetsConnection(std::chrono::steady_clock::now())) {
+                    struct linger abort_linger;
+                    abort_linger.l_onoff = 1;
+                    abort_linger.l_linger = 0;
+                    setsockopt(client_fd, SOL_SOCKET, SO_LINGER, &abort_linger, sizeof(abort_linger));
+                    close(client_fd);
+                    client_fd = socket_mgr.acceptConnection(&listener);
+                    continue;
                 }
 
                 // Create connection handler
-                auto handler = std::make_unique<ConnectionHandler>(client_fd);
+                auto handler = std::make_unique<ConnectionHandler>(
+                    client_fd, &listener_contexts[listener],
+                    listeners[listener].tls ? tls.get() : nullptr);
                 connections[client_fd] = std::move(handler);
+                connection_listeners[client_fd] = listener;
 
                 // Add to epoll
                 socket_mgr.addToEpoll(client_fd, EPOLLIN | EPOLLOUT | EPOLLET);
 
-                // Try to accept more connections
-                client_fd = socket_mgr.acceptConnection();
+                // Try to accept more connections, if there is room
+                admit();
+                client_fd = socket_mgr.acceptConnection(&listener);
+            }
+        }
+
+        // A new stitch on --upgrade-socket takes our listeners and, if it
+        // asks, the connections it can carry on with. The exchange moves on
+        // a step per round, so everything else keeps being served meanwhile.
+        if (!draining && handover.getFd() >= 0) {
+            if (handover.accept(std::chrono::steady_clock::now())) {
+                socket_mgr.addToEpoll(handover.getChannelFd(), EPOLLIN | EPOLLOUT | EPOLLET);
+            }
+            Handover::Stage stage = handover.step(std::chrono::steady_clock::now());
+            if (stage == Handover::Stage::OFFER) {
+                std::vector<Handover::Socket> sockets;
+                sockets.push_back({Handover::Kind::CONTROL, handover.getFd(), upgrade_socket});
+                for (size_t i = 0; i < socket_mgr.listenerCount(); i++) {
+                    sockets.push_back({Handover::Kind::LISTENER, socket_mgr.getListenFd(i),
+                                       listeners[i].address.toString()});
+                }
+                handed_listeners = socket_mgr.listenerCount();
+                for (const auto& pair : connections) {
+                    const ConnectionHandler& handler = *pair.second;
+                    if (!handover.wantsConnections() || !(handler.idle() || handler.parked())) {
+                        continue;
+                    }
+                    const Listener& from = listeners[connection_listeners[pair.first]];
+                    sockets.push_back({handler.idle() ? Handover::Kind::IDLE : Handover::Kind::PARKED,
+                                       pair.first, from.address.toString()});
+                    offered.insert(pair.first);
+                }
+                handover.handOver(sockets);
+                stage = handover.step(std::chrono::steady_clock::now());
+            }
+
+            if (stage == Handover::Stage::DONE) {
+                socket_mgr.releaseListeners();
+                handover.release();
+                if (admin) {
+                    admin->stop();
+                }
+                for (int fd : offered) {
+                    socket_mgr.removeFromEpoll(fd);
+                    connections[fd]->handOver();
+                    connections.erase(fd);
+                    connection_listeners.erase(fd);
+                }
+                draining = true;
+                drain_deadline = std::chrono::steady_clock::now() +
+                                 std::chrono::seconds(drain_timeout);
+                std::cout << "Handed over " << handed_listeners << " listeners and "
+                          << offered.size() << " connections to pid " << handover.peer()
+                          << "; draining " << connections.size() << " connections\n";
+                offered.clear();
+            } else if (stage == Handover::Stage::FAILED) {
+                // The offered connections carry on here
+                std::cerr << "Handover failed: " << handover.getErrorMessage() << "\n";
+                offered.clear();
             }
         }
 
+        socket_mgr.clearTimer();
+
+        // Hand finished compression jobs to the connections waiting for them
+        compression.collect();
+
+        // Connections whose client ran out of time find out in onTimer()
+        timeouts.expire(std::chrono::steady_clock::now());
+
         // Process existing connections
         std::vector<int> to_remove;
+        auto next_deadline = std::chrono::steady_clock::time_point::max();
 
         for (auto& pair : connections) {
             int fd = pair.first;
             auto& handler = pair.second;
+            if (!offered.empty() && offered.count(fd) != 0) {
+                continue;
+            }
 
             // Call onReadable to try reading data
             handler->onReadable();
@@ -149,6 +1019,8 @@ int main(int argc, char* argv[]) {
             // Call onTimer for delayed behaviors
             handler->onTimer();
 
+            handler->updateMemory();
+
             // Check if connection should be closed
             if (handler->shouldClose()) {
                 if (verbose) {
@@ -157,16 +1029,39 @@ int main(int argc, char* argv[]) {
                 socket_mgr.removeFromEpoll(fd);
                 handler->closeConnection();
                 to_remove.push_back(fd);
+            } else {
+                next_deadline = std::min(next_deadline, handler->getDeadline());
             }
         }
 
+        // Wake up exactly when the earliest delayed response or timeout is due
+        socket_mgr.armTimer(std::min(next_deadline, timeouts.nextDeadline()));
+
         // Remove closed connections
         for (int fd : to_remove) {
             connections.erase(fd);
+            connection_listeners.erase(fd);
+        }
+        admit();
+
+        // Snapshots older than every pinned one can go
+        if (config) {
+            config->quiesce();
+        }
+
+        if (recorder) {
+            recorder->flushIfDue();
+        }
+
+        if (draining && (connections.empty() || std::chrono::steady_clock::now() >= drain_deadline)) {
+            break;
         }
     }
 
     std::cout << "Shutting down server...\n";
+    if (draining) {
+        std::cout << "Drained; " << connections.size() << " connections still open were closed\n";
+    }
 
     // Clean up all connections
     for (auto& pair : connections) {
@@ -175,8 +1070,63 @@ int main(int argc, char* argv[]) {
     }
     connections.clear();
 
+    std::cout << "Accepted " << socket_mgr.accepted() << " connections, peak accept queue "
+              << socket_mgr.peakAcceptQueue() << ", " << socket_mgr.acceptErrors()
+              << " accept errors\n";
+    std::cout << "Peak usage: " << admission.peakConnections() << " connections, "
+              << admission.peakMemory() << " bytes; accepts paused " << admission.pauses()
+              << " times, " << admission.rejectedHeaders() << " request heads too large\n";
+    std::cout << "Timeouts:";
+    for (TimeoutCause cause : {TimeoutCause::IDLE, TimeoutCause::HEADER, TimeoutCause::BODY}) {
+        std::cout << (cause == TimeoutCause::IDLE ? " " : ", ") << timeouts.expired(cause) << " "
+                  << Timeouts::causeName(cause);
+    }
+    std::cout << "\n";
+    uint64_t overflows_now;
+    uint64_t drops_now;
+    if (have_listen_drops && SocketManager::readListenDrops(overflows_now, drops_now)) {
+        std::cout << "Listen queue overflows: " << overflows_now - listen_overflows
+                  << ", drops: " << drops_now - listen_drops << " (system-wide)\n";
+    }
+
     socket_mgr.closeAll();
 
+    if (recorder) {
+        recorder->close();
+        std::cout << "Recorded " << recorder->count() << " requests to " << record_file << "\n";
+        if (!recorder->getErrorMessage().empty()) {
+            std::cerr << recorder->getErrorMessage() << "\n";
+        }
+    }
+    if (replay) {
+        std::cout << "Replayed " << replay->consumed() << " recorded decisions\n";
+    }
+    if (upstream) {
+        std::cout << "Upstream: " << upstream->connects() << " connections, "
+                  << upstream->reuses() << " reuses\n";
+    }
+    if (admin) {
+        admin->stop();
+        std::cout << "Config: generation " << config->generation() << " after "
+                  << config->swaps() << " swaps, " << config->reclaimed()
+                  << " snapshots reclaimed\n";
+    }
+    if (overload) {
+        std::cout << "Overload: " << overload->served() << " served, "
+                  << overload->shed(Overload::Verdict::UNAVAILABLE) << " 503, "
+                  << overload->shed(Overload::Verdict::TOO_MANY) << " 429, "
+                  << overload->shed(Overload::Verdict::STALL) << " stalled, "
+                  << overload->shed(Overload::Verdict::RESET) << " reset, "
+                  << overload->connectionsReset() << " connections reset; peak "
+                  << overload->peakInFlight() << " in flight, " << overload->peakRate()
+                  << " requests/s\n";
+    }
+
+    if (tls) {
+        std::cout << "TLS: " << tls->handshakes() << " handshakes, " << tls->resumed()
+                  << " resumed, " << tls->kernelOffloaded() << " with kernel TLS\n";
+    }
+
     std::cout << "Server stopped.\n";
     return 0;
 }
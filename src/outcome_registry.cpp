@@ -0,0 +1,138 @@
+#include "outcome_registry.h"
+#include <cstring>
+#include <sstream>
+
+OutcomeRecord::OutcomeRecord()
+    : sequence(0)
+    , behavior(BehaviorType::NORMAL)
+    , status_code(0)
+    , bytes_sent(0)
+    , response_bytes(0)
+    , accepted_at_us(0)
+    , request_us(-1)
+    , first_byte_us(-1)
+    , close_us(-1)
+    , close_reason(CloseReason::NONE) {
+    id[0] = '\0';
+}
+
+OutcomeRegistry::OutcomeRegistry(size_t capacity)
+    : next_sequence_(1) {
+    // Round up to a power of two so the home slot is a mask, not a modulo
+    size_t size = PROBE_LIMIT;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+}
+
+void OutcomeRegistry::store(const OutcomeRecord& record) {
+    size_t length = strnlen(record.id, OutcomeRecord::MAX_ID_LENGTH + 1);
+    if (length == 0 || length > OutcomeRecord::MAX_ID_LENGTH) {
+        return;
+    }
+
+    size_t home = hashId(record.id, length) & mask_;
+    OutcomeRecord* victim = nullptr;
+
+    for (size_t i = 0; i < PROBE_LIMIT; ++i) {
+        OutcomeRecord& slot = slots_[(home + i) & mask_];
+
+        if (slot.sequence == 0 || strcmp(slot.id, record.id) == 0) {
+            // Empty slot or an earlier record for the same id
+            victim = &slot;
+            break;
+        }
+
+        if (victim == nullptr || slot.sequence < victim->sequence) {
+            victim = &slot;
+        }
+    }
+
+    *victim = record;
+    victim->sequence = next_sequence_++;
+}
+
+const OutcomeRecord* OutcomeRegistry::find(const std::string& id) const {
+    if (id.empty() || id.length() > OutcomeRecord::MAX_ID_LENGTH) {
+        return nullptr;
+    }
+
+    size_t home = hashId(id.c_str(), id.length()) & mask_;
+
+    for (size_t i = 0; i < PROBE_LIMIT; ++i) {
+        const OutcomeRecord& slot = slots_[(home + i) & mask_];
+        if (slot.sequence != 0 && id == slot.id) {
+            return &slot;
+        }
+    }
+
+    return nullptr;
+}
+
+size_t OutcomeRegistry::capacity() const {
+    return slots_.size();
+}
+
+bool OutcomeRegistry::isValidId(const std::string& id) {
+    if (id.empty() || id.length() > OutcomeRecord::MAX_ID_LENGTH) {
+        return false;
+    }
+
+    for (char c : id) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '.' || c == '_' ||
+                  c == ':' || c == '-';
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const char* OutcomeRegistry::closeReasonName(CloseReason reason) {
+    switch (reason) {
+        case CloseReason::NONE:           return "none";
+        case CloseReason::COMPLETED:      return "completed";
+        case CloseReason::TRUNCATED:      return "truncated";
+        case CloseReason::BEHAVIOR_CLOSE: return "behavior_close";
+        case CloseReason::PEER_CLOSED:    return "peer_closed";
+        case CloseReason::SEND_ERROR:     return "send_error";
+        case CloseReason::RESET:          return "reset";
+        case CloseReason::SHUTDOWN:       return "shutdown";
+        case CloseReason::BAD_REQUEST:    return "bad_request";
+        case CloseReason::UPSTREAM_ERROR: return "upstream_error";
+        case CloseReason::HANDED_OVER:    return "handed_over";
+    }
+    return "unknown";
+}
+
+std::string OutcomeRegistry::toJson(const OutcomeRecord& record) {
+    // Ids are restricted by isValidId(), so they never need escaping
+    std::ostringstream oss;
+    oss << "{\"id\":\"" << record.id << "\""
+        << ",\"state\":\"" << (record.close_reason == CloseReason::NONE ? "in_flight" : "closed") << "\""
+        << ",\"behavior\":\"" << CommandInterpreter::behaviorName(record.behavior) << "\""
+        << ",\"status\":" << record.status_code
+        << ",\"bytes_sent\":" << record.bytes_sent
+        << ",\"response_bytes\":" << record.response_bytes
+        << ",\"accepted_at_us\":" << record.accepted_at_us
+        << ",\"request_us\":" << record.request_us
+        << ",\"first_byte_us\":" << record.first_byte_us
+        << ",\"close_us\":" << record.close_us
+        << ",\"close_reason\":\"" << closeReasonName(record.close_reason) << "\""
+        << "}";
+    return oss.str();
+}
+
+uint64_t OutcomeRegistry::hashId(const char* id, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(id[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,74 @@
+#ifndef OUTCOME_REGISTRY_H
+#define OUTCOME_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "command_interpreter.h"
+
+enum class CloseReason {
+    NONE,           // Connection still in flight
+    COMPLETED,      // Full response written
+    TRUNCATED,      // Behavior cut the response short (close_headers, close_partial)
+    BEHAVIOR_CLOSE, // Behavior closed without sending anything
+    PEER_CLOSED,    // Client closed or reset the connection first
+    SEND_ERROR,     // send() failed for a reason other than the peer going away
+    RESET,          // fault=reset aborted the connection
+    SHUTDOWN,       // Server closed the connection (shutdown, timeout behavior)
+    BAD_REQUEST,    // Request body framing could not be followed
+    UPSTREAM_ERROR, // --upstream response broke off while being relayed
+    HANDED_OVER     // Passed to the process that took over (--upgrade-socket)
+};
+
+// Fixed-size record describing what Stitch did for one tagged request.
+// Timings are microseconds relative to accept; -1 means "did not happen".
+struct OutcomeRecord {
+    static constexpr size_t MAX_ID_LENGTH = 64;
+
+    char id[MAX_ID_LENGTH + 1];
+    uint64_t sequence;
+    BehaviorType behavior;
+    int status_code;
+    uint64_t bytes_sent;
+    uint64_t response_bytes;    // 0 when not known up front
+    int64_t accepted_at_us;     // Wall clock, microseconds since the epoch
+    int64_t request_us;
+    int64_t first_byte_us;
+    int64_t close_us;
+    CloseReason close_reason;
+
+    OutcomeRecord();
+};
+
+// Open-addressed hash table with ring semantics: a record lives in one of
+// PROBE_LIMIT slots after its home slot, and when all of them are taken the
+// oldest record in that window is overwritten. Lookups and stores therefore
+// touch a bounded number of slots regardless of how many ids were seen.
+class OutcomeRegistry {
+public:
+    static constexpr size_t PROBE_LIMIT = 8;
+
+    explicit OutcomeRegistry(size_t capacity = 65536);
+
+    // Insert or update the record for record.id
+    void store(const OutcomeRecord& record);
+
+    // Returns nullptr if the id was never seen or has been overwritten
+    const OutcomeRecord* find(const std::string& id) const;
+
+    size_t capacity() const;
+
+    // Ids are limited to MAX_ID_LENGTH characters from [A-Za-z0-9._:-]
+    static bool isValidId(const std::string& id);
+    static const char* closeReasonName(CloseReason reason);
+    static std::string toJson(const OutcomeRecord& record);
+
+private:
+    std::vector<OutcomeRecord> slots_;
+    size_t mask_;
+    uint64_t next_sequence_;
+
+    static uint64_t hashId(const char* id, size_t length);
+};
+
+#endif // OUTCOME_REGISTRY_H
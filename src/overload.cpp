@@ -0,0 +1,253 @@
+#include "overload.h"
+#include <algorithm>
+#include "text_util.h"
+
+namespace {
+
+bool parseNumber(const std::string& text, int64_t& value) {
+    uint64_t parsed;
+    if (!parseUnsigned(text, parsed, INT64_MAX)) {
+        return false;
+    }
+    value = static_cast<int64_t>(parsed);
+    return true;
+}
+
+int64_t steadyMs(std::chrono::steady_clock::time_point now) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+}
+
+} // namespace
+
+Overload::Overload()
+    : max_in_flight_(0)
+    , max_rate_(0)
+    , window_ms_(DEFAULT_WINDOW_MS)
+    , action_(Action::REJECT)
+    , retry_after_(1)
+    , buckets_{}
+    , window_total_(0)
+    , bucket_epoch_(-1)
+    , in_flight_(0)
+    , peak_in_flight_(0)
+    , peak_window_(0)
+    , served_(0)
+    , unavailable_(0)
+    , too_many_(0)
+    , stalled_(0)
+    , reset_(0)
+    , connections_reset_(0) {
+}
+
+bool Overload::parse(const std::string& spec) {
+    uint64_t max_in_flight = 0;
+    uint64_t max_rate = 0;
+    int64_t window_ms = DEFAULT_WINDOW_MS;
+    Action action = Action::REJECT;
+    int64_t retry_after = 1;
+
+    size_t pos = 0;
+    while (pos <= spec.length()) {
+        size_t comma = spec.find(',', pos);
+        size_t end = (comma == std::string::npos) ? spec.length() : comma;
+        std::string entry = trim(spec.substr(pos, end - pos));
+
+        if (!entry.empty()) {
+            size_t equals = entry.find('=');
+            std::string key = trim(entry.substr(0, equals));
+            std::string value = equals == std::string::npos ? "" : trim(entry.substr(equals + 1));
+            int64_t number = 0;
+            if (key == "action") {
+                if (value == "reject") {
+                    action = Action::REJECT;
+                } else if (value == "stall") {
+                    action = Action::STALL;
+                } else if (value == "reset") {
+                    action = Action::RESET;
+                } else {
+                    error_message_ = "Overload action must be reject, stall or reset: '" + value + "'";
+                    return false;
+                }
+            } else if (key != "inflight" && key != "rate" && key != "window" &&
+                       key != "retry_after") {
+                error_message_ = "Unknown overload option: " + key;
+                return false;
+            } else if (!parseNumber(value, number)) {
+                error_message_ = "Overload option '" + entry + "' needs a non-negative number";
+                return false;
+            } else if (key == "inflight") {
+                max_in_flight = static_cast<uint64_t>(number);
+            } else if (key == "rate") {
+                max_rate = static_cast<uint64_t>(number);
+            } else if (key == "window") {
+                window_ms = number;
+            } else {
+                retry_after = number;
+            }
+        }
+
+        if (comma == std::string::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+
+    if (max_in_flight == 0 && max_rate == 0) {
+        error_message_ = "Overload needs an inflight= or rate= limit";
+        return false;
+    }
+    // Buckets are whole milliseconds, so the rate is taken over exactly
+    // the window that was asked for
+    if (window_ms < static_cast<int64_t>(WINDOW_BUCKETS) ||
+        window_ms % static_cast<int64_t>(WINDOW_BUCKETS) != 0) {
+        error_message_ = "Overload window must be a multiple of " + std::to_string(WINDOW_BUCKETS) +
+                         " ms: " + std::to_string(window_ms);
+        return false;
+    }
+    if (retry_after > 86400) {
+        error_message_ = "Overload retry_after is at most 86400 seconds";
+        return false;
+    }
+
+    max_in_flight_ = max_in_flight;
+    max_rate_ = max_rate;
+    window_ms_ = window_ms;
+    action_ = action;
+    retry_after_ = static_cast<int>(retry_after);
+    error_message_.clear();
+    return true;
+}
+
+void Overload::bump(std::atomic<uint64_t>& counter) {
+    // One writer: a plain load and store, no locked read-modify-write
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Overload::advance(std::chrono::steady_clock::time_point now) {
+    int64_t epoch = steadyMs(now) / (window_ms_ / static_cast<int64_t>(WINDOW_BUCKETS));
+    if (bucket_epoch_ < 0) {
+        bucket_epoch_ = epoch;
+    }
+
+    // Slices that slid out of the window leave the total
+    int64_t steps = std::min<int64_t>(epoch - bucket_epoch_, static_cast<int64_t>(WINDOW_BUCKETS));
+    for (int64_t step = 1; step <= steps; step++) {
+        std::atomic<uint64_t>& bucket =
+            buckets_[static_cast<size_t>(bucket_epoch_ + step) % WINDOW_BUCKETS];
+        window_total_.store(window_total_.load(std::memory_order_relaxed) -
+                            bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    bucket_epoch_ = std::max(bucket_epoch_, epoch);
+}
+
+bool Overload::overRate() const {
+    // rate per second over window_ms_, without dividing
+    return max_rate_ > 0 && window_total_.load(std::memory_order_relaxed) * 1000 >
+                            max_rate_ * static_cast<uint64_t>(window_ms_);
+}
+
+Overload::Verdict Overload::admit(std::chrono::steady_clock::time_point now) {
+    advance(now);
+    bump(buckets_[static_cast<size_t>(bucket_epoch_) % WINDOW_BUCKETS]);
+    bump(window_total_);
+    peak_window_.store(std::max(peak_window_.load(std::memory_order_relaxed),
+                                window_total_.load(std::memory_order_relaxed)),
+                       std::memory_order_relaxed);
+
+    bool over_in_flight = max_in_flight_ > 0 &&
+                          in_flight_.load(std::memory_order_relaxed) >= max_in_flight_;
+    if (!over_in_flight && !overRate()) {
+        bump(in_flight_);
+        peak_in_flight_.store(std::max(peak_in_flight_.load(std::memory_order_relaxed),
+                                       in_flight_.load(std::memory_order_relaxed)),
+                              std::memory_order_relaxed);
+        bump(served_);
+        return Verdict::SERVE;
+    }
+
+    switch (action_) {
+        case Action::STALL:
+            bump(stalled_);
+            return Verdict::STALL;
+        case Action::RESET:
+            bump(reset_);
+            return Verdict::RESET;
+        case Action::REJECT:
+            break;
+    }
+    if (over_in_flight) {
+        bump(unavailable_);
+        return Verdict::UNAVAILABLE;
+    }
+    bump(too_many_);
+    return Verdict::TOO_MANY;
+}
+
+void Overload::finish() {
+    in_flight_.store(in_flight_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+bool Overload::resetsConnection(std::chrono::steady_clock::time_point now) {
+    if (action_ != Action::RESET) {
+        return false;
+    }
+    advance(now);
+
+    // Its request would be shed: at the in-flight limit, or the window is
+    // already full without it
+    bool full = (max_in_flight_ > 0 && in_flight_.load(std::memory_order_relaxed) >= max_in_flight_) ||
+                (max_rate_ > 0 && window_total_.load(std::memory_order_relaxed) * 1000 >=
+                                  max_rate_ * static_cast<uint64_t>(window_ms_));
+    if (full) {
+        bump(connections_reset_);
+    }
+    return full;
+}
+
+Overload::Action Overload::action() const {
+    return action_;
+}
+
+int Overload::retryAfter() const {
+    return retry_after_;
+}
+
+uint64_t Overload::inFlight() const {
+    return in_flight_.load(std::memory_order_relaxed);
+}
+
+uint64_t Overload::peakInFlight() const {
+    return peak_in_flight_.load(std::memory_order_relaxed);
+}
+
+uint64_t Overload::windowRequests() const {
+    return window_total_.load(std::memory_order_relaxed);
+}
+
+uint64_t Overload::peakRate() const {
+    return peak_window_.load(std::memory_order_relaxed) * 1000 / static_cast<uint64_t>(window_ms_);
+}
+
+uint64_t Overload::served() const {
+    return served_.load(std::memory_order_relaxed);
+}
+
+uint64_t Overload::shed(Verdict verdict) const {
+    switch (verdict) {
+        case Verdict::UNAVAILABLE: return unavailable_.load(std::memory_order_relaxed);
+        case Verdict::TOO_MANY: return too_many_.load(std::memory_order_relaxed);
+        case Verdict::STALL: return stalled_.load(std::memory_order_relaxed);
+        case Verdict::RESET: return reset_.load(std::memory_order_relaxed);
+        case Verdict::SERVE: break;
+    }
+    return 0;
+}
+
+uint64_t Overload::connectionsReset() const {
+    return connections_reset_.load(std::memory_order_relaxed);
+}
+
+const std::string& Overload::getErrorMessage() const {
+    return error_message_;
+}
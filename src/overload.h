@@ -0,0 +1,106 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+// --overload: stitch playing an upstream that sheds load. Requests in
+// flight (head read, connection not yet closed) and requests arriving in a
+// sliding window are counted; a request that finds either over its limit is
+// shed instead of served.
+//
+// Spec format: comma-separated "key=value" entries, e.g.
+//   inflight=100,rate=500,window=1000,action=reject,retry_after=2
+//   inflight   requests in flight before shedding; 0 = no limit
+//   rate       requests per second over the window; 0 = no limit
+//   window     sliding window in milliseconds, a multiple of
+//              WINDOW_BUCKETS (default 1000)
+//   action     reject: 503 past inflight, 429 past rate, with Retry-After
+//              stall:  hold the request and never answer it
+//              reset:  reset its connection, and new ones at accept
+//   retry_after  Retry-After seconds for reject (default 1, 0 omits it)
+//
+// The window is WINDOW_BUCKETS buckets in a ring with a running total, so
+// counting an arrival and reading the rate are O(1). The counters are
+// relaxed atomics: only the event loop writes them, and anything else may
+// read them without a lock.
+class Overload {
+public:
+    enum class Action {
+        REJECT,
+        STALL,
+        RESET
+    };
+
+    enum class Verdict {
+        SERVE,
+        UNAVAILABLE,    // 503: too many in flight
+        TOO_MANY,       // 429: arriving too fast
+        STALL,
+        RESET
+    };
+
+    static constexpr size_t WINDOW_BUCKETS = 10;
+    static constexpr int DEFAULT_WINDOW_MS = 1000;
+
+    Overload();
+
+    Overload(const Overload&) = delete;
+    Overload& operator=(const Overload&) = delete;
+
+    // Parse a spec, replacing the current settings. Returns false on error.
+    bool parse(const std::string& spec);
+
+    // A request arrives: counted in the window, and either served (in
+    // flight until finish()) or shed
+    Verdict admit(std::chrono::steady_clock::time_point now);
+    void finish();
+
+    // action=reset: whether a connection accepted now is reset at once
+    bool resetsConnection(std::chrono::steady_clock::time_point now);
+
+    Action action() const;
+    int retryAfter() const;
+
+    uint64_t inFlight() const;
+    uint64_t peakInFlight() const;
+    uint64_t windowRequests() const;        // Arrivals in the current window
+    uint64_t peakRate() const;              // Highest requests per second seen
+    uint64_t served() const;
+    uint64_t shed(Verdict verdict) const;
+    uint64_t connectionsReset() const;
+
+    const std::string& getErrorMessage() const;
+
+private:
+    uint64_t max_in_flight_;
+    uint64_t max_rate_;
+    int64_t window_ms_;
+    Action action_;
+    int retry_after_;
+
+    // The window: bucket i counts arrivals in its slice, the slice of
+    // bucket_epoch_ being the newest
+    std::atomic<uint64_t> buckets_[WINDOW_BUCKETS];
+    std::atomic<uint64_t> window_total_;
+    int64_t bucket_epoch_;
+
+    std::atomic<uint64_t> in_flight_;
+    std::atomic<uint64_t> peak_in_flight_;
+    std::atomic<uint64_t> peak_window_;
+    std::atomic<uint64_t> served_;
+    std::atomic<uint64_t> unavailable_;
+    std::atomic<uint64_t> too_many_;
+    std::atomic<uint64_t> stalled_;
+    std::atomic<uint64_t> reset_;
+    std::atomic<uint64_t> connections_reset_;
+    std::string error_message_;
+
+    void advance(std::chrono::steady_clock::time_point now);
+    bool overRate() const;
+    static void bump(std::atomic<uint64_t>& counter);
+};
+
+#endif // OVERLOAD_H
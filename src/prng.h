@@ -0,0 +1,53 @@
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <cstdint>
+
+// xoshiro256** (Blackman & Vigna). Small, fast and good enough for picking
+// behaviors and sampling delays; not for anything security related. The
+// state is seeded with splitmix64 so any 64-bit seed, including 0, works
+// and the same seed always yields the same sequence.
+class Xoshiro256 {
+public:
+    explicit Xoshiro256(uint64_t seed = 0) {
+        reseed(seed);
+    }
+
+    void reseed(uint64_t seed) {
+        for (uint64_t& word : state_) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(state_[1] * 5, 7) * 9;
+        uint64_t t = state_[1] << 17;
+
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = rotl(state_[3], 45);
+
+        return result;
+    }
+
+    // Uniform double in [0, 1)
+    double nextDouble() {
+        return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t state_[4];
+
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+#endif // PRNG_H
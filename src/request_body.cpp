@@ -0,0 +1,500 @@
+#include "request_body.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include "text_util.h"
+
+namespace {
+
+// Bytes a body pipe is asked to hold; the default 64 KiB needs more splices
+constexpr int PIPE_SIZE = 256 * 1024;
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Opened once; every discard goes to the same descriptor
+int devNull() {
+    static int fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    return fd;
+}
+
+} // namespace
+
+RequestBody::RequestBody()
+    : framing_(Framing::NONE)
+    , length_(0)
+    , received_(0)
+    , chunk_state_(ChunkState::SIZE)
+    , chunk_left_(0)
+    , size_digits_(0)
+    , line_bytes_(0)
+    , trailer_bytes_(0)
+    , ended_(false)
+    , failed_(false) {
+}
+
+bool RequestBody::begin(const HttpRequest& request) {
+    *this = RequestBody();
+    return beginFraming(request.getHeader("Transfer-Encoding"),
+                        request.getHeader("Content-Length"), false);
+}
+
+bool RequestBody::beginResponse(int status_code, bool head_request,
+                                const std::string& transfer_encoding,
+                                const std::string& content_length) {
+    *this = RequestBody();
+    if (head_request || (status_code >= 100 && status_code < 200) || status_code == 204 ||
+        status_code == 304) {
+        return true;
+    }
+    return beginFraming(transfer_encoding, content_length, true);
+}
+
+bool RequestBody::beginFraming(const std::string& transfer_encoding,
+                               const std::string& content_length, bool response) {
+    // Transfer-Encoding wins over Content-Length; chunked must come last,
+    // as that is what ends the body
+    if (!transfer_encoding.empty()) {
+        size_t comma = transfer_encoding.rfind(',');
+        std::string last = trim(comma == std::string::npos ? transfer_encoding
+                                                           : transfer_encoding.substr(comma + 1));
+        std::transform(last.begin(), last.end(), last.begin(), [](char c) {
+            return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        });
+        if (last == "chunked") {
+            framing_ = Framing::CHUNKED;
+        } else if (response) {
+            framing_ = Framing::CLOSE;
+        } else {
+            return fail("Transfer-Encoding does not end in chunked");
+        }
+        length_ = ResponseSource::UNKNOWN_LENGTH;
+        return true;
+    }
+
+    std::string length = trim(content_length);
+    if (length.empty()) {
+        if (response) {
+            framing_ = Framing::CLOSE;
+            length_ = ResponseSource::UNKNOWN_LENGTH;
+        }
+        return true;
+    }
+    if (length.length() > 19 || length.find_first_not_of("0123456789") != std::string::npos) {
+        return fail("Content-Length is not a number");
+    }
+    framing_ = Framing::LENGTH;
+    length_ = std::strtoull(length.c_str(), nullptr, 10);
+    return true;
+}
+
+void RequestBody::finish() {
+    if (framing_ == Framing::CLOSE) {
+        ended_ = true;
+    } else if (!done()) {
+        fail("Body cut short");
+    }
+}
+
+RequestBody::Framing RequestBody::framing() const {
+    return framing_;
+}
+
+uint64_t RequestBody::length() const {
+    return length_;
+}
+
+uint64_t RequestBody::dataAvailable() const {
+    switch (framing_) {
+        case Framing::LENGTH:
+            return length_ - received_;
+        case Framing::CHUNKED:
+            return chunk_state_ == ChunkState::DATA ? chunk_left_ : 0;
+        case Framing::CLOSE:
+            return ended_ ? 0 : UINT64_MAX;
+        case Framing::NONE:
+            break;
+    }
+    return 0;
+}
+
+void RequestBody::consumeData(uint64_t n) {
+    n = std::min(n, dataAvailable());
+    received_ += n;
+    if (framing_ == Framing::CHUNKED) {
+        chunk_left_ -= n;
+        if (chunk_left_ == 0) {
+            chunk_state_ = ChunkState::DATA_CR;
+        }
+    }
+}
+
+size_t RequestBody::parseFraming(const char* data, size_t length) {
+    if (framing_ != Framing::CHUNKED || failed_) {
+        return 0;
+    }
+
+    size_t used = 0;
+    while (used < length && chunk_state_ != ChunkState::DATA && chunk_state_ != ChunkState::DONE) {
+        char c = data[used++];
+        switch (chunk_state_) {
+            case ChunkState::SIZE: {
+                int digit = hexValue(c);
+                if (digit >= 0) {
+                    if (chunk_left_ > (UINT64_MAX >> 4)) {
+                        fail("Chunk size too large");
+                    }
+                    chunk_left_ = chunk_left_ * 16 + static_cast<uint64_t>(digit);
+                    size_digits_++;
+                } else if (size_digits_ == 0) {
+                    fail("Chunk size missing");
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    chunk_state_ = ChunkState::EXTENSION;
+                } else if (c == '\r') {
+                    chunk_state_ = ChunkState::SIZE_LF;
+                } else {
+                    fail("Bad chunk size");
+                }
+                break;
+            }
+
+            case ChunkState::EXTENSION:
+                if (c == '\r') {
+                    chunk_state_ = ChunkState::SIZE_LF;
+                } else if (c == '\n') {
+                    fail("Bad chunk extension");
+                }
+                break;
+
+            case ChunkState::SIZE_LF:
+                if (c != '\n') {
+                    fail("Chunk size line not ended by CRLF");
+                }
+                line_bytes_ = 0;
+                chunk_state_ = chunk_left_ == 0 ? ChunkState::TRAILER_START : ChunkState::DATA;
+                break;
+
+            case ChunkState::DATA_CR:
+                if (c != '\r') {
+                    fail("Chunk data not followed by CRLF");
+                }
+                chunk_state_ = ChunkState::DATA_LF;
+                break;
+
+            case ChunkState::DATA_LF:
+                if (c != '\n') {
+                    fail("Chunk data not followed by CRLF");
+                }
+                chunk_state_ = ChunkState::SIZE;
+                size_digits_ = 0;
+                break;
+
+            case ChunkState::TRAILER_START:
+                chunk_state_ = c == '\r' ? ChunkState::TRAILER_END_LF : ChunkState::TRAILER_LINE;
+                break;
+
+            case ChunkState::TRAILER_LINE:
+                if (c == '\n') {
+                    chunk_state_ = ChunkState::TRAILER_START;
+                }
+                break;
+
+            case ChunkState::TRAILER_END_LF:
+                if (c != '\n') {
+                    fail("Trailer section not ended by CRLF");
+                }
+                chunk_state_ = ChunkState::DONE;
+                break;
+
+            case ChunkState::DATA:
+            case ChunkState::DONE:
+                break;
+        }
+
+        // Size lines and trailers are bounded; a client that never ends
+        // one is broken or hostile
+        if (chunk_state_ == ChunkState::SIZE || chunk_state_ == ChunkState::EXTENSION) {
+            if (++line_bytes_ > MAX_LINE) {
+                fail("Chunk size line too long");
+            }
+        } else if (chunk_state_ == ChunkState::TRAILER_START ||
+                   chunk_state_ == ChunkState::TRAILER_LINE) {
+            if (++trailer_bytes_ > MAX_TRAILERS) {
+                fail("Trailer section too large");
+            }
+        }
+        if (failed_) {
+            break;
+        }
+    }
+    return used;
+}
+
+size_t RequestBody::feed(const char* data, size_t length,
+                         const std::function<void(const char*, size_t)>& on_data) {
+    size_t used = 0;
+    while (used < length && !done() && !failed_) {
+        uint64_t available = dataAvailable();
+        if (available > 0) {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(available, length - used));
+            on_data(data + used, take);
+            consumeData(take);
+            used += take;
+        } else {
+            size_t parsed = parseFraming(data + used, length - used);
+            if (parsed == 0) {
+                break;
+            }
+            used += parsed;
+        }
+    }
+    return used;
+}
+
+bool RequestBody::done() const {
+    switch (framing_) {
+        case Framing::LENGTH:
+            return received_ == length_;
+        case Framing::CHUNKED:
+            return chunk_state_ == ChunkState::DONE;
+        case Framing::CLOSE:
+            return ended_;
+        case Framing::NONE:
+            break;
+    }
+    return true;
+}
+
+bool RequestBody::failed() const {
+    return failed_;
+}
+
+uint64_t RequestBody::received() const {
+    return received_;
+}
+
+const std::string& RequestBody::getErrorMessage() const {
+    return error_message_;
+}
+
+bool RequestBody::fail(const char* message) {
+    failed_ = true;
+    error_message_ = message;
+    return false;
+}
+
+BodyPipe::BodyPipe()
+    : read_fd_(-1)
+    , write_fd_(-1)
+    , buffered_(0) {
+}
+
+BodyPipe::~BodyPipe() {
+    if (read_fd_ >= 0) {
+        close(read_fd_);
+        close(write_fd_);
+    }
+}
+
+bool BodyPipe::open() {
+    if (read_fd_ >= 0) {
+        return true;
+    }
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        return false;
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+    // Best effort; a smaller pipe only means more splices
+    fcntl(write_fd_, F_SETPIPE_SZ, PIPE_SIZE);
+    return true;
+}
+
+ssize_t BodyPipe::fill(int fd, size_t max_bytes) {
+    ssize_t n = splice(fd, nullptr, write_fd_, nullptr, max_bytes,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+        buffered_ += static_cast<size_t>(n);
+    }
+    return n;
+}
+
+ssize_t BodyPipe::readFrom(int fd, RequestBody& body, size_t max_bytes) {
+    uint64_t available = body.dataAvailable();
+    if (available > 0) {
+        ssize_t n = fill(fd, static_cast<size_t>(std::min<uint64_t>(available, max_bytes)));
+        if (n > 0) {
+            body.consumeData(static_cast<uint64_t>(n));
+        }
+        return n;
+    }
+
+    char buffer[512];
+    ssize_t n = recv(fd, buffer, std::min(sizeof(buffer), max_bytes), MSG_PEEK);
+    if (n <= 0) {
+        return n;
+    }
+    size_t used = body.parseFraming(buffer, static_cast<size_t>(n));
+    if (body.failed()) {
+        errno = EPROTO;
+        return -1;
+    }
+    return recv(fd, buffer, used, 0);
+}
+
+bool BodyPipe::discard() {
+    while (buffered_ > 0) {
+        ssize_t n = splice(read_fd_, nullptr, devNull(), nullptr, buffered_,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n <= 0) {
+            return false;
+        }
+        buffered_ -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+int BodyPipe::readFd() const {
+    return read_fd_;
+}
+
+void BodyPipe::consumed(size_t n) {
+    buffered_ -= std::min(n, buffered_);
+}
+
+size_t BodyPipe::buffered() const {
+    return buffered_;
+}
+
+EchoSource::EchoSource(std::string prefix, const RequestBody* body, BodyPipe* pipe)
+    : prefix_(std::move(prefix))
+    , prefix_sent_(0)
+    , body_(body)
+    , pipe_(pipe)
+    , chunked_(body->length() == UNKNOWN_LENGTH)
+    , framing_sent_(0)
+    , chunk_left_(0)
+    , data_sent_(0)
+    , finished_(false) {
+}
+
+size_t EchoSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    startChunk();
+    if (max_segments == 0 || max_bytes == 0) {
+        return 0;
+    }
+
+    if (framing_sent_ < framing_.length()) {
+        segments[0].iov_base = &framing_[framing_sent_];
+        segments[0].iov_len = std::min(framing_.length() - framing_sent_, max_bytes);
+        return 1;
+    }
+    uint64_t left = dataLeft();
+    if (prefix_sent_ < prefix_.length() && left > 0) {
+        segments[0].iov_base = &prefix_[prefix_sent_];
+        segments[0].iov_len = static_cast<size_t>(
+            std::min<uint64_t>(std::min(prefix_.length() - prefix_sent_, max_bytes), left));
+        return 1;
+    }
+    // The rest is in the pipe (see peekPipe) or not here yet
+    return 0;
+}
+
+bool EchoSource::peekPipe(int& fd, size_t& length, size_t max_bytes) {
+    startChunk();
+    if (framing_sent_ < framing_.length() || prefix_sent_ < prefix_.length() ||
+        pipe_->buffered() == 0) {
+        return false;
+    }
+    length = static_cast<size_t>(
+        std::min<uint64_t>(std::min(pipe_->buffered(), max_bytes), dataLeft()));
+    fd = pipe_->readFd();
+    return length > 0;
+}
+
+void EchoSource::consume(size_t n) {
+    if (framing_sent_ < framing_.length()) {
+        framing_sent_ += n;
+        return;
+    }
+    if (prefix_sent_ < prefix_.length()) {
+        prefix_sent_ += n;
+    } else {
+        pipe_->consumed(n);
+    }
+    data_sent_ += n;
+    if (chunked_) {
+        chunk_left_ -= std::min<uint64_t>(n, chunk_left_);
+        if (chunk_left_ == 0) {
+            framing_ = "\r\n";
+            framing_sent_ = 0;
+        }
+    }
+}
+
+bool EchoSource::done() const {
+    if (chunked_) {
+        return finished_ && framing_sent_ == framing_.length();
+    }
+    return data_sent_ >= body_->length();
+}
+
+uint64_t EchoSource::length() const {
+    return chunked_ ? UNKNOWN_LENGTH : body_->length();
+}
+
+bool EchoSource::blocked() const {
+    if (done() || framing_sent_ < framing_.length()) {
+        return false;
+    }
+    if (chunked_ && chunk_left_ == 0) {
+        // Either a new chunk or the last one can start
+        return dataBuffered() == 0 && !body_->done();
+    }
+    return dataBuffered() == 0;
+}
+
+uint64_t EchoSource::dataBuffered() const {
+    return (prefix_.length() - prefix_sent_) + pipe_->buffered();
+}
+
+uint64_t EchoSource::dataLeft() const {
+    return chunked_ ? chunk_left_ : body_->length() - data_sent_;
+}
+
+void EchoSource::startChunk() {
+    if (!chunked_ || finished_ || chunk_left_ > 0 || framing_sent_ < framing_.length()) {
+        return;
+    }
+    // Each chunk is whatever has arrived; the body's own chunk sizes are
+    // not kept
+    uint64_t available = dataBuffered();
+    if (available > 0) {
+        char line[32];
+        snprintf(line, sizeof(line), "%llx\r\n", static_cast<unsigned long long>(available));
+        framing_ = line;
+        chunk_left_ = available;
+    } else if (body_->done()) {
+        framing_ = "0\r\n\r\n";
+        finished_ = true;
+    } else {
+        return;
+    }
+    framing_sent_ = 0;
+}
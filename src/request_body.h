@@ -0,0 +1,164 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+#include "http_parser.h"
+#include "response_source.h"
+
+// Framing of a request body (RFC 9112 section 6): Content-Length, chunked
+// or none. Only framing bytes are parsed; data bytes are just counted, so
+// the caller can move them without looking at them (see BodyPipe).
+// Upstream responses (--upstream) are framed the same way, plus bodies
+// that run until the connection closes.
+class RequestBody {
+public:
+    enum class Framing { NONE, LENGTH, CHUNKED, CLOSE };
+
+    // Longest chunk size line, and most trailer bytes, accepted
+    static constexpr size_t MAX_LINE = 4096;
+    static constexpr size_t MAX_TRAILERS = 64 * 1024;
+
+    RequestBody();
+
+    // Reads the framing from the request headers. False (see
+    // getErrorMessage()) for a Content-Length that is not a number or a
+    // Transfer-Encoding that does not end in chunked.
+    bool begin(const HttpRequest& request);
+
+    // The same for a response to a request (RFC 9112 section 6.3): no body
+    // for HEAD, 1xx, 204 and 304; without a usable length the body ends
+    // when the connection does
+    bool beginResponse(int status_code, bool head_request, const std::string& transfer_encoding,
+                       const std::string& content_length);
+
+    // The stream ended: a CLOSE body is complete, any other that is not
+    // done fails
+    void finish();
+
+    Framing framing() const;
+
+    // Content-Length; UNKNOWN_LENGTH for chunked and CLOSE bodies
+    uint64_t length() const;
+
+    // Data bytes that come next in the stream, before any framing byte
+    uint64_t dataAvailable() const;
+    void consumeData(uint64_t n);
+
+    // Parses framing bytes from the start of data and returns how many it
+    // used: it stops at the first data byte, at the end of the body, or at
+    // an error (see failed())
+    size_t parseFraming(const char* data, size_t length);
+
+    // Both at once, for bytes already in memory: on_data gets every run of
+    // body data. Returns the bytes used; bytes after the body are left.
+    size_t feed(const char* data, size_t length,
+                const std::function<void(const char*, size_t)>& on_data);
+
+    bool done() const;
+    bool failed() const;
+
+    // Data bytes so far
+    uint64_t received() const;
+
+    const std::string& getErrorMessage() const;
+
+private:
+    enum class ChunkState {
+        SIZE, EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF,
+        TRAILER_START, TRAILER_LINE, TRAILER_END_LF, DONE
+    };
+
+    Framing framing_;
+    uint64_t length_;
+    uint64_t received_;
+    ChunkState chunk_state_;
+    uint64_t chunk_left_;
+    size_t size_digits_;
+    size_t line_bytes_;
+    size_t trailer_bytes_;
+    bool ended_;        // A CLOSE body saw the end of the stream
+    bool failed_;
+    std::string error_message_;
+
+    bool fail(const char* message);
+    bool beginFraming(const std::string& transfer_encoding, const std::string& content_length,
+                      bool response);
+};
+
+// A pipe that moves body bytes between descriptors inside the kernel with
+// splice(2): uploads are discarded into /dev/null and echoes go from the
+// request socket to the response socket without a copy to user space.
+class BodyPipe {
+public:
+    BodyPipe();
+    ~BodyPipe();
+
+    BodyPipe(const BodyPipe&) = delete;
+    BodyPipe& operator=(const BodyPipe&) = delete;
+
+    // Creates the pipe on first use; false if that failed
+    bool open();
+
+    // Moves up to max_bytes from fd into the pipe; returns as splice() does
+    ssize_t fill(int fd, size_t max_bytes);
+
+    // Takes up to max_bytes of body from fd: data goes into the pipe, chunk
+    // framing is peeked at and only the bytes it used are read. Returns the
+    // bytes taken, 0 at the end of the stream or -1 with errno set; bad
+    // framing is -1 with body.failed().
+    ssize_t readFrom(int fd, RequestBody& body, size_t max_bytes);
+
+    // Drops everything in the pipe; false if /dev/null could not take it
+    bool discard();
+
+    // Read end, for splicing the contents onward; report what went with
+    // consumed()
+    int readFd() const;
+    void consumed(size_t n);
+
+    size_t buffered() const;
+
+private:
+    int read_fd_;
+    int write_fd_;
+    size_t buffered_;
+};
+
+// The request body as the response body, for request_body=echo, or an
+// upstream response body being relayed. Bytes the parser already read come
+// from memory; the rest is spliced from the pipe as it arrives. Bodies of
+// unknown length are sent chunked, one chunk per run of buffered data;
+// others keep their Content-Length.
+class EchoSource : public ResponseSource {
+public:
+    // body and pipe belong to the connection and outlive the source
+    EchoSource(std::string prefix, const RequestBody* body, BodyPipe* pipe);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+    bool peekPipe(int& fd, size_t& length, size_t max_bytes) override;
+    bool blocked() const override;
+
+private:
+    std::string prefix_;
+    size_t prefix_sent_;
+    const RequestBody* body_;
+    BodyPipe* pipe_;
+    bool chunked_;
+    std::string framing_;       // Chunk size line, CRLF or last chunk
+    size_t framing_sent_;
+    uint64_t chunk_left_;       // Data bytes left in the current chunk
+    uint64_t data_sent_;
+    bool finished_;
+
+    uint64_t dataBuffered() const;
+    uint64_t dataLeft() const;
+    void startChunk();
+};
+
+#endif // REQUEST_BODY_H
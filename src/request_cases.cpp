@@ -0,0 +1,191 @@
+#include "request_cases.h"
+
+RequestTemplate::RequestTemplate()
+    : method("GET")
+    , target("/")
+    , version("HTTP/1.1")
+    , line_end("\r\n") {
+}
+
+RequestTemplate RequestTemplate::get(const std::string& host, const std::string& target) {
+    RequestTemplate request;
+    request.target = target;
+    request.headers.push_back("Host: " + host);
+    request.headers.push_back("User-Agent: stitch-client");
+    return request;
+}
+
+std::string RequestTemplate::serialize() const {
+    std::string out = method + " " + target;
+    if (!version.empty()) {
+        out += " " + version;
+    }
+    out += line_end;
+    for (const std::string& header : headers) {
+        out += header + line_end;
+    }
+    return out + line_end + body;
+}
+
+namespace {
+
+RequestCase makeCase(const char* name, const char* summary, const RequestTemplate& request) {
+    return RequestCase{name, summary, request.serialize(), false, ""};
+}
+
+} // namespace
+
+std::vector<RequestCase> RequestCases::catalog(const std::string& host, const std::string& path,
+                                               size_t oversize) {
+    const RequestTemplate base = RequestTemplate::get(host, path);
+    std::vector<RequestCase> cases;
+    cases.push_back(makeCase("valid", "Well-formed GET, for comparison", base));
+
+    // Request line
+    RequestTemplate request = base;
+    request.method = "G@T";
+    cases.push_back(makeCase("bad_method", "Method with a character outside token", request));
+
+    request = base;
+    request.version = "HTTX/1.1";
+    cases.push_back(makeCase("bad_version", "Version that is not HTTP/x.y", request));
+
+    request = base;
+    request.version.clear();
+    cases.push_back(makeCase("missing_version", "Request line without a version", request));
+
+    request = base;
+    request.method = "GET ";
+    request.target = " " + path;
+    cases.push_back(makeCase("extra_spaces", "Runs of spaces between request line parts", request));
+
+    request = base;
+    request.target = path + (path.find('?') == std::string::npos ? "?" : "&") + "a=" +
+                     std::string(oversize, 'a');
+    cases.push_back(makeCase("oversized_uri", "Request target of the oversize length", request));
+
+    // Header injection and bad header syntax
+    request = base;
+    request.headers.push_back("X-Stitch-Case: a\rX-Injected: 1");
+    cases.push_back(makeCase("bare_cr", "Bare CR inside a header value", request));
+
+    request = base;
+    request.headers.push_back(std::string("X-Stitch-Case: a\0b", 18));
+    cases.push_back(makeCase("nul_in_header", "NUL byte inside a header value", request));
+
+    request = base;
+    request.headers.push_back("X-Stitch-Case: a");
+    request.headers.push_back(" X-Injected: 1");
+    cases.push_back(makeCase("obs_fold", "Obsolete line folding", request));
+
+    request = base;
+    request.headers[0] = "Host : " + host;
+    cases.push_back(makeCase("space_before_colon", "Whitespace between a header name and colon",
+                             request));
+
+    request = base;
+    request.headers.erase(request.headers.begin());
+    cases.push_back(makeCase("missing_host", "HTTP/1.1 request without Host", request));
+
+    request = base;
+    request.headers.push_back("Host: injected.invalid");
+    cases.push_back(makeCase("duplicate_host", "Two Host headers that disagree", request));
+
+    request = base;
+    request.headers.push_back("X-Stitch-Case: " + std::string(oversize, 'a'));
+    cases.push_back(makeCase("oversized_header", "Header value of the oversize length", request));
+
+    request = base;
+    for (int i = 0; i < 10000; ++i) {
+        request.headers.push_back("X-Stitch-" + std::to_string(i) + ": 1");
+    }
+    cases.push_back(makeCase("many_headers", "10000 small headers", request));
+
+    // Framing that disagrees with itself: the request smuggling classics
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Content-Length: 6");
+    request.headers.push_back("Transfer-Encoding: chunked");
+    request.body = "0\r\n\r\nG";
+    cases.push_back(makeCase("cl_te", "Content-Length and chunked together (CL.TE)", request));
+
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Content-Length: 5");
+    request.headers.push_back("Content-Length: 6");
+    request.body = "hello!";
+    cases.push_back(makeCase("duplicate_cl", "Two Content-Length headers that disagree", request));
+
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Content-Length: 5x");
+    request.body = "hello";
+    cases.push_back(makeCase("bad_cl", "Content-Length that is not a number", request));
+
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Transfer-Encoding: gzip");
+    request.body = "hello";
+    cases.push_back(makeCase("te_not_chunked", "Transfer-Encoding that does not end in chunked",
+                             request));
+
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Transfer-Encoding: xchunked");
+    request.body = "5\r\nhello\r\n0\r\n\r\n";
+    cases.push_back(makeCase("te_obfuscated", "Transfer-Encoding that only looks chunked",
+                             request));
+
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Transfer-Encoding: chunked");
+    request.body = "zz\r\nhello\r\n0\r\n\r\n";
+    cases.push_back(makeCase("bad_chunk_size", "Chunk size that is not hex", request));
+
+    // Slow clients: the head, or the body, never ends
+    std::string head = base.serialize();
+    head.resize(head.size() - base.line_end.size());
+    cases.push_back(RequestCase{"slowloris", "Headers dripped without end", head, true,
+                                "X-Stitch-Drip: 1\r\n"});
+
+    request = base;
+    request.method = "POST";
+    request.headers.push_back("Content-Length: 1000000000");
+    cases.push_back(RequestCase{"slow_post", "Body dripped without end", request.serialize(), true,
+                                "x"});
+    return cases;
+}
+
+bool RequestCases::select(const std::vector<RequestCase>& all, const std::string& names,
+                          std::vector<RequestCase>& selected, std::string& error) {
+    selected.clear();
+    size_t start = 0;
+    while (start <= names.length()) {
+        size_t comma = names.find(',', start);
+        if (comma == std::string::npos) {
+            comma = names.length();
+        }
+        std::string name = names.substr(start, comma - start);
+        start = comma + 1;
+        if (name.empty()) {
+            continue;
+        }
+        bool found = false;
+        for (const RequestCase& request_case : all) {
+            if (request_case.name == name) {
+                selected.push_back(request_case);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            error = "Unknown case: " + name;
+            return false;
+        }
+    }
+    if (selected.empty()) {
+        error = "No cases selected";
+        return false;
+    }
+    return true;
+}
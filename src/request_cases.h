@@ -0,0 +1,54 @@
+#ifndef REQUEST_CASES_H
+#define REQUEST_CASES_H
+
+#include <string>
+#include <vector>
+
+// A request as stitch-client writes it. Every part is sent exactly as
+// given, so a case can break any of them.
+class RequestTemplate {
+public:
+    std::string method;
+    std::string target;
+    std::string version;                // Empty: no version on the request line
+    std::vector<std::string> headers;   // Whole lines, without line endings
+    std::string line_end;
+    std::string body;
+
+    RequestTemplate();
+
+    // A well-formed GET of target with Host set
+    static RequestTemplate get(const std::string& host, const std::string& target);
+
+    std::string serialize() const;
+};
+
+// One malformed (or deliberately well-formed) request that stitch-client
+// sends to the proxy under test
+struct RequestCase {
+    std::string name;
+    std::string summary;
+    std::string bytes;
+
+    // After bytes, drip_repeat follows without end, a byte at a time at the
+    // client's drip rate: the request never completes
+    bool drip;
+    std::string drip_repeat;
+};
+
+class RequestCases {
+public:
+    static constexpr size_t DEFAULT_OVERSIZE = 64 * 1024;
+
+    // Every case, in a fixed order; oversize is the length of the oversized
+    // URI and header
+    static std::vector<RequestCase> catalog(const std::string& host, const std::string& path,
+                                            size_t oversize = DEFAULT_OVERSIZE);
+
+    // The cases named in a comma-separated list, in list order; false with
+    // error set for an unknown name
+    static bool select(const std::vector<RequestCase>& all, const std::string& names,
+                       std::vector<RequestCase>& selected, std::string& error);
+};
+
+#endif // REQUEST_CASES_H
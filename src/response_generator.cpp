@@ -1,10 +1,48 @@
 #include "response_generator.h"
+#include "compression.h"
+#include <algorithm>
 #include <sstream>
 
-ResponseGenerator::ResponseGenerator() {
+ResponseGenerator::ResponseGenerator()
+    : corpus_(nullptr) {
 }
 
-HttpResponse ResponseGenerator::generate(const TestCommand& cmd) {
+ResponseGenerator::ResponseGenerator(const Corpus* corpus)
+    : corpus_(corpus) {
+}
+
+namespace {
+
+// Separates multipart/byteranges parts; fixed so responses are reproducible
+const char* const RANGE_BOUNDARY = "STITCH_BYTERANGES_5f3a9c1e";
+
+// Appends everything source produces to out
+void drain(ResponseSource& source, std::string& out) {
+    struct iovec segments[16];
+    while (!source.done()) {
+        size_t count = source.peek(segments, 16, SIZE_MAX);
+        if (count == 0) {
+            break;
+        }
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            out.append(static_cast<const char*>(segments[i].iov_base), segments[i].iov_len);
+            bytes += segments[i].iov_len;
+        }
+        source.consume(bytes);
+    }
+}
+
+// Header fields common to every factory
+void initHeaderFlood(HttpResponse& response) {
+    response.header_repeats = 0;
+    response.fill_headers = 0;
+    response.fill_header_size = 0;
+}
+
+} // namespace
+
+HttpResponse ResponseGenerator::generate(const TestCommand& cmd, const std::string& range_header) {
     HttpResponse response;
 
     // Initialize with defaults
@@ -13,12 +51,24 @@ HttpResponse ResponseGenerator::generate(const TestCommand& cmd) {
     response.wrong_content_length = false;
     response.wrong_content_length_value = 0;
     response.malform_chunking = false;
+    response.body_size = 0;
+    response.body_seeded = false;
+    response.body_seed = 0;
+    response.file = nullptr;
+    response.encoding = ContentEncoding::IDENTITY;
+    response.encoding_fault = EncodingFault::NONE;
+    initHeaderFlood(response);
+    response.echo_body = false;
+    response.echo_length = 0;
 
     switch (cmd.behavior) {
         case BehaviorType::NORMAL:
             response.status_code = 200;
             response.reason_phrase = "OK";
             response.body = cmd.body_content;
+            response.body_size = cmd.body_size;
+            response.body_seeded = cmd.body_seeded;
+            response.body_seed = cmd.body_seed;
             break;
 
         case BehaviorType::ERROR_RESPONSE:
@@ -54,6 +104,15 @@ HttpResponse ResponseGenerator::generate(const TestCommand& cmd) {
             response.reason_phrase = "OK";
             response.body = "Malformed chunking test";
             response.malform_chunking = true;
+            // Real chunked framing with one broken piece; bad_hex unless the
+            // query chose another chunk fault
+            response.chunks = cmd.chunks;
+            if (!response.chunks.active()) {
+                response.chunks.mode = ChunkPlan::Mode::FIXED;
+            }
+            if (response.chunks.fault == ChunkPlan::Fault::NONE) {
+                response.chunks.fault = ChunkPlan::Fault::BAD_HEX;
+            }
             break;
 
         default:
@@ -62,28 +121,340 @@ HttpResponse ResponseGenerator::generate(const TestCommand& cmd) {
             response.status_code = 200;
             response.reason_phrase = "OK";
             response.body = cmd.body_content;
+            response.body_size = cmd.body_size;
+            response.body_seeded = cmd.body_seeded;
+            response.body_seed = cmd.body_seed;
             break;
     }
 
+    // request_body=echo: the handler supplies the bytes (see EchoSource) and
+    // they keep the request's framing
+    if (echoes(cmd)) {
+        response.echo_body = true;
+        response.body.clear();
+        response.body_size = 0;
+    }
+
+    // wrong_length defines its own framing
+    if (!response.wrong_content_length && !response.malform_chunking && !response.echo_body) {
+        response.chunks = cmd.chunks;
+    }
+
+    // A corpus file replaces whatever body the behavior would have sent
+    if (!cmd.file.empty() && !response.echo_body) {
+        response.file = corpus_ != nullptr ? corpus_->find(cmd.file) : nullptr;
+        if (response.file == nullptr) {
+            return createErrorResponse(404, "Not Found");
+        }
+        response.body.clear();
+        response.body_size = 0;
+        response.headers["Content-Type"] = response.file->content_type;
+        if (response.wrong_content_length) {
+            // Claim one byte more than the file so the client waits for it
+            response.wrong_content_length_value = response.file->size + 1;
+        }
+    }
+
+    // Encoded bodies are compressed whole, by the caller (see
+    // CompressionCache); Range does not apply to them
+    bool encodable = response.status_code == 200 && !response.wrong_content_length &&
+                     !response.malform_chunking && !response.echo_body &&
+                     Compressor::supports(cmd.encoding);
+    if (encodable) {
+        response.encoding = cmd.encoding;
+        response.encoding_fault = cmd.encoding_fault;
+    } else if (!range_header.empty()) {
+        applyRange(response, cmd.range_fault, range_header);
+    }
+
+    // Tell the client how to check the body; see BodyPattern. Parts of a
+    // multipart body are checked one by one against their Content-Range.
+    if (response.body_size > 0 && response.body_seeded && response.part_heads.empty()) {
+        uint64_t offset = response.ranges.empty() ? 0 : response.ranges[0].first;
+        uint64_t length = response.ranges.empty() ? response.body_size
+                                                  : response.ranges[0].length();
+        response.headers["X-Stitch-Pattern"] =
+            BodyPattern::describe(response.body_seed, offset, length);
+    }
+
+    applyHeaderFlood(cmd, response);
+    return response;
+}
+
+HttpResponse ResponseGenerator::relay(const TestCommand& cmd, const UpstreamResponse& upstream,
+                                      uint64_t body_length) {
+    HttpResponse response = createOkResponse("");
+    response.status_code = upstream.getStatusCode();
+    response.reason_phrase = upstream.getReasonPhrase();
+    response.relayed_headers = upstream.getHeaderLines();
+    response.echo_body = true;
+    response.echo_length = body_length;
+
+    // Malformations go on top of what the backend sent; a wrong length
+    // claims one byte more, so the client waits for it
+    response.malform_status_line = cmd.behavior == BehaviorType::INVALID_STATUS_LINE;
+    response.malform_headers = cmd.behavior == BehaviorType::INVALID_HEADERS;
+    if (cmd.behavior == BehaviorType::WRONG_CONTENT_LENGTH &&
+        body_length != ResponseSource::UNKNOWN_LENGTH) {
+        response.wrong_content_length = true;
+        response.wrong_content_length_value = body_length + 1;
+    }
+    applyHeaderFlood(cmd, response);
     return response;
 }
 
+void ResponseGenerator::applyHeaderFlood(const TestCommand& cmd, HttpResponse& response) {
+    // Header floods go with whatever else the response is doing; repeated
+    // headers without h. names repeat a marker of our own
+    for (const auto& header : cmd.headers) {
+        response.header_lines += header.first + ": " + header.second + "\r\n";
+    }
+    if (response.header_lines.empty() && cmd.duplicate_headers > 1) {
+        response.header_lines = "X-Stitch-Duplicate: 1\r\n";
+    }
+    response.header_repeats = cmd.duplicate_headers;
+    response.fill_headers = cmd.header_count;
+    response.fill_header_size = cmd.header_size;
+}
+
+void ResponseGenerator::applyRange(HttpResponse& response, RangeFault fault,
+                                   const std::string& range_header) {
+    // Only bodies that can start anywhere are served partially, and only
+    // when the response is otherwise a plain 200
+    bool seekable = response.file != nullptr || response.body_size > 0;
+    if (!seekable || response.status_code != 200 || response.wrong_content_length ||
+        response.malform_chunking || fault == RangeFault::IGNORE) {
+        return;
+    }
+
+    uint64_t length = response.file != nullptr ? response.file->size : response.body_size;
+    std::vector<ByteRange> ranges;
+    switch (RangeRequest::parse(range_header, length, ranges)) {
+        case RangeRequest::Result::IGNORED:
+            return;
+
+        case RangeRequest::Result::UNSATISFIABLE:
+            response.status_code = 416;
+            response.reason_phrase = "Range Not Satisfiable";
+            response.body = response.reason_phrase;
+            response.body_size = 0;
+            response.file = nullptr;
+            response.chunks = ChunkPlan();
+            response.headers.erase("Content-Type");
+            response.headers["Content-Range"] = "bytes */" + std::to_string(length);
+            return;
+
+        case RangeRequest::Result::SATISFIABLE:
+            break;
+    }
+
+    if (fault == RangeFault::OVERLAP) {
+        // Each part starts halfway into the previous one; a single range
+        // is sent twice
+        if (ranges.size() == 1) {
+            ranges.push_back(ranges[0]);
+        }
+        for (size_t i = 1; i < ranges.size(); ++i) {
+            ranges[i].first = ranges[i - 1].first + ranges[i - 1].length() / 2;
+            ranges[i].last = std::max(ranges[i].last, ranges[i].first);
+        }
+    }
+
+    // wrong_range labels the bytes as if they started one later
+    auto label = [length, fault](ByteRange range) {
+        if (fault == RangeFault::WRONG_RANGE) {
+            range.first++;
+            range.last++;
+        }
+        return RangeRequest::contentRange(range, length);
+    };
+
+    response.status_code = 206;
+    response.reason_phrase = "Partial Content";
+    if (ranges.size() == 1 && fault != RangeFault::MULTIPART) {
+        response.headers["Content-Range"] = label(ranges[0]);
+    } else {
+        auto type_it = response.headers.find("Content-Type");
+        std::string part_type = type_it != response.headers.end() ? type_it->second
+                                                                  : "application/octet-stream";
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            response.part_heads.push_back(std::string(i > 0 ? "\r\n" : "") + "--" +
+                                          RANGE_BOUNDARY + "\r\nContent-Type: " + part_type +
+                                          "\r\nContent-Range: " + label(ranges[i]) + "\r\n\r\n");
+        }
+        response.parts_tail = std::string("\r\n--") + RANGE_BOUNDARY + "--\r\n";
+        response.headers["Content-Type"] =
+            std::string("multipart/byteranges; boundary=") + RANGE_BOUNDARY;
+    }
+    response.ranges = std::move(ranges);
+}
+
 std::string ResponseGenerator::serialize(const HttpResponse& response) {
+    std::string result = serializeHead(response);
+
+    // Drain the body stream so both paths produce identical bytes
+    drain(*streamBody(response), result);
+    return result;
+}
+
+std::string ResponseGenerator::serializeHead(const HttpResponse& response) {
     std::string result;
+    drain(*streamHead(response), result);
+    return result;
+}
 
-    // Serialize status line
-    result += serializeStatusLine(response);
+std::unique_ptr<ResponseSource> ResponseGenerator::streamHead(const HttpResponse& response) {
+    // Status line, headers, end of headers
+    std::string head = serializeStatusLine(response) + serializeHeaders(response);
+    bool flood = (!response.header_lines.empty() && response.header_repeats > 0) ||
+                 response.fill_headers > 0;
+    if (!flood) {
+        return std::make_unique<StringSource>(head + "\r\n");
+    }
 
-    // Serialize headers
-    result += serializeHeaders(response);
+    auto source = std::make_unique<ConcatSource>();
+    source->append(std::make_unique<StringSource>(std::move(head)));
+    source->append(std::make_unique<HeaderFloodSource>(response.header_lines,
+                                                       response.header_repeats,
+                                                       response.fill_headers,
+                                                       response.fill_header_size));
+    source->append(std::make_unique<StringSource>("\r\n"));
+    return source;
+}
 
-    // End of headers
-    result += "\r\n";
+std::unique_ptr<ResponseSource> ResponseGenerator::streamBody(const HttpResponse& response) {
+    std::unique_ptr<ResponseSource> body;
+    if (!response.part_heads.empty()) {
+        // Each range is produced from its own offset, so nothing between
+        // or around the ranges is ever generated or read
+        auto parts = std::make_unique<ConcatSource>();
+        for (size_t i = 0; i < response.ranges.size(); ++i) {
+            parts->append(std::make_unique<StringSource>(response.part_heads[i]));
+            parts->append(bodySlice(response, response.ranges[i].first,
+                                    response.ranges[i].length()));
+        }
+        parts->append(std::make_unique<StringSource>(response.parts_tail));
+        body = std::move(parts);
+    } else if (!response.ranges.empty()) {
+        body = bodySlice(response, response.ranges[0].first, response.ranges[0].length());
+    } else if (response.encoded) {
+        body = encodedBody(response);
+    } else if (response.echo_body) {
+        // Only a connection has the request body to send
+        body = std::make_unique<StringSource>("");
+    } else {
+        body = rawBody(response);
+    }
 
-    // Serialize body
-    result += serializeBody(response);
+    if (response.chunks.active()) {
+        body = std::make_unique<ChunkedSource>(std::move(body), response.chunks);
+    }
+    return body;
+}
 
-    return result;
+std::unique_ptr<ResponseSource> ResponseGenerator::rawBody(const HttpResponse& response) {
+    if (response.file != nullptr || response.body_size > 0) {
+        return bodySlice(response, 0, rawBodyLength(response));
+    }
+    return std::make_unique<StringSource>(serializeBody(response));
+}
+
+uint64_t ResponseGenerator::rawBodyLength(const HttpResponse& response) {
+    if (response.file != nullptr) {
+        return response.file->size;
+    }
+    return response.body_size > 0 ? response.body_size : response.body.length();
+}
+
+std::string ResponseGenerator::bodyKey(const HttpResponse& response) {
+    if (response.file != nullptr) {
+        return "file:" + response.file->name;
+    } else if (response.body_size > 0 && response.body_seeded) {
+        return "seeded:" + std::to_string(response.body_seed) + ":" +
+               std::to_string(response.body_size);
+    } else if (response.body_size > 0) {
+        return "pattern:" + std::to_string(response.body_size);
+    }
+    return "body:" + response.body;
+}
+
+bool ResponseGenerator::echoes(const TestCommand& cmd) {
+    if (cmd.request_body != RequestBodyMode::ECHO) {
+        return false;
+    }
+    switch (cmd.behavior) {
+        case BehaviorType::NORMAL:
+        case BehaviorType::CLOSE_AFTER_HEADERS:
+        case BehaviorType::CLOSE_AFTER_PARTIAL:
+        case BehaviorType::SLOW_RESPONSE:
+        case BehaviorType::SLOW_HEADERS:
+        case BehaviorType::SLOW_BODY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ResponseGenerator::relays(const TestCommand& cmd) {
+    switch (cmd.behavior) {
+        case BehaviorType::NORMAL:
+        case BehaviorType::CLOSE_AFTER_HEADERS:
+        case BehaviorType::CLOSE_AFTER_PARTIAL:
+        case BehaviorType::SLOW_RESPONSE:
+        case BehaviorType::SLOW_HEADERS:
+        case BehaviorType::SLOW_BODY:
+        case BehaviorType::WRONG_CONTENT_LENGTH:
+        case BehaviorType::INVALID_HEADERS:
+        case BehaviorType::INVALID_STATUS_LINE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::unique_ptr<ResponseSource> ResponseGenerator::encodedBody(const HttpResponse& response) {
+    const std::shared_ptr<const std::string>& data = response.encoded;
+    size_t length = data->size();
+
+    // The cached body is shared, so a broken byte is sent from a copy of
+    // its own between two slices of the original
+    size_t broken = length;
+    switch (response.encoding_fault) {
+        case EncodingFault::TRUNCATE:
+            return std::make_unique<SharedSource>(data, 0, length / 2);
+        case EncodingFault::CORRUPT:
+            broken = length / 2;
+            break;
+        case EncodingFault::CHECKSUM:
+            // gzip ends in CRC-32 and size, zlib in Adler-32; brotli has no
+            // checksum, so its final byte goes instead
+            broken = response.encoding == ContentEncoding::GZIP && length >= 8 ? length - 8
+                                                                                : length - 1;
+            break;
+        case EncodingFault::NONE:
+        case EncodingFault::MISLABEL:
+            break;
+    }
+    if (broken >= length) {
+        return std::make_unique<SharedSource>(data, 0, length);
+    }
+
+    auto body = std::make_unique<ConcatSource>();
+    body->append(std::make_unique<SharedSource>(data, 0, broken));
+    char flipped = static_cast<char>((*data)[broken] ^ 0x01);
+    body->append(std::make_unique<StringSource>(std::string(1, flipped)));
+    body->append(std::make_unique<SharedSource>(data, broken + 1, length - broken - 1));
+    return body;
+}
+
+std::unique_ptr<ResponseSource> ResponseGenerator::bodySlice(const HttpResponse& response,
+                                                             uint64_t offset, uint64_t length) {
+    if (response.file != nullptr) {
+        return std::make_unique<FileSource>(response.file->fd, offset, length);
+    } else if (response.body_seeded) {
+        return std::make_unique<SeededPatternSource>(response.body_seed, length, offset);
+    }
+    return std::make_unique<PatternSource>(length, offset);
 }
 
 HttpResponse ResponseGenerator::createOkResponse(const std::string& body) {
@@ -96,6 +467,15 @@ HttpResponse ResponseGenerator::createOkResponse(const std::string& body) {
     response.wrong_content_length = false;
     response.wrong_content_length_value = 0;
     response.malform_chunking = false;
+    response.body_size = 0;
+    response.body_seeded = false;
+    response.body_seed = 0;
+    response.file = nullptr;
+    response.encoding = ContentEncoding::IDENTITY;
+    response.encoding_fault = EncodingFault::NONE;
+    initHeaderFlood(response);
+    response.echo_body = false;
+    response.echo_length = 0;
     return response;
 }
 
@@ -109,6 +489,15 @@ HttpResponse ResponseGenerator::createErrorResponse(int code, const std::string&
     response.wrong_content_length = false;
     response.wrong_content_length_value = 0;
     response.malform_chunking = false;
+    response.body_size = 0;
+    response.body_seeded = false;
+    response.body_seed = 0;
+    response.file = nullptr;
+    response.encoding = ContentEncoding::IDENTITY;
+    response.encoding_fault = EncodingFault::NONE;
+    initHeaderFlood(response);
+    response.echo_body = false;
+    response.echo_length = 0;
     return response;
 }
 
@@ -123,6 +512,15 @@ HttpResponse ResponseGenerator::createMalformedResponse(const TestCommand& cmd)
     response.wrong_content_length = false;
     response.wrong_content_length_value = 0;
     response.malform_chunking = false;
+    response.body_size = 0;
+    response.body_seeded = false;
+    response.body_seed = 0;
+    response.file = nullptr;
+    response.encoding = ContentEncoding::IDENTITY;
+    response.encoding_fault = EncodingFault::NONE;
+    initHeaderFlood(response);
+    response.echo_body = false;
+    response.echo_length = 0;
     return response;
 }
 
@@ -151,16 +549,43 @@ std::string ResponseGenerator::serializeHeaders(const HttpResponse& response) {
             oss << header.first << ": " << header.second << "\r\n";
         }
     }
+    oss << response.relayed_headers;
 
     // Add Content-Length header
-    if (!response.body.empty()) {
+    uint64_t body_length = response.echo_body ? response.echo_length : rawBodyLength(response);
+    if (response.encoded) {
+        // mislabel names a coding the body is not in
+        ContentEncoding label = response.encoding;
+        if (response.encoding_fault == EncodingFault::MISLABEL) {
+            label = label == ContentEncoding::GZIP ? ContentEncoding::DEFLATE
+                                                   : ContentEncoding::GZIP;
+        }
+        oss << "Content-Encoding: " << CommandInterpreter::encodingName(label) << "\r\n";
+        body_length = response.encoded->size();
+        if (response.encoding_fault == EncodingFault::TRUNCATE) {
+            body_length /= 2;
+        }
+    } else if (!response.ranges.empty()) {
+        body_length = response.parts_tail.length();
+        for (size_t i = 0; i < response.ranges.size(); ++i) {
+            body_length += response.ranges[i].length();
+            if (i < response.part_heads.size()) {
+                body_length += response.part_heads[i].length();
+            }
+        }
+    } else if (response.status_code == 200 && (response.file != nullptr || response.body_size > 0) &&
+               !response.wrong_content_length && !response.malform_chunking &&
+               response.encoding == ContentEncoding::IDENTITY) {
+        // Seekable bodies honour Range requests
+        oss << "Accept-Ranges: bytes\r\n";
+    }
+    if (response.chunks.active() || body_length == ResponseSource::UNKNOWN_LENGTH) {
+        oss << "Transfer-Encoding: chunked\r\n";
+    } else if (body_length > 0) {
         if (response.wrong_content_length) {
             oss << "Content-Length: " << response.wrong_content_length_value << "\r\n";
-        } else if (response.malform_chunking) {
-            // Use chunked encoding header
-            oss << "Transfer-Encoding: chunked\r\n";
         } else {
-            oss << "Content-Length: " << response.body.length() << "\r\n";
+            oss << "Content-Length: " << body_length << "\r\n";
         }
     }
 
@@ -168,12 +593,5 @@ std::string ResponseGenerator::serializeHeaders(const HttpResponse& response) {
 }
 
 std::string ResponseGenerator::serializeBody(const HttpResponse& response) {
-    if (response.malform_chunking) {
-        // Return malformed chunked encoding
-        // Valid format should be: <hex-size>\r\n<data>\r\n0\r\n\r\n
-        // We'll send something invalid
-        return "INVALID_CHUNK_SIZE\r\n" + response.body + "\r\n";
-    }
-
     return response.body;
 }
@@ -3,32 +3,100 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 #include "command_interpreter.h"
+#include "byte_range.h"
+#include "response_source.h"
+#include "corpus.h"
+#include "upstream.h"
 
 struct HttpResponse {
     int status_code;
     std::string reason_phrase;
     std::map<std::string, std::string> headers;
     std::string body;
+    uint64_t body_size;     // Synthetic pattern body of this length instead of body
+    bool body_seeded;       // Seeded BodyPattern instead of the cyclic pattern
+    uint64_t body_seed;
+    ChunkPlan chunks;       // Send the body chunked; mode OFF = Content-Length
+    const CorpusFile* file; // Corpus file as the body instead of body
+    std::vector<ByteRange> ranges;       // 206: only these bytes of the body
+    std::vector<std::string> part_heads; // multipart/byteranges: text before each range
+    std::string parts_tail;
+    ContentEncoding encoding;   // Coding to send the body in, once encoded is set
+    EncodingFault encoding_fault;
+    std::shared_ptr<const std::string> encoded; // The compressed body; null = as is
+    std::string header_lines;   // Extra "Name: value\r\n" lines, sent header_repeats times
+    uint64_t header_repeats;
+    uint64_t fill_headers;      // Generated X-Stitch-Fill-NNNNNN headers after them
+    uint64_t fill_header_size;
+    bool echo_body;             // The connection supplies the body: the request's
+                                // (request_body=echo) or the upstream's
+    uint64_t echo_length;       // Its length; UNKNOWN_LENGTH sends it chunked
+    std::string relayed_headers; // Upstream header lines, after headers
 
     bool malform_status_line;
     bool malform_headers;
     bool wrong_content_length;
-    int wrong_content_length_value;
+    uint64_t wrong_content_length_value;
     bool malform_chunking;
 };
 
 class ResponseGenerator {
 public:
     ResponseGenerator();
-    HttpResponse generate(const TestCommand& cmd);
+    // file= names are looked up in corpus; without one they answer 404
+    explicit ResponseGenerator(const Corpus* corpus);
+    // range_header: the request's Range value; it applies to synthetic and
+    // corpus bodies, which can be sent from any offset
+    HttpResponse generate(const TestCommand& cmd, const std::string& range_header = "");
     std::string serialize(const HttpResponse& response);
 
+    // Status line, headers and the blank line
+    std::string serializeHead(const HttpResponse& response);
+
+    // The same as a stream; header floods are sent from templates instead
+    // of being built
+    std::unique_ptr<ResponseSource> streamHead(const HttpResponse& response);
+
+    // The body as a stream, so large synthetic bodies are never built
+    std::unique_ptr<ResponseSource> streamBody(const HttpResponse& response);
+
+    // The whole body before any encoding, ranges or chunking, and its length
+    std::unique_ptr<ResponseSource> rawBody(const HttpResponse& response);
+    static uint64_t rawBodyLength(const HttpResponse& response);
+
+    // Identifies the raw body, for caching what is derived from it
+    static std::string bodyKey(const HttpResponse& response);
+
+    // Whether cmd sends the request body back; only behaviors whose body
+    // comes from the command do
+    static bool echoes(const TestCommand& cmd);
+
+    // Whether cmd, with --upstream, relays the upstream response: behaviors
+    // that bend a response rather than replace it
+    static bool relays(const TestCommand& cmd);
+
+    // The upstream response as cmd sends it on; the body (body_length
+    // bytes, UNKNOWN_LENGTH when unknown) comes from the connection
+    HttpResponse relay(const TestCommand& cmd, const UpstreamResponse& upstream,
+                       uint64_t body_length);
+
     static HttpResponse createOkResponse(const std::string& body);
     static HttpResponse createErrorResponse(int code, const std::string& reason);
     static HttpResponse createMalformedResponse(const TestCommand& cmd);
 
 private:
+    const Corpus* corpus_;
+
+    void applyRange(HttpResponse& response, RangeFault fault, const std::string& range_header);
+    static void applyHeaderFlood(const TestCommand& cmd, HttpResponse& response);
+    // Source for body bytes [offset, offset + length)
+    std::unique_ptr<ResponseSource> bodySlice(const HttpResponse& response, uint64_t offset,
+                                              uint64_t length);
+    std::unique_ptr<ResponseSource> encodedBody(const HttpResponse& response);
+
     std::string serializeStatusLine(const HttpResponse& response);
     std::string serializeHeaders(const HttpResponse& response);
     std::string serializeBody(const HttpResponse& response);
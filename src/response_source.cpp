@@ -0,0 +1,833 @@
+#include "response_source.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+const char CRLF[] = "\r\n";
+
+std::string hex(uint64_t value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%llx", static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+// PERIOD-byte alphabet repeated far enough that any window of up to
+// PATTERN_WINDOW bytes starting anywhere in the first period is contiguous
+constexpr size_t PATTERN_WINDOW = 64 * 1024;
+
+const char* patternTable() {
+    static const std::string table = [] {
+        const char alphabet[] =
+            "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-_";
+        std::string bytes(PatternSource::PERIOD + PATTERN_WINDOW, '\0');
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            bytes[i] = alphabet[i % PatternSource::PERIOD];
+        }
+        return bytes;
+    }();
+    return table.data();
+}
+
+size_t drawChunkSize(const ChunkPlan& plan, Xoshiro256& rng, size_t& list_position) {
+    switch (plan.mode) {
+        case ChunkPlan::Mode::RANDOM: {
+            uint64_t span = plan.max_size - plan.min_size + 1;
+            // Multiply-shift maps the draw onto [0, span) without a division
+            uint64_t draw = ((rng.next() >> 32) * span) >> 32;
+            return plan.min_size + draw;
+        }
+        case ChunkPlan::Mode::LIST:
+            return plan.sizes[list_position++ % plan.sizes.size()];
+        default:
+            return plan.min_size;
+    }
+}
+
+// Trailer fields for the trailer bomb, TRAILER_LINE_LENGTH bytes each
+constexpr size_t TRAILER_LINE_LENGTH = 64;
+constexpr size_t TRAILER_BLOCK_LENGTH = 64 * 1024;
+
+const char* trailerBlock() {
+    static const std::string block = [] {
+        std::string line = "X-Stitch-Trailer: ";
+        line.append(TRAILER_LINE_LENGTH - line.length() - 2, 'a');
+        line += "\r\n";
+
+        std::string bytes;
+        bytes.reserve(TRAILER_BLOCK_LENGTH);
+        while (bytes.length() < TRAILER_BLOCK_LENGTH) {
+            bytes += line;
+        }
+        return bytes;
+    }();
+    return block.data();
+}
+
+// Fill header names, "X-Stitch-Fill-NNNNNN: ", one per index
+constexpr size_t FILL_NAME_LENGTH = 22;
+
+const char* fillNames() {
+    static const std::string names = [] {
+        std::string bytes;
+        bytes.reserve(HeaderFloodSource::MAX_COUNT * FILL_NAME_LENGTH);
+        char line[FILL_NAME_LENGTH + 1];
+        for (uint64_t i = 0; i < HeaderFloodSource::MAX_COUNT; ++i) {
+            snprintf(line, sizeof(line), "X-Stitch-Fill-%06llu: ", static_cast<unsigned long long>(i));
+            bytes.append(line, FILL_NAME_LENGTH);
+        }
+        return bytes;
+    }();
+    return names.data();
+}
+
+// Fill header values end with the line's CRLF; a value of n bytes is the
+// last n + 2 bytes of the block
+const char* fillValues() {
+    static const std::string values = [] {
+        std::string bytes(HeaderFloodSource::MAX_VALUE_SIZE + 2, '\0');
+        for (uint64_t i = 0; i < HeaderFloodSource::MAX_VALUE_SIZE; ++i) {
+            bytes[i] = static_cast<char>('a' + i % 26);
+        }
+        bytes[HeaderFloodSource::MAX_VALUE_SIZE] = '\r';
+        bytes[HeaderFloodSource::MAX_VALUE_SIZE + 1] = '\n';
+        return bytes;
+    }();
+    return values.data();
+}
+
+// total bytes made of a static block repeated end to end
+class RepeatSource : public ResponseSource {
+public:
+    RepeatSource(const char* block, size_t block_length, uint64_t total)
+        : block_(block), block_length_(block_length), total_(total), sent_(0) {}
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override {
+        uint64_t remaining = std::min<uint64_t>(total_ - sent_, max_bytes);
+        uint64_t offset = sent_;
+        size_t count = 0;
+        while (remaining > 0 && count < max_segments) {
+            size_t start = offset % block_length_;
+            size_t len = static_cast<size_t>(
+                std::min<uint64_t>(remaining, block_length_ - start));
+            segments[count].iov_base = const_cast<char*>(block_ + start);
+            segments[count].iov_len = len;
+            ++count;
+            remaining -= len;
+            offset += len;
+        }
+        return count;
+    }
+
+    void consume(size_t n) override { sent_ = std::min<uint64_t>(sent_ + n, total_); }
+    bool done() const override { return sent_ >= total_; }
+    uint64_t length() const override { return total_; }
+
+private:
+    const char* block_;
+    size_t block_length_;
+    uint64_t total_;
+    uint64_t sent_;
+};
+
+} // namespace
+
+MemorySource::MemorySource(const char* data, size_t length)
+    : data_(data)
+    , length_(length)
+    , offset_(0) {
+}
+
+size_t MemorySource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    if (offset_ >= length_ || max_segments == 0 || max_bytes == 0) {
+        return 0;
+    }
+    segments[0].iov_base = const_cast<char*>(data_ + offset_);
+    segments[0].iov_len = std::min(length_ - offset_, max_bytes);
+    return 1;
+}
+
+void MemorySource::consume(size_t n) {
+    offset_ = std::min(offset_ + n, length_);
+}
+
+bool MemorySource::done() const {
+    return offset_ >= length_;
+}
+
+uint64_t MemorySource::length() const {
+    return length_;
+}
+
+SharedSource::SharedSource(std::shared_ptr<const std::string> data, size_t offset,
+                           size_t length)
+    : MemorySource(data->data() + offset, length)
+    , storage_(std::move(data)) {
+}
+
+StringSource::StringSource(std::string data)
+    : MemorySource(nullptr, 0)
+    , storage_(std::move(data)) {
+    data_ = storage_.data();
+    length_ = storage_.length();
+}
+
+PatternSource::PatternSource(uint64_t length, uint64_t start_offset)
+    : length_(length)
+    , start_offset_(start_offset)
+    , sent_(0) {
+}
+
+size_t PatternSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    const char* table = patternTable();
+    uint64_t remaining = std::min<uint64_t>(length_ - sent_, max_bytes);
+    uint64_t offset = start_offset_ + sent_;
+
+    size_t count = 0;
+    while (remaining > 0 && count < max_segments) {
+        size_t len = static_cast<size_t>(std::min<uint64_t>(remaining, PATTERN_WINDOW));
+        segments[count].iov_base = const_cast<char*>(table + offset % PERIOD);
+        segments[count].iov_len = len;
+        ++count;
+        remaining -= len;
+        offset += len;
+    }
+    return count;
+}
+
+void PatternSource::consume(size_t n) {
+    sent_ = std::min<uint64_t>(sent_ + n, length_);
+}
+
+bool PatternSource::done() const {
+    return sent_ >= length_;
+}
+
+uint64_t PatternSource::length() const {
+    return length_;
+}
+
+char PatternSource::byteAt(uint64_t offset) {
+    return patternTable()[offset % PERIOD];
+}
+
+SeededPatternSource::SeededPatternSource(uint64_t seed, uint64_t length, uint64_t start_offset)
+    : pattern_(seed)
+    , length_(length)
+    , start_offset_(start_offset)
+    , sent_(0)
+    , buffer_start_(0)
+    , buffer_end_(0) {
+}
+
+size_t SeededPatternSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    if (done() || max_segments == 0 || max_bytes == 0) {
+        return 0;
+    }
+
+    if (buffer_start_ == buffer_end_) {
+        uint64_t remaining = length_ - sent_;
+        if (buffer_.empty()) {
+            buffer_.resize(std::min<uint64_t>(remaining, BUFFER_SIZE));
+        }
+        buffer_start_ = 0;
+        buffer_end_ = std::min<uint64_t>(remaining, buffer_.size());
+        pattern_.fill(start_offset_ + sent_, buffer_.data(), buffer_end_);
+    }
+
+    segments[0].iov_base = buffer_.data() + buffer_start_;
+    segments[0].iov_len = std::min(buffer_end_ - buffer_start_, max_bytes);
+    return 1;
+}
+
+void SeededPatternSource::consume(size_t n) {
+    n = std::min<uint64_t>(n, length_ - sent_);
+    sent_ += n;
+    buffer_start_ = std::min(buffer_start_ + n, buffer_end_);
+}
+
+bool SeededPatternSource::done() const {
+    return sent_ >= length_;
+}
+
+uint64_t SeededPatternSource::length() const {
+    return length_;
+}
+
+FileSource::FileSource(int fd, uint64_t offset, uint64_t length)
+    : fd_(fd)
+    , offset_(offset)
+    , length_(length)
+    , sent_(0)
+    , buffer_start_(0)
+    , buffer_end_(0)
+    , failed_(false) {
+}
+
+size_t FileSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    if (done() || failed_ || max_segments == 0 || max_bytes == 0) {
+        return 0;
+    }
+
+    if (buffer_start_ == buffer_end_) {
+        uint64_t remaining = length_ - sent_;
+        if (buffer_.empty()) {
+            buffer_.resize(static_cast<size_t>(std::min<uint64_t>(remaining, BUFFER_SIZE)));
+        }
+        size_t want = static_cast<size_t>(std::min<uint64_t>(remaining, buffer_.size()));
+
+        ssize_t n;
+        do {
+            n = pread(fd_, buffer_.data(), want, static_cast<off_t>(offset_ + sent_));
+        } while (n < 0 && errno == EINTR);
+
+        // A file that shrank after it was opened cannot deliver its length
+        if (n <= 0) {
+            failed_ = true;
+            return 0;
+        }
+        buffer_start_ = 0;
+        buffer_end_ = static_cast<size_t>(n);
+    }
+
+    segments[0].iov_base = buffer_.data() + buffer_start_;
+    segments[0].iov_len = std::min(buffer_end_ - buffer_start_, max_bytes);
+    return 1;
+}
+
+void FileSource::consume(size_t n) {
+    n = std::min<uint64_t>(n, length_ - sent_);
+    sent_ += n;
+    // Bytes that went out through sendfile() were never buffered; the next
+    // peek() refills from the new position
+    buffer_start_ = std::min(buffer_start_ + n, buffer_end_);
+}
+
+bool FileSource::done() const {
+    return sent_ >= length_;
+}
+
+uint64_t FileSource::length() const {
+    return length_;
+}
+
+bool FileSource::failed() const {
+    return failed_;
+}
+
+bool FileSource::peekFile(int& fd, uint64_t& offset, size_t& length, size_t max_bytes) {
+    if (done() || failed_ || max_bytes == 0) {
+        return false;
+    }
+    fd = fd_;
+    offset = offset_ + sent_;
+    length = std::min<uint64_t>(length_ - sent_, max_bytes);
+    return true;
+}
+
+ChunkPlan::ChunkPlan()
+    : mode(Mode::OFF)
+    , min_size(DEFAULT_SIZE)
+    , max_size(DEFAULT_SIZE)
+    , seed(1)
+    , fault(Fault::NONE)
+    , fault_chunk(0)
+    , trailer_bytes(DEFAULT_TRAILER_BYTES) {
+}
+
+bool ChunkPlan::parseSizes(const std::string& spec) {
+    auto parseSize = [](const std::string& text, size_t& out) {
+        if (text.empty() || text.length() > 12 ||
+            text.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        out = static_cast<size_t>(std::strtoull(text.c_str(), nullptr, 10));
+        return out > 0;
+    };
+
+    if (spec.find(',') != std::string::npos) {
+        std::vector<size_t> list;
+        size_t pos = 0;
+        while (pos <= spec.length()) {
+            size_t comma = spec.find(',', pos);
+            size_t end = comma == std::string::npos ? spec.length() : comma;
+            size_t size = 0;
+            if (!parseSize(spec.substr(pos, end - pos), size)) {
+                return false;
+            }
+            list.push_back(size);
+            if (comma == std::string::npos) {
+                break;
+            }
+            pos = comma + 1;
+        }
+        mode = Mode::LIST;
+        sizes = std::move(list);
+        return true;
+    }
+
+    size_t dash = spec.find('-');
+    if (dash != std::string::npos) {
+        size_t low = 0;
+        size_t high = 0;
+        if (!parseSize(spec.substr(0, dash), low) || !parseSize(spec.substr(dash + 1), high) ||
+            high < low) {
+            return false;
+        }
+        mode = Mode::RANDOM;
+        min_size = low;
+        max_size = high;
+        return true;
+    }
+
+    size_t size = 0;
+    if (!parseSize(spec, size)) {
+        return false;
+    }
+    mode = Mode::FIXED;
+    min_size = size;
+    max_size = size;
+    return true;
+}
+
+bool ChunkPlan::parseFault(const std::string& name, Fault& fault) {
+    for (Fault candidate : {Fault::NONE, Fault::BAD_HEX, Fault::MISSING_CRLF,
+                            Fault::LENGTH_MISMATCH, Fault::TRUNCATED_LAST, Fault::TRAILER_BOMB}) {
+        if (name == faultName(candidate)) {
+            fault = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* ChunkPlan::faultName(Fault fault) {
+    switch (fault) {
+        case Fault::NONE:            return "none";
+        case Fault::BAD_HEX:         return "bad_hex";
+        case Fault::MISSING_CRLF:    return "missing_crlf";
+        case Fault::LENGTH_MISMATCH: return "length_mismatch";
+        case Fault::TRUNCATED_LAST:  return "truncated_last";
+        case Fault::TRAILER_BOMB:    return "trailer_bomb";
+    }
+    return "unknown";
+}
+
+ChunkedSource::ChunkedSource(std::unique_ptr<ResponseSource> inner, const ChunkPlan& plan)
+    : inner_(std::move(inner))
+    , plan_(plan)
+    , rng_(plan.seed)
+    , unplanned_(inner_->length())
+    , chunk_index_(0)
+    , list_position_(0)
+    , last_planned_(false)
+    , unit_offset_(0)
+    , length_(UNKNOWN_LENGTH) {
+    if (plan_.mode == ChunkPlan::Mode::OFF) {
+        plan_.mode = ChunkPlan::Mode::FIXED;
+    }
+    if (plan_.mode == ChunkPlan::Mode::LIST && plan_.sizes.empty()) {
+        plan_.mode = ChunkPlan::Mode::FIXED;
+        plan_.min_size = ChunkPlan::DEFAULT_SIZE;
+    }
+    if (plan_.fault == ChunkPlan::Fault::TRAILER_BOMB) {
+        uint64_t lines = (plan_.trailer_bytes + TRAILER_LINE_LENGTH - 1) / TRAILER_LINE_LENGTH;
+        trailers_ = std::make_unique<RepeatSource>(trailerBlock(), TRAILER_BLOCK_LENGTH,
+                                                   lines * TRAILER_LINE_LENGTH);
+    }
+
+    length_ = computeLength();
+    planAhead(1);
+}
+
+size_t ChunkedSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    planAhead(MAX_SEGMENTS / 3 + 1);
+
+    size_t count = 0;
+    size_t budget = max_bytes;
+
+    // Append [data, data + len) as far as segments and budget allow;
+    // false once either runs out
+    auto emit = [&](const char* data, uint64_t len) {
+        if (len == 0) {
+            return true;
+        }
+        if (count >= max_segments || budget == 0) {
+            return false;
+        }
+        size_t take = static_cast<size_t>(std::min<uint64_t>(len, budget));
+        segments[count].iov_base = const_cast<char*>(data);
+        segments[count].iov_len = take;
+        ++count;
+        budget -= take;
+        return take == len;
+    };
+
+    // Data segments of whichever source is feeding the current chunk; each
+    // source is peeked at most once
+    struct iovec data[MAX_SEGMENTS];
+    size_t data_count = 0;
+    size_t data_index = 0;
+    size_t data_offset = 0;
+    ResponseSource* peeked = nullptr;
+
+    uint64_t offset = unit_offset_;
+    for (const Unit& unit : units_) {
+        uint64_t header_length = unit.header.length();
+
+        if (offset < header_length &&
+            !emit(unit.header.data() + offset, header_length - offset)) {
+            return count;
+        }
+
+        uint64_t data_start = offset > header_length ? offset - header_length : 0;
+        if (data_start < unit.data_length) {
+            if (unit.data != peeked) {
+                peeked = unit.data;
+                data_count = peeked->peek(data, MAX_SEGMENTS, budget);
+                data_index = 0;
+                data_offset = 0;
+            }
+
+            uint64_t needed = unit.data_length - data_start;
+            while (needed > 0) {
+                if (data_index >= data_count) {
+                    return count;
+                }
+                const struct iovec& segment = data[data_index];
+                size_t take = static_cast<size_t>(
+                    std::min<uint64_t>(segment.iov_len - data_offset, needed));
+                if (!emit(static_cast<const char*>(segment.iov_base) + data_offset, take)) {
+                    return count;
+                }
+                data_offset += take;
+                needed -= take;
+                if (data_offset == segment.iov_len) {
+                    ++data_index;
+                    data_offset = 0;
+                }
+            }
+        }
+
+        uint64_t tail_start = offset > header_length + unit.data_length
+            ? offset - header_length - unit.data_length : 0;
+        if (tail_start < unit.tail_length &&
+            !emit(unit.tail + tail_start, unit.tail_length - tail_start)) {
+            return count;
+        }
+        offset = 0;
+    }
+    return count;
+}
+
+void ChunkedSource::consume(size_t n) {
+    while (n > 0 && !units_.empty()) {
+        const Unit& unit = units_.front();
+        uint64_t header_length = unit.header.length();
+        uint64_t total = header_length + unit.data_length + unit.tail_length;
+        uint64_t take = std::min<uint64_t>(n, total - unit_offset_);
+
+        // Forward the part of [unit_offset_, unit_offset_ + take) that is data
+        uint64_t data_begin = std::max(unit_offset_, header_length);
+        uint64_t data_end = std::min(unit_offset_ + take, header_length + unit.data_length);
+        if (data_end > data_begin) {
+            unit.data->consume(data_end - data_begin);
+        }
+
+        unit_offset_ += take;
+        n -= take;
+        if (unit_offset_ == total) {
+            units_.pop_front();
+            unit_offset_ = 0;
+            planAhead(1);
+        }
+    }
+}
+
+bool ChunkedSource::done() const {
+    return units_.empty() && last_planned_;
+}
+
+uint64_t ChunkedSource::length() const {
+    return length_;
+}
+
+bool ChunkedSource::failed() const {
+    return inner_->failed();
+}
+
+void ChunkedSource::planAhead(size_t count) {
+    while (units_.size() < count && !last_planned_) {
+        Unit unit;
+
+        if (unplanned_ > 0 && unplanned_ != UNKNOWN_LENGTH) {
+            uint64_t size = std::min<uint64_t>(nextSize(), unplanned_);
+            bool faulty = chunk_index_ == plan_.fault_chunk;
+
+            unit.header = hex(faulty && plan_.fault == ChunkPlan::Fault::LENGTH_MISMATCH
+                              ? size + 1 : size) + CRLF;
+            if (faulty && plan_.fault == ChunkPlan::Fault::BAD_HEX) {
+                // 'g' is the first letter that is not a hex digit
+                unit.header.insert(0, 1, 'g');
+            }
+            unit.data = inner_.get();
+            unit.data_length = size;
+            unit.tail = CRLF;
+            unit.tail_length = faulty && plan_.fault == ChunkPlan::Fault::MISSING_CRLF ? 0 : 2;
+
+            unplanned_ -= size;
+            ++chunk_index_;
+            units_.push_back(std::move(unit));
+            continue;
+        }
+
+        last_planned_ = true;
+        if (plan_.fault == ChunkPlan::Fault::TRUNCATED_LAST) {
+            break;
+        }
+        unit.header = "0\r\n";
+        unit.data = trailers_ ? trailers_.get() : inner_.get();
+        unit.data_length = trailers_ ? trailers_->length() : 0;
+        unit.tail = CRLF;
+        unit.tail_length = 2;
+        units_.push_back(std::move(unit));
+    }
+}
+
+size_t ChunkedSource::nextSize() {
+    return drawChunkSize(plan_, rng_, list_position_);
+}
+
+uint64_t ChunkedSource::computeLength() const {
+    uint64_t body = inner_->length();
+    if (body == UNKNOWN_LENGTH) {
+        return UNKNOWN_LENGTH;
+    }
+
+    uint64_t total = 0;
+    auto addChunk = [&](uint64_t index, uint64_t size, uint64_t repeat) {
+        total += repeat * (hex(size).length() + 2 + size + 2);
+        if (plan_.fault_chunk >= index && plan_.fault_chunk < index + repeat) {
+            switch (plan_.fault) {
+                case ChunkPlan::Fault::BAD_HEX:
+                    total += 1;
+                    break;
+                case ChunkPlan::Fault::MISSING_CRLF:
+                    total -= 2;
+                    break;
+                case ChunkPlan::Fault::LENGTH_MISMATCH:
+                    total += hex(size + 1).length() - hex(size).length();
+                    break;
+                default:
+                    break;
+            }
+        }
+    };
+
+    if (plan_.mode == ChunkPlan::Mode::FIXED) {
+        uint64_t full = body / plan_.min_size;
+        addChunk(0, plan_.min_size, full);
+        if (body % plan_.min_size > 0) {
+            addChunk(full, body % plan_.min_size, 1);
+        }
+    } else {
+        // Replay the size sequence; give up on bodies cut into millions of chunks
+        size_t smallest = plan_.mode == ChunkPlan::Mode::LIST
+            ? *std::min_element(plan_.sizes.begin(), plan_.sizes.end()) : plan_.min_size;
+        if (body / smallest > (1u << 20)) {
+            return UNKNOWN_LENGTH;
+        }
+
+        Xoshiro256 rng(plan_.seed);
+        size_t position = 0;
+        uint64_t remaining = body;
+        for (uint64_t index = 0; remaining > 0; ++index) {
+            uint64_t size = std::min<uint64_t>(drawChunkSize(plan_, rng, position), remaining);
+            addChunk(index, size, 1);
+            remaining -= size;
+        }
+    }
+
+    if (plan_.fault != ChunkPlan::Fault::TRUNCATED_LAST) {
+        total += 3 + (trailers_ ? trailers_->length() : 0) + 2;
+    }
+    return total;
+}
+
+HeaderFloodSource::HeaderFloodSource(std::string lines, uint64_t repeats, uint64_t count,
+                                     uint64_t value_size)
+    : line_length_(lines.length())
+    , repeated_length_(lines.empty() ? 0 : lines.length() * repeats)
+    , count_(std::min(count, MAX_COUNT))
+    , value_size_(std::min(value_size, MAX_VALUE_SIZE))
+    , sent_(0) {
+    // Enough copies for large iovecs, never more than are sent
+    if (line_length_ > 0) {
+        uint64_t copies = std::min<uint64_t>(repeats, 64 * 1024 / line_length_ + 1);
+        block_.reserve(line_length_ * copies);
+        for (uint64_t i = 0; i < copies; ++i) {
+            block_ += lines;
+        }
+    }
+    length_ = repeated_length_ + count_ * (FILL_NAME_LENGTH + value_size_ + 2);
+}
+
+size_t HeaderFloodSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    uint64_t budget = std::min<uint64_t>(length_ - sent_, max_bytes);
+    uint64_t offset = sent_;
+    size_t count = 0;
+
+    while (budget > 0 && count < max_segments) {
+        const char* data;
+        uint64_t available;
+        if (offset < repeated_length_) {
+            // Whole copies of lines fit the block, so any offset maps into it
+            size_t start = offset % line_length_;
+            data = block_.data() + start;
+            available = std::min<uint64_t>(block_.length() - start, repeated_length_ - offset);
+        } else {
+            uint64_t fill = offset - repeated_length_;
+            uint64_t line = FILL_NAME_LENGTH + value_size_ + 2;
+            uint64_t index = fill / line;
+            size_t within = fill % line;
+            if (within < FILL_NAME_LENGTH) {
+                data = fillNames() + index * FILL_NAME_LENGTH + within;
+                available = FILL_NAME_LENGTH - within;
+            } else {
+                within -= FILL_NAME_LENGTH;
+                data = fillValues() + (MAX_VALUE_SIZE - value_size_) + within;
+                available = value_size_ + 2 - within;
+            }
+        }
+
+        size_t take = static_cast<size_t>(std::min(available, budget));
+        segments[count].iov_base = const_cast<char*>(data);
+        segments[count].iov_len = take;
+        ++count;
+        budget -= take;
+        offset += take;
+    }
+    return count;
+}
+
+void HeaderFloodSource::consume(size_t n) {
+    sent_ = std::min<uint64_t>(sent_ + n, length_);
+}
+
+bool HeaderFloodSource::done() const {
+    return sent_ >= length_;
+}
+
+uint64_t HeaderFloodSource::length() const {
+    return length_;
+}
+
+ConcatSource::ConcatSource()
+    : current_(0)
+    , current_sent_(0) {
+}
+
+void ConcatSource::append(std::unique_ptr<ResponseSource> part) {
+    parts_.push_back(std::move(part));
+}
+
+size_t ConcatSource::peek(struct iovec* segments, size_t max_segments, size_t max_bytes) {
+    skipFinished();
+
+    size_t count = 0;
+    for (size_t i = current_; i < parts_.size() && count < max_segments && max_bytes > 0; ++i) {
+        size_t filled = parts_[i]->peek(segments + count, max_segments - count, max_bytes);
+
+        size_t bytes = 0;
+        for (size_t j = 0; j < filled; ++j) {
+            bytes += segments[count + j].iov_len;
+        }
+        count += filled;
+        max_bytes -= bytes;
+
+        // Only run on into the next part when this one is fully described
+        uint64_t length = parts_[i]->length();
+        if (length == UNKNOWN_LENGTH || filled == 0) {
+            break;
+        }
+        uint64_t remaining = (i == current_) ? length - current_sent_ : length;
+        if (bytes < remaining) {
+            break;
+        }
+    }
+    return count;
+}
+
+void ConcatSource::consume(size_t n) {
+    while (n > 0 && current_ < parts_.size()) {
+        ResponseSource& part = *parts_[current_];
+        uint64_t length = part.length();
+
+        size_t take = n;
+        if (length != UNKNOWN_LENGTH) {
+            take = static_cast<size_t>(std::min<uint64_t>(n, length - current_sent_));
+        }
+        part.consume(take);
+        current_sent_ += take;
+        n -= take;
+        skipFinished();
+
+        if (take == 0) {
+            break;
+        }
+    }
+}
+
+bool ConcatSource::done() const {
+    for (size_t i = current_; i < parts_.size(); ++i) {
+        if (!parts_[i]->done()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t ConcatSource::length() const {
+    uint64_t total = 0;
+    for (const auto& part : parts_) {
+        uint64_t length = part->length();
+        if (length == UNKNOWN_LENGTH) {
+            return UNKNOWN_LENGTH;
+        }
+        total += length;
+    }
+    return total;
+}
+
+bool ConcatSource::peekFile(int& fd, uint64_t& offset, size_t& length, size_t max_bytes) {
+    skipFinished();
+    return current_ < parts_.size() && parts_[current_]->peekFile(fd, offset, length, max_bytes);
+}
+
+bool ConcatSource::peekPipe(int& fd, size_t& length, size_t max_bytes) {
+    skipFinished();
+    return current_ < parts_.size() && parts_[current_]->peekPipe(fd, length, max_bytes);
+}
+
+bool ConcatSource::blocked() const {
+    for (size_t i = current_; i < parts_.size(); ++i) {
+        if (!parts_[i]->done()) {
+            return parts_[i]->blocked();
+        }
+    }
+    return false;
+}
+
+bool ConcatSource::failed() const {
+    return current_ < parts_.size() && parts_[current_]->failed();
+}
+
+void ConcatSource::skipFinished() {
+    while (current_ < parts_.size() && parts_[current_]->done()) {
+        ++current_;
+        current_sent_ = 0;
+    }
+}
@@ -0,0 +1,307 @@
+#ifndef RESPONSE_SOURCE_H
+#define RESPONSE_SOURCE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <cstdint>
+#include <sys/uio.h>
+#include "prng.h"
+#include "body_pattern.h"
+
+// Pull interface for response bytes. ConnectionHandler asks for the next
+// unsent bytes as the socket has room (peek), writes what it can and then
+// reports how much went out (consume), so a source only has to keep the
+// window it is currently exposing in memory, never the whole response.
+class ResponseSource {
+public:
+    static constexpr uint64_t UNKNOWN_LENGTH = UINT64_MAX;
+
+    // iovecs a caller should offer to peek()
+    static constexpr size_t MAX_SEGMENTS = 64;
+
+    virtual ~ResponseSource() {}
+
+    // Describe the next unsent bytes in at most max_segments iovecs and at
+    // most max_bytes in total without consuming them. Returns the number of
+    // segments filled; 0 means done() or a read error (see failed()).
+    virtual size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) = 0;
+
+    // Advance past the first n bytes of the last peek()
+    virtual void consume(size_t n) = 0;
+
+    virtual bool done() const = 0;
+
+    // Total bytes the source produces, or UNKNOWN_LENGTH
+    virtual uint64_t length() const = 0;
+
+    virtual bool failed() const { return false; }
+
+    // If the next unsent bytes are a range of a file, describe at most
+    // max_bytes of it so the caller can sendfile() them instead of peeking.
+    // consume() advances past them as usual.
+    virtual bool peekFile(int& fd, uint64_t& offset, size_t& length, size_t max_bytes) {
+        (void)fd;
+        (void)offset;
+        (void)length;
+        (void)max_bytes;
+        return false;
+    }
+
+    // Likewise for bytes waiting in a pipe, which the caller can splice()
+    virtual bool peekPipe(int& fd, size_t& length, size_t max_bytes) {
+        (void)fd;
+        (void)length;
+        (void)max_bytes;
+        return false;
+    }
+
+    // Nothing can be sent yet but more is coming, e.g. a request body that
+    // is still arriving; peek() returns 0 meanwhile
+    virtual bool blocked() const { return false; }
+};
+
+// Bytes that live somewhere else for at least as long as the source,
+// e.g. a response serialized once when a scenario was loaded.
+class MemorySource : public ResponseSource {
+public:
+    MemorySource(const char* data, size_t length);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+
+protected:
+    const char* data_;
+    size_t length_;
+    size_t offset_;
+};
+
+// A slice of a string shared with other responses, such as a cached
+// compressed body; the source keeps the string alive.
+class SharedSource : public MemorySource {
+public:
+    SharedSource(std::shared_ptr<const std::string> data, size_t offset, size_t length);
+
+private:
+    std::shared_ptr<const std::string> storage_;
+};
+
+// A MemorySource that owns its string.
+class StringSource : public MemorySource {
+public:
+    explicit StringSource(std::string data);
+
+private:
+    std::string storage_;
+};
+
+// Synthetic body of any length. The pattern repeats every PERIOD bytes, so
+// segments point into one static table and nothing is generated or stored
+// per connection. Byte i of the body is always the same, whatever the
+// starting offset.
+class PatternSource : public ResponseSource {
+public:
+    static constexpr size_t PERIOD = 64;
+
+    explicit PatternSource(uint64_t length, uint64_t start_offset = 0);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+
+    // Byte at absolute body offset
+    static char byteAt(uint64_t offset);
+
+private:
+    uint64_t length_;
+    uint64_t start_offset_;
+    uint64_t sent_;
+};
+
+// Synthetic body from a seeded BodyPattern, generated into a fixed-size
+// buffer as the socket takes it. Like PatternSource it starts at any
+// offset at no extra cost.
+class SeededPatternSource : public ResponseSource {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    SeededPatternSource(uint64_t seed, uint64_t length, uint64_t start_offset = 0);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+
+private:
+    BodyPattern pattern_;
+    uint64_t length_;
+    uint64_t start_offset_;
+    uint64_t sent_;
+    std::vector<char> buffer_;
+    size_t buffer_start_;
+    size_t buffer_end_;
+};
+
+// A byte range of an open file, read through a fixed-size buffer or handed
+// to sendfile() through peekFile(). The file descriptor is borrowed.
+class FileSource : public ResponseSource {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    FileSource(int fd, uint64_t offset, uint64_t length);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+    bool failed() const override;
+    bool peekFile(int& fd, uint64_t& offset, size_t& length, size_t max_bytes) override;
+
+private:
+    int fd_;
+    uint64_t offset_;
+    uint64_t length_;
+    uint64_t sent_;
+    std::vector<char> buffer_;
+    size_t buffer_start_;
+    size_t buffer_end_;
+    bool failed_;
+};
+
+// How a body is split into chunks and which framing fault, if any, to
+// inject. Parsed from query parameters; mode OFF means Content-Length.
+struct ChunkPlan {
+    enum class Mode { OFF, FIXED, RANDOM, LIST };
+
+    enum class Fault {
+        NONE,
+        BAD_HEX,            // Chunk size line is not hexadecimal
+        MISSING_CRLF,       // Chunk data is not followed by CRLF
+        LENGTH_MISMATCH,    // Chunk size line claims one byte more than is sent
+        TRUNCATED_LAST,     // The terminating zero-length chunk is never sent
+        TRAILER_BOMB        // trailer_bytes of trailer fields after the last chunk
+    };
+
+    static constexpr size_t DEFAULT_SIZE = 8192;
+    static constexpr uint64_t DEFAULT_TRAILER_BYTES = 1024 * 1024;
+
+    Mode mode;
+    size_t min_size;            // FIXED: the size; RANDOM: inclusive range
+    size_t max_size;
+    std::vector<size_t> sizes;  // LIST, repeated in order
+    uint64_t seed;              // RANDOM
+    Fault fault;
+    uint64_t fault_chunk;       // Data chunk that BAD_HEX, MISSING_CRLF and
+                                // LENGTH_MISMATCH apply to
+    uint64_t trailer_bytes;     // TRAILER_BOMB, rounded up to whole fields
+
+    ChunkPlan();
+
+    bool active() const { return mode != Mode::OFF; }
+
+    // "8192" (fixed), "512-65536" (random) or "100,7,4096" (list)
+    bool parseSizes(const std::string& spec);
+
+    static bool parseFault(const std::string& name, Fault& fault);
+    static const char* faultName(Fault fault);
+};
+
+// Frames another source with chunked transfer-encoding. Chunk size lines
+// and CRLFs are planned a few chunks ahead and handed out as their own
+// iovecs between the inner source's segments, so one peek() can cover
+// several chunks and body bytes are never copied.
+class ChunkedSource : public ResponseSource {
+public:
+    ChunkedSource(std::unique_ptr<ResponseSource> inner, const ChunkPlan& plan);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+    bool failed() const override;
+
+private:
+    // One chunk on the wire: size line, data, then tail
+    struct Unit {
+        std::string header;
+        ResponseSource* data;   // inner_ or trailers_
+        uint64_t data_length;
+        const char* tail;
+        size_t tail_length;
+    };
+
+    std::unique_ptr<ResponseSource> inner_;
+    std::unique_ptr<ResponseSource> trailers_;
+    ChunkPlan plan_;
+    Xoshiro256 rng_;
+
+    uint64_t unplanned_;        // Inner bytes not assigned to a chunk yet
+    uint64_t chunk_index_;
+    size_t list_position_;
+    bool last_planned_;
+    std::deque<Unit> units_;
+    uint64_t unit_offset_;      // Bytes of units_.front() already consumed
+    uint64_t length_;
+
+    void planAhead(size_t count);
+    size_t nextSize();
+    uint64_t computeLength() const;
+};
+
+// Extra header lines for header floods: lines (complete "Name: value\r\n"
+// lines) sent repeats times, then count X-Stitch-Fill-NNNNNN headers with
+// value_size-byte values. Names and values come from static templates and
+// every peek position is computed directly, so a flood of any size costs
+// the same to set up and is sent straight from the templates.
+class HeaderFloodSource : public ResponseSource {
+public:
+    static constexpr uint64_t MAX_COUNT = 100000;
+    static constexpr uint64_t MAX_VALUE_SIZE = 1 << 20;
+    static constexpr uint64_t DEFAULT_VALUE_SIZE = 32;
+
+    HeaderFloodSource(std::string lines, uint64_t repeats, uint64_t count, uint64_t value_size);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+
+private:
+    std::string block_;         // lines repeated up to about 64 KiB
+    size_t line_length_;        // Bytes of lines, one copy
+    uint64_t repeated_length_;  // Bytes of all repeats
+    uint64_t count_;
+    uint64_t value_size_;
+    uint64_t length_;
+    uint64_t sent_;
+};
+
+// Sources sent back to back, e.g. serialized headers followed by a body.
+class ConcatSource : public ResponseSource {
+public:
+    ConcatSource();
+
+    void append(std::unique_ptr<ResponseSource> part);
+
+    size_t peek(struct iovec* segments, size_t max_segments, size_t max_bytes) override;
+    void consume(size_t n) override;
+    bool done() const override;
+    uint64_t length() const override;
+    bool failed() const override;
+    bool peekFile(int& fd, uint64_t& offset, size_t& length, size_t max_bytes) override;
+    bool peekPipe(int& fd, size_t& length, size_t max_bytes) override;
+    bool blocked() const override;
+
+private:
+    std::vector<std::unique_ptr<ResponseSource>> parts_;
+    size_t current_;
+    uint64_t current_sent_;  // Bytes consumed from parts_[current_]
+
+    void skipFinished();
+};
+
+#endif // RESPONSE_SOURCE_H
@@ -0,0 +1,126 @@
+#include "runtime_config.h"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned int>(c));
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+} // namespace
+
+ConfigSnapshot::ConfigSnapshot()
+    : generation(0)
+    , has_default(false) {
+}
+
+std::string ConfigSnapshot::toJson() const {
+    std::ostringstream oss;
+    oss << "{\"generation\":" << generation
+        << ",\"default\":" << (has_default ? jsonString(default_query) : "null")
+        << ",\"chaos\":" << (chaos ? jsonString(chaos_spec) : "null")
+        << ",\"scenario_routes\":" << (router ? router->size() : 0)
+        << "}";
+    return oss.str();
+}
+
+RuntimeConfig::RuntimeConfig(std::unique_ptr<ConfigSnapshot> initial)
+    : current_(nullptr)
+    , reader_epoch_(1)
+    , swaps_(0)
+    , reclaimed_(0) {
+    initial->generation = 1;
+    current_.store(initial.release(), std::memory_order_release);
+}
+
+RuntimeConfig::~RuntimeConfig() {
+    delete current_.load(std::memory_order_acquire);
+}
+
+const ConfigSnapshot* RuntimeConfig::pin() {
+    const ConfigSnapshot* snapshot = current_.load(std::memory_order_acquire);
+
+    // Loads only ever see newer generations, so the newest pin is last
+    if (pins_.empty() || pins_.back().first != snapshot->generation) {
+        pins_.emplace_back(snapshot->generation, 0);
+    }
+    pins_.back().second++;
+    return snapshot;
+}
+
+void RuntimeConfig::unpin(uint64_t generation) {
+    for (auto& pin : pins_) {
+        if (pin.first == generation) {
+            pin.second--;
+            break;
+        }
+    }
+    while (!pins_.empty() && pins_.front().second == 0) {
+        pins_.pop_front();
+    }
+}
+
+void RuntimeConfig::quiesce() {
+    // Anything the loop loads from now on is at least this new
+    uint64_t oldest = current_.load(std::memory_order_acquire)->generation;
+    if (!pins_.empty()) {
+        oldest = std::min(oldest, pins_.front().first);
+    }
+    reader_epoch_.store(oldest, std::memory_order_release);
+}
+
+const ConfigSnapshot& RuntimeConfig::current() const {
+    return *current_.load(std::memory_order_relaxed);
+}
+
+void RuntimeConfig::publish(std::unique_ptr<ConfigSnapshot> next) {
+    next->generation = current().generation + 1;
+    const ConfigSnapshot* old = current_.exchange(next.release(), std::memory_order_acq_rel);
+    retired_.emplace_back(old);
+    swaps_.store(swaps_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    reclaim();
+}
+
+size_t RuntimeConfig::reclaim() {
+    uint64_t epoch = reader_epoch_.load(std::memory_order_acquire);
+    auto reachable = std::stable_partition(
+        retired_.begin(), retired_.end(),
+        [epoch](const std::unique_ptr<const ConfigSnapshot>& snapshot) {
+            return snapshot->generation >= epoch;
+        });
+    size_t freed = static_cast<size_t>(retired_.end() - reachable);
+    retired_.erase(reachable, retired_.end());
+    reclaimed_.store(reclaimed_.load(std::memory_order_relaxed) + freed, std::memory_order_relaxed);
+    return freed;
+}
+
+size_t RuntimeConfig::retired() const {
+    return retired_.size();
+}
+
+uint64_t RuntimeConfig::generation() const {
+    return current_.load(std::memory_order_acquire)->generation;
+}
+
+uint64_t RuntimeConfig::swaps() const {
+    return swaps_.load(std::memory_order_relaxed);
+}
+
+uint64_t RuntimeConfig::reclaimed() const {
+    return reclaimed_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,89 @@
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "command_interpreter.h"
+#include "chaos_mix.h"
+#include "scenario_router.h"
+
+// What --admin can change while stitch runs. A snapshot is never modified
+// once published; a change builds a new one, sharing the parts it keeps.
+struct ConfigSnapshot {
+    uint64_t generation;        // Set by RuntimeConfig::publish()
+
+    // For requests with no route, behavior or chaos: the command built from
+    // default_query ("behavior=slow&delay=200"), if any
+    std::string default_query;
+    bool has_default;
+    TestCommand default_command;
+
+    std::string chaos_spec;
+    std::shared_ptr<const ChaosMix> chaos;
+    std::shared_ptr<const ScenarioRouter> router;
+
+    ConfigSnapshot();
+
+    std::string toJson() const;
+};
+
+// Publishes snapshots from the admin thread to the event loop.
+//
+// The loop reads the current snapshot with one acquire load and no lock.
+// The admin thread replaces it with an atomic pointer swap and keeps the
+// old one on a retired list: connections that resolved their request
+// against it may still point into it (a scenario route, say).
+//
+// Reclamation is epoch-based, with generations as the epochs. The loop
+// counts the connections pinning each generation and, once per round,
+// announces the oldest generation it may still touch: the oldest pinned,
+// or the current one if nothing is pinned. The admin thread frees retired
+// snapshots older than that. Neither side ever waits for the other.
+class RuntimeConfig {
+public:
+    explicit RuntimeConfig(std::unique_ptr<ConfigSnapshot> initial);
+    ~RuntimeConfig();
+
+    RuntimeConfig(const RuntimeConfig&) = delete;
+    RuntimeConfig& operator=(const RuntimeConfig&) = delete;
+
+    // Event loop. pin() returns the current snapshot, which stays valid
+    // until unpin() with its generation.
+    const ConfigSnapshot* pin();
+    void unpin(uint64_t generation);
+
+    // Event loop, once per round with no unpinned snapshot in hand
+    void quiesce();
+
+    // Admin thread (the only writer). current() is the snapshot a change
+    // starts from; publish() numbers the new one, swaps it in and retires
+    // the old one.
+    const ConfigSnapshot& current() const;
+    void publish(std::unique_ptr<ConfigSnapshot> next);
+
+    // Admin thread: frees retired snapshots the loop has moved past
+    size_t reclaim();
+    size_t retired() const;
+
+    uint64_t generation() const;
+    uint64_t swaps() const;
+    uint64_t reclaimed() const;
+
+private:
+    std::atomic<const ConfigSnapshot*> current_;
+    std::atomic<uint64_t> reader_epoch_;    // Oldest generation the loop may touch
+
+    // Loop only: connections pinning each generation, oldest first
+    std::deque<std::pair<uint64_t, size_t>> pins_;
+
+    // Admin thread only
+    std::vector<std::unique_ptr<const ConfigSnapshot>> retired_;
+    std::atomic<uint64_t> swaps_;
+    std::atomic<uint64_t> reclaimed_;
+};
+
+#endif // RUNTIME_CONFIG_H
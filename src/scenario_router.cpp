@@ -0,0 +1,275 @@
+#include "scenario_router.h"
+#include "json_parser.h"
+#include "response_generator.h"
+#include <fstream>
+#include <sstream>
+#include <map>
+
+struct ScenarioRouter::Node {
+    std::string label;                              // Edge label from the parent
+    std::vector<std::unique_ptr<Node>> children;    // Distinct first characters
+    std::vector<size_t> routes;                     // Indices into routes_
+};
+
+ScenarioRoute::ScenarioRoute()
+    : has_response(false)
+    , response_status(0) {
+}
+
+ScenarioRouter::ScenarioRouter()
+    : root_(new Node()) {
+}
+
+ScenarioRouter::~ScenarioRouter() {
+}
+
+bool ScenarioRouter::loadFile(const std::string& path, LatencyDistributionCache* distributions,
+                              ScriptCache* scripts) {
+    std::ifstream file(path);
+    if (!file) {
+        error_message_ = "Cannot open scenario file: " + path;
+        return false;
+    }
+
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return loadString(contents.str(), distributions, scripts);
+}
+
+bool ScenarioRouter::loadString(const std::string& json, LatencyDistributionCache* distributions,
+                                ScriptCache* scripts) {
+    JsonParser parser;
+    JsonValue document;
+    if (!parser.parse(json, document)) {
+        error_message_ = "Invalid scenario JSON: " + parser.getErrorMessage();
+        return false;
+    }
+
+    const JsonValue* routes = document.get("routes");
+    if (routes == nullptr || !routes->isArray()) {
+        error_message_ = "Scenario must be an object with a \"routes\" array";
+        return false;
+    }
+
+    CommandInterpreter interpreter(distributions, scripts);
+    std::vector<ScenarioRoute> compiled(routes->array.size());
+    for (size_t i = 0; i < routes->array.size(); ++i) {
+        if (!compileRoute(routes->array[i], i, interpreter, compiled[i])) {
+            return false;
+        }
+    }
+
+    routes_ = std::move(compiled);
+    root_.reset(new Node());
+    for (size_t i = 0; i < routes_.size(); ++i) {
+        insert(routes_[i].prefix, i);
+    }
+
+    error_message_.clear();
+    return true;
+}
+
+const ScenarioRoute* ScenarioRouter::resolve(const HttpRequest& request) const {
+    const std::string& path = request.path;
+    size_t end = path.find('?');
+    if (end == std::string::npos) {
+        end = path.length();
+    }
+
+    const ScenarioRoute* best = nullptr;
+    const Node* node = root_.get();
+    size_t pos = 0;
+
+    while (true) {
+        const ScenarioRoute* match = matchNode(*node, request);
+        if (match != nullptr) {
+            best = match;
+        }
+
+        if (pos == end) {
+            break;
+        }
+
+        const Node* next = nullptr;
+        for (const auto& child : node->children) {
+            if (child->label[0] == path[pos]) {
+                next = child.get();
+                break;
+            }
+        }
+
+        if (next == nullptr || next->label.length() > end - pos ||
+            path.compare(pos, next->label.length(), next->label) != 0) {
+            break;
+        }
+
+        pos += next->label.length();
+        node = next;
+    }
+
+    return best;
+}
+
+size_t ScenarioRouter::size() const {
+    return routes_.size();
+}
+
+const std::string& ScenarioRouter::getErrorMessage() const {
+    return error_message_;
+}
+
+bool ScenarioRouter::compileRoute(const JsonValue& spec, size_t index,
+                                  CommandInterpreter& interpreter, ScenarioRoute& route) {
+    std::string where = "route " + std::to_string(index);
+
+    if (!spec.isObject()) {
+        error_message_ = where + ": must be an object";
+        return false;
+    }
+
+    bool preserialize = true;
+    std::map<std::string, std::string> params;
+
+    for (const auto& member : spec.object) {
+        const std::string& key = member.first;
+        const JsonValue& value = member.second;
+
+        if (key == "prefix") {
+            if (!value.isString() || value.string.empty() || value.string[0] != '/') {
+                error_message_ = where + ": \"prefix\" must be a string starting with '/'";
+                return false;
+            }
+            route.prefix = value.string;
+        } else if (key == "method") {
+            if (!value.isString()) {
+                error_message_ = where + ": \"method\" must be a string";
+                return false;
+            }
+            route.method = value.string;
+        } else if (key == "headers") {
+            if (!value.isObject()) {
+                error_message_ = where + ": \"headers\" must be an object";
+                return false;
+            }
+            for (const auto& header : value.object) {
+                route.headers.emplace_back(header.first, header.second.toParamString());
+            }
+        } else if (key == "preserialize") {
+            preserialize = value.type == JsonValue::Type::BOOLEAN && value.boolean;
+        } else if (value.isObject() || value.isArray()) {
+            error_message_ = where + ": \"" + key + "\" must be a scalar";
+            return false;
+        } else {
+            // Everything else is a behavior parameter, exactly as in a query string
+            params[key] = value.toParamString();
+        }
+    }
+
+    if (route.prefix.empty()) {
+        error_message_ = where + ": missing \"prefix\"";
+        return false;
+    }
+
+    route.command = interpreter.interpret(params);
+    if (!interpreter.isValid(route.command)) {
+        error_message_ = where + ": invalid behavior parameters";
+        return false;
+    }
+
+    // A query with a bad script or distribution is served without it; a
+    // route is rejected
+    if (!interpreter.getErrorMessage().empty()) {
+        error_message_ = where + ": " + interpreter.getErrorMessage();
+        return false;
+    }
+
+    // Behaviors that never write a response have nothing to prebuild
+    bool sends_response = route.command.behavior != BehaviorType::CLOSE_IMMEDIATELY &&
+                          route.command.behavior != BehaviorType::TIMEOUT;
+    // Synthetic bodies can be gigabytes and corpus files are sent from the
+    // page cache; both are always streamed. Encoded bodies come from the
+    // compression cache, header floods are sent from their templates and
+    // echoes are the request body.
+    bool streamed = route.command.body_size > 0 || !route.command.file.empty() ||
+                    route.command.encoding != ContentEncoding::IDENTITY ||
+                    route.command.header_count > 0 || route.command.duplicate_headers > 1 ||
+                    ResponseGenerator::echoes(route.command);
+    if (preserialize && sends_response && !streamed) {
+        ResponseGenerator generator;
+        HttpResponse response = generator.generate(route.command);
+        route.response = generator.serialize(response);
+        route.response_status = response.status_code;
+        route.has_response = true;
+    }
+
+    return true;
+}
+
+void ScenarioRouter::insert(const std::string& prefix, size_t route_index) {
+    Node* node = root_.get();
+    size_t pos = 0;
+
+    while (pos < prefix.length()) {
+        std::unique_ptr<Node>* slot = nullptr;
+        for (auto& child : node->children) {
+            if (child->label[0] == prefix[pos]) {
+                slot = &child;
+                break;
+            }
+        }
+
+        if (slot == nullptr) {
+            // No edge starts with this character, hang the rest off a new leaf
+            std::unique_ptr<Node> leaf(new Node());
+            leaf->label = prefix.substr(pos);
+            node->children.push_back(std::move(leaf));
+            node = node->children.back().get();
+            break;
+        }
+
+        const std::string& label = (*slot)->label;
+        size_t common = 0;
+        while (common < label.length() && pos + common < prefix.length() &&
+               label[common] == prefix[pos + common]) {
+            ++common;
+        }
+
+        if (common < label.length()) {
+            // Split the edge so the shared part becomes its own node
+            std::unique_ptr<Node> middle(new Node());
+            middle->label = label.substr(0, common);
+            (*slot)->label = label.substr(common);
+            middle->children.push_back(std::move(*slot));
+            *slot = std::move(middle);
+        }
+
+        node = slot->get();
+        pos += common;
+    }
+
+    node->routes.push_back(route_index);
+}
+
+const ScenarioRoute* ScenarioRouter::matchNode(const Node& node, const HttpRequest& request) const {
+    for (size_t index : node.routes) {
+        const ScenarioRoute& route = routes_[index];
+
+        if (!route.method.empty() && route.method != request.method) {
+            continue;
+        }
+
+        bool headers_match = true;
+        for (const auto& header : route.headers) {
+            if (request.getHeader(header.first) != header.second) {
+                headers_match = false;
+                break;
+            }
+        }
+
+        if (headers_match) {
+            return &route;
+        }
+    }
+
+    return nullptr;
+}
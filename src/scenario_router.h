@@ -0,0 +1,66 @@
+#ifndef SCENARIO_ROUTER_H
+#define SCENARIO_ROUTER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include "command_interpreter.h"
+#include "http_parser.h"
+
+class JsonValue;
+
+// One entry of a scenario file, compiled at load time
+struct ScenarioRoute {
+    std::string prefix;
+    std::string method;     // Empty matches any method
+    std::vector<std::pair<std::string, std::string>> headers;  // All must match
+
+    TestCommand command;
+
+    // Serialized response bytes, built once for behaviors whose response
+    // does not depend on the request
+    bool has_response;
+    int response_status;
+    std::string response;
+
+    ScenarioRoute();
+};
+
+// Maps path prefixes to prebuilt TestCommands. Prefixes are stored in a
+// radix trie so a request is resolved in a single walk over its path; the
+// deepest (longest) prefix whose method and header constraints match wins,
+// and routes sharing a prefix are tried in file order.
+class ScenarioRouter {
+public:
+    ScenarioRouter();
+    ~ScenarioRouter();
+
+    // Load a scenario document, replacing any previous routes. dist= and
+    // script= resolve through the caches given; a route whose dist= or
+    // script= does not resolve is an error.
+    bool loadFile(const std::string& path, LatencyDistributionCache* distributions = nullptr,
+                  ScriptCache* scripts = nullptr);
+    bool loadString(const std::string& json, LatencyDistributionCache* distributions = nullptr,
+                    ScriptCache* scripts = nullptr);
+
+    // Returns nullptr if no route matches
+    const ScenarioRoute* resolve(const HttpRequest& request) const;
+
+    size_t size() const;
+    const std::string& getErrorMessage() const;
+
+private:
+    struct Node;
+
+    std::unique_ptr<Node> root_;
+    std::vector<ScenarioRoute> routes_;
+    std::string error_message_;
+
+    bool compileRoute(const JsonValue& spec, size_t index, CommandInterpreter& interpreter,
+                      ScenarioRoute& route);
+    void insert(const std::string& prefix, size_t route_index);
+    const ScenarioRoute* matchNode(const Node& node, const HttpRequest& request) const;
+};
+
+#endif // SCENARIO_ROUTER_H
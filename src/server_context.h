@@ -0,0 +1,62 @@
+#ifndef SERVER_CONTEXT_H
+#define SERVER_CONTEXT_H
+
+class OutcomeRegistry;
+class ScenarioRouter;
+class ChaosMix;
+class ChaosMixCache;
+class Xoshiro256;
+class LatencyDistributionCache;
+class TrafficRecorder;
+class TrafficReplayer;
+class Corpus;
+class CompressionCache;
+class UpstreamPool;
+class ScriptCache;
+class Admission;
+class Timeouts;
+class Overload;
+class RuntimeConfig;
+
+// Process-wide services shared by every connection. main() owns the objects;
+// handlers only borrow the pointers, and any of them may be null when the
+// corresponding feature is not in use.
+struct ServerContext {
+    OutcomeRegistry* outcomes;
+    const ScenarioRouter* router;
+    const ChaosMix* chaos;  // Default mix for requests without a behavior
+    ChaosMixCache* chaos_mixes; // Compiled ?chaos= mixes
+    Xoshiro256* rng;        // Seeded generator owned by the event loop thread
+    LatencyDistributionCache* distributions;
+    TrafficRecorder* recorder;  // Logs every request and its command
+    TrafficReplayer* replay;    // Supplies commands in recorded order
+    const Corpus* corpus;       // Preopened bodies for file=
+    CompressionCache* compression;  // Compressed bodies for encoding=
+    UpstreamPool* upstream;     // --upstream backend whose responses are relayed
+    ScriptCache* scripts;       // Compiled script= programs
+    Admission* admission;       // Connection and memory limits, and usage
+    Timeouts* timeouts;         // Clocks on what connections wait for from clients
+    Overload* overload;         // Sheds requests past in-flight and rate limits
+    RuntimeConfig* config;      // --admin: default, chaos and scenario, swapped at runtime
+
+    ServerContext()
+        : outcomes(nullptr)
+        , router(nullptr)
+        , chaos(nullptr)
+        , chaos_mixes(nullptr)
+        , rng(nullptr)
+        , distributions(nullptr)
+        , recorder(nullptr)
+        , replay(nullptr)
+        , corpus(nullptr)
+        , compression(nullptr)
+        , upstream(nullptr)
+        , scripts(nullptr)
+        , admission(nullptr)
+        , timeouts(nullptr)
+        , overload(nullptr)
+        , config(nullptr) {
+    }
+};
+
+#endif // SERVER_CONTEXT_H
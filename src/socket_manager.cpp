@@ -1,15 +1,169 @@
 #include "socket_manager.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
 #include <cstring>
+#include <fstream>
+#include <sstream>
 #include <stdexcept>
 
+ListenAddress::ListenAddress()
+    : family(AF_INET)
+    , host("0.0.0.0")
+    , port(0) {
+}
+
+bool ListenAddress::parse(const std::string& text, ListenAddress& address, std::string& error) {
+    if (text.compare(0, 5, "unix:") == 0) {
+        address.family = AF_UNIX;
+        address.host = text.substr(5);
+        address.port = 0;
+        if (address.host.empty() || address.host.length() >= sizeof(sockaddr_un::sun_path)) {
+            error = "Unix socket path must be 1 to " +
+                    std::to_string(sizeof(sockaddr_un::sun_path) - 1) + " bytes: " + text;
+            return false;
+        }
+        return true;
+    }
+
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos || colon + 1 == text.length()) {
+        error = "Listen address must be host:port, [host]:port or unix:<path>: " + text;
+        return false;
+    }
+    std::string host = text.substr(0, colon);
+    std::string port = text.substr(colon + 1);
+    if (port.length() > 5 || port.find_first_not_of("0123456789") != std::string::npos ||
+        std::stoi(port) > 65535) {
+        error = "Listen port is not a number from 0 to 65535: " + port;
+        return false;
+    }
+
+    int family = AF_INET;
+    if (host.length() >= 2 && host.front() == '[' && host.back() == ']') {
+        family = AF_INET6;
+        host = host.substr(1, host.length() - 2);
+    } else if (host.find(':') != std::string::npos) {
+        error = "IPv6 addresses need brackets, as in [::1]:8080: " + text;
+        return false;
+    }
+    if (host.empty()) {
+        host = family == AF_INET6 ? "::" : "0.0.0.0";
+    }
+
+    struct in6_addr parsed;
+    if (inet_pton(family, host.c_str(), &parsed) != 1) {
+        error = std::string("Not a numeric ") + (family == AF_INET6 ? "IPv6" : "IPv4") +
+                " address: " + host;
+        return false;
+    }
+
+    address.family = family;
+    address.host = host;
+    address.port = std::stoi(port);
+    return true;
+}
+
+bool ListenAddress::fromSocket(int fd, ListenAddress& address, std::string& error) {
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t length = sizeof(storage);
+    if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&storage), &length) < 0) {
+        error = "Cannot read the address of socket " + std::to_string(fd) + ": " + strerror(errno);
+        return false;
+    }
+
+    char host[INET6_ADDRSTRLEN];
+    switch (storage.ss_family) {
+        case AF_INET: {
+            auto* addr = reinterpret_cast<struct sockaddr_in*>(&storage);
+            inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host));
+            address.host = host;
+            address.port = ntohs(addr->sin_port);
+            break;
+        }
+        case AF_INET6: {
+            auto* addr = reinterpret_cast<struct sockaddr_in6*>(&storage);
+            inet_ntop(AF_INET6, &addr->sin6_addr, host, sizeof(host));
+            address.host = host;
+            address.port = ntohs(addr->sin6_port);
+            break;
+        }
+        case AF_UNIX: {
+            // Abstract names start with a NUL and run to the end of the address
+            auto* addr = reinterpret_cast<struct sockaddr_un*>(&storage);
+            size_t path_length = length > offsetof(struct sockaddr_un, sun_path)
+                ? length - offsetof(struct sockaddr_un, sun_path) : 0;
+            if (path_length == 0) {
+                error = "Socket " + std::to_string(fd) + " is an unbound Unix socket";
+                return false;
+            }
+            if (addr->sun_path[0] == '\0') {
+                address.host = "@" + std::string(addr->sun_path + 1, path_length - 1);
+            } else {
+                address.host = std::string(addr->sun_path, strnlen(addr->sun_path, path_length));
+            }
+            address.port = 0;
+            break;
+        }
+        default:
+            error = "Socket " + std::to_string(fd) + " is not an IPv4, IPv6 or Unix socket";
+            return false;
+    }
+    address.family = storage.ss_family;
+    return true;
+}
+
+bool ListenAddress::operator==(const ListenAddress& other) const {
+    if (family != other.family || port != other.port) {
+        return false;
+    }
+    if (family == AF_UNIX) {
+        return host == other.host;
+    }
+    struct in6_addr mine;
+    struct in6_addr theirs;
+    memset(&mine, 0, sizeof(mine));
+    memset(&theirs, 0, sizeof(theirs));
+    return inet_pton(family, host.c_str(), &mine) == 1 &&
+           inet_pton(family, other.host.c_str(), &theirs) == 1 &&
+           memcmp(&mine, &theirs, sizeof(mine)) == 0;
+}
+
+std::string ListenAddress::toString() const {
+    if (family == AF_UNIX) {
+        return "unix:" + host;
+    }
+    if (family == AF_INET6) {
+        return "[" + host + "]:" + std::to_string(port);
+    }
+    return host + ":" + std::to_string(port);
+}
+
 SocketManager::SocketManager()
-    : listen_fd_(-1)
+    : defer_accept_(0)
+    , fast_open_(0)
+    , accept_batch_(DEFAULT_ACCEPT_BATCH)
+    , accept_cursor_(0)
+    , accept_taken_(0)
+    , accept_backlogged_(false)
+    , accept_failed_(false)
+    , accept_paused_(false)
+    , accepted_(0)
+    , accept_errors_(0)
+    , peak_accept_queue_(0)
     , epoll_fd_(-1)
+    , timer_fd_(-1)
+    , timer_deadline_(std::chrono::steady_clock::time_point::max())
     , events_(MAX_EVENTS) {
 }
 
@@ -18,74 +172,343 @@ SocketManager::~SocketManager() {
 }
 
 bool SocketManager::bind(const std::string& host, int port) {
+    ListenAddress address;
+    address.family = host.find(':') != std::string::npos ? AF_INET6 : AF_INET;
+    if (!host.empty()) {
+        address.host = host;
+    }
+    address.port = port;
+    return bind(address);
+}
+
+bool SocketManager::bind(const ListenAddress& address) {
+    if (address.family == AF_UNIX) {
+        return bindUnix(address);
+    }
+
+    // Set up address
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t length;
+    int parsed;
+    if (address.family == AF_INET6) {
+        auto* addr = reinterpret_cast<struct sockaddr_in6*>(&storage);
+        addr->sin6_family = AF_INET6;
+        addr->sin6_port = htons(static_cast<uint16_t>(address.port));
+        parsed = inet_pton(AF_INET6, address.host.c_str(), &addr->sin6_addr);
+        length = sizeof(struct sockaddr_in6);
+    } else {
+        auto* addr = reinterpret_cast<struct sockaddr_in*>(&storage);
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(static_cast<uint16_t>(address.port));
+        parsed = inet_pton(AF_INET, address.host.c_str(), &addr->sin_addr);
+        length = sizeof(struct sockaddr_in);
+    }
+    if (parsed != 1) {
+        error_message_ = "Not a numeric address: " + address.host;
+        return false;
+    }
+
     // Create socket
-    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd_ < 0) {
+    int listen_fd = socket(address.family, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        error_message_ = "Cannot create socket for " + address.toString() + ": " + strerror(errno);
         return false;
     }
 
-    // Set socket options
+    // Set socket options; [::] is IPv6 only, so 0.0.0.0 can share its port
     int opt = 1;
-    if (setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        ::close(listen_fd_);
-        listen_fd_ = -1;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        (address.family == AF_INET6 &&
+         setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) < 0)) {
+        error_message_ = "Cannot set options on " + address.toString() + ": " + strerror(errno);
+        ::close(listen_fd);
         return false;
     }
 
-    // Set up address
-    struct sockaddr_in addr;
+    // Bind socket
+    if (::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&storage), length) < 0) {
+        error_message_ = "Failed to bind to " + address.toString() + ": " + strerror(errno);
+        ::close(listen_fd);
+        return false;
+    }
+
+    // Set non-blocking
+    setNonBlocking(listen_fd);
+
+    listen_fds_.push_back(listen_fd);
+    listen_tcp_.push_back(true);
+    return true;
+}
+
+bool SocketManager::bindUnix(const ListenAddress& address) {
+    struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sun_family = AF_UNIX;
+    if (address.host.empty() || address.host.length() >= sizeof(addr.sun_path)) {
+        error_message_ = "Unix socket path too long: " + address.host;
+        return false;
+    }
+    memcpy(addr.sun_path, address.host.data(), address.host.length());
+    socklen_t length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) +
+                                              address.host.length() + 1);
+
+    bool abstract = address.host.front() == '@';
+    if (abstract) {
+        // Abstract names are not NUL-terminated; the length ends them
+        addr.sun_path[0] = '\0';
+        length--;
+    }
 
-    if (host == "0.0.0.0" || host.empty()) {
-        addr.sin_addr.s_addr = INADDR_ANY;
-    } else {
-        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
-            ::close(listen_fd_);
-            listen_fd_ = -1;
-            return false;
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        error_message_ = "Cannot create socket for " + address.toString() + ": " + strerror(errno);
+        return false;
+    }
+
+    // A socket file left by a server that is gone refuses connections and is
+    // replaced; one that accepts them belongs to a live server
+    struct stat status;
+    if (!abstract && stat(address.host.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0 &&
+            connect(probe, reinterpret_cast<struct sockaddr*>(&addr), length) < 0 &&
+            errno == ECONNREFUSED) {
+            unlink(address.host.c_str());
+        }
+        if (probe >= 0) {
+            ::close(probe);
         }
     }
 
-    // Bind socket
-    if (::bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
-        ::close(listen_fd_);
-        listen_fd_ = -1;
+    if (::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), length) < 0) {
+        error_message_ = "Failed to bind to " + address.toString() + ": " + strerror(errno);
+        ::close(listen_fd);
         return false;
     }
 
-    // Set non-blocking
-    setNonBlocking(listen_fd_);
+    setNonBlocking(listen_fd);
 
+    listen_fds_.push_back(listen_fd);
+    listen_tcp_.push_back(false);
+    if (!abstract) {
+        unix_paths_.push_back(address.host);
+    }
     return true;
 }
 
-bool SocketManager::listen(int backlog) {
-    if (listen_fd_ < 0) {
+bool SocketManager::adopt(int fd, bool own_path) {
+    int type = 0;
+    socklen_t type_length = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_length) < 0 || type != SOCK_STREAM) {
+        error_message_ = "Socket " + std::to_string(fd) + " is not a stream socket";
         return false;
     }
-
-    if (::listen(listen_fd_, backlog) < 0) {
+    ListenAddress address;
+    if (!ListenAddress::fromSocket(fd, address, error_message_)) {
         return false;
     }
 
+    setNonBlocking(fd);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    listen_fds_.push_back(fd);
+    listen_tcp_.push_back(address.family != AF_UNIX);
+    if (own_path && address.family == AF_UNIX && address.host.front() != '@') {
+        unix_paths_.push_back(address.host);
+    }
     return true;
 }
 
-int SocketManager::acceptConnection() {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+void SocketManager::releaseListeners() {
+    for (int listen_fd : listen_fds_) {
+        if (epoll_fd_ >= 0) {
+            removeFromEpoll(listen_fd);
+        }
+        ::close(listen_fd);
+    }
+    listen_fds_.clear();
+    listen_tcp_.clear();
+    unix_paths_.clear();
+    accept_cursor_ = 0;
+    accept_taken_ = 0;
+    accept_backlogged_ = false;
+    accept_failed_ = false;
+    accept_paused_ = false;
+}
+
+void SocketManager::setDeferAccept(int seconds) {
+    defer_accept_ = seconds;
+}
+
+void SocketManager::setFastOpen(int queue) {
+    fast_open_ = queue;
+}
+
+bool SocketManager::listen(int backlog) {
+    if (listen_fds_.empty()) {
+        return false;
+    }
 
-    int client_fd = accept(listen_fd_, reinterpret_cast<struct sockaddr*>(&client_addr), &client_len);
-    if (client_fd < 0) {
+    for (size_t i = 0; i < listen_fds_.size(); i++) {
+        int listen_fd = listen_fds_[i];
+        // Both are TCP-only and must be set before listen() for Fast Open
+        if (listen_tcp_[i] && defer_accept_ > 0 &&
+            setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept_,
+                       sizeof(defer_accept_)) < 0) {
+            error_message_ = std::string("Cannot set TCP_DEFER_ACCEPT: ") + strerror(errno);
+            return false;
+        }
+        if (listen_tcp_[i] && fast_open_ > 0 &&
+            setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &fast_open_, sizeof(fast_open_)) < 0) {
+            error_message_ = std::string("Cannot set TCP_FASTOPEN: ") + strerror(errno);
+            return false;
+        }
+        if (::listen(listen_fd, backlog) < 0) {
+            error_message_ = std::string("Failed to listen on socket: ") + strerror(errno);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int SocketManager::acceptConnection(size_t* listener) {
+    if (accept_paused_) {
         return -1;
     }
 
-    // Set non-blocking
-    setNonBlocking(client_fd);
+    // A new round: forget what the last one left behind
+    if (accept_cursor_ == 0 && accept_taken_ == 0) {
+        accept_backlogged_ = false;
+        accept_failed_ = false;
+    }
+
+    // Each listener is drained in turn, as edge-triggered epoll requires,
+    // up to the batch; the rest waits for the next round
+    while (accept_cursor_ < listen_fds_.size()) {
+        int listen_fd = listen_fds_[accept_cursor_];
+        if (accept_taken_ >= accept_batch_) {
+            if (listen_tcp_[accept_cursor_]) {
+                sampleAcceptQueue(listen_fd);
+            }
+            accept_backlogged_ = true;
+        } else {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd >= 0) {
+                accept_taken_++;
+                accepted_++;
+                if (listener != nullptr) {
+                    *listener = accept_cursor_;
+                }
+                return client_fd;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                // Gone before we got to it; the next one may be fine
+                continue;
+            }
+            if (errno != EAGAIN) {
+                // EMFILE and friends leave the connection queued (EAGAIN ==
+                // EWOULDBLOCK on Linux)
+                accept_errors_++;
+                accept_failed_ = true;
+            }
+        }
+        accept_cursor_++;
+        accept_taken_ = 0;
+    }
+
+    accept_cursor_ = 0;
+    return -1;
+}
 
-    return client_fd;
+void SocketManager::setAcceptBatch(size_t batch) {
+    accept_batch_ = batch > 0 ? batch : 1;
+}
+
+bool SocketManager::acceptBacklogged() const {
+    return accept_backlogged_ && !accept_paused_;
+}
+
+bool SocketManager::acceptPending() const {
+    return (accept_backlogged_ || accept_failed_) && !accept_paused_;
+}
+
+void SocketManager::pauseAccepting() {
+    if (accept_paused_) {
+        return;
+    }
+    for (int listen_fd : listen_fds_) {
+        removeFromEpoll(listen_fd);
+    }
+    accept_paused_ = true;
+}
+
+void SocketManager::resumeAccepting() {
+    if (!accept_paused_) {
+        return;
+    }
+    for (int listen_fd : listen_fds_) {
+        addToEpoll(listen_fd, EPOLLIN);
+    }
+    accept_paused_ = false;
+
+    // Whatever queued up meanwhile is taken without waiting for an event
+    accept_backlogged_ = true;
+}
+
+bool SocketManager::acceptPaused() const {
+    return accept_paused_;
+}
+
+uint64_t SocketManager::accepted() const {
+    return accepted_;
+}
+
+uint64_t SocketManager::acceptErrors() const {
+    return accept_errors_;
+}
+
+uint64_t SocketManager::peakAcceptQueue() const {
+    return peak_accept_queue_;
+}
+
+void SocketManager::sampleAcceptQueue(int listen_fd) {
+    // On a listening socket, tcpi_unacked is the accept queue length
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(listen_fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+        peak_accept_queue_ = std::max<uint64_t>(peak_accept_queue_, info.tcpi_unacked);
+    }
+}
+
+bool SocketManager::readListenDrops(uint64_t& overflows, uint64_t& drops) {
+    // Pairs of lines: "TcpExt: <names>" then "TcpExt: <values>"
+    std::ifstream netstat("/proc/net/netstat");
+    std::string names;
+    std::string values;
+    while (std::getline(netstat, names) && std::getline(netstat, values)) {
+        if (names.compare(0, 7, "TcpExt:") != 0) {
+            continue;
+        }
+        std::istringstream name_stream(names);
+        std::istringstream value_stream(values);
+        std::string name;
+        std::string value;
+        bool found_overflows = false;
+        bool found_drops = false;
+        while (name_stream >> name && value_stream >> value) {
+            if (name == "ListenOverflows") {
+                overflows = std::stoull(value);
+                found_overflows = true;
+            } else if (name == "ListenDrops") {
+                drops = std::stoull(value);
+                found_drops = true;
+            }
+        }
+        return found_overflows && found_drops;
+    }
+    return false;
 }
 
 bool SocketManager::initEpoll() {
@@ -94,8 +517,13 @@ bool SocketManager::initEpoll() {
         return false;
     }
 
-    // Add listen socket to epoll
-    return addToEpoll(listen_fd_, EPOLLIN);
+    // Add listen sockets to epoll
+    for (int listen_fd : listen_fds_) {
+        if (!addToEpoll(listen_fd, EPOLLIN)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool SocketManager::addToEpoll(int fd, uint32_t events) {
@@ -130,6 +558,50 @@ bool SocketManager::modifyEpoll(int fd, uint32_t events) {
     return true;
 }
 
+bool SocketManager::initTimer() {
+    // steady_clock is CLOCK_MONOTONIC on Linux, so deadlines map directly
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+        return false;
+    }
+
+    return addToEpoll(timer_fd_, EPOLLIN);
+}
+
+void SocketManager::armTimer(std::chrono::steady_clock::time_point deadline) {
+    if (timer_fd_ < 0 || deadline == timer_deadline_) {
+        return;
+    }
+    timer_deadline_ = deadline;
+
+    // A zero it_value disarms the timer
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline.time_since_epoch()).count();
+        if (ns <= 0) {
+            ns = 1;
+        }
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void SocketManager::clearTimer() {
+    if (timer_fd_ < 0) {
+        return;
+    }
+
+    // Drain the expiration count so edge-triggered epoll reports the next one
+    uint64_t expirations;
+    if (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+        timer_deadline_ = std::chrono::steady_clock::time_point::max();
+    }
+}
+
 int SocketManager::waitForEvents(int timeout_ms) {
     int n = epoll_wait(epoll_fd_, events_.data(), MAX_EVENTS, timeout_ms);
     return n;
@@ -150,9 +622,18 @@ void SocketManager::close(int fd) {
 }
 
 void SocketManager::closeAll() {
-    if (listen_fd_ >= 0) {
-        ::close(listen_fd_);
-        listen_fd_ = -1;
+    for (int listen_fd : listen_fds_) {
+        ::close(listen_fd);
+    }
+    listen_fds_.clear();
+    listen_tcp_.clear();
+    for (const std::string& path : unix_paths_) {
+        unlink(path.c_str());
+    }
+    unix_paths_.clear();
+    if (timer_fd_ >= 0) {
+        ::close(timer_fd_);
+        timer_fd_ = -1;
     }
     if (epoll_fd_ >= 0) {
         ::close(epoll_fd_);
@@ -160,8 +641,16 @@ void SocketManager::closeAll() {
     }
 }
 
-int SocketManager::getListenFd() const {
-    return listen_fd_;
+int SocketManager::getListenFd(size_t listener) const {
+    return listener < listen_fds_.size() ? listen_fds_[listener] : -1;
+}
+
+size_t SocketManager::listenerCount() const {
+    return listen_fds_.size();
+}
+
+const std::string& SocketManager::getErrorMessage() const {
+    return error_message_;
 }
 
 void SocketManager::setNonBlocking(int fd) {
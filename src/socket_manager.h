@@ -4,8 +4,29 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <chrono>
 #include <sys/epoll.h>
 
+// Where a listener binds: host:port for IPv4, [host]:port for IPv6, or
+// unix:<path> for a Unix domain socket (unix:@<name> for Linux's abstract
+// namespace, which leaves no file behind)
+struct ListenAddress {
+    int family;         // AF_INET, AF_INET6 or AF_UNIX
+    std::string host;   // Numeric address, or the socket path
+    int port;
+
+    ListenAddress();
+
+    static bool parse(const std::string& text, ListenAddress& address, std::string& error);
+
+    // The address a socket is bound to, for descriptors we did not bind
+    static bool fromSocket(int fd, ListenAddress& address, std::string& error);
+    std::string toString() const;
+
+    // Same socket address, however the host was spelled
+    bool operator==(const ListenAddress& other) const;
+};
+
 class SocketManager {
 public:
     struct Event {
@@ -16,32 +37,110 @@ public:
         bool hangup;
     };
 
+    static constexpr int DEFAULT_BACKLOG = 511;
+    static constexpr size_t DEFAULT_ACCEPT_BATCH = 64;
+
     SocketManager();
     ~SocketManager();
 
+    // Each bind() adds a listening socket; listeners are numbered from 0
+    // in the order they were bound. A host containing ':' is IPv6.
     bool bind(const std::string& host, int port);
-    bool listen(int backlog = 128);
-    int acceptConnection();
+    bool bind(const ListenAddress& address);
+
+    // Adds a socket bound elsewhere (socket activation, or a process we
+    // took over from) as the next listener. With own_path, a Unix socket's
+    // file is removed by closeAll() as if we had bound it.
+    bool adopt(int fd, bool own_path);
+
+    // Stops accepting and closes our listening descriptors, leaving socket
+    // files in place: another process holds the same sockets now
+    void releaseListeners();
+
+    // TCP listener options, applied by listen(): TCP_DEFER_ACCEPT (wake
+    // only once a connection has data, giving up after seconds) and
+    // TCP_FASTOPEN with this many pending cookie-less requests; 0 = off
+    void setDeferAccept(int seconds);
+    void setFastOpen(int queue);
+    bool listen(int backlog = DEFAULT_BACKLOG);
+
+    // A connection from any listener, with the listener's number in
+    // *listener; -1 once every listener is empty or has given its batch.
+    // Connections come non-blocking and close-on-exec.
+    int acceptConnection(size_t* listener = nullptr);
+
+    // Connections taken from one listener per round of acceptConnection()
+    // calls, so a flood of new connections cannot starve open ones
+    void setAcceptBatch(size_t batch);
+
+    // The last round left connections queued: edge-triggered epoll will not
+    // report them again, so accept again without waiting for an event
+    bool acceptBacklogged() const;
+    // ... or accept() failed (out of descriptors); retry on the next wakeup
+    bool acceptPending() const;
+
+    // Admission control: the listeners leave the epoll set and
+    // acceptConnection() takes nothing, so new connections wait in the
+    // accept queues; resuming picks up where the round stopped
+    void pauseAccepting();
+    void resumeAccepting();
+    bool acceptPaused() const;
+
+    // Counters for the shutdown summary
+    uint64_t accepted() const;
+    uint64_t acceptErrors() const;
+    uint64_t peakAcceptQueue() const;   // Deepest TCP accept queue seen
+
+    // System-wide TcpExt ListenOverflows (accept queue full) and ListenDrops
+    // from /proc/net/netstat; false if unavailable
+    static bool readListenDrops(uint64_t& overflows, uint64_t& drops);
 
     bool initEpoll();
     bool addToEpoll(int fd, uint32_t events);
     bool removeFromEpoll(int fd);
     bool modifyEpoll(int fd, uint32_t events);
 
+    // timerfd in the epoll set that wakes the loop at the next deadline,
+    // giving sub-millisecond delays independent of the poll timeout
+    bool initTimer();
+    void armTimer(std::chrono::steady_clock::time_point deadline);
+    void clearTimer();
+
     int waitForEvents(int timeout_ms = -1);
     std::vector<Event> getEvents() const;
 
     void close(int fd);
     void closeAll();
 
-    int getListenFd() const;
+    int getListenFd(size_t listener = 0) const;
+    size_t listenerCount() const;
+    const std::string& getErrorMessage() const;
 
 private:
-    int listen_fd_;
+    std::vector<int> listen_fds_;
+    std::vector<bool> listen_tcp_;
+    std::vector<std::string> unix_paths_;  // Socket files to remove on closeAll()
+    int defer_accept_;
+    int fast_open_;
+    size_t accept_batch_;
+    size_t accept_cursor_;      // Listener acceptConnection() tries first
+    size_t accept_taken_;       // Connections taken from it this round
+    bool accept_backlogged_;
+    bool accept_failed_;
+    bool accept_paused_;
+    uint64_t accepted_;
+    uint64_t accept_errors_;
+    uint64_t peak_accept_queue_;
     int epoll_fd_;
+    int timer_fd_;
+    std::chrono::steady_clock::time_point timer_deadline_;
     std::vector<struct epoll_event> events_;
+    std::string error_message_;
     static constexpr int MAX_EVENTS = 64;
 
+    bool bindUnix(const ListenAddress& address);
+    void sampleAcceptQueue(int listen_fd);
+
     void setNonBlocking(int fd);
 };
 
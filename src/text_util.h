@@ -0,0 +1,16 @@
+#ifndef TEXT_UTIL_H
+#define TEXT_UTIL_H
+
+#include <cstdint>
+#include <string>
+
+// Small helpers shared by the spec and header parsers
+
+// text without leading and trailing characters from whitespace
+std::string trim(const std::string& text, const char* whitespace = " \t");
+
+// Decimal digits only, no sign or spaces, and at most max; false for
+// anything else, including values past 64 bits
+bool parseUnsigned(const std::string& text, uint64_t& out, uint64_t max = UINT64_MAX);
+
+#endif // TEXT_UTIL_H
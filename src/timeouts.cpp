@@ -0,0 +1,109 @@
+#include "timeouts.h"
+#include <algorithm>
+
+Timeouts::Entry::Entry()
+    : prev(nullptr)
+    , next(nullptr)
+    , cause(TimeoutCause::IDLE)
+    , linked(false)
+    , expired(false) {
+}
+
+Timeouts::Timeouts(std::chrono::milliseconds idle, std::chrono::milliseconds header,
+                   std::chrono::milliseconds body)
+    : durations_{idle, header, body}
+    , lists_{}
+    , expired_{} {
+}
+
+size_t Timeouts::index(TimeoutCause cause) {
+    return static_cast<size_t>(cause);
+}
+
+void Timeouts::start(Entry& entry, TimeoutCause cause, std::chrono::steady_clock::time_point now) {
+    unlink(entry);
+    entry.cause = cause;
+    entry.expired = false;
+    if (durations_[index(cause)].count() <= 0) {
+        return;
+    }
+
+    // Same duration for the whole list: the newest deadline is the latest
+    entry.deadline = now + durations_[index(cause)];
+    List& list = lists_[index(cause)];
+    entry.prev = list.tail;
+    entry.next = nullptr;
+    if (list.tail != nullptr) {
+        list.tail->next = &entry;
+    } else {
+        list.head = &entry;
+    }
+    list.tail = &entry;
+    entry.linked = true;
+}
+
+void Timeouts::stop(Entry& entry) {
+    unlink(entry);
+    entry.expired = false;
+}
+
+void Timeouts::unlink(Entry& entry) {
+    if (!entry.linked) {
+        return;
+    }
+    List& list = lists_[index(entry.cause)];
+    if (entry.prev != nullptr) {
+        entry.prev->next = entry.next;
+    } else {
+        list.head = entry.next;
+    }
+    if (entry.next != nullptr) {
+        entry.next->prev = entry.prev;
+    } else {
+        list.tail = entry.prev;
+    }
+    entry.prev = nullptr;
+    entry.next = nullptr;
+    entry.linked = false;
+}
+
+size_t Timeouts::expire(std::chrono::steady_clock::time_point now) {
+    size_t count = 0;
+    for (size_t i = 0; i < CAUSES; i++) {
+        while (lists_[i].head != nullptr && lists_[i].head->deadline <= now) {
+            Entry& entry = *lists_[i].head;
+            unlink(entry);
+            entry.expired = true;
+            expired_[i]++;
+            count++;
+        }
+    }
+    return count;
+}
+
+std::chrono::steady_clock::time_point Timeouts::nextDeadline() const {
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    for (const List& list : lists_) {
+        if (list.head != nullptr) {
+            deadline = std::min(deadline, list.head->deadline);
+        }
+    }
+    return deadline;
+}
+
+std::chrono::milliseconds Timeouts::duration(TimeoutCause cause) const {
+    return durations_[index(cause)];
+}
+
+uint64_t Timeouts::expired(TimeoutCause cause) const {
+    return expired_[index(cause)];
+}
+
+const char* Timeouts::causeName(TimeoutCause cause) {
+    switch (cause) {
+        case TimeoutCause::IDLE: return "idle";
+        case TimeoutCause::HEADER: return "header";
+        case TimeoutCause::BODY: return "body";
+    }
+    return "unknown";
+}
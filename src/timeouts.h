@@ -0,0 +1,74 @@
+#ifndef TIMEOUTS_H
+#define TIMEOUTS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// What a connection is waiting for from the client when its clock runs out
+enum class TimeoutCause {
+    IDLE,       // The first byte of a request (or of the TLS handshake)
+    HEADER,     // The rest of the request head, from its first byte
+    BODY        // More of a request body being read before the behavior
+};
+
+// --idle-timeout, --header-timeout and --body-timeout. Every cause has one
+// duration, so a connection started (or restarted) later always expires
+// later: each cause keeps its connections in an intrusive list in deadline
+// order. Starting a clock appends to a list, stopping it unlinks, and
+// expire() only looks at the fronts, so none of them scans connections.
+class Timeouts {
+public:
+    static constexpr size_t CAUSES = 3;
+
+    // Embedded in each connection; on at most one list at a time
+    struct Entry {
+        Entry* prev;
+        Entry* next;
+        std::chrono::steady_clock::time_point deadline;
+        TimeoutCause cause;
+        bool linked;
+        bool expired;       // Set by expire(); the connection clears it
+
+        Entry();
+    };
+
+    // A duration of zero disables that cause
+    Timeouts(std::chrono::milliseconds idle, std::chrono::milliseconds header,
+             std::chrono::milliseconds body);
+
+    Timeouts(const Timeouts&) = delete;
+    Timeouts& operator=(const Timeouts&) = delete;
+
+    // (Re)starts entry's clock for cause at now, replacing whatever it was
+    // waiting for; stop() takes it off the clock
+    void start(Entry& entry, TimeoutCause cause, std::chrono::steady_clock::time_point now);
+    void stop(Entry& entry);
+
+    // Marks and unlinks every entry whose deadline is at or before now;
+    // returns how many
+    size_t expire(std::chrono::steady_clock::time_point now);
+
+    // Earliest deadline of any entry; time_point::max() if none
+    std::chrono::steady_clock::time_point nextDeadline() const;
+
+    std::chrono::milliseconds duration(TimeoutCause cause) const;
+    uint64_t expired(TimeoutCause cause) const;
+
+    static const char* causeName(TimeoutCause cause);
+
+private:
+    struct List {
+        Entry* head;
+        Entry* tail;
+    };
+
+    std::chrono::milliseconds durations_[CAUSES];
+    List lists_[CAUSES];
+    uint64_t expired_[CAUSES];
+
+    static size_t index(TimeoutCause cause);
+    void unlink(Entry& entry);
+};
+
+#endif // TIMEOUTS_H
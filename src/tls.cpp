@@ -0,0 +1,447 @@
+#include "tls.h"
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <cerrno>
+
+#ifdef STITCH_HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/tls1.h>
+
+#ifdef OPENSSL_NO_KTLS
+#define BIO_get_ktls_send(b) 0
+#define BIO_get_ktls_recv(b) 0
+#endif
+#endif
+
+namespace {
+
+constexpr size_t BUFFER_SIZE = 16384;   // One TLS record of plaintext
+
+#ifdef STITCH_HAVE_OPENSSL
+std::string lastError(const std::string& what) {
+    char buffer[256];
+    ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+    ERR_clear_error();
+    return what + ": " + buffer;
+}
+#endif
+
+} // namespace
+
+TlsContext::TlsContext()
+    : ctx_(nullptr)
+    , handshakes_(0)
+    , resumed_(0)
+    , kernel_offloaded_(0) {
+}
+
+TlsContext::~TlsContext() {
+#ifdef STITCH_HAVE_OPENSSL
+    SSL_CTX_free(ctx_);
+#endif
+}
+
+bool TlsContext::available() {
+#ifdef STITCH_HAVE_OPENSSL
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool TlsContext::load(const std::string& cert_file, const std::string& key_file,
+                      size_t session_cache, bool tickets) {
+#ifdef STITCH_HAVE_OPENSSL
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if (ctx_ == nullptr) {
+        error_message_ = lastError("Cannot create TLS context");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx_, cert_file.c_str()) != 1) {
+        error_message_ = lastError("Cannot load certificate " + cert_file);
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx_, key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx_) != 1) {
+        error_message_ = lastError("Cannot load private key " + key_file);
+        return false;
+    }
+
+    // Partial writes let the bridge hand over whatever the socket takes.
+    // A client that closes without close_notify reads as an ordinary close.
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    uint64_t options = SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF;
+    if (!tickets) {
+        options |= SSL_OP_NO_TICKET;
+    }
+    SSL_CTX_set_options(ctx_, options);
+
+    static const unsigned char SESSION_CONTEXT[] = "stitch";
+    SSL_CTX_set_session_id_context(ctx_, SESSION_CONTEXT, sizeof(SESSION_CONTEXT) - 1);
+    if (session_cache > 0) {
+        SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx_, static_cast<long>(session_cache));
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_OFF);
+    }
+
+    SSL_CTX_set_client_hello_cb(ctx_, TlsSession::onClientHello, nullptr);
+    return true;
+#else
+    (void)cert_file;
+    (void)key_file;
+    (void)session_cache;
+    (void)tickets;
+    error_message_ = "TLS not available: built without OpenSSL";
+    return false;
+#endif
+}
+
+void TlsContext::setWatcher(std::function<void(int)> watcher) {
+    watcher_ = std::move(watcher);
+}
+
+void TlsContext::watch(int fd) const {
+    if (watcher_) {
+        watcher_(fd);
+    }
+}
+
+HandshakeFault TlsContext::handshakeFault(const std::string& server_name) {
+    std::string label = server_name.substr(0, server_name.find('.'));
+    if (strcasecmp(label.c_str(), "stall-handshake") == 0) {
+        return HandshakeFault::STALL;
+    }
+    if (strcasecmp(label.c_str(), "reset-handshake") == 0) {
+        return HandshakeFault::RESET;
+    }
+    return HandshakeFault::NONE;
+}
+
+uint64_t TlsContext::handshakes() const {
+    return handshakes_;
+}
+
+uint64_t TlsContext::resumed() const {
+    return resumed_;
+}
+
+uint64_t TlsContext::kernelOffloaded() const {
+    return kernel_offloaded_;
+}
+
+void TlsContext::countHandshake(bool resumed, bool kernel_send) {
+    handshakes_++;
+    resumed_ += resumed ? 1 : 0;
+    kernel_offloaded_ += kernel_send ? 1 : 0;
+}
+
+ssl_ctx_st* TlsContext::get() const {
+    return ctx_;
+}
+
+const std::string& TlsContext::getErrorMessage() const {
+    return error_message_;
+}
+
+TlsSession::TlsSession(TlsContext& context, int fd)
+    : context_(context)
+    , fd_(fd)
+    , ssl_(nullptr)
+    , fault_(HandshakeFault::NONE)
+    , established_(false)
+    , kernel_send_(false)
+    , kernel_recv_(false)
+    , plain_fd_(-1)
+    , bridge_fd_(-1)
+    , failed_(false)
+    , read_closed_(false)
+    , inbound_length_(0)
+    , inbound_sent_(0)
+    , outbound_length_(0)
+    , outbound_sent_(0) {
+}
+
+TlsSession::~TlsSession() {
+    if (fd_ >= 0) {
+        close(false, false);
+    }
+#ifdef STITCH_HAVE_OPENSSL
+    SSL_free(ssl_);
+#endif
+}
+
+int TlsSession::onClientHello(ssl_st* ssl, int* alert, void* arg) {
+#ifdef STITCH_HAVE_OPENSSL
+    (void)alert;
+    (void)arg;
+    auto* session = static_cast<TlsSession*>(SSL_get_app_data(ssl));
+
+    // server_name list: length (2), name type (1, 0 = host name),
+    // name length (2), name
+    const unsigned char* data;
+    size_t length;
+    if (session == nullptr ||
+        SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_server_name, &data, &length) != 1 ||
+        length < 5 || data[2] != TLSEXT_NAMETYPE_host_name) {
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+    size_t name_length = (static_cast<size_t>(data[3]) << 8) | data[4];
+    if (name_length > length - 5) {
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+    session->fault_ = TlsContext::handshakeFault(
+        std::string(reinterpret_cast<const char*>(data + 5), name_length));
+
+    // Retry suspends the handshake before anything is sent back; a faulty
+    // one is never resumed
+    return session->fault_ == HandshakeFault::NONE ? SSL_CLIENT_HELLO_SUCCESS
+                                                   : SSL_CLIENT_HELLO_RETRY;
+#else
+    (void)ssl;
+    (void)alert;
+    (void)arg;
+    return 0;
+#endif
+}
+
+TlsSession::Status TlsSession::handshake() {
+#ifdef STITCH_HAVE_OPENSSL
+    if (established_) {
+        return Status::DONE;
+    }
+    if (failed_ || fd_ < 0) {
+        return Status::FAILED;
+    }
+
+    if (fault_ == HandshakeFault::STALL) {
+        // Held until the client gives up
+        char byte;
+        ssize_t n = recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n == 0 || (n < 0 && errno != EAGAIN) ? Status::FAILED : Status::PENDING;
+    }
+
+    if (ssl_ == nullptr) {
+        ssl_ = SSL_new(context_.get());
+        if (ssl_ == nullptr || SSL_set_fd(ssl_, fd_) != 1) {
+            ERR_clear_error();
+            return Status::FAILED;
+        }
+        SSL_set_app_data(ssl_, this);
+        SSL_set_accept_state(ssl_);
+    }
+
+    int result = SSL_do_handshake(ssl_);
+    if (result == 1) {
+        established_ = true;
+        kernel_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+        kernel_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+        context_.countHandshake(SSL_session_reused(ssl_) == 1, kernel_send_);
+
+        // Records go out whole; Nagle would hold the first response record
+        // behind the unacknowledged session tickets, where a reset drops it
+        int nodelay = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        if ((!kernel_send_ || !kernel_recv_) && !openBridge()) {
+            return Status::FAILED;
+        }
+        return Status::DONE;
+    }
+
+    switch (SSL_get_error(ssl_, result)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return Status::PENDING;
+        case SSL_ERROR_WANT_CLIENT_HELLO_CB:
+            if (fault_ == HandshakeFault::RESET) {
+                close(true, false);
+                return Status::FAILED;
+            }
+            return Status::PENDING;
+        default:
+            ERR_clear_error();
+            return Status::FAILED;
+    }
+#else
+    return Status::FAILED;
+#endif
+}
+
+HandshakeFault TlsSession::handshakeFault() const {
+    return fault_;
+}
+
+int TlsSession::readFd() const {
+    return kernel_recv_ ? fd_ : plain_fd_;
+}
+
+int TlsSession::sendFd() const {
+    return kernel_send_ ? fd_ : plain_fd_;
+}
+
+bool TlsSession::kernelSend() const {
+    return kernel_send_;
+}
+
+bool TlsSession::kernelRecv() const {
+    return kernel_recv_;
+}
+
+size_t TlsSession::memoryUsage() const {
+    return inbound_.capacity() + outbound_.capacity();
+}
+
+bool TlsSession::openBridge() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) != 0) {
+        return false;
+    }
+    plain_fd_ = fds[0];
+    bridge_fd_ = fds[1];
+    inbound_.resize(BUFFER_SIZE);
+    outbound_.resize(BUFFER_SIZE);
+    context_.watch(plain_fd_);
+    context_.watch(bridge_fd_);
+    return true;
+}
+
+void TlsSession::pump() {
+    if (!established_ || bridge_fd_ < 0) {
+        return;
+    }
+    if (!kernel_recv_) {
+        pumpInbound();
+    }
+    if (!kernel_send_) {
+        pumpOutbound();
+    }
+}
+
+void TlsSession::pumpInbound() {
+#ifdef STITCH_HAVE_OPENSSL
+    while (!failed_ && !read_closed_) {
+        while (inbound_sent_ < inbound_length_) {
+            ssize_t n = send(bridge_fd_, inbound_.data() + inbound_sent_,
+                             inbound_length_ - inbound_sent_, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN) {
+                    fail();
+                }
+                return;
+            }
+            inbound_sent_ += static_cast<size_t>(n);
+        }
+
+        int n = SSL_read(ssl_, inbound_.data(), static_cast<int>(inbound_.size()));
+        if (n > 0) {
+            inbound_length_ = static_cast<size_t>(n);
+            inbound_sent_ = 0;
+            continue;
+        }
+        switch (SSL_get_error(ssl_, n)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                return;
+            case SSL_ERROR_ZERO_RETURN:
+                // The handler reads its EOF; the other direction stays open
+                read_closed_ = true;
+                shutdown(bridge_fd_, SHUT_WR);
+                return;
+            default:
+                ERR_clear_error();
+                fail();
+                return;
+        }
+    }
+#endif
+}
+
+void TlsSession::pumpOutbound() {
+#ifdef STITCH_HAVE_OPENSSL
+    while (!failed_) {
+        if (outbound_sent_ == outbound_length_) {
+            ssize_t n = recv(bridge_fd_, outbound_.data(), outbound_.size(), 0);
+            if (n <= 0) {
+                return;
+            }
+            outbound_length_ = static_cast<size_t>(n);
+            outbound_sent_ = 0;
+        }
+
+        // A retried write passes the same bytes again, as OpenSSL requires
+        int n = SSL_write(ssl_, outbound_.data() + outbound_sent_,
+                          static_cast<int>(outbound_length_ - outbound_sent_));
+        if (n > 0) {
+            outbound_sent_ += static_cast<size_t>(n);
+            continue;
+        }
+        switch (SSL_get_error(ssl_, n)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                return;
+            default:
+                ERR_clear_error();
+                fail();
+                return;
+        }
+    }
+#endif
+}
+
+void TlsSession::fail() {
+    // Closing our end fails the handler's reads and sends as a dead socket would
+    failed_ = true;
+    if (bridge_fd_ >= 0) {
+        ::close(bridge_fd_);
+        bridge_fd_ = -1;
+    }
+}
+
+bool TlsSession::drained() const {
+    if (failed_ || bridge_fd_ < 0 || kernel_send_) {
+        return true;
+    }
+    int queued = 0;
+    return outbound_sent_ == outbound_length_ &&
+           ioctl(bridge_fd_, FIONREAD, &queued) == 0 && queued == 0;
+}
+
+void TlsSession::close(bool reset, bool close_notify) {
+    if (fd_ < 0) {
+        return;
+    }
+    if (reset) {
+        // Zero linger turns the close() into an RST
+        struct linger abort_linger;
+        abort_linger.l_onoff = 1;
+        abort_linger.l_linger = 0;
+        setsockopt(fd_, SOL_SOCKET, SO_LINGER, &abort_linger, sizeof(abort_linger));
+    }
+#ifdef STITCH_HAVE_OPENSSL
+    else if (close_notify && established_ && !failed_) {
+        // One attempt; a client that is not reading does not get to hold
+        // the connection open
+        SSL_shutdown(ssl_);
+        ERR_clear_error();
+    }
+#else
+    (void)close_notify;
+#endif
+    ::close(fd_);
+    fd_ = -1;
+    if (plain_fd_ >= 0) {
+        ::close(plain_fd_);
+        plain_fd_ = -1;
+    }
+    if (bridge_fd_ >= 0) {
+        ::close(bridge_fd_);
+        bridge_fd_ = -1;
+    }
+}
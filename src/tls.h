@@ -0,0 +1,140 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// OpenSSL types, so only tls.cpp needs its headers
+struct ssl_st;
+struct ssl_ctx_st;
+
+// Handshake faults, picked by the first label of the client's server name
+// (SNI), since the handshake is over before any query could be read:
+//   stall-handshake.<anything>   read the ClientHello and never answer
+//   reset-handshake.<anything>   answer the ClientHello with an RST
+enum class HandshakeFault {
+    NONE,
+    STALL,
+    RESET
+};
+
+// The TLS side of a --tls-port listener: certificate, session resumption
+// (tickets and a server-side session cache) and kernel TLS where the
+// kernel and OpenSSL support it. Built without OpenSSL, load() fails.
+class TlsContext {
+public:
+    static constexpr size_t DEFAULT_SESSION_CACHE = 20480;
+
+    TlsContext();
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    static bool available();
+
+    // PEM certificate chain and private key. session_cache is the number of
+    // sessions kept for ID resumption (0 disables it); without tickets,
+    // TLS 1.3 resumption goes through the same cache.
+    bool load(const std::string& cert_file, const std::string& key_file,
+              size_t session_cache = DEFAULT_SESSION_CACHE, bool tickets = true);
+
+    // Called with each descriptor a session adds, so the event loop wakes
+    // when the plaintext side of a connection moves
+    void setWatcher(std::function<void(int)> watcher);
+    void watch(int fd) const;
+
+    static HandshakeFault handshakeFault(const std::string& server_name);
+
+    // Counters for the shutdown summary
+    uint64_t handshakes() const;
+    uint64_t resumed() const;
+    uint64_t kernelOffloaded() const;
+    void countHandshake(bool resumed, bool kernel_send);
+
+    ssl_ctx_st* get() const;
+    const std::string& getErrorMessage() const;
+
+private:
+    ssl_ctx_st* ctx_;
+    std::function<void(int)> watcher_;
+    uint64_t handshakes_;
+    uint64_t resumed_;
+    uint64_t kernel_offloaded_;
+    std::string error_message_;
+};
+
+// One TLS connection. The handshake runs on the TCP socket; afterwards the
+// connection handler reads and sends plaintext through readFd() and
+// sendFd(). With kernel TLS in a direction that descriptor is the socket
+// itself, so sendfile() and splice() still skip user space; otherwise it is
+// one end of a socketpair that pump() moves through SSL_read/SSL_write.
+class TlsSession {
+public:
+    enum class Status {
+        DONE,
+        PENDING,    // Wants the socket readable or writable again
+        FAILED
+    };
+
+    // Takes ownership of fd
+    TlsSession(TlsContext& context, int fd);
+    ~TlsSession();
+
+    TlsSession(const TlsSession&) = delete;
+    TlsSession& operator=(const TlsSession&) = delete;
+
+    Status handshake();
+    HandshakeFault handshakeFault() const;
+
+    int readFd() const;
+    int sendFd() const;
+    bool kernelSend() const;
+    bool kernelRecv() const;
+
+    // Moves plaintext between the socketpair and the TLS connection as far
+    // as both sides allow
+    void pump();
+
+    // Nothing sent by the handler is still waiting to be encrypted (or the
+    // client is gone, so it never will be)
+    bool drained() const;
+
+    // Plaintext buffered between the socketpair and the TLS connection
+    size_t memoryUsage() const;
+
+    // Ends the connection: an RST, a FIN without close_notify, or
+    // close_notify and a FIN
+    void close(bool reset, bool close_notify);
+
+private:
+    TlsContext& context_;
+    int fd_;
+    ssl_st* ssl_;
+    HandshakeFault fault_;
+    bool established_;
+    bool kernel_send_;
+    bool kernel_recv_;
+    int plain_fd_;      // Handler's end of the socketpair
+    int bridge_fd_;     // Our end of it
+    bool failed_;       // The TLS connection is gone
+    bool read_closed_;  // The client sent close_notify (or its FIN)
+    std::vector<char> inbound_;     // Decrypted, not yet taken by the handler
+    size_t inbound_length_;
+    size_t inbound_sent_;
+    std::vector<char> outbound_;    // From the handler, not yet encrypted
+    size_t outbound_length_;
+    size_t outbound_sent_;
+
+    bool openBridge();
+    void pumpInbound();
+    void pumpOutbound();
+    void fail();
+
+    static int onClientHello(ssl_st* ssl, int* alert, void* arg);
+    friend class TlsContext;
+};
+
+#endif // TLS_H
@@ -0,0 +1,432 @@
+#include "traffic_log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void putSigned(std::string& out, int64_t value) {
+    // Zigzag so small negative numbers stay small
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void putString(std::string& out, const std::string& value) {
+    putVarint(out, value.length());
+    out += value;
+}
+
+// Bounds-checked cursor over one encoded record
+class Reader {
+public:
+    Reader(const char* data, size_t size) : data_(data), size_(size), pos_(0), ok_(true) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos_ >= size_) {
+                break;
+            }
+            uint8_t byte = static_cast<uint8_t>(data_[pos_++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    int64_t signedVarint() {
+        uint64_t value = varint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    std::string string() {
+        uint64_t length = varint();
+        if (!ok_ || length > size_ - pos_) {
+            ok_ = false;
+            return "";
+        }
+        std::string value(data_ + pos_, length);
+        pos_ += length;
+        return value;
+    }
+
+    size_t position() const { return pos_; }
+    bool ok() const { return ok_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+    bool ok_;
+};
+
+} // namespace
+
+const char TrafficLog::MAGIC[8] = {'S', 'T', 'I', 'T', 'C', 'H', 'L', '1'};
+
+TrafficRecord::TrafficRecord()
+    : sequence(0)
+    , arrival_us(0)
+    , parse_us(0) {
+}
+
+void TrafficLog::encode(const TrafficRecord& record, int64_t previous_arrival_us,
+                        std::string& out) {
+    const TestCommand& cmd = record.command;
+
+    std::string payload;
+    payload.reserve(32 + cmd.reason_phrase.length() + cmd.body_content.length() +
+                    cmd.file.length() + record.request.length());
+    putVarint(payload, record.sequence);
+    putSigned(payload, record.arrival_us - previous_arrival_us);
+    putSigned(payload, record.parse_us);
+    putVarint(payload, static_cast<uint64_t>(cmd.behavior));
+    putSigned(payload, cmd.status_code);
+    putSigned(payload, cmd.delay_ms);
+    putSigned(payload, cmd.delay_us);
+    putSigned(payload, cmd.bytes_per_second);
+    putVarint(payload, cmd.bytes_before_close);
+    putVarint(payload, cmd.body_size);
+    putVarint(payload, cmd.body_seeded ? 1 : 0);
+    putVarint(payload, cmd.body_seed);
+    putVarint(payload, static_cast<uint64_t>(cmd.chunks.mode));
+    putVarint(payload, cmd.chunks.min_size);
+    putVarint(payload, cmd.chunks.max_size);
+    putVarint(payload, cmd.chunks.sizes.size());
+    for (size_t size : cmd.chunks.sizes) {
+        putVarint(payload, size);
+    }
+    putVarint(payload, cmd.chunks.seed);
+    putVarint(payload, static_cast<uint64_t>(cmd.chunks.fault));
+    putVarint(payload, cmd.chunks.fault_chunk);
+    putVarint(payload, cmd.chunks.trailer_bytes);
+    putVarint(payload, static_cast<uint64_t>(cmd.fault));
+    putVarint(payload, cmd.fault_at);
+    putVarint(payload, static_cast<uint64_t>(cmd.range_fault));
+    putVarint(payload, static_cast<uint64_t>(cmd.encoding));
+    putVarint(payload, static_cast<uint64_t>(cmd.encoding_fault));
+    putVarint(payload, cmd.duplicate_headers);
+    putVarint(payload, cmd.header_count);
+    putVarint(payload, cmd.header_size);
+    putVarint(payload, cmd.headers.size());
+    for (const auto& header : cmd.headers) {
+        putString(payload, header.first);
+        putString(payload, header.second);
+    }
+    putVarint(payload, static_cast<uint64_t>(cmd.request_body));
+    putVarint(payload, cmd.read_rate);
+    putVarint(payload, static_cast<uint64_t>(cmd.tls_fault));
+    putVarint(payload, cmd.sndbuf);
+    putSigned(payload, cmd.nodelay);
+    putString(payload, cmd.reason_phrase);
+    putString(payload, cmd.body_content);
+    putString(payload, cmd.file);
+    putString(payload, cmd.script ? cmd.script->source() : "");
+    putString(payload, record.request);
+
+    putVarint(out, payload.length());
+    out += payload;
+}
+
+bool TrafficLog::decode(const char* data, size_t size, size_t& offset,
+                        int64_t previous_arrival_us, TrafficRecord& record) {
+    Reader header(data + offset, size - offset);
+    uint64_t length = header.varint();
+    if (!header.ok() || length > size - offset - header.position()) {
+        return false;
+    }
+
+    Reader payload(data + offset + header.position(), length);
+    TrafficRecord decoded;
+    TestCommand& cmd = decoded.command;
+
+    decoded.sequence = payload.varint();
+    decoded.arrival_us = previous_arrival_us + payload.signedVarint();
+    decoded.parse_us = payload.signedVarint();
+    uint64_t behavior = payload.varint();
+    cmd.status_code = static_cast<int>(payload.signedVarint());
+    cmd.delay_ms = static_cast<int>(payload.signedVarint());
+    cmd.delay_us = payload.signedVarint();
+    cmd.bytes_per_second = static_cast<int>(payload.signedVarint());
+    cmd.bytes_before_close = payload.varint();
+    cmd.body_size = payload.varint();
+    cmd.body_seeded = payload.varint() != 0;
+    cmd.body_seed = payload.varint();
+    uint64_t chunk_mode = payload.varint();
+    cmd.chunks.min_size = payload.varint();
+    cmd.chunks.max_size = payload.varint();
+    uint64_t size_count = payload.varint();
+    for (uint64_t i = 0; i < size_count && payload.ok(); ++i) {
+        uint64_t chunk = payload.varint();
+        if (chunk == 0) {
+            return false;
+        }
+        cmd.chunks.sizes.push_back(chunk);
+    }
+    cmd.chunks.seed = payload.varint();
+    uint64_t chunk_fault = payload.varint();
+    cmd.chunks.fault_chunk = payload.varint();
+    cmd.chunks.trailer_bytes = payload.varint();
+    uint64_t fault = payload.varint();
+    cmd.fault_at = payload.varint();
+    uint64_t range_fault = payload.varint();
+    uint64_t encoding = payload.varint();
+    uint64_t encoding_fault = payload.varint();
+    cmd.duplicate_headers = payload.varint();
+    cmd.header_count = payload.varint();
+    cmd.header_size = payload.varint();
+    uint64_t header_lines = payload.varint();
+    for (uint64_t i = 0; i < header_lines && payload.ok(); ++i) {
+        std::string name = payload.string();
+        cmd.headers.emplace_back(std::move(name), payload.string());
+    }
+    uint64_t request_body = payload.varint();
+    cmd.read_rate = payload.varint();
+    uint64_t tls_fault = payload.varint();
+    cmd.sndbuf = payload.varint();
+    int64_t nodelay = payload.signedVarint();
+    cmd.reason_phrase = payload.string();
+    cmd.body_content = payload.string();
+    cmd.file = payload.string();
+    std::string script = payload.string();
+    decoded.request = payload.string();
+
+    if (!payload.ok() || behavior > static_cast<uint64_t>(BehaviorType::TIMEOUT) ||
+        fault > static_cast<uint64_t>(ResponseFault::CORRUPT) ||
+        range_fault > static_cast<uint64_t>(RangeFault::MULTIPART) ||
+        encoding > static_cast<uint64_t>(ContentEncoding::BROTLI) ||
+        encoding_fault > static_cast<uint64_t>(EncodingFault::MISLABEL) ||
+        cmd.header_count > HeaderFloodSource::MAX_COUNT ||
+        cmd.header_size > HeaderFloodSource::MAX_VALUE_SIZE ||
+        request_body > static_cast<uint64_t>(RequestBodyMode::IGNORE) ||
+        tls_fault > static_cast<uint64_t>(TlsFault::NO_CLOSE_NOTIFY) ||
+        cmd.sndbuf > TestCommand::MAX_SNDBUF || nodelay < -1 || nodelay > 1 ||
+        chunk_mode > static_cast<uint64_t>(ChunkPlan::Mode::LIST) ||
+        chunk_fault > static_cast<uint64_t>(ChunkPlan::Fault::TRAILER_BOMB) ||
+        cmd.chunks.min_size == 0 || cmd.chunks.max_size < cmd.chunks.min_size) {
+        return false;
+    }
+    cmd.behavior = static_cast<BehaviorType>(behavior);
+    cmd.fault = static_cast<ResponseFault>(fault);
+    cmd.range_fault = static_cast<RangeFault>(range_fault);
+    cmd.encoding = static_cast<ContentEncoding>(encoding);
+    cmd.encoding_fault = static_cast<EncodingFault>(encoding_fault);
+    cmd.request_body = static_cast<RequestBodyMode>(request_body);
+    cmd.tls_fault = static_cast<TlsFault>(tls_fault);
+    cmd.nodelay = static_cast<int>(nodelay);
+    cmd.chunks.mode = static_cast<ChunkPlan::Mode>(chunk_mode);
+    cmd.chunks.fault = static_cast<ChunkPlan::Fault>(chunk_fault);
+    if (!script.empty()) {
+        // Replay recompiles; the log keeps only the source
+        std::string error;
+        cmd.script = BehaviorScript::compile(script, error);
+        if (!cmd.script) {
+            return false;
+        }
+    }
+
+    offset += header.position() + length;
+    record = std::move(decoded);
+    return true;
+}
+
+TrafficRecorder::TrafficRecorder()
+    : fd_(-1)
+    , sequence_(0)
+    , previous_arrival_us_(0) {
+}
+
+TrafficRecorder::~TrafficRecorder() {
+    close();
+}
+
+bool TrafficRecorder::open(const std::string& path) {
+    close();
+
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        error_message_ = "Cannot open record file " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    buffer_.reserve(BUFFER_SIZE);
+    buffer_.assign(TrafficLog::MAGIC, sizeof(TrafficLog::MAGIC));
+    sequence_ = 0;
+    previous_arrival_us_ = 0;
+    started_at_ = std::chrono::steady_clock::now();
+    buffered_since_ = started_at_;
+    return flush();
+}
+
+void TrafficRecorder::record(const std::string& request, int64_t parse_us,
+                             const TestCommand& command) {
+    if (fd_ < 0) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (buffer_.empty()) {
+        buffered_since_ = now;
+    }
+
+    TrafficRecord entry;
+    entry.sequence = sequence_++;
+    entry.arrival_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - started_at_).count();
+    entry.parse_us = parse_us;
+    entry.command = command;
+    entry.request = request;
+
+    TrafficLog::encode(entry, previous_arrival_us_, buffer_);
+    previous_arrival_us_ = entry.arrival_us;
+
+    if (buffer_.length() >= BUFFER_SIZE) {
+        flush();
+    }
+}
+
+bool TrafficRecorder::flush() {
+    size_t written = 0;
+    while (written < buffer_.length() && fd_ >= 0) {
+        ssize_t n = ::write(fd_, buffer_.data() + written, buffer_.length() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // A full disk must not take the server down; stop recording
+            error_message_ = std::string("Recording stopped: ") + strerror(errno);
+            ::close(fd_);
+            fd_ = -1;
+            buffer_.clear();
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    buffer_.clear();
+    return fd_ >= 0;
+}
+
+void TrafficRecorder::flushIfDue() {
+    if (!buffer_.empty() &&
+        std::chrono::steady_clock::now() - buffered_since_ >= FLUSH_INTERVAL) {
+        flush();
+    }
+}
+
+void TrafficRecorder::close() {
+    if (fd_ >= 0) {
+        flush();
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+uint64_t TrafficRecorder::count() const {
+    return sequence_;
+}
+
+const std::string& TrafficRecorder::getErrorMessage() const {
+    return error_message_;
+}
+
+TrafficReplayer::TrafficReplayer()
+    : data_(nullptr)
+    , size_(0)
+    , offset_(0)
+    , consumed_(0)
+    , previous_arrival_us_(0) {
+}
+
+TrafficReplayer::~TrafficReplayer() {
+    unmap();
+}
+
+bool TrafficReplayer::open(const std::string& path) {
+    unmap();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error_message_ = "Cannot open replay file " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TrafficLog::MAGIC)) {
+        ::close(fd);
+        error_message_ = "Not a Stitch traffic log: " + path;
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        error_message_ = "Cannot map replay file " + path + ": " + strerror(errno);
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    if (memcmp(mapping, TrafficLog::MAGIC, sizeof(TrafficLog::MAGIC)) != 0) {
+        munmap(mapping, size);
+        error_message_ = "Not a Stitch traffic log: " + path;
+        return false;
+    }
+
+    data_ = static_cast<const char*>(mapping);
+    size_ = size;
+    offset_ = sizeof(TrafficLog::MAGIC);
+    consumed_ = 0;
+    previous_arrival_us_ = 0;
+    return true;
+}
+
+bool TrafficReplayer::next(TrafficRecord& record) {
+    if (exhausted()) {
+        return false;
+    }
+
+    if (!TrafficLog::decode(data_, size_, offset_, previous_arrival_us_, record)) {
+        // Partial tail of a log that was still being written; stop here
+        offset_ = size_;
+        return false;
+    }
+
+    previous_arrival_us_ = record.arrival_us;
+    ++consumed_;
+    return true;
+}
+
+bool TrafficReplayer::exhausted() const {
+    return data_ == nullptr || offset_ >= size_;
+}
+
+uint64_t TrafficReplayer::consumed() const {
+    return consumed_;
+}
+
+const std::string& TrafficReplayer::getErrorMessage() const {
+    return error_message_;
+}
+
+void TrafficReplayer::unmap() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef TRAFFIC_LOG_H
+#define TRAFFIC_LOG_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include "command_interpreter.h"
+
+// One request as seen by the server: the raw bytes it parsed, when it
+// arrived and the command it was answered with. command.delay_us holds the
+// delay that was actually applied; distributions are not recorded.
+struct TrafficRecord {
+    uint64_t sequence;
+    int64_t arrival_us;     // Since the recording started
+    int64_t parse_us;       // From accept to a complete request
+    TestCommand command;
+    std::string request;
+
+    TrafficRecord();
+};
+
+// Log layout: an 8-byte magic followed by records of
+//   varint payload_length, payload
+// where the payload is LEB128 varints (zigzag for signed values) and
+// length-prefixed strings. arrival_us is stored as the delta to the previous
+// record. Records are only ever appended, so a log cut short by a crash is
+// still readable up to its last complete record.
+class TrafficLog {
+public:
+    static const char MAGIC[8];
+
+    // Append the encoded record to out; previous_arrival_us is the arrival
+    // time of the record before it (0 for the first)
+    static void encode(const TrafficRecord& record, int64_t previous_arrival_us,
+                       std::string& out);
+
+    // Decode the record starting at data[offset]; advances offset. Returns
+    // false on a truncated or malformed record.
+    static bool decode(const char* data, size_t size, size_t& offset,
+                       int64_t previous_arrival_us, TrafficRecord& record);
+};
+
+// Appends records to a log through a userspace buffer. The file is written
+// when the buffer fills or when flushIfDue() finds data older than
+// FLUSH_INTERVAL, so a soak run costs one write() per 64 KiB of traffic
+// and a crash loses at most about a second of it.
+class TrafficRecorder {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{1000};
+
+    TrafficRecorder();
+    ~TrafficRecorder();
+
+    TrafficRecorder(const TrafficRecorder&) = delete;
+    TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+    // Creates or truncates path and writes the log header
+    bool open(const std::string& path);
+
+    void record(const std::string& request, int64_t parse_us, const TestCommand& command);
+
+    bool flush();
+    void flushIfDue();
+    void close();
+
+    uint64_t count() const;
+    const std::string& getErrorMessage() const;
+
+private:
+    int fd_;
+    std::string buffer_;
+    uint64_t sequence_;
+    int64_t previous_arrival_us_;
+    std::chrono::steady_clock::time_point started_at_;
+    std::chrono::steady_clock::time_point buffered_since_;
+    std::string error_message_;
+};
+
+// Reads a log back in order through a read-only mapping of the file.
+class TrafficReplayer {
+public:
+    TrafficReplayer();
+    ~TrafficReplayer();
+
+    TrafficReplayer(const TrafficReplayer&) = delete;
+    TrafficReplayer& operator=(const TrafficReplayer&) = delete;
+
+    bool open(const std::string& path);
+
+    // Next record in log order; false once the log is exhausted (or ends
+    // in a partial record)
+    bool next(TrafficRecord& record);
+
+    bool exhausted() const;
+    uint64_t consumed() const;
+    const std::string& getErrorMessage() const;
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t offset_;
+    uint64_t consumed_;
+    int64_t previous_arrival_us_;
+    std::string error_message_;
+
+    void unmap();
+};
+
+#endif // TRAFFIC_LOG_H
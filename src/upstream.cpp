@@ -0,0 +1,380 @@
+#include "upstream.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "text_util.h"
+
+namespace {
+
+// Lines of a head without their line endings, the blank line excluded
+std::vector<std::string> splitLines(const std::string& head) {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < head.length()) {
+        size_t end = head.find('\n', start);
+        if (end == std::string::npos) {
+            end = head.length();
+        }
+        std::string line = head.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            break;
+        }
+        lines.push_back(line);
+        start = end + 1;
+    }
+    return lines;
+}
+
+// Headers that describe one connection rather than the message, and any
+// the Connection header names as such
+class HopByHop {
+public:
+    explicit HopByHop(const std::vector<std::string>& lines) {
+        for (const std::string& line : lines) {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos ||
+                strcasecmp(line.substr(0, colon).c_str(), "Connection") != 0) {
+                continue;
+            }
+            std::string value = line.substr(colon + 1);
+            size_t start = 0;
+            while (start <= value.length()) {
+                size_t comma = value.find(',', start);
+                if (comma == std::string::npos) {
+                    comma = value.length();
+                }
+                std::string name = trim(value.substr(start, comma - start));
+                if (!name.empty()) {
+                    listed_.push_back(name);
+                }
+                start = comma + 1;
+            }
+        }
+    }
+
+    bool contains(const std::string& name) const {
+        static const char* const NAMES[] = {
+            "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade"
+        };
+        for (const char* hop : NAMES) {
+            if (strcasecmp(name.c_str(), hop) == 0) {
+                return true;
+            }
+        }
+        return std::any_of(listed_.begin(), listed_.end(), [&name](const std::string& listed) {
+            return strcasecmp(name.c_str(), listed.c_str()) == 0;
+        });
+    }
+
+    // Whether Connection listed this option (close, keep-alive)
+    bool lists(const char* option) const {
+        return std::any_of(listed_.begin(), listed_.end(), [option](const std::string& listed) {
+            return strcasecmp(listed.c_str(), option) == 0;
+        });
+    }
+
+private:
+    std::vector<std::string> listed_;
+};
+
+} // namespace
+
+UpstreamPool::UpstreamPool(size_t max_idle)
+    : max_idle_(max_idle)
+    , address_length_(0)
+    , connects_(0)
+    , reuses_(0) {
+    memset(&address_, 0, sizeof(address_));
+}
+
+UpstreamPool::~UpstreamPool() {
+    for (int fd : idle_) {
+        ::close(fd);
+    }
+}
+
+bool UpstreamPool::configure(const std::string& address) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.length()) {
+        error_message_ = "Upstream address must be host:port: " + address;
+        return false;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    if (host.length() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.length() - 2);
+    }
+    if (port.find_first_not_of("0123456789") != std::string::npos) {
+        error_message_ = "Upstream port is not a number: " + port;
+        return false;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (rc != 0 || result == nullptr) {
+        error_message_ = "Cannot resolve upstream " + host + ": " + gai_strerror(rc);
+        return false;
+    }
+    memcpy(&address_, result->ai_addr, result->ai_addrlen);
+    address_length_ = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    address_text_ = address;
+    return true;
+}
+
+const std::string& UpstreamPool::getAddress() const {
+    return address_text_;
+}
+
+void UpstreamPool::setWatcher(std::function<void(int)> watcher) {
+    watcher_ = std::move(watcher);
+}
+
+int UpstreamPool::acquire(bool* reused) {
+    // The newest idle connection is the least likely to have timed out; one
+    // that is readable has been closed by the backend (or got bytes nobody
+    // asked for) and is not worth the risk
+    while (!idle_.empty()) {
+        int fd = idle_.back();
+        idle_.pop_back();
+        char byte;
+        if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN) {
+            reuses_++;
+            if (reused != nullptr) {
+                *reused = true;
+            }
+            return fd;
+        }
+        ::close(fd);
+    }
+
+    if (address_length_ == 0) {
+        error_message_ = "No upstream configured";
+        return -1;
+    }
+    int fd = socket(address_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error_message_ = std::string("Cannot create upstream socket: ") + strerror(errno);
+        return -1;
+    }
+    // Heads and small bodies go out as soon as they are written
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&address_), address_length_) != 0 &&
+        errno != EINPROGRESS) {
+        error_message_ = "Cannot connect to upstream " + address_text_ + ": " + strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    connects_++;
+    if (reused != nullptr) {
+        *reused = false;
+    }
+    if (watcher_) {
+        watcher_(fd);
+    }
+    return fd;
+}
+
+void UpstreamPool::release(int fd) {
+    if (idle_.size() >= max_idle_) {
+        ::close(fd);
+        return;
+    }
+    idle_.push_back(fd);
+}
+
+void UpstreamPool::discard(int fd) {
+    ::close(fd);
+}
+
+size_t UpstreamPool::idle() const {
+    return idle_.size();
+}
+
+uint64_t UpstreamPool::connects() const {
+    return connects_;
+}
+
+uint64_t UpstreamPool::reuses() const {
+    return reuses_;
+}
+
+const std::string& UpstreamPool::getErrorMessage() const {
+    return error_message_;
+}
+
+std::string UpstreamRequest::forwardHead(const char* head, size_t length) {
+    std::vector<std::string> lines = splitLines(std::string(head, length));
+    if (lines.empty()) {
+        return "";
+    }
+    HopByHop hop(lines);
+
+    std::string forwarded = lines[0] + "\r\n";
+    for (size_t i = 1; i < lines.size(); ++i) {
+        std::string name = lines[i].substr(0, lines[i].find(':'));
+        if (hop.contains(name) || strcasecmp(name.c_str(), "Expect") == 0) {
+            continue;
+        }
+        forwarded += lines[i] + "\r\n";
+    }
+    return forwarded + "\r\n";
+}
+
+UpstreamResponse::UpstreamResponse() {
+    reset();
+}
+
+void UpstreamResponse::reset() {
+    buffer_.clear();
+    received_ = false;
+    complete_ = false;
+    status_code_ = 0;
+    reason_phrase_.clear();
+    header_lines_.clear();
+    transfer_encoding_.clear();
+    content_length_.clear();
+    keep_alive_ = false;
+    body_start_.clear();
+    error_message_.clear();
+}
+
+UpstreamResponse::ParseResult UpstreamResponse::parse(const char* data, size_t length) {
+    if (complete_) {
+        body_start_.append(data, length);
+        return ParseResult::COMPLETE;
+    }
+    received_ = received_ || length > 0;
+    buffer_.append(data, length);
+
+    // Interim responses come before the final one; each is dropped whole
+    while (true) {
+        size_t crlf = buffer_.find("\r\n\r\n");
+        size_t lf = buffer_.find("\n\n");
+        size_t end = std::min(crlf == std::string::npos ? crlf : crlf + 4,
+                              lf == std::string::npos ? lf : lf + 2);
+        if (end == std::string::npos) {
+            if (buffer_.length() > MAX_HEAD) {
+                return fail("Upstream response head too large");
+            }
+            return ParseResult::INCOMPLETE;
+        }
+
+        ParseResult result = parseHead(buffer_.substr(0, end));
+        if (result == ParseResult::ERROR) {
+            return result;
+        }
+        buffer_.erase(0, end);
+        if (status_code_ >= 200) {
+            complete_ = true;
+            body_start_ = std::move(buffer_);
+            buffer_.clear();
+            return ParseResult::COMPLETE;
+        }
+    }
+}
+
+UpstreamResponse::ParseResult UpstreamResponse::parseHead(const std::string& head) {
+    std::vector<std::string> lines = splitLines(head);
+    if (lines.empty()) {
+        return fail("Empty upstream response head");
+    }
+
+    // HTTP/1.x SSS reason
+    const std::string& status = lines[0];
+    if (status.compare(0, 7, "HTTP/1.") != 0 || status.length() < 12 || status[8] != ' ' ||
+        !std::all_of(status.begin() + 9, status.begin() + 12,
+                     [](char c) { return c >= '0' && c <= '9'; }) ||
+        (status.length() > 12 && status[12] != ' ')) {
+        return fail("Bad upstream status line");
+    }
+    status_code_ = std::stoi(status.substr(9, 3));
+    if (status_code_ < 100 || status_code_ == 101) {
+        // Upgrades would hand the connection over, which a relay cannot follow
+        return fail("Unsupported upstream status");
+    }
+    reason_phrase_ = status.length() > 13 ? status.substr(13) : "";
+    bool http10 = status[7] == '0';
+
+    HopByHop hop(lines);
+    header_lines_.clear();
+    transfer_encoding_.clear();
+    content_length_.clear();
+    for (size_t i = 1; i < lines.size(); ++i) {
+        const std::string& line = lines[i];
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0 || line[0] == ' ' || line[0] == '\t') {
+            return fail("Bad upstream header line");
+        }
+        std::string name = line.substr(0, colon);
+        std::string value = trim(line.substr(colon + 1));
+        if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+            transfer_encoding_ += (transfer_encoding_.empty() ? "" : ", ") + value;
+        } else if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+            // Copies that disagree leave no way to find the end of the body
+            if (!content_length_.empty() && content_length_ != value) {
+                return fail("Conflicting upstream Content-Length");
+            }
+            content_length_ = value;
+        } else if (!hop.contains(name)) {
+            header_lines_ += line + "\r\n";
+        }
+    }
+    keep_alive_ = http10 ? hop.lists("keep-alive") : !hop.lists("close");
+    return ParseResult::INCOMPLETE;
+}
+
+bool UpstreamResponse::empty() const {
+    return !received_;
+}
+
+int UpstreamResponse::getStatusCode() const {
+    return status_code_;
+}
+
+const std::string& UpstreamResponse::getReasonPhrase() const {
+    return reason_phrase_;
+}
+
+const std::string& UpstreamResponse::getHeaderLines() const {
+    return header_lines_;
+}
+
+const std::string& UpstreamResponse::getTransferEncoding() const {
+    return transfer_encoding_;
+}
+
+const std::string& UpstreamResponse::getContentLength() const {
+    return content_length_;
+}
+
+bool UpstreamResponse::keepAlive() const {
+    return keep_alive_;
+}
+
+const std::string& UpstreamResponse::getBodyStart() const {
+    return body_start_;
+}
+
+const std::string& UpstreamResponse::getErrorMessage() const {
+    return error_message_;
+}
+
+UpstreamResponse::ParseResult UpstreamResponse::fail(const char* message) {
+    error_message_ = message;
+    return ParseResult::ERROR;
+}
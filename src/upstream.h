@@ -0,0 +1,120 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <sys/socket.h>
+
+// Connections to the --upstream backend. Idle connections are kept for
+// reuse, newest first, so the proxy does not pay a handshake per request.
+class UpstreamPool {
+public:
+    static constexpr size_t DEFAULT_MAX_IDLE = 64;
+
+    explicit UpstreamPool(size_t max_idle = DEFAULT_MAX_IDLE);
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    // host:port (IPv6 hosts in brackets); the host is resolved once, here
+    bool configure(const std::string& address);
+    const std::string& getAddress() const;
+
+    // Called with every new connection, so the event loop can watch it
+    void setWatcher(std::function<void(int)> watcher);
+
+    // An idle connection that is still open (reused is set), or a new one
+    // whose non-blocking connect may still be in progress; -1 if none could
+    // be made (see getErrorMessage())
+    int acquire(bool* reused = nullptr);
+
+    // Takes back a connection after a complete exchange; discard() closes
+    // one that is in any other state
+    void release(int fd);
+    void discard(int fd);
+
+    size_t idle() const;
+    uint64_t connects() const;
+    uint64_t reuses() const;
+
+    const std::string& getErrorMessage() const;
+
+private:
+    size_t max_idle_;
+    struct sockaddr_storage address_;
+    socklen_t address_length_;
+    std::string address_text_;
+    std::vector<int> idle_;
+    std::function<void(int)> watcher_;
+    uint64_t connects_;
+    uint64_t reuses_;
+    std::string error_message_;
+};
+
+// The client's request head as it goes upstream: hop-by-hop headers
+// (RFC 9110 section 7.6.1) and Expect, which the proxy answers itself,
+// are left out
+class UpstreamRequest {
+public:
+    static std::string forwardHead(const char* head, size_t length);
+};
+
+// Incremental parser for an upstream response head. Interim 1xx responses
+// are skipped; framing and hop-by-hop headers are kept apart from the
+// lines that are relayed.
+class UpstreamResponse {
+public:
+    enum class ParseResult {
+        INCOMPLETE,
+        COMPLETE,
+        ERROR
+    };
+
+    static constexpr size_t MAX_HEAD = 64 * 1024;
+
+    UpstreamResponse();
+
+    ParseResult parse(const char* data, size_t length);
+    void reset();
+
+    // Nothing received yet
+    bool empty() const;
+
+    int getStatusCode() const;
+    const std::string& getReasonPhrase() const;
+
+    // End-to-end headers, one "Name: value\r\n" line each, in order
+    const std::string& getHeaderLines() const;
+
+    const std::string& getTransferEncoding() const;
+    const std::string& getContentLength() const;
+
+    // Whether the backend will take another request on the connection
+    bool keepAlive() const;
+
+    // Bytes parse() was given past the head: the start of the body
+    const std::string& getBodyStart() const;
+
+    const std::string& getErrorMessage() const;
+
+private:
+    std::string buffer_;
+    bool received_;
+    bool complete_;
+    int status_code_;
+    std::string reason_phrase_;
+    std::string header_lines_;
+    std::string transfer_encoding_;
+    std::string content_length_;
+    bool keep_alive_;
+    std::string body_start_;
+    std::string error_message_;
+
+    ParseResult parseHead(const std::string& head);
+    ParseResult fail(const char* message);
+};
+
+#endif // UPSTREAM_H
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include "body_pattern.h"
+#include "text_util.h"
+
+namespace {
+
+void printUsage(const char* prog_name) {
+    std::cout << "Usage: " << prog_name << " [options] < input\n"
+              << "Checks a body served with body_seed= against its pattern.\n"
+              << "Without --seed the input is a whole HTTP response (curl -si) and\n"
+              << "the X-Stitch-Pattern header says what to expect.\n"
+              << "Options:\n"
+              << "  --seed <n>            Input is a bare body made with body_seed=<n>\n"
+              << "  --offset <n>          Pattern offset of the first input byte (default: 0)\n"
+              << "  --length <n>          Expected body length (default: whatever arrives)\n"
+              << "  --help                Show this help message\n"
+              << "Exit status: 0 intact, 1 corrupted, 2 wrong length or bad input\n";
+}
+
+// Reads the response head from stdin and takes the pattern parameters from
+// X-Stitch-Pattern; anything read past the head is left in body
+bool readHead(uint64_t& seed, uint64_t& offset, uint64_t& length, std::string& body) {
+    std::string input;
+    char buffer[65536];
+    size_t head_end = std::string::npos;
+
+    while (head_end == std::string::npos) {
+        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::cerr << "Input ended before the end of the response head\n";
+            return false;
+        }
+        input.append(buffer, static_cast<size_t>(n));
+        head_end = input.find("\r\n\r\n");
+    }
+
+    const std::string name = "x-stitch-pattern:";
+    size_t line_start = 0;
+    while (line_start < head_end) {
+        size_t line_end = input.find("\r\n", line_start);
+        std::string line = input.substr(line_start, line_end - line_start);
+        line_start = line_end + 2;
+
+        if (line.length() < name.length() ||
+            strncasecmp(line.c_str(), name.c_str(), name.length()) != 0) {
+            continue;
+        }
+        if (!BodyPattern::parseDescription(line.substr(name.length()), seed, offset, length)) {
+            std::cerr << "Unreadable X-Stitch-Pattern header: " << line << "\n";
+            return false;
+        }
+        body = input.substr(head_end + 4);
+        return true;
+    }
+
+    std::cerr << "Response has no X-Stitch-Pattern header (was body_seed= set?)\n";
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t seed = 0;
+    uint64_t offset = 0;
+    uint64_t length = UINT64_MAX;
+    bool have_seed = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--seed" || arg == "--offset" || arg == "--length") {
+            uint64_t value = 0;
+            if (i + 1 >= argc || !parseUnsigned(argv[++i], value)) {
+                std::cerr << "Error: " << arg << " requires a number\n";
+                return 2;
+            }
+            if (arg == "--seed") {
+                seed = value;
+                have_seed = true;
+            } else if (arg == "--offset") {
+                offset = value;
+            } else {
+                length = value;
+            }
+        } else if (arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::string pending;
+    if (!have_seed && !readHead(seed, offset, length, pending)) {
+        return 2;
+    }
+
+    PatternVerifier verifier(seed, offset);
+    verifier.update(pending.data(), pending.size());
+
+    std::vector<char> buffer(1 << 20);
+    while (true) {
+        ssize_t n = read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            std::cerr << "Read error: " << strerror(errno) << "\n";
+            return 2;
+        }
+        if (n == 0) {
+            break;
+        }
+        verifier.update(buffer.data(), static_cast<size_t>(n));
+    }
+
+    uint64_t received = verifier.bytesChecked();
+    if (!verifier.ok()) {
+        std::cout << "CORRUPT: first wrong byte at body offset "
+                  << verifier.firstMismatch() - offset << " of " << received << "\n";
+        return 1;
+    }
+    if (length != UINT64_MAX && received != length) {
+        std::cout << "LENGTH: received " << received << " of " << length << " bytes\n";
+        return 2;
+    }
+    std::cout << "OK: " << received << " bytes intact\n";
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include "admin.h"
+
+class AdminServerTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(AdminServerTest);
+
+    CPPUNIT_TEST(testSetDefault);
+    CPPUNIT_TEST(testSetChaos);
+    CPPUNIT_TEST(testSetScenario);
+    CPPUNIT_TEST(testRejectedChangesKeepSnapshot);
+    CPPUNIT_TEST(testServerCaches);
+    CPPUNIT_TEST(testServeOverSocket);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    static HttpRequest makeRequest(const std::string& method, const std::string& path) {
+        HttpParser parser;
+        std::string head = method + " " + path + " HTTP/1.1\r\n\r\n";
+        CPPUNIT_ASSERT(parser.parse(head.data(), head.length()) ==
+                       HttpParser::ParseResult::COMPLETE);
+        return parser.getRequest();
+    }
+
+    static std::string exchange(const std::string& abstract, const std::string& request) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CPPUNIT_ASSERT(fd >= 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, abstract.data(), abstract.length());
+        addr.sun_path[0] = '\0';
+        socklen_t length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) +
+                                                  abstract.length());
+        CPPUNIT_ASSERT_EQUAL(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr), length));
+        CPPUNIT_ASSERT(write(fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+
+        std::string response;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            response.append(buffer, static_cast<size_t>(n));
+        }
+        close(fd);
+        return response;
+    }
+
+    static void loadHistogram(LatencyDistributionCache& distributions) {
+        char path[] = "/tmp/stitch_histXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+        {
+            std::ofstream file(path);
+            file << "10 50\n100 50\n";
+        }
+        bool loaded = distributions.addHistogram("api", path);
+        std::remove(path);
+        CPPUNIT_ASSERT(loaded);
+    }
+
+public:
+    void testSetDefault() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        AdminServer admin(config);
+        std::string reply;
+
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(
+            makeRequest("PUT", "/config/default?behavior=error&code=503"), "", reply));
+        CPPUNIT_ASSERT(config.current().has_default);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE, config.current().default_command.behavior);
+        CPPUNIT_ASSERT_EQUAL(503, config.current().default_command.status_code);
+        CPPUNIT_ASSERT(reply.find("\"default\":\"behavior=error&code=503\"") != std::string::npos);
+
+        // No query clears it
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(makeRequest("POST", "/config/default"), "", reply));
+        CPPUNIT_ASSERT(!config.current().has_default);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), config.generation());
+    }
+
+    void testSetChaos() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        AdminServer admin(config);
+        std::string reply;
+
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(makeRequest("PUT", "/config/chaos"),
+                                               "normal:90,close:10\n", reply));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), config.current().chaos->size());
+        CPPUNIT_ASSERT_EQUAL(std::string("normal:90,close:10"), config.current().chaos_spec);
+
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(makeRequest("PUT", "/config/chaos"), "", reply));
+        CPPUNIT_ASSERT(!config.current().chaos);
+        CPPUNIT_ASSERT(reply.find("\"chaos\":null") != std::string::npos);
+    }
+
+    void testSetScenario() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        AdminServer admin(config);
+        std::string reply;
+
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(makeRequest("PUT", "/config/chaos"),
+                                               "close:1", reply));
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(
+            makeRequest("PUT", "/config/scenario"),
+            "{\"routes\": [{\"prefix\": \"/a\", \"behavior\": \"close\"}]}", reply));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), config.current().router->size());
+
+        // Other parts carry over, shared rather than rebuilt
+        const ChaosMix* chaos = config.current().chaos.get();
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(makeRequest("PUT", "/config/default?behavior=slow"),
+                                               "", reply));
+        CPPUNIT_ASSERT(config.current().chaos.get() == chaos);
+        CPPUNIT_ASSERT(config.current().router);
+    }
+
+    void testRejectedChangesKeepSnapshot() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        AdminServer admin(config);
+        std::string reply;
+
+        CPPUNIT_ASSERT_EQUAL(400, admin.handle(makeRequest("PUT", "/config/chaos"),
+                                               "normal", reply));
+        CPPUNIT_ASSERT(!reply.empty());
+        CPPUNIT_ASSERT_EQUAL(400, admin.handle(makeRequest("PUT", "/config/scenario"),
+                                               "{\"routes\": [", reply));
+        CPPUNIT_ASSERT_EQUAL(400, admin.handle(makeRequest("PUT", "/config/default?behavior=nope"),
+                                               "", reply));
+        CPPUNIT_ASSERT_EQUAL(405, admin.handle(makeRequest("GET", "/config/chaos"), "", reply));
+        CPPUNIT_ASSERT_EQUAL(404, admin.handle(makeRequest("GET", "/other"), "", reply));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), config.generation());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), config.swaps());
+    }
+
+    void testServerCaches() {
+        LatencyDistributionCache distributions;
+        loadHistogram(distributions);
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        AdminServer admin(config, &distributions);
+        std::string reply;
+
+        // The histograms are the loop's; the tables built from them are not
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(
+            makeRequest("PUT", "/config/default?behavior=slow&dist=empirical&hist=api"), "", reply));
+        auto table = config.current().default_command.delay_distribution;
+        CPPUNIT_ASSERT(table);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), distributions.size());
+
+        // A second change with the same parameters reuses the table
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(makeRequest("PUT", "/config/chaos"),
+                                               "normal:1,slow&dist=empirical&hist=api:1", reply));
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(
+            makeRequest("PUT", "/config/default?behavior=slow&dist=empirical&hist=api"), "", reply));
+        CPPUNIT_ASSERT(config.current().default_command.delay_distribution == table);
+        CPPUNIT_ASSERT_EQUAL(200, admin.handle(
+            makeRequest("PUT", "/config/scenario"),
+            "{\"routes\": [{\"prefix\": \"/\", \"script\": \"status,headers\"}]}", reply));
+
+        // Distributions and scripts that do not resolve are refused
+        CPPUNIT_ASSERT_EQUAL(400, admin.handle(
+            makeRequest("PUT", "/config/default?behavior=slow&dist=empirical&hist=web"), "", reply));
+        CPPUNIT_ASSERT(reply.find("dist=") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(400, admin.handle(makeRequest("PUT", "/config/chaos"),
+                                               "slow&dist=empirical&hist=web:1", reply));
+        CPPUNIT_ASSERT_EQUAL(400, admin.handle(
+            makeRequest("PUT", "/config/scenario"),
+            "{\"routes\": [{\"prefix\": \"/\", \"behavior\": \"slow\","
+            " \"dist\": \"empirical\", \"hist\": \"web\"}]}", reply));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(5), config.generation());
+    }
+
+    void testServeOverSocket() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        AdminServer admin(config);
+        std::string abstract = "@stitch_admin_test_" + std::to_string(getpid());
+        ListenAddress address;
+        std::string error;
+        CPPUNIT_ASSERT(ListenAddress::parse("unix:" + abstract, address, error));
+        CPPUNIT_ASSERT(admin.start(address));
+
+        std::string spec = "error=503:1";
+        std::string response = exchange(abstract,
+            "PUT /config/chaos HTTP/1.1\r\nContent-Length: " + std::to_string(spec.length()) +
+            "\r\n\r\n" + spec);
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK\r\n") == 0);
+        CPPUNIT_ASSERT(response.find("\"generation\":2") != std::string::npos);
+
+        response = exchange(abstract, "PUT /config/chaos HTTP/1.1\r\n"
+                                      "Transfer-Encoding: chunked\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 411 Length Required\r\n") == 0);
+
+        admin.stop();
+        CPPUNIT_ASSERT_EQUAL(std::string("error=503:1"), config.current().chaos_spec);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), config.swaps());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AdminServerTest);
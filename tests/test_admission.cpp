@@ -0,0 +1,83 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include "admission.h"
+
+class AdmissionTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(AdmissionTest);
+
+    CPPUNIT_TEST(testMaxConnections);
+    CPPUNIT_TEST(testMemoryBudget);
+    CPPUNIT_TEST(testNoLimits);
+    CPPUNIT_TEST(testPausesAndJson);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void testMaxConnections() {
+        Admission admission(2, 0, 1000);
+        CPPUNIT_ASSERT(admission.admits());
+        admission.open();
+        admission.open();
+        CPPUNIT_ASSERT(!admission.admits());
+        admission.close(0);
+        CPPUNIT_ASSERT(admission.admits());
+        CPPUNIT_ASSERT_EQUAL(size_t(1), admission.connections());
+        CPPUNIT_ASSERT_EQUAL(size_t(2), admission.peakConnections());
+    }
+
+    void testMemoryBudget() {
+        // Room for what is held plus one connection with the largest head
+        size_t budget = 3 * Admission::CONNECTION_MEMORY + 2 * 1000;
+        Admission admission(0, budget, 1000);
+        size_t first = 0;
+        size_t second = 0;
+        admission.open();
+        admission.charge(first, Admission::CONNECTION_MEMORY);
+        admission.open();
+        admission.charge(second, Admission::CONNECTION_MEMORY);
+        CPPUNIT_ASSERT(admission.admits());
+
+        admission.charge(second, Admission::CONNECTION_MEMORY + 1);
+        CPPUNIT_ASSERT(!admission.admits());
+        CPPUNIT_ASSERT_EQUAL(2 * Admission::CONNECTION_MEMORY + 1, admission.memory());
+
+        // Giving memory back makes room again
+        admission.charge(second, Admission::CONNECTION_MEMORY);
+        CPPUNIT_ASSERT(admission.admits());
+        admission.close(second);
+        admission.close(first);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), admission.memory());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), admission.connections());
+        CPPUNIT_ASSERT_EQUAL(2 * Admission::CONNECTION_MEMORY + 1, admission.peakMemory());
+    }
+
+    void testNoLimits() {
+        Admission admission(0, 0, 1000);
+        size_t charged = 0;
+        for (int i = 0; i < 1000; i++) {
+            admission.open();
+        }
+        admission.charge(charged, size_t(1) << 40);
+        CPPUNIT_ASSERT(admission.admits());
+    }
+
+    void testPausesAndJson() {
+        Admission admission(10, 1 << 20, 8192);
+        admission.setPaused(true);
+        admission.setPaused(true);
+        admission.setPaused(false);
+        admission.setPaused(true);
+        CPPUNIT_ASSERT(admission.paused());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), admission.pauses());
+        admission.rejectHeaders();
+
+        std::string json = admission.toJson();
+        CPPUNIT_ASSERT(json.find("\"max_connections\":10,") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"memory_budget\":1048576,") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"max_header_size\":8192,") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"accepting\":false,") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"pauses\":2,") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"rejected_headers\":1}") != std::string::npos);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AdmissionTest);
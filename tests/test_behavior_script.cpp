@@ -0,0 +1,151 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include "behavior_script.h"
+
+class BehaviorScriptTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(BehaviorScriptTest);
+
+    CPPUNIT_TEST(testCompile);
+    CPPUNIT_TEST(testCompileErrors);
+    CPPUNIT_TEST(testCacheHit);
+    CPPUNIT_TEST(testRunnerSteps);
+    CPPUNIT_TEST(testRunnerRepeat);
+    CPPUNIT_TEST(testRunnerLines);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static std::shared_ptr<const BehaviorScript> compile(const std::string& source) {
+        std::string error;
+        std::shared_ptr<const BehaviorScript> script = BehaviorScript::compile(source, error);
+        CPPUNIT_ASSERT_MESSAGE(error, script != nullptr);
+        return script;
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testCompile() {
+        auto script = compile("status, headers, wait:2s, body:12.5%, rate:100, "
+                              "repeat:3, bytes:10, pause:500us, end, reset");
+        CPPUNIT_ASSERT_EQUAL(size_t(10), script->size());
+        CPPUNIT_ASSERT_EQUAL(std::string("SEND_LINES 1\n"
+                                         "SEND_HEAD 0\n"
+                                         "WAIT 2000000\n"
+                                         "SEND_BODY 125\n"
+                                         "RATE 100\n"
+                                         "REPEAT 3\n"
+                                         "SEND_BYTES 10\n"
+                                         "WAIT 500\n"
+                                         "END_REPEAT 0\n"
+                                         "RESET 0\n"),
+                             script->disassemble());
+        CPPUNIT_ASSERT_EQUAL(std::string("WAIT 250000\n"), compile("wait:250")->disassemble());
+        CPPUNIT_ASSERT_EQUAL(std::string("SEND_LINES 3\n"), compile("headers:3")->disassemble());
+    }
+
+    void testCompileErrors() {
+        const char* bad[] = {
+            "", " , ", "jump", "status:1", "body:101%", "body:1.25%", "wait:", "wait:2h",
+            "wait:3601s", "headers:0", "repeat:2,repeat:2,end,end", "end", "repeat:2,status",
+            "close:1", "rate:-1"
+        };
+        for (const char* source : bad) {
+            std::string error;
+            CPPUNIT_ASSERT_MESSAGE(source, BehaviorScript::compile(source, error) == nullptr);
+            CPPUNIT_ASSERT_MESSAGE(source, !error.empty());
+        }
+
+        std::string long_source;
+        while (long_source.size() <= BehaviorScript::MAX_SOURCE) {
+            long_source += "status,";
+        }
+        std::string error;
+        CPPUNIT_ASSERT(BehaviorScript::compile(long_source, error) == nullptr);
+    }
+
+    void testCacheHit() {
+        ScriptCache cache;
+        std::string error;
+        auto first = cache.get("status,close", error);
+        auto second = cache.get("status,close", error);
+        CPPUNIT_ASSERT(first != nullptr);
+        CPPUNIT_ASSERT(first == second);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), cache.size());
+
+        CPPUNIT_ASSERT(cache.get("status,nope", error) == nullptr);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), cache.size());
+        CPPUNIT_ASSERT(ScriptCache::hash("a") != ScriptCache::hash("b"));
+    }
+
+    void testRunnerSteps() {
+        // A 100-byte head and 1000-byte body
+        ScriptRunner runner;
+        CPPUNIT_ASSERT(!runner.active());
+        runner.start(compile("headers,wait:10,body:25%,rate:50,bytes:10,stall"));
+        CPPUNIT_ASSERT(runner.active());
+
+        CPPUNIT_ASSERT(runner.next(0, 100, 1100) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100), runner.target());
+        CPPUNIT_ASSERT(runner.sending(99));
+        CPPUNIT_ASSERT(!runner.sending(100));
+
+        CPPUNIT_ASSERT(runner.next(100, 100, 1100) == ScriptRunner::Action::WAIT);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10000), runner.waitUs());
+        CPPUNIT_ASSERT(runner.next(100, 100, 1100) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(350), runner.target());
+        CPPUNIT_ASSERT(runner.next(350, 100, 1100) == ScriptRunner::Action::RATE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(50), runner.rate());
+        CPPUNIT_ASSERT(runner.next(350, 100, 1100) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(360), runner.target());
+        CPPUNIT_ASSERT(runner.next(360, 100, 1100) == ScriptRunner::Action::STALL);
+        CPPUNIT_ASSERT(runner.next(360, 100, 1100) == ScriptRunner::Action::FINISH);
+        CPPUNIT_ASSERT(runner.sending(360));
+
+        // Percent steps of a body of unknown length send all of it
+        runner.start(compile("body:50%"));
+        CPPUNIT_ASSERT(runner.next(0, 100, UINT64_MAX) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(UINT64_MAX, runner.target());
+    }
+
+    void testRunnerRepeat() {
+        ScriptRunner runner;
+        runner.start(compile("repeat:3,bytes:5,wait:1,end,close"));
+        uint64_t sent = 0;
+        for (int i = 0; i < 3; ++i) {
+            CPPUNIT_ASSERT(runner.next(sent, 10, 1000) == ScriptRunner::Action::SEND);
+            sent = runner.target();
+            CPPUNIT_ASSERT(runner.next(sent, 10, 1000) == ScriptRunner::Action::WAIT);
+        }
+        CPPUNIT_ASSERT_EQUAL(uint64_t(15), sent);
+        CPPUNIT_ASSERT(runner.next(sent, 10, 1000) == ScriptRunner::Action::CLOSE);
+
+        // Zero repeats skip the loop, and sends past the end are dropped
+        runner.start(compile("repeat:0,reset,end,bytes:2000,close"));
+        CPPUNIT_ASSERT(runner.next(0, 10, 1000) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1000), runner.target());
+        CPPUNIT_ASSERT(runner.next(1000, 10, 1000) == ScriptRunner::Action::CLOSE);
+    }
+
+    void testRunnerLines() {
+        ScriptRunner runner;
+        runner.start(compile("status,headers:2,headers"));
+        CPPUNIT_ASSERT(runner.next(0, 100, 200) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), runner.lines());
+        runner.linesSent(1);
+        CPPUNIT_ASSERT(!runner.sending(17));
+
+        CPPUNIT_ASSERT(runner.next(17, 100, 200) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), runner.lines());
+        runner.linesSent(1);
+        CPPUNIT_ASSERT(runner.sending(30));
+        runner.linesSent(1);
+        CPPUNIT_ASSERT(!runner.sending(40));
+
+        CPPUNIT_ASSERT(runner.next(40, 100, 200) == ScriptRunner::Action::SEND);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), runner.lines());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100), runner.target());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BehaviorScriptTest);
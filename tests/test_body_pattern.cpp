@@ -0,0 +1,111 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include "body_pattern.h"
+
+class BodyPatternTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(BodyPatternTest);
+
+    CPPUNIT_TEST(testFillMatchesWords);
+    CPPUNIT_TEST(testSeekable);
+    CPPUNIT_TEST(testRegionBoundary);
+    CPPUNIT_TEST(testSeedsDiffer);
+    CPPUNIT_TEST(testDescriptionRoundTrip);
+    CPPUNIT_TEST(testVerifierAcceptsIntactBody);
+    CPPUNIT_TEST(testVerifierFindsFirstWrongByte);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static std::string fill(uint64_t seed, uint64_t offset, size_t length) {
+        std::string out(length, '\0');
+        BodyPattern(seed).fill(offset, &out[0], length);
+        return out;
+    }
+
+    // Byte-at-a-time reference built from word()
+    static char referenceByte(uint64_t seed, uint64_t offset) {
+        return static_cast<char>(BodyPattern::word(seed, offset / 4) >> (8 * (offset % 4)));
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testFillMatchesWords() {
+        // Long enough for the vector kernel plus a scalar tail
+        std::string body = fill(7, 0, 1000);
+        for (size_t i = 0; i < body.size(); ++i) {
+            CPPUNIT_ASSERT_EQUAL(referenceByte(7, i), body[i]);
+        }
+    }
+
+    void testSeekable() {
+        std::string whole = fill(99, 0, 4096);
+        for (uint64_t offset : {1u, 2u, 3u, 5u, 63u, 1000u}) {
+            for (size_t length : {0u, 1u, 3u, 37u, 2000u}) {
+                CPPUNIT_ASSERT_EQUAL(whole.substr(offset, length), fill(99, offset, length));
+            }
+        }
+    }
+
+    void testRegionBoundary() {
+        // Word index 2^32 starts a new key region 16 GiB into the body
+        uint64_t boundary = uint64_t(4) << 32;
+        std::string body = fill(5, boundary - 70, 140);
+        for (size_t i = 0; i < body.size(); ++i) {
+            CPPUNIT_ASSERT_EQUAL(referenceByte(5, boundary - 70 + i), body[i]);
+        }
+        CPPUNIT_ASSERT(fill(5, 0, 64) != fill(5, boundary, 64));
+    }
+
+    void testSeedsDiffer() {
+        CPPUNIT_ASSERT(fill(1, 0, 64) != fill(2, 0, 64));
+        CPPUNIT_ASSERT(fill(uint64_t(1) << 32, 0, 64) != fill(0, 0, 64));
+    }
+
+    void testDescriptionRoundTrip() {
+        std::string header = BodyPattern::describe(42, 100, 1 << 20);
+        CPPUNIT_ASSERT_EQUAL(std::string("seed=42; offset=100; length=1048576"), header);
+
+        uint64_t seed = 0;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        CPPUNIT_ASSERT(BodyPattern::parseDescription(" " + header, seed, offset, length));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(42), seed);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100), offset);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1048576), length);
+
+        CPPUNIT_ASSERT(!BodyPattern::parseDescription("seed=1", seed, offset, length));
+        CPPUNIT_ASSERT(!BodyPattern::parseDescription("seed=x; length=1", seed, offset, length));
+    }
+
+    void testVerifierAcceptsIntactBody() {
+        std::string body = fill(3, 500, 100000);
+        PatternVerifier verifier(3, 500);
+
+        // Uneven pieces, as they come off a socket
+        size_t pos = 0;
+        for (size_t piece = 1; pos < body.size(); piece = piece * 3 + 1) {
+            size_t take = std::min(piece, body.size() - pos);
+            CPPUNIT_ASSERT(verifier.update(body.data() + pos, take));
+            pos += take;
+        }
+        CPPUNIT_ASSERT(verifier.ok());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100000), verifier.bytesChecked());
+    }
+
+    void testVerifierFindsFirstWrongByte() {
+        std::string body = fill(3, 0, 50000);
+        body[30001] ^= 0x01;
+        body[40000] ^= 0x01;
+
+        PatternVerifier verifier(3);
+        CPPUNIT_ASSERT(verifier.update(body.data(), 30000));
+        CPPUNIT_ASSERT(!verifier.update(body.data() + 30000, body.size() - 30000));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(30001), verifier.firstMismatch());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(50000), verifier.bytesChecked());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BodyPatternTest);
@@ -0,0 +1,103 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include "byte_range.h"
+
+class ByteRangeTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ByteRangeTest);
+
+    CPPUNIT_TEST(testSingleRanges);
+    CPPUNIT_TEST(testMultipleRanges);
+    CPPUNIT_TEST(testUnsatisfiable);
+    CPPUNIT_TEST(testIgnoredHeaders);
+    CPPUNIT_TEST(testContentRange);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef RangeRequest::Result Result;
+
+    static Result parse(const std::string& header, uint64_t length,
+                        std::vector<ByteRange>& ranges) {
+        return RangeRequest::parse(header, length, ranges);
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testSingleRanges() {
+        std::vector<ByteRange> ranges;
+
+        CPPUNIT_ASSERT(parse("bytes=0-99", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), ranges.size());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), ranges[0].first);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(99), ranges[0].last);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100), ranges[0].length());
+
+        // Open-ended and past-the-end ranges stop at the last byte
+        CPPUNIT_ASSERT(parse("bytes=900-", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(999), ranges[0].last);
+        CPPUNIT_ASSERT(parse("bytes=990-5000", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(999), ranges[0].last);
+
+        // Suffix ranges count from the end, at most the whole body
+        CPPUNIT_ASSERT(parse("bytes=-10", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(990), ranges[0].first);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(999), ranges[0].last);
+        CPPUNIT_ASSERT(parse("bytes=-5000", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), ranges[0].first);
+
+        // Unit is case-insensitive, whitespace around specs is allowed
+        CPPUNIT_ASSERT(parse(" Bytes=5-6 ", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(5), ranges[0].first);
+    }
+
+    void testMultipleRanges() {
+        std::vector<ByteRange> ranges;
+
+        // Request order is kept and overlaps are not merged
+        CPPUNIT_ASSERT(parse("bytes=500-599, 0-9,5-14", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(size_t(3), ranges.size());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(500), ranges[0].first);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), ranges[1].first);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(14), ranges[2].last);
+
+        // Unsatisfiable members are dropped when others remain
+        CPPUNIT_ASSERT(parse("bytes=0-0,2000-3000,,-1", 1000, ranges) == Result::SATISFIABLE);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), ranges.size());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(999), ranges[1].first);
+    }
+
+    void testUnsatisfiable() {
+        std::vector<ByteRange> ranges;
+        CPPUNIT_ASSERT(parse("bytes=1000-", 1000, ranges) == Result::UNSATISFIABLE);
+        CPPUNIT_ASSERT(parse("bytes=-0", 1000, ranges) == Result::UNSATISFIABLE);
+        CPPUNIT_ASSERT(parse("bytes=0-10", 0, ranges) == Result::UNSATISFIABLE);
+        CPPUNIT_ASSERT(ranges.empty());
+    }
+
+    void testIgnoredHeaders() {
+        std::vector<ByteRange> ranges;
+        CPPUNIT_ASSERT(parse("", 1000, ranges) == Result::IGNORED);
+        CPPUNIT_ASSERT(parse("items=0-10", 1000, ranges) == Result::IGNORED);
+        CPPUNIT_ASSERT(parse("bytes=", 1000, ranges) == Result::IGNORED);
+        CPPUNIT_ASSERT(parse("bytes=10-5", 1000, ranges) == Result::IGNORED);
+        CPPUNIT_ASSERT(parse("bytes=0-10,abc", 1000, ranges) == Result::IGNORED);
+        CPPUNIT_ASSERT(parse("bytes=1-2-3", 1000, ranges) == Result::IGNORED);
+        CPPUNIT_ASSERT(ranges.empty());
+
+        std::string many = "bytes=0-0";
+        for (size_t i = 1; i <= RangeRequest::MAX_RANGES; ++i) {
+            many += "," + std::to_string(i) + "-" + std::to_string(i);
+        }
+        CPPUNIT_ASSERT(parse(many, 1000, ranges) == Result::IGNORED);
+    }
+
+    void testContentRange() {
+        CPPUNIT_ASSERT_EQUAL(std::string("bytes 10-19/1000"),
+                             RangeRequest::contentRange({10, 19}, 1000));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ByteRangeTest);
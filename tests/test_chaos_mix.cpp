@@ -0,0 +1,168 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include "chaos_mix.h"
+
+class ChaosMixTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ChaosMixTest);
+
+    CPPUNIT_TEST(testParseEntries);
+    CPPUNIT_TEST(testPrimaryValues);
+    CPPUNIT_TEST(testInvalidSpecs);
+    CPPUNIT_TEST(testSingleEntry);
+    CPPUNIT_TEST(testZeroWeightNeverPicked);
+    CPPUNIT_TEST(testDistributionFollowsWeights);
+    CPPUNIT_TEST(testReproducibleFromSeed);
+    CPPUNIT_TEST(testCacheCompilesOnce);
+    CPPUNIT_TEST(testExtraParameters);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    ChaosMix* mix;
+
+    // A cache with histogram "api" loaded
+    static void loadHistogram(LatencyDistributionCache& distributions) {
+        char path[] = "/tmp/stitch_histXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+        {
+            std::ofstream file(path);
+            file << "10 50\n100 50\n";
+        }
+        bool loaded = distributions.addHistogram("api", path);
+        std::remove(path);
+        CPPUNIT_ASSERT(loaded);
+    }
+
+public:
+    void setUp() {
+        mix = new ChaosMix();
+    }
+
+    void tearDown() {
+        delete mix;
+    }
+
+    void testParseEntries() {
+        CPPUNIT_ASSERT(mix->parse("normal:90, close_partial:5,slow:3,error=503:2"));
+        CPPUNIT_ASSERT_EQUAL(size_t(4), mix->size());
+    }
+
+    void testPrimaryValues() {
+        CPPUNIT_ASSERT(mix->parse("error=503:1"));
+        Xoshiro256 rng(1);
+        const TestCommand& cmd = mix->pick(rng);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE, cmd.behavior);
+        CPPUNIT_ASSERT_EQUAL(503, cmd.status_code);
+
+        CPPUNIT_ASSERT(mix->parse("slow=250:1"));
+        CPPUNIT_ASSERT_EQUAL(250, mix->pick(rng).delay_ms);
+
+        CPPUNIT_ASSERT(mix->parse("close_partial=17:1"));
+        CPPUNIT_ASSERT_EQUAL(size_t(17), mix->pick(rng).bytes_before_close);
+    }
+
+    void testInvalidSpecs() {
+        CPPUNIT_ASSERT(!mix->parse(""));
+        CPPUNIT_ASSERT(!mix->parse("normal"));
+        CPPUNIT_ASSERT(!mix->parse("normal:abc"));
+        CPPUNIT_ASSERT(!mix->parse("normal:-1"));
+        CPPUNIT_ASSERT(!mix->parse("bogus:10"));
+        CPPUNIT_ASSERT(!mix->parse("timeout=5:10"));
+        CPPUNIT_ASSERT(!mix->parse("error=42:10"));
+        CPPUNIT_ASSERT(!mix->parse("normal:0"));
+        CPPUNIT_ASSERT(!mix->getErrorMessage().empty());
+    }
+
+    void testSingleEntry() {
+        CPPUNIT_ASSERT(mix->parse("timeout:1"));
+        Xoshiro256 rng(7);
+        for (int i = 0; i < 100; ++i) {
+            CPPUNIT_ASSERT_EQUAL(BehaviorType::TIMEOUT, mix->pick(rng).behavior);
+        }
+    }
+
+    void testZeroWeightNeverPicked() {
+        CPPUNIT_ASSERT(mix->parse("normal:1,close:0,error:1"));
+        Xoshiro256 rng(3);
+        for (int i = 0; i < 10000; ++i) {
+            CPPUNIT_ASSERT(mix->pick(rng).behavior != BehaviorType::CLOSE_IMMEDIATELY);
+        }
+    }
+
+    void testDistributionFollowsWeights() {
+        CPPUNIT_ASSERT(mix->parse("normal:90,close:5,slow:3,error:2"));
+        Xoshiro256 rng(42);
+
+        std::map<BehaviorType, int> counts;
+        const int draws = 100000;
+        for (int i = 0; i < draws; ++i) {
+            counts[mix->pick(rng).behavior]++;
+        }
+
+        // Within half a percentage point of the configured share
+        CPPUNIT_ASSERT(std::abs(counts[BehaviorType::NORMAL] - 90000) < 500);
+        CPPUNIT_ASSERT(std::abs(counts[BehaviorType::CLOSE_IMMEDIATELY] - 5000) < 500);
+        CPPUNIT_ASSERT(std::abs(counts[BehaviorType::SLOW_RESPONSE] - 3000) < 500);
+        CPPUNIT_ASSERT(std::abs(counts[BehaviorType::ERROR_RESPONSE] - 2000) < 500);
+    }
+
+    void testReproducibleFromSeed() {
+        CPPUNIT_ASSERT(mix->parse("normal:50,close:25,error:25"));
+        Xoshiro256 first(1234);
+        Xoshiro256 second(1234);
+
+        for (int i = 0; i < 1000; ++i) {
+            CPPUNIT_ASSERT_EQUAL(mix->pick(first).behavior, mix->pick(second).behavior);
+        }
+    }
+
+    void testExtraParameters() {
+        LatencyDistributionCache distributions;
+        loadHistogram(distributions);
+        CPPUNIT_ASSERT(mix->parse("slow&dist=empirical&hist=api:1", &distributions));
+        Xoshiro256 rng(1);
+        CPPUNIT_ASSERT(mix->pick(rng).delay_distribution != nullptr);
+
+        CPPUNIT_ASSERT(mix->parse("error=503&h.Retry-After=5:1"));
+        const TestCommand& cmd = mix->pick(rng);
+        CPPUNIT_ASSERT_EQUAL(503, cmd.status_code);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), cmd.headers.size());
+
+        // Unresolved distributions and scripts are errors, not dropped
+        CPPUNIT_ASSERT(!mix->parse("slow&dist=empirical&hist=api:1"));
+        CPPUNIT_ASSERT(mix->getErrorMessage().find("dist=") != std::string::npos);
+        CPPUNIT_ASSERT(!mix->parse("slow&dist=empirical&hist=web:1", &distributions));
+        CPPUNIT_ASSERT(!mix->parse("normal&script=jump:1"));
+        CPPUNIT_ASSERT(!mix->parse("normal&behavior=close:1"));
+        CPPUNIT_ASSERT(!mix->parse("normal&=1:1"));
+    }
+
+    void testCacheCompilesOnce() {
+        ChaosMixCache cache;
+        auto first = cache.get("normal:1,close:1");
+        CPPUNIT_ASSERT(first);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), first->size());
+        CPPUNIT_ASSERT(cache.get("normal:1,close:1") == first);
+
+        // Invalid specs are remembered as such
+        CPPUNIT_ASSERT(!cache.get("normal"));
+        CPPUNIT_ASSERT(!cache.get("normal"));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cache.size());
+
+        // Full: starts over, while mixes already handed out stay usable
+        for (size_t i = 0; i < ChaosMixCache::MAX_ENTRIES; i++) {
+            cache.get("error=" + std::to_string(400 + i % 100) + ":" + std::to_string(i + 1));
+        }
+        CPPUNIT_ASSERT(cache.size() <= ChaosMixCache::MAX_ENTRIES);
+        CPPUNIT_ASSERT(cache.get("normal:1,close:1") != first);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), first->size());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChaosMixTest);
@@ -0,0 +1,149 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <thread>
+#include "client_runner.h"
+
+class ClientRunnerTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ClientRunnerTest);
+
+    CPPUNIT_TEST(testDescribe);
+    CPPUNIT_TEST(testMerge);
+    CPPUNIT_TEST(testReactionsFromServer);
+    CPPUNIT_TEST(testRefused);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static int listenLoopback(int& port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CPPUNIT_ASSERT_EQUAL(0, bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+        CPPUNIT_ASSERT_EQUAL(0, listen(fd, 64));
+        socklen_t length = sizeof(addr);
+        CPPUNIT_ASSERT_EQUAL(0, getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length));
+        port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    // Answers by the first byte of the request: 'A' gets 200, 'B' a close,
+    // 'C' garbage, and anything else is left waiting until the client gives up
+    static void serve(int fd) {
+        char request[256];
+        if (read(fd, request, sizeof(request)) > 0) {
+            char first = request[0];
+            const char* answer = nullptr;
+            if (first == 'A') {
+                answer = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+            } else if (first == 'C') {
+                answer = "SSH-2.0-nope\r\n\r\n";
+            }
+            if (answer != nullptr) {
+                ssize_t written = write(fd, answer, strlen(answer));
+                (void)written;
+            }
+            if (first != 'A' && first != 'B' && first != 'C') {
+                char rest[256];
+                while (read(fd, rest, sizeof(rest)) > 0) {
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    static RequestCase makeCase(const std::string& name, const std::string& bytes) {
+        return RequestCase{name, name, bytes, false, ""};
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testDescribe() {
+        CaseTally tally;
+        CPPUNIT_ASSERT_EQUAL(std::string(""), tally.describe());
+        tally.add(Reaction::STATUS, 400, 10);
+        tally.add(Reaction::TIMEOUT, 0, 10);
+        tally.add(Reaction::STATUS, 200, 10);
+        tally.add(Reaction::STATUS, 200, 10);
+        tally.add(Reaction::CLOSED, 0, 10);
+        tally.add(Reaction::CLOSED, 0, 10);
+        CPPUNIT_ASSERT_EQUAL(std::string("200:2 400:1 closed:2 timeout:1"), tally.describe());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(6), tally.requests);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(60), tally.latency_us);
+    }
+
+    void testMerge() {
+        CaseTally a;
+        CaseTally b;
+        a.add(Reaction::STATUS, 400, 1);
+        b.add(Reaction::STATUS, 400, 2);
+        b.add(Reaction::RESET, 0, 3);
+        a.merge(b);
+        CPPUNIT_ASSERT_EQUAL(std::string("400:2 reset:1"), a.describe());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(6), a.latency_us);
+    }
+
+    void testReactionsFromServer() {
+        int port;
+        int listener = listenLoopback(port);
+        const uint64_t requests = 16;
+        std::thread server([listener, requests]() {
+            std::vector<std::thread> connections;
+            for (uint64_t i = 0; i < requests; ++i) {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd >= 0) {
+                    connections.emplace_back(serve, fd);
+                }
+            }
+            for (std::thread& connection : connections) {
+                connection.join();
+            }
+        });
+
+        std::vector<RequestCase> cases = {makeCase("ok", "A\r\n\r\n"), makeCase("close", "B\r\n\r\n"),
+                                          makeCase("garbage", "C\r\n\r\n"), makeCase("hang", "D")};
+        ClientOptions options;
+        options.target = "127.0.0.1:" + std::to_string(port);
+        options.threads = 2;
+        options.connections = 4;
+        options.requests = requests;
+        options.timeout = std::chrono::milliseconds(200);
+        ClientRunner runner(cases, options);
+        CPPUNIT_ASSERT(runner.run());
+        server.join();
+        ::close(listener);
+
+        const std::vector<CaseTally>& tallies = runner.getTallies();
+        CPPUNIT_ASSERT_EQUAL(std::string("200:4"), tallies[0].describe());
+        CPPUNIT_ASSERT_EQUAL(std::string("closed:4"), tallies[1].describe());
+        CPPUNIT_ASSERT_EQUAL(std::string("bad_response:4"), tallies[2].describe());
+        CPPUNIT_ASSERT_EQUAL(std::string("timeout:4"), tallies[3].describe());
+        CPPUNIT_ASSERT(tallies[3].latency_us >= 4 * 200000);
+    }
+
+    void testRefused() {
+        int port;
+        int listener = listenLoopback(port);
+        ::close(listener);
+
+        ClientOptions options;
+        options.target = "127.0.0.1:" + std::to_string(port);
+        options.requests = 3;
+        ClientRunner runner({RequestCase{"ok", "ok", "GET / HTTP/1.1\r\n\r\n", false, ""}}, options);
+        CPPUNIT_ASSERT(runner.run());
+        CPPUNIT_ASSERT_EQUAL(std::string("refused:3"), runner.getTallies()[0].describe());
+
+        options.target = "nowhere";
+        ClientRunner unusable({RequestCase{"ok", "ok", "x", false, ""}}, options);
+        CPPUNIT_ASSERT(!unusable.run());
+        CPPUNIT_ASSERT(!unusable.getErrorMessage().empty());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ClientRunnerTest);
@@ -22,6 +22,11 @@ class CommandInterpreterTest : public CppUnit::TestFixture {
     CPPUNIT_TEST(testSlowResponse);
     CPPUNIT_TEST(testSlowHeaders);
     CPPUNIT_TEST(testSlowBody);
+    CPPUNIT_TEST(testSlowResponseDistribution);
+    CPPUNIT_TEST(testBodyOptions);
+    CPPUNIT_TEST(testHeaderFloodOptions);
+    CPPUNIT_TEST(testRequestBodyOptions);
+    CPPUNIT_TEST(testSlowResponseInvalidDistribution);
 
     // Malformed response tests
     CPPUNIT_TEST(testInvalidStatusLine);
@@ -168,6 +173,155 @@ public:
         CPPUNIT_ASSERT_EQUAL(100, cmd.bytes_per_second);
     }
 
+    void testBodyOptions() {
+        std::map<std::string, std::string> params;
+        params["size"] = "10737418240";
+        params["chunked"] = "1";
+        params["fault"] = "reset";
+        params["fault_at"] = "4096";
+
+        TestCommand cmd = interpreter->interpret(params);
+
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::NORMAL, cmd.behavior);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10737418240ULL), cmd.body_size);
+        CPPUNIT_ASSERT(cmd.chunks.mode == ChunkPlan::Mode::FIXED);
+        CPPUNIT_ASSERT_EQUAL(size_t(8192), cmd.chunks.min_size);
+        CPPUNIT_ASSERT_EQUAL(ResponseFault::RESET, cmd.fault);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(4096), cmd.fault_at);
+
+        params["fault"] = "bogus";
+        params["size"] = "-5";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT_EQUAL(ResponseFault::NONE, cmd.fault);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), cmd.body_size);
+
+        CPPUNIT_ASSERT(!cmd.body_seeded);
+        params["body_seed"] = "42";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.body_seeded);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(42), cmd.body_seed);
+
+        params.clear();
+        params["chunk_size"] = "512-4096";
+        params["chunk_seed"] = "7";
+        params["chunk_fault"] = "missing_crlf";
+        params["chunk_fault_at"] = "3";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.chunks.mode == ChunkPlan::Mode::RANDOM);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(7), cmd.chunks.seed);
+        CPPUNIT_ASSERT(cmd.chunks.fault == ChunkPlan::Fault::MISSING_CRLF);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), cmd.chunks.fault_chunk);
+
+        // A chunk fault alone turns chunking on
+        params.clear();
+        params["chunk_fault"] = "truncated_last";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.chunks.mode == ChunkPlan::Mode::FIXED);
+        CPPUNIT_ASSERT(cmd.range_fault == RangeFault::NONE);
+
+        params["range_fault"] = "overlap";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.range_fault == RangeFault::OVERLAP);
+
+        params["encoding"] = "br";
+        params["encoding_fault"] = "checksum";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.encoding == ContentEncoding::BROTLI);
+        CPPUNIT_ASSERT(cmd.encoding_fault == EncodingFault::CHECKSUM);
+        params["encoding"] = "compress";
+        CPPUNIT_ASSERT(interpreter->interpret(params).encoding == ContentEncoding::IDENTITY);
+    }
+
+    void testHeaderFloodOptions() {
+        std::map<std::string, std::string> params;
+        TestCommand cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), cmd.duplicate_headers);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), cmd.header_count);
+        CPPUNIT_ASSERT(cmd.headers.empty());
+
+        // header_size= alone is one oversized header
+        params["header_size"] = "65536";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), cmd.header_count);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(65536), cmd.header_size);
+
+        params.clear();
+        params["header_count"] = "999999999";
+        params["duplicate_headers"] = "3";
+        params["h.Set-Cookie"] = "a=1";
+        params["h.Content-Length"] = "5";
+        params["h.Bad Name"] = "x";
+        params["h.X-Split"] = "a\r\nInjected: 1";
+        params["h."] = "empty";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT_EQUAL(HeaderFloodSource::MAX_COUNT, cmd.header_count);
+        CPPUNIT_ASSERT_EQUAL(HeaderFloodSource::DEFAULT_VALUE_SIZE, cmd.header_size);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), cmd.duplicate_headers);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cmd.headers.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("Content-Length"), cmd.headers[0].first);
+        CPPUNIT_ASSERT_EQUAL(std::string("Set-Cookie"), cmd.headers[1].first);
+        CPPUNIT_ASSERT_EQUAL(std::string("a=1"), cmd.headers[1].second);
+    }
+
+    void testRequestBodyOptions() {
+        std::map<std::string, std::string> params;
+        TestCommand cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.request_body == RequestBodyMode::DISCARD);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), cmd.read_rate);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), cmd.sndbuf);
+        CPPUNIT_ASSERT_EQUAL(-1, cmd.nodelay);
+
+        params["request_body"] = "echo";
+        params["read_rate"] = "65536";
+        params["sndbuf"] = "65536";
+        params["nodelay"] = "0";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT(cmd.request_body == RequestBodyMode::ECHO);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(65536), cmd.read_rate);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(65536), cmd.sndbuf);
+        CPPUNIT_ASSERT_EQUAL(0, cmd.nodelay);
+
+        params["sndbuf"] = "99999999999";
+        params["nodelay"] = "yes";
+        cmd = interpreter->interpret(params);
+        CPPUNIT_ASSERT_EQUAL(TestCommand::MAX_SNDBUF, cmd.sndbuf);
+        CPPUNIT_ASSERT_EQUAL(-1, cmd.nodelay);
+        params.erase("sndbuf");
+        params.erase("nodelay");
+
+        params["request_body"] = "ignore";
+        CPPUNIT_ASSERT(interpreter->interpret(params).request_body == RequestBodyMode::IGNORE);
+        params["request_body"] = "keep";
+        CPPUNIT_ASSERT(interpreter->interpret(params).request_body == RequestBodyMode::DISCARD);
+    }
+
+    void testSlowResponseDistribution() {
+        std::map<std::string, std::string> params;
+        params["behavior"] = "slow";
+        params["dist"] = "uniform";
+        params["min"] = "0.5";
+        params["max"] = "1.5";
+
+        TestCommand cmd = interpreter->interpret(params);
+
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::SLOW_RESPONSE, cmd.behavior);
+        CPPUNIT_ASSERT(cmd.delay_distribution != nullptr);
+        CPPUNIT_ASSERT(interpreter->describe(cmd).find("uniform") != std::string::npos);
+    }
+
+    void testSlowResponseInvalidDistribution() {
+        std::map<std::string, std::string> params;
+        params["behavior"] = "slow";
+        params["delay"] = "250";
+        params["dist"] = "pareto";
+
+        TestCommand cmd = interpreter->interpret(params);
+
+        // Falls back to the fixed delay
+        CPPUNIT_ASSERT(cmd.delay_distribution == nullptr);
+        CPPUNIT_ASSERT_EQUAL(int64_t(250000), cmd.delay_us);
+    }
+
     void testInvalidStatusLine() {
         std::map<std::string, std::string> params;
         params["behavior"] = "invalid_status";
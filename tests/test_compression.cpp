@@ -0,0 +1,180 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <cstring>
+#include "compression.h"
+
+class CompressionTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(CompressionTest);
+
+    CPPUNIT_TEST(testGzipRoundTrip);
+    CPPUNIT_TEST(testDeflateRoundTrip);
+    CPPUNIT_TEST(testSupportedEncodings);
+    CPPUNIT_TEST(testCacheCompressesOnce);
+    CPPUNIT_TEST(testCacheKeysByEncoding);
+    CPPUNIT_TEST(testCacheEvictsLeastRecentlyUsed);
+    CPPUNIT_TEST(testCacheSkipsOversizedBodies);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static std::string inflateAll(const std::string& compressed, int window_bits) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        CPPUNIT_ASSERT_EQUAL(Z_OK, inflateInit2(&stream, window_bits));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+        stream.avail_in = static_cast<uInt>(compressed.size());
+
+        std::string out;
+        char buffer[16384];
+        int rc = Z_OK;
+        while (rc == Z_OK) {
+            stream.next_out = reinterpret_cast<Bytef*>(buffer);
+            stream.avail_out = sizeof(buffer);
+            rc = inflate(&stream, Z_NO_FLUSH);
+            out.append(buffer, sizeof(buffer) - stream.avail_out);
+        }
+        inflateEnd(&stream);
+        CPPUNIT_ASSERT_EQUAL(Z_STREAM_END, rc);
+        return out;
+    }
+
+    // Runs the event loop side until the entry is no longer pending
+    static void waitFor(CompressionCache& cache,
+                        const std::shared_ptr<const CompressionCache::Entry>& entry) {
+        for (int i = 0; i < 5000 && entry->state == CompressionCache::Entry::State::PENDING; ++i) {
+            cache.collect();
+            usleep(1000);
+        }
+    }
+
+    static CompressionCache::InputFactory pattern(uint64_t length) {
+        return [length] { return std::make_unique<SeededPatternSource>(3, length); };
+    }
+
+    static std::string patternBody(uint64_t length) {
+        std::string body(length, '\0');
+        BodyPattern(3).fill(0, &body[0], body.size());
+        return body;
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testGzipRoundTrip() {
+        SeededPatternSource input(3, 300000);
+        std::string compressed;
+        std::string error;
+        CPPUNIT_ASSERT(Compressor::compress(ContentEncoding::GZIP, input, compressed, error));
+        CPPUNIT_ASSERT_EQUAL(std::string("\x1f\x8b"), compressed.substr(0, 2));
+        CPPUNIT_ASSERT(inflateAll(compressed, 16 + MAX_WBITS) == patternBody(300000));
+    }
+
+    void testDeflateRoundTrip() {
+        PatternSource input(1000000);
+        std::string compressed;
+        std::string error;
+        CPPUNIT_ASSERT(Compressor::compress(ContentEncoding::DEFLATE, input, compressed, error));
+        // The cyclic pattern compresses to almost nothing
+        CPPUNIT_ASSERT(compressed.size() < 10000);
+
+        std::string expected;
+        PatternSource reference(1000000);
+        struct iovec segments[ResponseSource::MAX_SEGMENTS];
+        while (!reference.done()) {
+            size_t count = reference.peek(segments, ResponseSource::MAX_SEGMENTS, SIZE_MAX);
+            size_t bytes = 0;
+            for (size_t i = 0; i < count; ++i) {
+                expected.append(static_cast<const char*>(segments[i].iov_base), segments[i].iov_len);
+                bytes += segments[i].iov_len;
+            }
+            reference.consume(bytes);
+        }
+        CPPUNIT_ASSERT(inflateAll(compressed, MAX_WBITS) == expected);
+    }
+
+    void testSupportedEncodings() {
+        CPPUNIT_ASSERT(!Compressor::supports(ContentEncoding::IDENTITY));
+        CPPUNIT_ASSERT(Compressor::supports(ContentEncoding::GZIP));
+        CPPUNIT_ASSERT(Compressor::supports(ContentEncoding::DEFLATE));
+
+        StringSource input("hello");
+        std::string out;
+        std::string error;
+        CPPUNIT_ASSERT_EQUAL(Compressor::supports(ContentEncoding::BROTLI),
+                             Compressor::compress(ContentEncoding::BROTLI, input, out, error));
+    }
+
+    void testCacheCompressesOnce() {
+        CompressionCache cache(2, 1 << 20);
+        CPPUNIT_ASSERT(cache.start());
+        CPPUNIT_ASSERT(cache.getEventFd() >= 0);
+
+        auto first = cache.get("a", ContentEncoding::GZIP, 50000, pattern(50000));
+        CPPUNIT_ASSERT(first->state == CompressionCache::Entry::State::PENDING);
+        waitFor(cache, first);
+        CPPUNIT_ASSERT(first->state == CompressionCache::Entry::State::READY);
+        CPPUNIT_ASSERT(inflateAll(*first->data, 16 + MAX_WBITS) == patternBody(50000));
+
+        // The second request never builds its input
+        bool built = false;
+        auto second = cache.get("a", ContentEncoding::GZIP, 50000, [&built] {
+            built = true;
+            return std::make_unique<StringSource>("");
+        });
+        CPPUNIT_ASSERT(second == first);
+        CPPUNIT_ASSERT(!built);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), cache.hits());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), cache.misses());
+        CPPUNIT_ASSERT_EQUAL(first->data->size(), cache.bytes());
+    }
+
+    void testCacheKeysByEncoding() {
+        CompressionCache cache(1, 1 << 20);
+        CPPUNIT_ASSERT(cache.start());
+
+        auto gzip = cache.get("a", ContentEncoding::GZIP, 1000, pattern(1000));
+        auto deflate = cache.get("a", ContentEncoding::DEFLATE, 1000, pattern(1000));
+        CPPUNIT_ASSERT(gzip != deflate);
+        waitFor(cache, gzip);
+        waitFor(cache, deflate);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cache.entries());
+        CPPUNIT_ASSERT(*gzip->data != *deflate->data);
+    }
+
+    void testCacheEvictsLeastRecentlyUsed() {
+        // Seeded bodies barely compress, so each entry is about 30 KB
+        CompressionCache cache(1, 70000);
+        CPPUNIT_ASSERT(cache.start());
+
+        auto a = cache.get("a", ContentEncoding::GZIP, 30000, pattern(30000));
+        waitFor(cache, a);
+        auto b = cache.get("b", ContentEncoding::GZIP, 30000, pattern(30000));
+        waitFor(cache, b);
+        // Touch a, so b is the oldest when c arrives
+        CPPUNIT_ASSERT(cache.get("a", ContentEncoding::GZIP, 30000, pattern(30000)) == a);
+        auto c = cache.get("c", ContentEncoding::GZIP, 30000, pattern(30000));
+        waitFor(cache, c);
+
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cache.entries());
+        CPPUNIT_ASSERT(cache.bytes() <= 70000);
+        CPPUNIT_ASSERT(cache.get("a", ContentEncoding::GZIP, 30000, pattern(30000)) == a);
+        // Evicted entries stay valid for whoever holds them
+        CPPUNIT_ASSERT(b->state == CompressionCache::Entry::State::READY);
+        CPPUNIT_ASSERT(cache.get("b", ContentEncoding::GZIP, 30000, pattern(30000)) != b);
+    }
+
+    void testCacheSkipsOversizedBodies() {
+        CompressionCache cache(1, 1000);
+        CPPUNIT_ASSERT(cache.start());
+        CPPUNIT_ASSERT(cache.get("big", ContentEncoding::GZIP, 1001, pattern(1001)) == nullptr);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), cache.entries());
+
+        CompressionCache idle(0, 1000);
+        CPPUNIT_ASSERT(!idle.start());
+        CPPUNIT_ASSERT(!idle.getErrorMessage().empty());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CompressionTest);
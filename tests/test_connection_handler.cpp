@@ -1,14 +1,1131 @@
 #include <cppunit/extensions/HelperMacros.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
 #include "connection_handler.h"
+#include "request_body.h"
+#include "chaos_mix.h"
+#include "traffic_log.h"
+#include "corpus.h"
+#include "compression.h"
+#include "upstream.h"
 
 class ConnectionHandlerTest : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(ConnectionHandlerTest);
-    // Tests will be added when implementing
+
+    CPPUNIT_TEST(testNormalRequest);
+    CPPUNIT_TEST(testOutcomeRecordedFromHeader);
+    CPPUNIT_TEST(testOutcomeRecordedFromQuery);
+    CPPUNIT_TEST(testOutcomeLookup);
+    CPPUNIT_TEST(testOutcomeLookupUnknownId);
+    CPPUNIT_TEST(testScenarioRouteOverridesQuery);
+    CPPUNIT_TEST(testChaosMixForPlainRequests);
+    CPPUNIT_TEST(testChaosQueryParameter);
+    CPPUNIT_TEST(testChaosQueryParameterCached);
+    CPPUNIT_TEST(testSlowResponseSendsAfterDelay);
+    CPPUNIT_TEST(testSlowResponseDistributionDeadline);
+    CPPUNIT_TEST(testRecordAndReplay);
+    CPPUNIT_TEST(testSyntheticBodyStreams);
+    CPPUNIT_TEST(testChunkedResponse);
+    CPPUNIT_TEST(testFaultCloseAtOffset);
+    CPPUNIT_TEST(testFaultCorruptsOneByte);
+    CPPUNIT_TEST(testClosePartialStillTruncates);
+    CPPUNIT_TEST(testSlowBodyIsPaced);
+    CPPUNIT_TEST(testCorpusFileSent);
+    CPPUNIT_TEST(testCorpusFileWithBehaviors);
+    CPPUNIT_TEST(testCorpusFileRanges);
+    CPPUNIT_TEST(testEncodedBodyWaitsForCompression);
+    CPPUNIT_TEST(testHeaderFlood);
+    CPPUNIT_TEST(testRequestBodyDiscarded);
+    CPPUNIT_TEST(testRequestBodyEchoed);
+    CPPUNIT_TEST(testChunkedRequestBodyEchoed);
+    CPPUNIT_TEST(testBadRequestFraming);
+    CPPUNIT_TEST(testProxyRelaysUpstream);
+    CPPUNIT_TEST(testProxyUnreachable);
+    CPPUNIT_TEST(testScriptedSend);
+    CPPUNIT_TEST(testScriptStopsAfterStatusLine);
+    CPPUNIT_TEST(testSocketTuning);
+    CPPUNIT_TEST(testHandOverParked);
+    CPPUNIT_TEST(testHeadersTooLarge);
+    CPPUNIT_TEST(testMemoryCharged);
+    CPPUNIT_TEST(testReadTimeouts);
+    CPPUNIT_TEST(testOverloadShedding);
+    CPPUNIT_TEST(testRuntimeConfig);
+
     CPPUNIT_TEST_SUITE_END();
 
+private:
+    int client_fd;
+    int server_fd;
+    CompressionCache* compression;  // Collected between passes, as main() does
+
+    // Feed a request to a handler on one end of a socketpair and drive it
+    // until it wants to close, returning everything the client received
+    std::string exchange(ConnectionHandler& handler, const std::string& request) {
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+
+        // Delayed behaviors need a few real milliseconds to complete
+        for (int i = 0; i < 2000 && !handler.shouldClose(); ++i) {
+            if (compression != nullptr) {
+                compression->collect();
+            }
+            handler.onReadable();
+            handler.onWritable();
+            handler.onTimer();
+            if (!handler.shouldClose()) {
+                usleep(1000);
+            }
+        }
+        handler.closeConnection();
+        server_fd = -1;
+
+        std::string received;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        return received;
+    }
+
 public:
-    void setUp() {}
-    void tearDown() {}
+    void setUp() {
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        client_fd = fds[0];
+        server_fd = fds[1];
+        compression = nullptr;
+    }
+
+    void tearDown() {
+        ::close(client_fd);
+        if (server_fd >= 0) {
+            ::close(server_fd);
+        }
+    }
+
+    void testNormalRequest() {
+        ConnectionHandler handler(server_fd);
+        std::string response = exchange(handler, "GET / HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(response.find("\r\n\r\nOK") != std::string::npos);
+    }
+
+    void testOutcomeRecordedFromHeader() {
+        OutcomeRegistry outcomes(64);
+        ServerContext context;
+        context.outcomes = &outcomes;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /?behavior=close_partial&bytes=10 HTTP/1.1\r\n"
+            "x-stitch-id: run1-case7\r\n\r\n");
+
+        CPPUNIT_ASSERT_EQUAL(size_t(10), response.size());
+
+        const OutcomeRecord* record = outcomes.find("run1-case7");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::CLOSE_AFTER_PARTIAL, record->behavior);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10), record->bytes_sent);
+        CPPUNIT_ASSERT(record->response_bytes > 10);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::TRUNCATED, record->close_reason);
+        CPPUNIT_ASSERT(record->first_byte_us >= record->request_us);
+        CPPUNIT_ASSERT(record->close_us >= record->first_byte_us);
+    }
+
+    void testOutcomeRecordedFromQuery() {
+        OutcomeRegistry outcomes(64);
+        ServerContext context;
+        context.outcomes = &outcomes;
+
+        ConnectionHandler handler(server_fd, &context);
+        exchange(handler, "GET /?behavior=close&id=abc HTTP/1.1\r\n\r\n");
+
+        const OutcomeRecord* record = outcomes.find("abc");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), record->bytes_sent);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::BEHAVIOR_CLOSE, record->close_reason);
+        CPPUNIT_ASSERT_EQUAL(int64_t(-1), record->first_byte_us);
+    }
+
+    void testOutcomeLookup() {
+        OutcomeRegistry outcomes(64);
+        OutcomeRecord record;
+        strcpy(record.id, "xyz");
+        record.status_code = 503;
+        record.close_reason = CloseReason::COMPLETED;
+        outcomes.store(record);
+
+        ServerContext context;
+        context.outcomes = &outcomes;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /__stitch/outcome?id=xyz HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(response.find("application/json") != std::string::npos);
+        CPPUNIT_ASSERT(response.find("\"status\":503") != std::string::npos);
+    }
+
+    void testOutcomeLookupUnknownId() {
+        OutcomeRegistry outcomes(64);
+        ServerContext context;
+        context.outcomes = &outcomes;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /__stitch/outcome?id=nope HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 404") == 0);
+    }
+
+    void testScenarioRouteOverridesQuery() {
+        ScenarioRouter router;
+        CPPUNIT_ASSERT(router.loadString(
+            "{\"routes\": [{\"prefix\": \"/flaky\", \"behavior\": \"error\", \"code\": 503}]}"));
+        ServerContext context;
+        context.router = &router;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /flaky/item?behavior=close HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 503") == 0);
+    }
+
+    void testChaosMixForPlainRequests() {
+        ChaosMix mix;
+        CPPUNIT_ASSERT(mix.parse("error=502:1"));
+        Xoshiro256 rng(1);
+        ServerContext context;
+        context.chaos = &mix;
+        context.rng = &rng;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler, "GET / HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 502") == 0);
+    }
+
+    void testChaosQueryParameter() {
+        ConnectionHandler handler(server_fd);
+        std::string response = exchange(handler,
+            "GET /?chaos=error%3D504:1 HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 504") == 0);
+    }
+
+    void testChaosQueryParameterCached() {
+        ChaosMixCache mixes;
+        ServerContext context;
+        context.chaos_mixes = &mixes;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /?chaos=error%3D504:1 HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 504") == 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), mixes.size());
+        CPPUNIT_ASSERT(mixes.get("error=504:1"));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), mixes.size());
+    }
+
+    void testSlowResponseSendsAfterDelay() {
+        ConnectionHandler handler(server_fd);
+        auto start = std::chrono::steady_clock::now();
+        std::string response = exchange(handler, "GET /?behavior=slow&delay=20 HTTP/1.1\r\n\r\n");
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(elapsed >= std::chrono::milliseconds(20));
+    }
+
+    void testSlowResponseDistributionDeadline() {
+        ConnectionHandler handler(server_fd);
+        std::string request = "GET /?behavior=slow&dist=uniform&min=500&max=600 HTTP/1.1\r\n\r\n";
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+
+        auto before = std::chrono::steady_clock::now();
+        handler.onReadable();
+
+        CPPUNIT_ASSERT_EQUAL(ConnectionState::WAITING, handler.getState());
+        auto wait = handler.getDeadline() - before;
+        CPPUNIT_ASSERT(wait >= std::chrono::milliseconds(500));
+        CPPUNIT_ASSERT(wait <= std::chrono::milliseconds(601));
+    }
+
+    void testRecordAndReplay() {
+        char path[] = "/tmp/stitch_recordXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        ::close(fd);
+
+        {
+            TrafficRecorder recorder;
+            CPPUNIT_ASSERT(recorder.open(path));
+            ServerContext context;
+            context.recorder = &recorder;
+
+            ConnectionHandler handler(server_fd, &context);
+            exchange(handler, "GET /?behavior=error&code=418 HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT_EQUAL(uint64_t(1), recorder.count());
+        }
+
+        TrafficReplayer replay;
+        bool opened = replay.open(path);
+        std::remove(path);
+        CPPUNIT_ASSERT(opened);
+
+        ServerContext context;
+        context.replay = &replay;
+
+        // The plain request is answered with the recorded decision
+        tearDown();
+        setUp();
+        ConnectionHandler first(server_fd, &context);
+        CPPUNIT_ASSERT(exchange(first, "GET / HTTP/1.1\r\n\r\n").find("HTTP/1.1 418") == 0);
+
+        // Once the log runs out, requests resolve as usual
+        tearDown();
+        setUp();
+        ConnectionHandler second(server_fd, &context);
+        CPPUNIT_ASSERT(exchange(second, "GET / HTTP/1.1\r\n\r\n").find("HTTP/1.1 200") == 0);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), replay.consumed());
+    }
+
+    void testSyntheticBodyStreams() {
+        // Larger than the socketpair buffer, so sending has to resume
+        ConnectionHandler handler(server_fd);
+        std::string request = "GET /?size=2000000 HTTP/1.1\r\n\r\n";
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+
+        std::string received;
+        char buffer[65536];
+        for (int i = 0; i < 10000 && !handler.shouldClose(); ++i) {
+            handler.onReadable();
+            handler.onWritable();
+            ssize_t n = read(client_fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                received.append(buffer, static_cast<size_t>(n));
+            }
+        }
+        ssize_t n;
+        while ((n = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            received.append(buffer, static_cast<size_t>(n));
+        }
+
+        size_t body_start = received.find("\r\n\r\n") + 4;
+        CPPUNIT_ASSERT(received.find("Content-Length: 2000000\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(size_t(2000000), received.size() - body_start);
+        CPPUNIT_ASSERT_EQUAL(PatternSource::byteAt(1999999), received.back());
+    }
+
+    void testChunkedResponse() {
+        ConnectionHandler handler(server_fd);
+        std::string response = exchange(handler, "GET /?size=20&chunk_size=8 HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT(response.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(response.find("Content-Length") == std::string::npos);
+        std::string body = response.substr(response.find("\r\n\r\n") + 4);
+        CPPUNIT_ASSERT(body.find("8\r\n") == 0);
+        CPPUNIT_ASSERT(body.find("\r\n4\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(body.size() >= 5 && body.compare(body.size() - 5, 5, "0\r\n\r\n") == 0);
+    }
+
+    void testFaultCloseAtOffset() {
+        OutcomeRegistry outcomes(64);
+        ServerContext context;
+        context.outcomes = &outcomes;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /?size=1000&fault=close&fault_at=100&id=f1 HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT_EQUAL(size_t(100), response.size());
+        const OutcomeRecord* record = outcomes.find("f1");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::TRUNCATED, record->close_reason);
+        CPPUNIT_ASSERT(record->response_bytes > 1000);
+    }
+
+    void testFaultCorruptsOneByte() {
+        ConnectionHandler clean_handler(server_fd);
+        std::string clean = exchange(clean_handler, "GET /?size=300 HTTP/1.1\r\n\r\n");
+        size_t offset = clean.find("\r\n\r\n") + 4 + 150;
+
+        tearDown();
+        setUp();
+        ConnectionHandler handler(server_fd);
+        std::string corrupted = exchange(handler,
+            "GET /?size=300&fault=corrupt&fault_at=" + std::to_string(offset) + " HTTP/1.1\r\n\r\n");
+
+        CPPUNIT_ASSERT_EQUAL(clean.size(), corrupted.size());
+        for (size_t i = 0; i < clean.size(); ++i) {
+            if (i == offset) {
+                CPPUNIT_ASSERT(clean[i] != corrupted[i]);
+            } else {
+                CPPUNIT_ASSERT_EQUAL(clean[i], corrupted[i]);
+            }
+        }
+    }
+
+    void testClosePartialStillTruncates() {
+        ConnectionHandler handler(server_fd);
+        std::string response = exchange(handler,
+            "GET /?behavior=close_partial&bytes=10&size=5000 HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 2"), response);
+    }
+
+    void testScriptedSend() {
+        OutcomeRegistry outcomes(64);
+        ScriptCache scripts;
+        ServerContext context;
+        context.outcomes = &outcomes;
+        context.scripts = &scripts;
+
+        // The head, a pause, 2 body bytes, then an abort
+        ConnectionHandler handler(server_fd, &context);
+        auto start = std::chrono::steady_clock::now();
+        std::string response = exchange(handler,
+            "GET /?size=1000&id=s1&script=status,wait:50,headers,body:2,reset HTTP/1.1\r\n\r\n");
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK\r\n") == 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), response.size() - (response.find("\r\n\r\n") + 4));
+        CPPUNIT_ASSERT(elapsed >= std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), scripts.size());
+        const OutcomeRecord* record = outcomes.find("s1");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::RESET, record->close_reason);
+    }
+
+    void testScriptStopsAfterStatusLine() {
+        ConnectionHandler handler(server_fd);
+        std::string response = exchange(handler,
+            "GET /?size=100&script=status,close HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 200 OK\r\n"), response);
+    }
+
+    void testSlowBodyIsPaced() {
+        // 100 bytes/s in 10-byte slices: 20 body bytes take about 100 ms
+        // after the first slice, while the headers go out at once
+        ConnectionHandler handler(server_fd);
+        auto start = std::chrono::steady_clock::now();
+        std::string response = exchange(handler,
+            "GET /?behavior=slow_body&rate=100&size=20 HTTP/1.1\r\n\r\n");
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(20), response.size() - (response.find("\r\n\r\n") + 4));
+        CPPUNIT_ASSERT(elapsed >= std::chrono::milliseconds(100));
+        CPPUNIT_ASSERT(elapsed < std::chrono::milliseconds(1000));
+    }
+
+    // A corpus holding one 5000-byte JSON file; removed again by the caller
+    static std::string makeCorpus(std::string& contents) {
+        char path[] = "/tmp/stitch_corpusXXXXXX";
+        CPPUNIT_ASSERT(mkdtemp(path) != nullptr);
+        contents.clear();
+        for (int i = 0; contents.size() < 5000; ++i) {
+            contents += "{\"n\":" + std::to_string(i) + "}";
+        }
+        contents.resize(5000);
+        std::ofstream(std::string(path) + "/body.json", std::ios::binary) << contents;
+        return path;
+    }
+
+    void testCorpusFileSent() {
+        std::string contents;
+        std::string dir = makeCorpus(contents);
+        Corpus corpus;
+        CPPUNIT_ASSERT(corpus.load(dir));
+        std::remove((dir + "/body.json").c_str());
+        rmdir(dir.c_str());
+
+        ServerContext context;
+        context.corpus = &corpus;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler, "GET /?file=body.json HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(response.find("Content-Type: application/json\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(response.find("Content-Length: 5000\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(contents, response.substr(response.find("\r\n\r\n") + 4));
+
+        tearDown();
+        setUp();
+        ConnectionHandler missing(server_fd, &context);
+        response = exchange(missing, "GET /?file=nope.json HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 404 Not Found") == 0);
+    }
+
+    void testCorpusFileWithBehaviors() {
+        std::string contents;
+        std::string dir = makeCorpus(contents);
+        Corpus corpus;
+        CPPUNIT_ASSERT(corpus.load(dir));
+        std::remove((dir + "/body.json").c_str());
+        rmdir(dir.c_str());
+
+        ServerContext context;
+        context.corpus = &corpus;
+
+        ConnectionHandler partial(server_fd, &context);
+        std::string response = exchange(partial,
+            "GET /?file=body.json&behavior=close_partial&bytes=1000 HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(size_t(1000), response.size());
+        size_t body_start = response.find("\r\n\r\n") + 4;
+        CPPUNIT_ASSERT_EQUAL(contents.substr(0, 1000 - body_start), response.substr(body_start));
+
+        tearDown();
+        setUp();
+        ConnectionHandler wrong(server_fd, &context);
+        response = exchange(wrong, "GET /?file=body.json&behavior=wrong_length HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("Content-Length: 5001\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(contents, response.substr(response.find("\r\n\r\n") + 4));
+
+        tearDown();
+        setUp();
+        ConnectionHandler slow(server_fd, &context);
+        response = exchange(slow,
+            "GET /?file=body.json&behavior=slow_body&rate=50000 HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(contents, response.substr(response.find("\r\n\r\n") + 4));
+    }
+
+    void testCorpusFileRanges() {
+        std::string contents;
+        std::string dir = makeCorpus(contents);
+        Corpus corpus;
+        CPPUNIT_ASSERT(corpus.load(dir));
+        std::remove((dir + "/body.json").c_str());
+        rmdir(dir.c_str());
+
+        ServerContext context;
+        context.corpus = &corpus;
+
+        ConnectionHandler single(server_fd, &context);
+        std::string response = exchange(single,
+            "GET /?file=body.json HTTP/1.1\r\nRange: bytes=4000-\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 206 Partial Content") == 0);
+        CPPUNIT_ASSERT(response.find("Content-Range: bytes 4000-4999/5000\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(contents.substr(4000), response.substr(response.find("\r\n\r\n") + 4));
+
+        tearDown();
+        setUp();
+        ConnectionHandler multi(server_fd, &context);
+        response = exchange(multi,
+            "GET /?file=body.json HTTP/1.1\r\nRange: bytes=10-19,100-109\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("Content-Type: multipart/byteranges") != std::string::npos);
+        std::string first_head = "Content-Range: bytes 10-19/5000\r\n\r\n";
+        std::string second_head = "Content-Range: bytes 100-109/5000\r\n\r\n";
+        size_t first = response.find(first_head);
+        size_t second = response.find(second_head);
+        CPPUNIT_ASSERT(first != std::string::npos && second != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(contents.substr(10, 10), response.substr(first + first_head.size(), 10));
+        CPPUNIT_ASSERT_EQUAL(contents.substr(100, 10),
+                             response.substr(second + second_head.size(), 10));
+
+        // Only GET has range semantics
+        tearDown();
+        setUp();
+        ConnectionHandler post(server_fd, &context);
+        response = exchange(post,
+            "POST /?file=body.json HTTP/1.1\r\nRange: bytes=0-0\r\nContent-Length: 0\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+    }
+
+    void testEncodedBodyWaitsForCompression() {
+        CompressionCache cache(1, 1 << 20);
+        CPPUNIT_ASSERT(cache.start());
+        ServerContext context;
+        context.compression = &cache;
+        compression = &cache;
+
+        ConnectionHandler first(server_fd, &context);
+        std::string response = exchange(first, "GET /?size=20000&encoding=gzip HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(response.find("Content-Encoding: gzip\r\n") != std::string::npos);
+        std::string body = response.substr(response.find("\r\n\r\n") + 4);
+        CPPUNIT_ASSERT_EQUAL(std::string("\x1f\x8b"), body.substr(0, 2));
+        CPPUNIT_ASSERT(response.find("Content-Length: " + std::to_string(body.size()) + "\r\n") !=
+                       std::string::npos);
+
+        // The second request is served from the cache, truncated on the way out
+        tearDown();
+        setUp();
+        compression = &cache;
+        ConnectionHandler second(server_fd, &context);
+        response = exchange(second,
+            "GET /?size=20000&encoding=gzip&encoding_fault=truncate HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(body.substr(0, body.size() / 2),
+                             response.substr(response.find("\r\n\r\n") + 4));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), cache.hits());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), cache.misses());
+    }
+
+    void testHeaderFlood() {
+        ServerContext context;
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /?header_count=500&header_size=100&h.Set-Cookie=a%3D1&duplicate_headers=50 "
+            "HTTP/1.1\r\n\r\n");
+
+        size_t end = response.find("\r\n\r\n");
+        CPPUNIT_ASSERT(end != std::string::npos);
+        std::string head = response.substr(0, end + 2);
+        size_t cookies = 0;
+        for (size_t at = head.find("Set-Cookie: a=1\r\n"); at != std::string::npos;
+             at = head.find("Set-Cookie: a=1\r\n", at + 1)) {
+            cookies++;
+        }
+        CPPUNIT_ASSERT_EQUAL(size_t(50), cookies);
+        CPPUNIT_ASSERT(head.find("X-Stitch-Fill-000499: ") != std::string::npos);
+        CPPUNIT_ASSERT(head.find("X-Stitch-Fill-000500: ") == std::string::npos);
+        CPPUNIT_ASSERT(head.size() > 500 * 124);
+        CPPUNIT_ASSERT_EQUAL(std::string("OK"), response.substr(end + 4));
+    }
+
+    void testRequestBodyDiscarded() {
+        ServerContext context;
+        ConnectionHandler handler(server_fd, &context);
+        std::string body(100000, 'x');
+        std::string response = exchange(handler,
+            "POST /?behavior=error&code=201 HTTP/1.1\r\nExpect: 100-continue\r\n"
+            "Content-Length: 100000\r\n\r\n" + body);
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 ") == 0);
+        CPPUNIT_ASSERT(response.find(body.substr(0, 100)) == std::string::npos);
+    }
+
+    void testRequestBodyEchoed() {
+        ServerContext context;
+        ConnectionHandler handler(server_fd, &context);
+        std::string body;
+        for (int i = 0; i < 5000; ++i) {
+            body += std::to_string(i) + ",";
+        }
+        std::string response = exchange(handler,
+            "POST /?request_body=echo HTTP/1.1\r\nContent-Type: text/csv\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(response.find("Content-Type: text/csv\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(response.find("Content-Length: " + std::to_string(body.size()) + "\r\n") !=
+                       std::string::npos);
+        CPPUNIT_ASSERT(response.substr(response.find("\r\n\r\n") + 4) == body);
+    }
+
+    void testChunkedRequestBodyEchoed() {
+        ServerContext context;
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "POST /?request_body=echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "5;x=y\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+        CPPUNIT_ASSERT(response.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+
+        // However the body was re-chunked, it decodes to the same bytes
+        RequestBody decoder;
+        HttpRequest request;
+        request.headers["transfer-encoding"] = "chunked";
+        CPPUNIT_ASSERT(decoder.begin(request));
+        std::string echoed;
+        std::string chunked = response.substr(response.find("\r\n\r\n") + 4);
+        CPPUNIT_ASSERT_EQUAL(chunked.size(), decoder.feed(chunked.data(), chunked.size(),
+            [&echoed](const char* data, size_t length) { echoed.append(data, length); }));
+        CPPUNIT_ASSERT(decoder.done());
+        CPPUNIT_ASSERT_EQUAL(std::string("hello world"), echoed);
+    }
+
+    void testBadRequestFraming() {
+        ServerContext context;
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\nxxxx");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 400 Bad Request") == 0);
+
+        // A broken chunk is only seen after the outcome has begun
+        tearDown();
+        setUp();
+        OutcomeRegistry outcomes(64);
+        context.outcomes = &outcomes;
+        ConnectionHandler chunked(server_fd, &context);
+        response = exchange(chunked,
+            "POST /?id=bad HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n");
+        CPPUNIT_ASSERT(response.empty());
+        const OutcomeRecord* record = outcomes.find("bad");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::BAD_REQUEST, record->close_reason);
+    }
+
+    // A loopback backend that answers every request head on one kept-alive
+    // connection with the same response, until the proxy hangs up
+    static int listenLoopback(int& port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CPPUNIT_ASSERT_EQUAL(0, bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+        CPPUNIT_ASSERT_EQUAL(0, listen(fd, 8));
+        socklen_t length = sizeof(addr);
+        CPPUNIT_ASSERT_EQUAL(0, getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length));
+        port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    static void serveBackend(int listener, const std::string& response, std::string* requests) {
+        int fd = accept(listener, nullptr, nullptr);
+        std::string pending;
+        char buffer[4096];
+        ssize_t n;
+        while (fd >= 0 && (n = read(fd, buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, static_cast<size_t>(n));
+            size_t end;
+            while ((end = pending.find("\r\n\r\n")) != std::string::npos) {
+                requests->append(pending, 0, end + 4);
+                pending.erase(0, end + 4);
+                if (write(fd, response.data(), response.size()) < 0) {
+                    break;
+                }
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    void testProxyRelaysUpstream() {
+        int port;
+        int listener = listenLoopback(port);
+        std::string requests;
+        std::thread backend(serveBackend, listener,
+                            std::string("HTTP/1.1 201 Created\r\nX-Backend: 1\r\nSet-Cookie: a=1\r\n"
+                                        "Set-Cookie: b=2\r\nContent-Length: 5\r\n\r\nhello"),
+                            &requests);
+
+        UpstreamPool pool;
+        CPPUNIT_ASSERT(pool.configure("127.0.0.1:" + std::to_string(port)));
+        ServerContext context;
+        context.upstream = &pool;
+
+        // The backend's status, headers and body come back; its
+        // connection is kept for the next request
+        for (int i = 0; i < 2; ++i) {
+            ConnectionHandler handler(server_fd, &context);
+            std::string response = exchange(handler,
+                "GET /item HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\n");
+            CPPUNIT_ASSERT(response.find("HTTP/1.1 201 Created\r\n") == 0);
+            CPPUNIT_ASSERT(response.find("Set-Cookie: a=1\r\nSet-Cookie: b=2\r\n") != std::string::npos);
+            CPPUNIT_ASSERT(response.find("Content-Length: 5\r\n") != std::string::npos);
+            CPPUNIT_ASSERT_EQUAL(std::string("hello"), response.substr(response.find("\r\n\r\n") + 4));
+            tearDown();
+            setUp();
+        }
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), pool.connects());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), pool.reuses());
+        CPPUNIT_ASSERT_EQUAL(size_t(1), pool.idle());
+
+        // Behaviors still shape the relayed response
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler,
+            "GET /item?behavior=close_partial&bytes=10 HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 2"), response);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), pool.reuses());
+
+        // Hanging up lets the backend finish
+        pool.discard(pool.acquire());
+        backend.join();
+        ::close(listener);
+        CPPUNIT_ASSERT(requests.find("GET /item HTTP/1.1\r\nHost: x\r\n\r\n") == 0);
+        CPPUNIT_ASSERT(requests.find("Connection: keep-alive") == std::string::npos);
+    }
+
+    void testProxyUnreachable() {
+        // A port that was just free has nothing listening on it
+        int port;
+        int listener = listenLoopback(port);
+        ::close(listener);
+        UpstreamPool pool;
+        CPPUNIT_ASSERT(pool.configure("127.0.0.1:" + std::to_string(port)));
+        OutcomeRegistry outcomes(64);
+        ServerContext context;
+        context.upstream = &pool;
+        context.outcomes = &outcomes;
+
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler, "GET /?id=down HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 502 Bad Gateway") == 0);
+        const OutcomeRecord* record = outcomes.find("down");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(502, record->status_code);
+    }
+
+    // Replaces the socketpair with a loopback TCP connection, so TCP
+    // options can be read back
+    void useTcp() {
+        int port;
+        int listener = listenLoopback(port);
+        ::close(client_fd);
+        if (server_fd >= 0) {
+            ::close(server_fd);
+        }
+        client_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        CPPUNIT_ASSERT_EQUAL(0, connect(client_fd, reinterpret_cast<struct sockaddr*>(&addr),
+                                        sizeof(addr)));
+        server_fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+        CPPUNIT_ASSERT(server_fd >= 0);
+        fcntl(client_fd, F_SETFL, O_NONBLOCK);
+        ::close(listener);
+    }
+
+    int serverOption(int level, int name) {
+        int value = -1;
+        socklen_t length = sizeof(value);
+        CPPUNIT_ASSERT_EQUAL(0, getsockopt(server_fd, level, name, &value, &length));
+        return value;
+    }
+
+    // Sends the request and drives the handler for a while, leaving the
+    // connection open so its options can be inspected
+    void start(ConnectionHandler& handler, const std::string& request) {
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+        for (int i = 0; i < 20 && !handler.shouldClose(); ++i) {
+            handler.onReadable();
+            handler.onWritable();
+            usleep(1000);
+        }
+    }
+
+    void testSocketTuning() {
+        // A cut-off response: small buffers, no Nagle
+        useTcp();
+        {
+            ConnectionHandler handler(server_fd);
+            start(handler, "GET /?size=1000&fault=stall&fault_at=500 HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT(handler.getState() == ConnectionState::WAITING);
+            CPPUNIT_ASSERT_EQUAL(1, serverOption(IPPROTO_TCP, TCP_NODELAY));
+            CPPUNIT_ASSERT_EQUAL(ConnectionHandler::SHAPED_NOTSENT_LOWAT,
+                                 serverOption(IPPROTO_TCP, TCP_NOTSENT_LOWAT));
+            // Linux doubles the request and has a floor of its own
+            CPPUNIT_ASSERT(serverOption(SOL_SOCKET, SO_SNDBUF) <=
+                           4 * ConnectionHandler::SHAPED_SNDBUF);
+            CPPUNIT_ASSERT_EQUAL(0, serverOption(IPPROTO_TCP, TCP_CORK));
+            handler.closeConnection();
+            server_fd = -1;
+        }
+
+        // A fast response is corked while the client is not reading...
+        useTcp();
+        {
+            ConnectionHandler handler(server_fd);
+            start(handler, "GET /?size=100000000 HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT(handler.getState() == ConnectionState::SENDING_RESPONSE);
+            CPPUNIT_ASSERT_EQUAL(1, serverOption(IPPROTO_TCP, TCP_NODELAY));
+            CPPUNIT_ASSERT_EQUAL(1, serverOption(IPPROTO_TCP, TCP_CORK));
+            handler.closeConnection();
+            server_fd = -1;
+        }
+
+        // ...and uncorked once it is all written
+        useTcp();
+        {
+            ConnectionHandler handler(server_fd);
+            start(handler, "GET /?size=10 HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT(handler.shouldClose());
+            CPPUNIT_ASSERT_EQUAL(0, serverOption(IPPROTO_TCP, TCP_CORK));
+            handler.closeConnection();
+            server_fd = -1;
+        }
+
+        // Query overrides win, on fast and shaped responses alike
+        useTcp();
+        {
+            ConnectionHandler handler(server_fd);
+            start(handler, "GET /?size=10&sndbuf=65536&nodelay=0 HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT_EQUAL(0, serverOption(IPPROTO_TCP, TCP_NODELAY));
+            CPPUNIT_ASSERT_EQUAL(0, serverOption(IPPROTO_TCP, TCP_CORK));
+            CPPUNIT_ASSERT(serverOption(SOL_SOCKET, SO_SNDBUF) >= 65536);
+            handler.closeConnection();
+            server_fd = -1;
+        }
+        useTcp();
+        {
+            ConnectionHandler handler(server_fd);
+            start(handler, "GET /?behavior=slow_body&rate=10&sndbuf=65536 HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT(serverOption(SOL_SOCKET, SO_SNDBUF) >= 65536);
+            CPPUNIT_ASSERT_EQUAL(ConnectionHandler::SHAPED_NOTSENT_LOWAT,
+                                 serverOption(IPPROTO_TCP, TCP_NOTSENT_LOWAT));
+            handler.closeConnection();
+            server_fd = -1;
+        }
+    }
+
+    void testHandOverParked() {
+        OutcomeRegistry outcomes(64);
+        ServerContext context;
+        context.outcomes = &outcomes;
+        ConnectionHandler handler(server_fd, &context);
+        CPPUNIT_ASSERT(handler.idle());
+        CPPUNIT_ASSERT(!handler.parked());
+
+        // Half a request can be taken over by nobody
+        std::string request = "GET /?behavior=timeout HTTP/1.1\r\n";
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+        handler.onReadable();
+        CPPUNIT_ASSERT(!handler.idle());
+        CPPUNIT_ASSERT(!handler.parked());
+
+        request = "X-Stitch-Id: parked-1\r\n\r\n";
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+        handler.onReadable();
+        handler.onWritable();
+        handler.onTimer();
+        CPPUNIT_ASSERT(handler.parked());
+
+        // The process taking over holds a copy, so closing ours ends nothing
+        int copy = dup(server_fd);
+        handler.handOver();
+        server_fd = -1;
+        const OutcomeRecord* record = outcomes.find("parked-1");
+        CPPUNIT_ASSERT(record != nullptr);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::HANDED_OVER, record->close_reason);
+        char byte;
+        CPPUNIT_ASSERT(read(client_fd, &byte, 1) < 0 && errno == EAGAIN);
+
+        ConnectionHandler carried(copy);
+        carried.park();
+        carried.onReadable();
+        carried.onWritable();
+        carried.onTimer();
+        CPPUNIT_ASSERT(carried.parked());
+        CPPUNIT_ASSERT(!carried.shouldClose());
+        CPPUNIT_ASSERT(carried.getDeadline() == std::chrono::steady_clock::time_point::max());
+        CPPUNIT_ASSERT(read(client_fd, &byte, 1) < 0 && errno == EAGAIN);
+        carried.closeConnection();
+        CPPUNIT_ASSERT_EQUAL(ssize_t(0), read(client_fd, &byte, 1));
+    }
+
+    void testHeadersTooLarge() {
+        Admission admission(0, 0, 1024);
+        ServerContext context;
+        context.admission = &admission;
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler, "GET / HTTP/1.1\r\nX-Long: " +
+                                                 std::string(2000, 'A') + "\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 431 Request Header Fields Too Large\r\n") == 0);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), admission.rejectedHeaders());
+    }
+
+    void testMemoryCharged() {
+        Admission admission(0, 0, HttpParser::DEFAULT_MAX_HEADER_SIZE);
+        ServerContext context;
+        context.admission = &admission;
+        {
+            ConnectionHandler handler(server_fd, &context);
+            CPPUNIT_ASSERT_EQUAL(size_t(1), admission.connections());
+            CPPUNIT_ASSERT_EQUAL(handler.memoryUsage(), admission.memory());
+            CPPUNIT_ASSERT(admission.memory() >= Admission::CONNECTION_MEMORY);
+
+            // The head so far is charged once the loop updates it
+            std::string head = "GET / HTTP/1.1\r\nX-Long: " + std::string(3000, 'A');
+            CPPUNIT_ASSERT(write(client_fd, head.data(), head.size()) ==
+                           static_cast<ssize_t>(head.size()));
+            handler.onReadable();
+            handler.updateMemory();
+            CPPUNIT_ASSERT(admission.memory() >= Admission::CONNECTION_MEMORY + head.size());
+            CPPUNIT_ASSERT_EQUAL(handler.memoryUsage(), admission.memory());
+        }
+        server_fd = -1;
+        CPPUNIT_ASSERT_EQUAL(size_t(0), admission.connections());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), admission.memory());
+        CPPUNIT_ASSERT(admission.peakMemory() >= Admission::CONNECTION_MEMORY + 3000);
+
+        // Usage and high-water marks are served as JSON
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ::close(client_fd);
+        client_fd = fds[0];
+        server_fd = fds[1];
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler, "GET /__stitch/usage HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK\r\n") == 0);
+        CPPUNIT_ASSERT(response.find("Content-Type: application/json") != std::string::npos);
+        CPPUNIT_ASSERT(response.find("{\"connections\":1,\"peak_connections\":1,") !=
+                       std::string::npos);
+    }
+
+    void testReadTimeouts() {
+        using std::chrono::seconds;
+        Timeouts timeouts(seconds(10), seconds(10), seconds(10));
+        ServerContext context;
+        context.timeouts = &timeouts;
+        auto later = [] { return std::chrono::steady_clock::now() + seconds(11); };
+
+        // Nothing sent: closed without an answer
+        {
+            ConnectionHandler handler(server_fd, &context);
+            handler.onReadable();
+            CPPUNIT_ASSERT(timeouts.nextDeadline() < later());
+            CPPUNIT_ASSERT_EQUAL(size_t(1), timeouts.expire(later()));
+            handler.onTimer();
+            CPPUNIT_ASSERT(handler.shouldClose());
+            CPPUNIT_ASSERT(exchange(handler, "").empty());
+        }
+
+        // Half a head, or half a body: 408
+        const char* partial[] = {
+            "GET / HTTP/1.1\r\nHost: exa",
+            "POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\n0123456789"
+        };
+        for (const char* request : partial) {
+            int fds[2];
+            CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+            ::close(client_fd);
+            client_fd = fds[0];
+            server_fd = fds[1];
+            ConnectionHandler handler(server_fd, &context);
+            CPPUNIT_ASSERT(write(client_fd, request, strlen(request)) ==
+                           static_cast<ssize_t>(strlen(request)));
+            handler.onReadable();
+            CPPUNIT_ASSERT(!handler.shouldClose());
+            CPPUNIT_ASSERT_EQUAL(size_t(1), timeouts.expire(later()));
+            std::string response = exchange(handler, "");
+            CPPUNIT_ASSERT(response.find("HTTP/1.1 408 Request Timeout\r\n") == 0);
+        }
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), timeouts.expired(TimeoutCause::IDLE));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), timeouts.expired(TimeoutCause::HEADER));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), timeouts.expired(TimeoutCause::BODY));
+
+        // A complete request is off the clock while its behavior runs
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ::close(client_fd);
+        client_fd = fds[0];
+        server_fd = fds[1];
+        ConnectionHandler handler(server_fd, &context);
+        std::string request = "GET /?behavior=timeout HTTP/1.1\r\n\r\n";
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+        handler.onReadable();
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == std::chrono::steady_clock::time_point::max());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), timeouts.expire(later()));
+        handler.closeConnection();
+        server_fd = -1;
+    }
+
+    void testOverloadShedding() {
+        Overload overload;
+        CPPUNIT_ASSERT(overload.parse("inflight=1,retry_after=3"));
+        ServerContext context;
+        context.overload = &overload;
+
+        // Holds the only slot while it waits out its delay
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        auto holder = std::make_unique<ConnectionHandler>(fds[1], &context);
+        std::string slow = "GET /?behavior=timeout HTTP/1.1\r\n\r\n";
+        CPPUNIT_ASSERT(write(fds[0], slow.data(), slow.size()) == static_cast<ssize_t>(slow.size()));
+        holder->onReadable();
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), overload.inFlight());
+
+        {
+            ConnectionHandler handler(server_fd, &context);
+            std::string response = exchange(handler, "GET /?behavior=normal HTTP/1.1\r\n\r\n");
+            CPPUNIT_ASSERT(response.find("HTTP/1.1 503 Service Unavailable\r\n") == 0);
+            CPPUNIT_ASSERT(response.find("Retry-After: 3\r\n") != std::string::npos);
+        }
+
+        // Closing frees the slot
+        holder.reset();
+        ::close(fds[0]);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), overload.inFlight());
+
+        // Past the rate: 429, here without Retry-After
+        CPPUNIT_ASSERT(overload.parse("rate=1,retry_after=0"));
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ::close(client_fd);
+        client_fd = fds[0];
+        server_fd = fds[1];
+        ConnectionHandler handler(server_fd, &context);
+        std::string response = exchange(handler, "GET / HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 429 Too Many Requests\r\n") == 0);
+        CPPUNIT_ASSERT(response.find("Retry-After") == std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), overload.inFlight());
+    }
+
+    void testRuntimeConfig() {
+        auto initial = std::make_unique<ConfigSnapshot>();
+        auto router = std::make_shared<ScenarioRouter>();
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": [{\"prefix\": \"/a\", \"behavior\": \"error\", \"code\": 418}]}"));
+        initial->router = router;
+        initial->has_default = true;
+        initial->default_command.behavior = BehaviorType::ERROR_RESPONSE;
+        initial->default_command.status_code = 503;
+        RuntimeConfig config(std::move(initial));
+        ServerContext context;
+        context.config = &config;
+
+        // Resolved against generation 1, which a swap must not free while
+        // the connection is open
+        auto handler = std::make_unique<ConnectionHandler>(server_fd, &context);
+        std::string request = "GET /a HTTP/1.1\r\n\r\n";
+        CPPUNIT_ASSERT(write(client_fd, request.data(), request.size()) ==
+                       static_cast<ssize_t>(request.size()));
+        handler->onReadable();
+        config.publish(std::make_unique<ConfigSnapshot>());
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(0), config.reclaim());
+        std::string response = exchange(*handler, "");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 418 ") == 0);
+        handler.reset();
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(1), config.reclaim());
+
+        // Generation 2 has neither route nor default
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ::close(client_fd);
+        client_fd = fds[0];
+        server_fd = fds[1];
+        ConnectionHandler plain(server_fd, &context);
+        response = exchange(plain, "GET /a HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK") == 0);
+
+        // A listener's own scenario still wins over the snapshot's
+        auto next = std::make_unique<ConfigSnapshot>();
+        next->has_default = true;
+        next->default_command.behavior = BehaviorType::ERROR_RESPONSE;
+        next->default_command.status_code = 503;
+        config.publish(std::move(next));
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ::close(client_fd);
+        client_fd = fds[0];
+        server_fd = fds[1];
+        context.router = router.get();
+        ConnectionHandler routed(server_fd, &context);
+        response = exchange(routed, "GET /b HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 503 ") == 0);
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(ConnectionHandlerTest);
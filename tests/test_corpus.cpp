@@ -0,0 +1,92 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "corpus.h"
+
+class CorpusTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(CorpusTest);
+
+    CPPUNIT_TEST(testLoadIndexesNestedFiles);
+    CPPUNIT_TEST(testFileDescriptorsStayUsable);
+    CPPUNIT_TEST(testContentTypes);
+    CPPUNIT_TEST(testMissingDirectory);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    std::string dir;
+
+    void writeFile(const std::string& name, const std::string& contents) {
+        std::ofstream file(dir + "/" + name, std::ios::binary);
+        file << contents;
+    }
+
+public:
+    void setUp() {
+        char path[] = "/tmp/stitch_corpusXXXXXX";
+        CPPUNIT_ASSERT(mkdtemp(path) != nullptr);
+        dir = path;
+        CPPUNIT_ASSERT_EQUAL(0, mkdir((dir + "/api").c_str(), 0755));
+        writeFile("index.html", "<html></html>");
+        writeFile("api/users.json", "[{\"id\":1}]");
+    }
+
+    void tearDown() {
+        std::remove((dir + "/api/users.json").c_str());
+        std::remove((dir + "/index.html").c_str());
+        rmdir((dir + "/api").c_str());
+        rmdir(dir.c_str());
+    }
+
+    void testLoadIndexesNestedFiles() {
+        Corpus corpus;
+        CPPUNIT_ASSERT(corpus.load(dir));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), corpus.size());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(23), corpus.totalBytes());
+
+        const CorpusFile* file = corpus.find("api/users.json");
+        CPPUNIT_ASSERT(file != nullptr);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10), file->size);
+        CPPUNIT_ASSERT_EQUAL(std::string("application/json"), std::string(file->content_type));
+
+        CPPUNIT_ASSERT(corpus.find("users.json") == nullptr);
+        CPPUNIT_ASSERT(corpus.find("api") == nullptr);
+    }
+
+    void testFileDescriptorsStayUsable() {
+        Corpus corpus;
+        CPPUNIT_ASSERT(corpus.load(dir));
+
+        // Removing the file does not affect requests; the descriptor was
+        // opened up front
+        std::remove((dir + "/index.html").c_str());
+        const CorpusFile* file = corpus.find("index.html");
+        CPPUNIT_ASSERT(file != nullptr);
+
+        char buffer[32];
+        ssize_t n = pread(file->fd, buffer, sizeof(buffer), 0);
+        CPPUNIT_ASSERT_EQUAL(std::string("<html></html>"),
+                             std::string(buffer, static_cast<size_t>(n)));
+    }
+
+    void testContentTypes() {
+        CPPUNIT_ASSERT_EQUAL(std::string("image/jpeg"), std::string(Corpus::contentTypeFor("a/b.JPG")));
+        CPPUNIT_ASSERT_EQUAL(std::string("video/mp2t"), std::string(Corpus::contentTypeFor("seg1.ts")));
+        CPPUNIT_ASSERT_EQUAL(std::string("application/octet-stream"),
+                             std::string(Corpus::contentTypeFor("v1.2/blob")));
+        CPPUNIT_ASSERT_EQUAL(std::string("application/octet-stream"),
+                             std::string(Corpus::contentTypeFor("README")));
+    }
+
+    void testMissingDirectory() {
+        Corpus corpus;
+        CPPUNIT_ASSERT(!corpus.load(dir + "/nonexistent"));
+        CPPUNIT_ASSERT(corpus.getErrorMessage().find("Cannot open corpus directory") == 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), corpus.size());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CorpusTest);
@@ -0,0 +1,342 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <thread>
+#include "handover.h"
+#include "socket_manager.h"
+
+class HandoverTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(HandoverTest);
+
+    CPPUNIT_TEST(testNobodyToTakeOver);
+    CPPUNIT_TEST(testTakeOver);
+    CPPUNIT_TEST(testTakeOverAgain);
+    CPPUNIT_TEST(testNoConfirm);
+    CPPUNIT_TEST(testSilentPeerDoesNotBlock);
+    CPPUNIT_TEST(testSecondPeerDuringExchange);
+    CPPUNIT_TEST(testActivatedSockets);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    std::string path_;
+
+    // Steps old's side of the exchange, the way the event loop does,
+    // until it reaches one of the stages given
+    static Handover::Stage runUntil(Handover& old, std::initializer_list<Handover::Stage> stages) {
+        while (true) {
+            Handover::Stage stage = old.step(std::chrono::steady_clock::now());
+            for (Handover::Stage wanted : stages) {
+                if (stage == wanted) {
+                    return stage;
+                }
+            }
+            struct pollfd ready;
+            ready.fd = old.getChannelFd();
+            ready.events = POLLIN;
+            poll(&ready, 1, 10);
+        }
+    }
+
+    // Waits for a new process to connect to old's control socket and ask
+    static void awaitRequest(Handover& old, bool& connections) {
+        struct pollfd ready;
+        ready.fd = old.getFd();
+        ready.events = POLLIN;
+        CPPUNIT_ASSERT_EQUAL(1, poll(&ready, 1, Handover::TIMEOUT_MS));
+        CPPUNIT_ASSERT_MESSAGE(old.getErrorMessage(), old.accept(std::chrono::steady_clock::now()));
+        CPPUNIT_ASSERT(runUntil(old, {Handover::Stage::OFFER, Handover::Stage::FAILED}) ==
+                       Handover::Stage::OFFER);
+        connections = old.wantsConnections();
+    }
+
+    // Hands sockets over and steps until the new process confirms or not
+    static bool handOver(Handover& old, const std::vector<Handover::Socket>& sockets) {
+        CPPUNIT_ASSERT_MESSAGE(old.getErrorMessage(), old.handOver(sockets));
+        return runUntil(old, {Handover::Stage::DONE, Handover::Stage::FAILED}) ==
+               Handover::Stage::DONE;
+    }
+
+public:
+    void setUp() {
+        path_ = "/tmp/stitch_handover_" + std::to_string(getpid()) + ".sock";
+        unlink(path_.c_str());
+    }
+
+    void tearDown() {
+        unlink(path_.c_str());
+    }
+
+    void testNobodyToTakeOver() {
+        Handover first;
+        std::vector<Handover::Socket> sockets;
+        CPPUNIT_ASSERT(first.takeOver(path_, true, sockets));
+        CPPUNIT_ASSERT(sockets.empty());
+        CPPUNIT_ASSERT(first.peer() == 0);
+        CPPUNIT_ASSERT(first.confirm());
+
+        // A file left by a stitch that is gone: nobody to take over from,
+        // and serving the path replaces it
+        int stale = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path_.data(), path_.length());
+        CPPUNIT_ASSERT_EQUAL(0, bind(stale, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+        close(stale);
+        CPPUNIT_ASSERT(first.takeOver(path_, true, sockets));
+        CPPUNIT_ASSERT(sockets.empty());
+        CPPUNIT_ASSERT_MESSAGE(first.getErrorMessage(), first.serve(path_));
+        CPPUNIT_ASSERT(first.getFd() >= 0);
+
+        // Nobody asking
+        CPPUNIT_ASSERT(!first.accept(std::chrono::steady_clock::now()));
+        CPPUNIT_ASSERT(first.getErrorMessage().empty());
+        CPPUNIT_ASSERT(first.step(std::chrono::steady_clock::now()) == Handover::Stage::IDLE);
+        CPPUNIT_ASSERT(!first.handOver({}));
+
+        first.close();
+        struct stat status;
+        CPPUNIT_ASSERT(stat(path_.c_str(), &status) != 0);
+    }
+
+    void testTakeOver() {
+        SocketManager listeners;
+        ListenAddress address;
+        std::string error;
+        CPPUNIT_ASSERT(ListenAddress::parse("127.0.0.1:0", address, error));
+        CPPUNIT_ASSERT(listeners.bind(address));
+        CPPUNIT_ASSERT(listeners.listen());
+        CPPUNIT_ASSERT(ListenAddress::fromSocket(listeners.getListenFd(), address, error));
+        int pair[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+
+        Handover old;
+        CPPUNIT_ASSERT(old.serve(path_));
+
+        Handover replacement;
+        std::vector<Handover::Socket> sockets;
+        bool taken = false;
+        std::thread newProcess([&] {
+            taken = replacement.takeOver(path_, true, sockets) && replacement.confirm();
+        });
+
+        bool connections = false;
+        awaitRequest(old, connections);
+        CPPUNIT_ASSERT(connections);
+        CPPUNIT_ASSERT_EQUAL(getpid(), old.peer());
+        std::vector<Handover::Socket> given = {
+            {Handover::Kind::CONTROL, old.getFd(), path_},
+            {Handover::Kind::LISTENER, listeners.getListenFd(), address.toString()},
+            {Handover::Kind::PARKED, pair[1], "127.0.0.1:8080"}
+        };
+        CPPUNIT_ASSERT_MESSAGE(old.getErrorMessage(), handOver(old, given));
+        newProcess.join();
+        CPPUNIT_ASSERT_MESSAGE(replacement.getErrorMessage(), taken);
+
+        CPPUNIT_ASSERT_EQUAL(size_t(3), sockets.size());
+        for (size_t i = 0; i < sockets.size(); i++) {
+            CPPUNIT_ASSERT(sockets[i].kind == given[i].kind);
+            CPPUNIT_ASSERT_EQUAL(given[i].address, sockets[i].address);
+            CPPUNIT_ASSERT(sockets[i].fd >= 0 && sockets[i].fd != given[i].fd);
+        }
+
+        // The copies are the same sockets: the old ones can go
+        old.release();
+        listeners.releaseListeners();
+        close(pair[1]);
+        CPPUNIT_ASSERT_EQUAL(ssize_t(2), write(pair[0], "ok", 2));
+        char buffer[2];
+        CPPUNIT_ASSERT_EQUAL(ssize_t(2), read(sockets[2].fd, buffer, 2));
+
+        SocketManager adopted;
+        CPPUNIT_ASSERT(adopted.adopt(sockets[1].fd, true));
+        struct sockaddr_in v4;
+        memset(&v4, 0, sizeof(v4));
+        v4.sin_family = AF_INET;
+        v4.sin_port = htons(static_cast<uint16_t>(address.port));
+        v4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        CPPUNIT_ASSERT_EQUAL(0, connect(client, reinterpret_cast<struct sockaddr*>(&v4), sizeof(v4)));
+        int accepted = adopted.acceptConnection();
+        CPPUNIT_ASSERT(accepted >= 0);
+        close(accepted);
+        close(client);
+
+        close(sockets[0].fd);
+        close(sockets[2].fd);
+        close(pair[0]);
+    }
+
+    void testTakeOverAgain() {
+        Handover first;
+        CPPUNIT_ASSERT(first.serve(path_));
+
+        // The second takes the control socket, and serves it in turn
+        Handover second;
+        std::vector<Handover::Socket> sockets;
+        std::thread secondProcess([&] {
+            second.takeOver(path_, false, sockets);
+            second.confirm();
+        });
+        bool connections = true;
+        awaitRequest(first, connections);
+        CPPUNIT_ASSERT(!connections);
+        CPPUNIT_ASSERT(handOver(first, {{Handover::Kind::CONTROL, first.getFd(), path_}}));
+        secondProcess.join();
+        first.release();
+        CPPUNIT_ASSERT_EQUAL(size_t(1), sockets.size());
+        CPPUNIT_ASSERT(sockets[0].kind == Handover::Kind::CONTROL);
+        CPPUNIT_ASSERT(second.serve(path_, sockets[0].fd));
+
+        Handover third;
+        std::vector<Handover::Socket> none;
+        bool taken = false;
+        std::thread thirdProcess([&] {
+            taken = third.takeOver(path_, true, none) && third.confirm();
+        });
+        awaitRequest(second, connections);
+        CPPUNIT_ASSERT(handOver(second, {}));
+        thirdProcess.join();
+        CPPUNIT_ASSERT(taken);
+        CPPUNIT_ASSERT(none.empty());
+        CPPUNIT_ASSERT_EQUAL(getpid(), third.peer());
+    }
+
+    void testNoConfirm() {
+        Handover old;
+        CPPUNIT_ASSERT(old.serve(path_));
+        int pair[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+
+        // A new process that gives up before it is ready
+        std::thread newProcess([&] {
+            Handover replacement;
+            std::vector<Handover::Socket> sockets;
+            replacement.takeOver(path_, true, sockets);
+            for (const Handover::Socket& socket : sockets) {
+                close(socket.fd);
+            }
+        });
+        bool connections;
+        awaitRequest(old, connections);
+        CPPUNIT_ASSERT(!handOver(old, {{Handover::Kind::IDLE, pair[1], "127.0.0.1:8080"}}));
+        CPPUNIT_ASSERT(!old.getErrorMessage().empty());
+        newProcess.join();
+
+        // Nothing was given up
+        CPPUNIT_ASSERT(old.getFd() >= 0);
+        CPPUNIT_ASSERT_EQUAL(ssize_t(2), write(pair[1], "ok", 2));
+        close(pair[0]);
+        close(pair[1]);
+    }
+
+    void testSilentPeerDoesNotBlock() {
+        Handover old;
+        CPPUNIT_ASSERT(old.serve(path_));
+
+        // Connects and says nothing
+        int silent = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path_.data(), path_.length());
+        CPPUNIT_ASSERT_EQUAL(0, connect(silent, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+
+        auto start = std::chrono::steady_clock::now();
+        CPPUNIT_ASSERT(old.accept(start));
+        CPPUNIT_ASSERT(old.getChannelFd() >= 0);
+        CPPUNIT_ASSERT(old.step(start) == Handover::Stage::REQUEST);
+        CPPUNIT_ASSERT(old.step(start + std::chrono::milliseconds(Handover::TIMEOUT_MS - 1)) ==
+                       Handover::Stage::REQUEST);
+        CPPUNIT_ASSERT(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+
+        // Only one exchange at a time, and this one runs out of time
+        CPPUNIT_ASSERT(!old.accept(start));
+        CPPUNIT_ASSERT(old.step(start + std::chrono::milliseconds(Handover::TIMEOUT_MS)) ==
+                       Handover::Stage::FAILED);
+        CPPUNIT_ASSERT(!old.getErrorMessage().empty());
+        CPPUNIT_ASSERT(old.getChannelFd() < 0);
+        CPPUNIT_ASSERT(old.step(start) == Handover::Stage::IDLE);
+        char byte;
+        CPPUNIT_ASSERT_EQUAL(ssize_t(0), read(silent, &byte, 1));
+        close(silent);
+
+        // A request that makes no sense fails at once
+        int confused = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        CPPUNIT_ASSERT_EQUAL(0, connect(confused, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+        CPPUNIT_ASSERT_EQUAL(ssize_t(5), write(confused, "HELLO", 5));
+        CPPUNIT_ASSERT(old.accept(std::chrono::steady_clock::now()));
+        CPPUNIT_ASSERT(old.step(std::chrono::steady_clock::now()) == Handover::Stage::FAILED);
+        CPPUNIT_ASSERT(old.getErrorMessage().find("Unexpected upgrade request") == 0);
+        close(confused);
+    }
+
+    void testSecondPeerDuringExchange() {
+        Handover old;
+        CPPUNIT_ASSERT(old.serve(path_));
+        SocketManager loop;
+        CPPUNIT_ASSERT(loop.initEpoll());
+        CPPUNIT_ASSERT(loop.addToEpoll(old.getFd(), EPOLLIN));
+
+        Handover first;
+        std::vector<Handover::Socket> none;
+        std::thread firstProcess([&] {
+            first.takeOver(path_, false, none);
+            first.confirm();
+        });
+        CPPUNIT_ASSERT_EQUAL(1, loop.waitForEvents(Handover::TIMEOUT_MS));
+        CPPUNIT_ASSERT(old.accept(std::chrono::steady_clock::now()));
+        CPPUNIT_ASSERT(runUntil(old, {Handover::Stage::OFFER, Handover::Stage::FAILED}) ==
+                       Handover::Stage::OFFER);
+
+        // A second one asks while the first is under way; the control
+        // socket is edge-triggered, so this is the only wakeup it gets
+        Handover second;
+        std::vector<Handover::Socket> more;
+        bool taken = false;
+        std::thread secondProcess([&] {
+            taken = second.takeOver(path_, false, more) && second.confirm();
+        });
+        CPPUNIT_ASSERT_EQUAL(1, loop.waitForEvents(Handover::TIMEOUT_MS));
+        CPPUNIT_ASSERT(!old.accept(std::chrono::steady_clock::now()));
+        CPPUNIT_ASSERT(handOver(old, {}));
+        firstProcess.join();
+
+        // Nothing else arrives, and a round with no events still finds it
+        CPPUNIT_ASSERT_EQUAL(0, loop.waitForEvents(100));
+        CPPUNIT_ASSERT_MESSAGE(old.getErrorMessage(), old.accept(std::chrono::steady_clock::now()));
+        CPPUNIT_ASSERT(runUntil(old, {Handover::Stage::OFFER, Handover::Stage::FAILED}) ==
+                       Handover::Stage::OFFER);
+        CPPUNIT_ASSERT(handOver(old, {}));
+        secondProcess.join();
+        CPPUNIT_ASSERT_MESSAGE(second.getErrorMessage(), taken);
+    }
+
+    void testActivatedSockets() {
+        // Meant for another process
+        setenv("LISTEN_PID", std::to_string(getpid() + 1).c_str(), 1);
+        setenv("LISTEN_FDS", "2", 1);
+        setenv("LISTEN_FDNAMES", "http:https", 1);
+        CPPUNIT_ASSERT(Handover::activatedSockets().empty());
+        CPPUNIT_ASSERT(getenv("LISTEN_PID") == nullptr);
+        CPPUNIT_ASSERT(getenv("LISTEN_FDS") == nullptr);
+        CPPUNIT_ASSERT(getenv("LISTEN_FDNAMES") == nullptr);
+
+        setenv("LISTEN_PID", std::to_string(getpid()).c_str(), 1);
+        setenv("LISTEN_FDS", "0", 1);
+        CPPUNIT_ASSERT(Handover::activatedSockets().empty());
+        CPPUNIT_ASSERT(Handover::activatedSockets().empty());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(HandoverTest);
@@ -1,5 +1,6 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cstring>
+#include <algorithm>
 #include "http_parser.h"
 
 class HttpParserTest : public CppUnit::TestFixture {
@@ -9,6 +10,7 @@ class HttpParserTest : public CppUnit::TestFixture {
     CPPUNIT_TEST(testSimpleGetRequest);
     CPPUNIT_TEST(testGetRequestWithHeaders);
     CPPUNIT_TEST(testPostRequest);
+    CPPUNIT_TEST(testBodyAfterHeaders);
 
     // Query parameter tests
     CPPUNIT_TEST(testQueryParameterExtraction);
@@ -26,6 +28,7 @@ class HttpParserTest : public CppUnit::TestFixture {
     CPPUNIT_TEST(testMalformedHeaders);
     CPPUNIT_TEST(testEmptyRequest);
     CPPUNIT_TEST(testVeryLongHeaders);
+    CPPUNIT_TEST(testHeadersTooLarge);
 
     // HTTP version tests
     CPPUNIT_TEST(testHttp10Request);
@@ -94,6 +97,20 @@ public:
         const HttpRequest& req = parser->getRequest();
         CPPUNIT_ASSERT_EQUAL(std::string("POST"), req.method);
         CPPUNIT_ASSERT_EQUAL(std::string("/api/data"), req.path);
+        CPPUNIT_ASSERT_EQUAL(strlen(request), parser->getHeaderLength());
+    }
+
+    void testBodyAfterHeaders() {
+        const char* request =
+            "POST / HTTP/1.1\r\n"
+            "Content-Length: 5\r\n"
+            "\r\n"
+            "hel";
+
+        CPPUNIT_ASSERT_EQUAL(HttpParser::ParseResult::COMPLETE,
+                             parser->parse(request, strlen(request)));
+        const std::string& raw = parser->getRawData();
+        CPPUNIT_ASSERT_EQUAL(std::string("hel"), raw.substr(parser->getHeaderLength()));
     }
 
     void testQueryParameterExtraction() {
@@ -205,6 +222,43 @@ public:
                        result == HttpParser::ParseResult::ERROR);
     }
 
+    void testHeadersTooLarge() {
+        std::string request = "GET / HTTP/1.1\r\nX-Long-Header: " + std::string(100, 'A') + "\r\n\r\n";
+
+        // Up to the limit, the blank line included, and a body after it
+        parser->setMaxHeaderSize(request.length());
+        std::string with_body = request + std::string(500, 'B');
+        CPPUNIT_ASSERT_EQUAL(HttpParser::ParseResult::COMPLETE,
+                             parser->parse(with_body.c_str(), with_body.length()));
+
+        // One byte more, whether it comes at once or a little at a time
+        parser->reset();
+        parser->setMaxHeaderSize(request.length() - 1);
+        CPPUNIT_ASSERT_EQUAL(HttpParser::ParseResult::TOO_LARGE,
+                             parser->parse(request.c_str(), request.length()));
+        CPPUNIT_ASSERT(!parser->getErrorMessage().empty());
+
+        // Without the blank line yet: refused as soon as there is too much
+        parser->reset();
+        parser->setMaxHeaderSize(100);
+        HttpParser::ParseResult result = HttpParser::ParseResult::INCOMPLETE;
+        size_t fed = 0;
+        while (result == HttpParser::ParseResult::INCOMPLETE && fed < request.length()) {
+            size_t length = std::min<size_t>(10, request.length() - fed);
+            result = parser->parse(request.c_str() + fed, length);
+            fed += length;
+        }
+        CPPUNIT_ASSERT_EQUAL(HttpParser::ParseResult::TOO_LARGE, result);
+        CPPUNIT_ASSERT_EQUAL(size_t(110), fed);
+
+        // Nothing more is taken until a reset, which gives the buffer back
+        CPPUNIT_ASSERT_EQUAL(HttpParser::ParseResult::TOO_LARGE, parser->parse("\r\n\r\n", 4));
+        parser->reset();
+        CPPUNIT_ASSERT(parser->getRawData().capacity() < 100);
+        CPPUNIT_ASSERT_EQUAL(HttpParser::ParseResult::COMPLETE,
+                             parser->parse("GET / HTTP/1.1\r\n\r\n", 18));
+    }
+
     void testHttp10Request() {
         const char* request = "GET / HTTP/1.0\r\n\r\n";
         HttpParser::ParseResult result = parser->parse(request, strlen(request));
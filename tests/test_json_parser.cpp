@@ -0,0 +1,87 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include "json_parser.h"
+
+class JsonParserTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(JsonParserTest);
+
+    CPPUNIT_TEST(testScalars);
+    CPPUNIT_TEST(testObjectOrderPreserved);
+    CPPUNIT_TEST(testNestedArray);
+    CPPUNIT_TEST(testStringEscapes);
+    CPPUNIT_TEST(testNumberKeepsTokenText);
+    CPPUNIT_TEST(testSyntaxErrors);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    JsonParser* parser;
+
+public:
+    void setUp() {
+        parser = new JsonParser();
+    }
+
+    void tearDown() {
+        delete parser;
+    }
+
+    void testScalars() {
+        JsonValue value;
+        CPPUNIT_ASSERT(parser->parse("true", value));
+        CPPUNIT_ASSERT_EQUAL(JsonValue::Type::BOOLEAN, value.type);
+        CPPUNIT_ASSERT(value.boolean);
+
+        CPPUNIT_ASSERT(parser->parse("  null ", value));
+        CPPUNIT_ASSERT_EQUAL(JsonValue::Type::NUL, value.type);
+
+        CPPUNIT_ASSERT(parser->parse("\"text\"", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("text"), value.string);
+    }
+
+    void testObjectOrderPreserved() {
+        JsonValue value;
+        CPPUNIT_ASSERT(parser->parse("{\"b\": 1, \"a\": \"x\"}", value));
+        CPPUNIT_ASSERT(value.isObject());
+        CPPUNIT_ASSERT_EQUAL(size_t(2), value.object.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("b"), value.object[0].first);
+        CPPUNIT_ASSERT_EQUAL(std::string("a"), value.object[1].first);
+        CPPUNIT_ASSERT(value.get("a") != nullptr);
+        CPPUNIT_ASSERT(value.get("missing") == nullptr);
+    }
+
+    void testNestedArray() {
+        JsonValue value;
+        CPPUNIT_ASSERT(parser->parse("{\"routes\": [{\"p\": [1, 2]}, {}]}", value));
+        const JsonValue* routes = value.get("routes");
+        CPPUNIT_ASSERT(routes != nullptr);
+        CPPUNIT_ASSERT(routes->isArray());
+        CPPUNIT_ASSERT_EQUAL(size_t(2), routes->array.size());
+        CPPUNIT_ASSERT_EQUAL(size_t(2), routes->array[0].get("p")->array.size());
+    }
+
+    void testStringEscapes() {
+        JsonValue value;
+        CPPUNIT_ASSERT(parser->parse("\"a\\\"b\\n\\u0041\"", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("a\"b\nA"), value.string);
+    }
+
+    void testNumberKeepsTokenText() {
+        JsonValue value;
+        CPPUNIT_ASSERT(parser->parse("503", value));
+        CPPUNIT_ASSERT(value.isNumber());
+        CPPUNIT_ASSERT_EQUAL(std::string("503"), value.toParamString());
+        CPPUNIT_ASSERT(value.number == 503.0);
+    }
+
+    void testSyntaxErrors() {
+        JsonValue value;
+        CPPUNIT_ASSERT(!parser->parse("{\"a\": }", value));
+        CPPUNIT_ASSERT(!parser->getErrorMessage().empty());
+        CPPUNIT_ASSERT(!parser->parse("[1, 2", value));
+        CPPUNIT_ASSERT(!parser->parse("\"unterminated", value));
+        CPPUNIT_ASSERT(!parser->parse("{} extra", value));
+        CPPUNIT_ASSERT(!parser->parse("", value));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(JsonParserTest);
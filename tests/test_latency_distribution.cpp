@@ -0,0 +1,144 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "latency_distribution.h"
+
+class LatencyDistributionTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LatencyDistributionTest);
+
+    CPPUNIT_TEST(testUniformBounds);
+    CPPUNIT_TEST(testNormalQuantiles);
+    CPPUNIT_TEST(testLognormalMedian);
+    CPPUNIT_TEST(testParetoTail);
+    CPPUNIT_TEST(testClampToMax);
+    CPPUNIT_TEST(testEmpiricalHistogram);
+    CPPUNIT_TEST(testInvalidParameters);
+    CPPUNIT_TEST(testSamplesReproducible);
+    CPPUNIT_TEST(testCacheReusesTables);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static std::shared_ptr<const LatencyDistribution> make(
+        const std::map<std::string, std::string>& params) {
+        std::string error;
+        return LatencyDistribution::create(params, nullptr, error);
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testUniformBounds() {
+        auto dist = make({{"dist", "uniform"}, {"min", "10"}, {"max", "20"}});
+        CPPUNIT_ASSERT(dist != nullptr);
+
+        Xoshiro256 rng(1);
+        for (int i = 0; i < 10000; ++i) {
+            int64_t us = dist->sampleUs(rng);
+            CPPUNIT_ASSERT(us >= 10000 && us <= 20000);
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(15000.0, dist->quantileUs(0.5), 1.0);
+    }
+
+    void testNormalQuantiles() {
+        auto dist = make({{"dist", "normal"}, {"mean", "100"}, {"stddev", "10"}});
+        CPPUNIT_ASSERT(dist != nullptr);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(100000.0, dist->quantileUs(0.5), 10.0);
+        // z(0.99) = 2.3263, z(0.999) = 3.0902
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(123263.0, dist->quantileUs(0.99), 50.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(130902.0, dist->quantileUs(0.999), 50.0);
+    }
+
+    void testLognormalMedian() {
+        auto dist = make({{"dist", "lognormal"}, {"median", "20"}, {"sigma", "0.5"}});
+        CPPUNIT_ASSERT(dist != nullptr);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(20000.0, dist->quantileUs(0.5), 20.0);
+        // median * exp(sigma * z(0.99))
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(20000.0 * std::exp(0.5 * 2.3263), dist->quantileUs(0.99), 100.0);
+    }
+
+    void testParetoTail() {
+        auto dist = make({{"dist", "pareto"}, {"scale", "1"}, {"shape", "1.5"}});
+        CPPUNIT_ASSERT(dist != nullptr);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1000.0, dist->quantileUs(0.0), 0.001);
+        // scale / (1 - p)^(1/shape), p999 sits inside the tail table
+        double expected = 1000.0 / std::pow(0.001, 1.0 / 1.5);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, dist->quantileUs(0.999), expected * 0.01);
+    }
+
+    void testClampToMax() {
+        auto dist = make({{"dist", "pareto"}, {"scale", "1"}, {"shape", "0.5"}, {"max", "50"}});
+        CPPUNIT_ASSERT(dist != nullptr);
+
+        Xoshiro256 rng(9);
+        for (int i = 0; i < 10000; ++i) {
+            CPPUNIT_ASSERT(dist->sampleUs(rng) <= 50000);
+        }
+    }
+
+    void testEmpiricalHistogram() {
+        char path[] = "/tmp/stitch_histXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+        {
+            std::ofstream file(path);
+            file << "# upper_ms count\n10 50\n20 0\n100 50\n";
+        }
+
+        LatencyDistributionCache cache;
+        bool loaded = cache.addHistogram("api", path);
+        std::remove(path);
+        CPPUNIT_ASSERT(loaded);
+
+        std::string error;
+        auto dist = cache.get({{"dist", "empirical"}, {"hist", "api"}}, error);
+        CPPUNIT_ASSERT(dist != nullptr);
+
+        // Half the mass is in (0, 10], the other half in (20, 100]
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(5000.0, dist->quantileUs(0.25), 5.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(60000.0, dist->quantileUs(0.75), 50.0);
+        CPPUNIT_ASSERT(!cache.addHistogram("missing", "/nonexistent/hist.txt"));
+    }
+
+    void testInvalidParameters() {
+        CPPUNIT_ASSERT(make({{"dist", "bogus"}}) == nullptr);
+        CPPUNIT_ASSERT(make({{"dist", "uniform"}, {"min", "5"}}) == nullptr);
+        CPPUNIT_ASSERT(make({{"dist", "normal"}, {"mean", "5"}}) == nullptr);
+        CPPUNIT_ASSERT(make({{"dist", "lognormal"}, {"median", "0"}, {"sigma", "1"}}) == nullptr);
+        CPPUNIT_ASSERT(make({{"dist", "pareto"}, {"scale", "1"}, {"shape", "x"}}) == nullptr);
+        CPPUNIT_ASSERT(make({{"dist", "empirical"}, {"hist", "none"}}) == nullptr);
+    }
+
+    void testSamplesReproducible() {
+        auto dist = make({{"dist", "lognormal"}, {"median", "5"}, {"sigma", "1"}});
+        Xoshiro256 first(77);
+        Xoshiro256 second(77);
+        for (int i = 0; i < 1000; ++i) {
+            CPPUNIT_ASSERT_EQUAL(dist->sampleUs(first), dist->sampleUs(second));
+        }
+    }
+
+    void testCacheReusesTables() {
+        LatencyDistributionCache cache;
+        std::string error;
+        std::map<std::string, std::string> params = {
+            {"behavior", "slow"}, {"dist", "uniform"}, {"min", "1"}, {"max", "2"}};
+
+        auto first = cache.get(params, error);
+        params["id"] = "unrelated";
+        auto second = cache.get(params, error);
+
+        CPPUNIT_ASSERT(first != nullptr);
+        CPPUNIT_ASSERT(first.get() == second.get());
+        CPPUNIT_ASSERT_EQUAL(size_t(1), cache.size());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(LatencyDistributionTest);
@@ -0,0 +1,107 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstring>
+#include "outcome_registry.h"
+
+class OutcomeRegistryTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(OutcomeRegistryTest);
+
+    CPPUNIT_TEST(testStoreAndFind);
+    CPPUNIT_TEST(testUnknownId);
+    CPPUNIT_TEST(testUpdateSameId);
+    CPPUNIT_TEST(testCapacityRoundsToPowerOfTwo);
+    CPPUNIT_TEST(testOldestRecordIsOverwritten);
+    CPPUNIT_TEST(testIdValidation);
+    CPPUNIT_TEST(testJsonFormat);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static OutcomeRecord makeRecord(const std::string& id) {
+        OutcomeRecord record;
+        strncpy(record.id, id.c_str(), OutcomeRecord::MAX_ID_LENGTH);
+        record.id[OutcomeRecord::MAX_ID_LENGTH] = '\0';
+        return record;
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testStoreAndFind() {
+        OutcomeRegistry registry(64);
+        OutcomeRecord record = makeRecord("req-1");
+        record.behavior = BehaviorType::CLOSE_AFTER_PARTIAL;
+        record.bytes_sent = 100;
+        registry.store(record);
+
+        const OutcomeRecord* found = registry.find("req-1");
+        CPPUNIT_ASSERT(found != nullptr);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::CLOSE_AFTER_PARTIAL, found->behavior);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100), found->bytes_sent);
+    }
+
+    void testUnknownId() {
+        OutcomeRegistry registry(64);
+        CPPUNIT_ASSERT(registry.find("missing") == nullptr);
+        CPPUNIT_ASSERT(registry.find("") == nullptr);
+    }
+
+    void testUpdateSameId() {
+        OutcomeRegistry registry(64);
+        OutcomeRecord record = makeRecord("req-1");
+        registry.store(record);
+
+        record.close_reason = CloseReason::COMPLETED;
+        record.bytes_sent = 42;
+        registry.store(record);
+
+        const OutcomeRecord* found = registry.find("req-1");
+        CPPUNIT_ASSERT(found != nullptr);
+        CPPUNIT_ASSERT_EQUAL(CloseReason::COMPLETED, found->close_reason);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(42), found->bytes_sent);
+    }
+
+    void testCapacityRoundsToPowerOfTwo() {
+        OutcomeRegistry registry(100);
+        CPPUNIT_ASSERT_EQUAL(size_t(128), registry.capacity());
+    }
+
+    void testOldestRecordIsOverwritten() {
+        // With the minimum table size every id shares one probe window,
+        // so storing one more id than fits must evict the first one
+        OutcomeRegistry registry(1);
+        size_t capacity = registry.capacity();
+
+        for (size_t i = 0; i <= capacity; ++i) {
+            registry.store(makeRecord("id-" + std::to_string(i)));
+        }
+
+        CPPUNIT_ASSERT(registry.find("id-0") == nullptr);
+        CPPUNIT_ASSERT(registry.find("id-" + std::to_string(capacity)) != nullptr);
+        CPPUNIT_ASSERT(registry.find("id-1") != nullptr);
+    }
+
+    void testIdValidation() {
+        CPPUNIT_ASSERT(OutcomeRegistry::isValidId("run-42.case_7:a"));
+        CPPUNIT_ASSERT(!OutcomeRegistry::isValidId(""));
+        CPPUNIT_ASSERT(!OutcomeRegistry::isValidId("has space"));
+        CPPUNIT_ASSERT(!OutcomeRegistry::isValidId("quote\""));
+        CPPUNIT_ASSERT(!OutcomeRegistry::isValidId(std::string(65, 'a')));
+    }
+
+    void testJsonFormat() {
+        OutcomeRecord record = makeRecord("abc");
+        record.behavior = BehaviorType::ERROR_RESPONSE;
+        record.status_code = 502;
+        record.close_reason = CloseReason::TRUNCATED;
+
+        std::string json = OutcomeRegistry::toJson(record);
+        CPPUNIT_ASSERT(json.find("\"id\":\"abc\"") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"behavior\":\"error\"") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"status\":502") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"close_reason\":\"truncated\"") != std::string::npos);
+        CPPUNIT_ASSERT(json.find("\"state\":\"closed\"") != std::string::npos);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(OutcomeRegistryTest);
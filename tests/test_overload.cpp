@@ -0,0 +1,120 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include "overload.h"
+
+class OverloadTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(OverloadTest);
+
+    CPPUNIT_TEST(testParse);
+    CPPUNIT_TEST(testParseErrors);
+    CPPUNIT_TEST(testInFlightLimit);
+    CPPUNIT_TEST(testRateWindowSlides);
+    CPPUNIT_TEST(testShortWindow);
+    CPPUNIT_TEST(testStallAndReset);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    using Clock = std::chrono::steady_clock;
+    using ms = std::chrono::milliseconds;
+
+public:
+    void testParse() {
+        Overload overload;
+        CPPUNIT_ASSERT(overload.parse("inflight=2, rate=100,window=500,action=stall,retry_after=0"));
+        CPPUNIT_ASSERT(overload.action() == Overload::Action::STALL);
+        CPPUNIT_ASSERT_EQUAL(0, overload.retryAfter());
+
+        CPPUNIT_ASSERT(overload.parse("rate=10"));
+        CPPUNIT_ASSERT(overload.action() == Overload::Action::REJECT);
+        CPPUNIT_ASSERT_EQUAL(1, overload.retryAfter());
+    }
+
+    void testParseErrors() {
+        Overload overload;
+        const char* bad[] = {
+            "", "inflight=0", "rate=-1", "rate=ten", "burst=5",
+            "rate=5,action=drop", "rate=5,window=5", "rate=5,window=19", "rate=5,retry_after=100000"
+        };
+        for (const char* spec : bad) {
+            CPPUNIT_ASSERT_MESSAGE(spec, !overload.parse(spec));
+            CPPUNIT_ASSERT(!overload.getErrorMessage().empty());
+        }
+    }
+
+    void testInFlightLimit() {
+        Overload overload;
+        CPPUNIT_ASSERT(overload.parse("inflight=2"));
+        Clock::time_point now = Clock::now();
+
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::UNAVAILABLE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), overload.inFlight());
+
+        overload.finish();
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), overload.served());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), overload.shed(Overload::Verdict::UNAVAILABLE));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), overload.peakInFlight());
+
+        // Without action=reset connections are never turned away at accept
+        CPPUNIT_ASSERT(!overload.resetsConnection(now));
+    }
+
+    void testRateWindowSlides() {
+        Overload overload;
+        CPPUNIT_ASSERT(overload.parse("rate=5,window=1000"));
+        Clock::time_point now = Clock::now();
+
+        for (int i = 0; i < 5; i++) {
+            CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+            overload.finish();
+        }
+        CPPUNIT_ASSERT(overload.admit(now + ms(500)) == Overload::Verdict::TOO_MANY);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(6), overload.windowRequests());
+
+        // Once the first five slide out only the rejected one is left
+        CPPUNIT_ASSERT(overload.admit(now + ms(1100)) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), overload.windowRequests());
+
+        // A long gap empties the whole window
+        overload.admit(now + ms(60000));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), overload.windowRequests());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(6), overload.peakRate());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), overload.shed(Overload::Verdict::TOO_MANY));
+    }
+
+    void testShortWindow() {
+        // 100 per second over 20 ms is two requests, not two per bucket slice
+        Overload overload;
+        CPPUNIT_ASSERT(overload.parse("rate=100,window=20"));
+        Clock::time_point now = Clock::now();
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::TOO_MANY);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(150), overload.peakRate());
+
+        CPPUNIT_ASSERT(overload.admit(now + ms(40)) == Overload::Verdict::SERVE);
+    }
+
+    void testStallAndReset() {
+        Overload overload;
+        CPPUNIT_ASSERT(overload.parse("inflight=1,action=stall"));
+        Clock::time_point now = Clock::now();
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT(overload.admit(now) == Overload::Verdict::STALL);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), overload.shed(Overload::Verdict::STALL));
+
+        Overload reset;
+        CPPUNIT_ASSERT(reset.parse("inflight=1,action=reset"));
+        CPPUNIT_ASSERT(!reset.resetsConnection(now));
+        CPPUNIT_ASSERT(reset.admit(now) == Overload::Verdict::SERVE);
+        CPPUNIT_ASSERT(reset.resetsConnection(now));
+        CPPUNIT_ASSERT(reset.admit(now) == Overload::Verdict::RESET);
+        reset.finish();
+        CPPUNIT_ASSERT(!reset.resetsConnection(now));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), reset.connectionsReset());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), reset.shed(Overload::Verdict::RESET));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(OverloadTest);
@@ -0,0 +1,277 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstring>
+#include "request_body.h"
+
+class RequestBodyTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(RequestBodyTest);
+
+    CPPUNIT_TEST(testNoBody);
+    CPPUNIT_TEST(testContentLength);
+    CPPUNIT_TEST(testChunked);
+    CPPUNIT_TEST(testChunkedByteAtATime);
+    CPPUNIT_TEST(testChunkedFraming);
+    CPPUNIT_TEST(testBadFraming);
+    CPPUNIT_TEST(testResponseFraming);
+    CPPUNIT_TEST(testPipeDiscard);
+    CPPUNIT_TEST(testEchoLength);
+    CPPUNIT_TEST(testEchoChunked);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static HttpRequest request(const std::string& name, const std::string& value) {
+        HttpRequest req;
+        req.method = "POST";
+        req.path = "/";
+        req.http_version = "HTTP/1.1";
+        req.headers[name] = value;
+        return req;
+    }
+
+    // Feeds everything at once and returns the body data
+    static std::string decode(RequestBody& body, const std::string& stream, size_t* used = nullptr) {
+        std::string data;
+        size_t n = body.feed(stream.data(), stream.size(), [&data](const char* bytes, size_t length) {
+            data.append(bytes, length);
+        });
+        if (used != nullptr) {
+            *used = n;
+        }
+        return data;
+    }
+
+    // Sends everything source produces through a socketpair, splicing pipe
+    // bytes the way ConnectionHandler does
+    static std::string drain(ResponseSource& source) {
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        while (!source.done() && !source.blocked()) {
+            int pipe_fd;
+            size_t length;
+            ssize_t n;
+            if (source.peekPipe(pipe_fd, length, SIZE_MAX)) {
+                n = splice(pipe_fd, nullptr, fds[1], nullptr, length, SPLICE_F_NONBLOCK);
+            } else {
+                struct iovec segments[ResponseSource::MAX_SEGMENTS];
+                size_t count = source.peek(segments, ResponseSource::MAX_SEGMENTS, SIZE_MAX);
+                CPPUNIT_ASSERT(count > 0);
+                n = writev(fds[1], segments, static_cast<int>(count));
+            }
+            CPPUNIT_ASSERT(n > 0);
+            source.consume(static_cast<size_t>(n));
+        }
+        std::string received;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return received;
+    }
+
+    // Puts bytes into pipe the way the handler does: socket to pipe
+    static void arrive(BodyPipe& pipe, RequestBody& body, const std::string& data) {
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        CPPUNIT_ASSERT(write(fds[0], data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+        CPPUNIT_ASSERT(pipe.open());
+        size_t moved = 0;
+        while (moved < data.size()) {
+            ssize_t n = pipe.fill(fds[1], data.size() - moved);
+            CPPUNIT_ASSERT(n > 0);
+            moved += static_cast<size_t>(n);
+        }
+        body.consumeData(moved);
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testNoBody() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(HttpRequest()));
+        CPPUNIT_ASSERT(body.framing() == RequestBody::Framing::NONE);
+        CPPUNIT_ASSERT(body.done());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), body.dataAvailable());
+    }
+
+    void testContentLength() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("content-length", " 10 ")));
+        CPPUNIT_ASSERT(body.framing() == RequestBody::Framing::LENGTH);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10), body.length());
+
+        size_t used = 0;
+        CPPUNIT_ASSERT_EQUAL(std::string("0123"), decode(body, "0123", &used));
+        CPPUNIT_ASSERT(!body.done());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(6), body.dataAvailable());
+
+        // Bytes after the body are not taken
+        CPPUNIT_ASSERT_EQUAL(std::string("456789"), decode(body, "456789GET", &used));
+        CPPUNIT_ASSERT_EQUAL(size_t(6), used);
+        CPPUNIT_ASSERT(body.done());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10), body.received());
+    }
+
+    void testChunked() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("Transfer-Encoding", "gzip, Chunked")));
+        CPPUNIT_ASSERT(body.framing() == RequestBody::Framing::CHUNKED);
+        CPPUNIT_ASSERT_EQUAL(ResponseSource::UNKNOWN_LENGTH, body.length());
+
+        std::string stream = "5;name=value\r\nhello\r\n"
+                             "A\r\n0123456789\r\n"
+                             "0\r\nX-Trailer: 1\r\n\r\n"
+                             "next";
+        size_t used = 0;
+        CPPUNIT_ASSERT_EQUAL(std::string("hello0123456789"), decode(body, stream, &used));
+        CPPUNIT_ASSERT(body.done());
+        CPPUNIT_ASSERT_EQUAL(stream.size() - 4, used);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(15), body.received());
+    }
+
+    void testChunkedByteAtATime() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("Transfer-Encoding", "chunked")));
+        std::string stream = "3\r\nabc\r\n1\r\nd\r\n0\r\n\r\n";
+        std::string data;
+        for (char c : stream) {
+            data += decode(body, std::string(1, c));
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("abcd"), data);
+        CPPUNIT_ASSERT(body.done());
+    }
+
+    void testChunkedFraming() {
+        // parseFraming stops at data, so data can be moved elsewhere
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("Transfer-Encoding", "chunked")));
+        std::string stream = "10\r\n";
+        CPPUNIT_ASSERT_EQUAL(size_t(4), body.parseFraming(stream.data(), stream.size()));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(16), body.dataAvailable());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), body.parseFraming("xx", 2));
+        body.consumeData(16);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), body.dataAvailable());
+
+        std::string rest = "\r\n0\r\n\r\n";
+        CPPUNIT_ASSERT_EQUAL(rest.size(), body.parseFraming(rest.data(), rest.size()));
+        CPPUNIT_ASSERT(body.done());
+        CPPUNIT_ASSERT(!body.failed());
+    }
+
+    void testBadFraming() {
+        RequestBody body;
+        CPPUNIT_ASSERT(!body.begin(request("Transfer-Encoding", "chunked, gzip")));
+        CPPUNIT_ASSERT(!body.getErrorMessage().empty());
+        CPPUNIT_ASSERT(!body.begin(request("Content-Length", "12a")));
+        CPPUNIT_ASSERT(!body.begin(request("Content-Length", "-1")));
+
+        for (const char* stream : {"x\r\n", "5\r\nhelloX", "\r\n", "5\rX",
+                                   "fffffffffffffffff\r\n"}) {
+            CPPUNIT_ASSERT(body.begin(request("Transfer-Encoding", "chunked")));
+            decode(body, stream);
+            CPPUNIT_ASSERT(body.failed());
+            CPPUNIT_ASSERT(!body.done());
+        }
+
+        // A size line that never ends
+        CPPUNIT_ASSERT(body.begin(request("Transfer-Encoding", "chunked")));
+        decode(body, "1;" + std::string(RequestBody::MAX_LINE, 'x'));
+        CPPUNIT_ASSERT(body.failed());
+    }
+
+    void testResponseFraming() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.beginResponse(200, true, "", "10"));
+        CPPUNIT_ASSERT(body.framing() == RequestBody::Framing::NONE);
+        CPPUNIT_ASSERT(body.beginResponse(304, false, "chunked", ""));
+        CPPUNIT_ASSERT(body.done());
+        CPPUNIT_ASSERT(body.beginResponse(200, false, "chunked", "10"));
+        CPPUNIT_ASSERT(body.framing() == RequestBody::Framing::CHUNKED);
+
+        // Without a length the body runs until the connection closes
+        for (const char* transfer : {"", "gzip"}) {
+            CPPUNIT_ASSERT(body.beginResponse(200, false, transfer, ""));
+            CPPUNIT_ASSERT(body.framing() == RequestBody::Framing::CLOSE);
+            CPPUNIT_ASSERT_EQUAL(ResponseSource::UNKNOWN_LENGTH, body.length());
+            CPPUNIT_ASSERT_EQUAL(std::string("anything"), decode(body, "anything"));
+            CPPUNIT_ASSERT(!body.done());
+            body.finish();
+            CPPUNIT_ASSERT(body.done());
+            CPPUNIT_ASSERT(!body.failed());
+        }
+
+        // A length the stream does not reach is a failure
+        CPPUNIT_ASSERT(body.beginResponse(200, false, "", "10"));
+        decode(body, "short");
+        body.finish();
+        CPPUNIT_ASSERT(body.failed());
+        CPPUNIT_ASSERT(!body.beginResponse(200, false, "", "ten"));
+    }
+
+    void testPipeDiscard() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("Content-Length", "100000")));
+        BodyPipe pipe;
+        arrive(pipe, body, std::string(100000, 'x'));
+        CPPUNIT_ASSERT_EQUAL(size_t(100000), pipe.buffered());
+        CPPUNIT_ASSERT(pipe.discard());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), pipe.buffered());
+        CPPUNIT_ASSERT(body.done());
+    }
+
+    void testEchoLength() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("Content-Length", "10")));
+        decode(body, "0123");
+        BodyPipe pipe;
+        EchoSource echo("0123", &body, &pipe);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(10), echo.length());
+
+        // What arrived goes out; then the source waits for the rest
+        CPPUNIT_ASSERT_EQUAL(std::string("0123"), drain(echo));
+        CPPUNIT_ASSERT(echo.blocked());
+        arrive(pipe, body, "456789");
+        CPPUNIT_ASSERT(!echo.blocked());
+        CPPUNIT_ASSERT_EQUAL(std::string("456789"), drain(echo));
+        CPPUNIT_ASSERT(echo.done());
+    }
+
+    void testEchoChunked() {
+        RequestBody body;
+        CPPUNIT_ASSERT(body.begin(request("Transfer-Encoding", "chunked")));
+        decode(body, "3\r\nabc\r\n4\r\n");
+        BodyPipe pipe;
+        EchoSource echo("abc", &body, &pipe);
+        CPPUNIT_ASSERT_EQUAL(ResponseSource::UNKNOWN_LENGTH, echo.length());
+
+        // Each chunk is what had arrived; the last one waits for the body to end
+        CPPUNIT_ASSERT_EQUAL(std::string("3\r\nabc\r\n"), drain(echo));
+        arrive(pipe, body, "defg");
+        CPPUNIT_ASSERT_EQUAL(std::string("4\r\ndefg\r\n"), drain(echo));
+        CPPUNIT_ASSERT(echo.blocked());
+        decode(body, "\r\n0\r\n\r\n");
+        CPPUNIT_ASSERT_EQUAL(std::string("0\r\n\r\n"), drain(echo));
+        CPPUNIT_ASSERT(echo.done());
+
+        // Behind the response head, as the handler sends it
+        RequestBody empty;
+        CPPUNIT_ASSERT(empty.begin(request("Transfer-Encoding", "chunked")));
+        decode(empty, "0\r\n\r\n");
+        ConcatSource response;
+        response.append(std::make_unique<StringSource>("HEAD\r\n\r\n"));
+        response.append(std::make_unique<EchoSource>("", &empty, &pipe));
+        CPPUNIT_ASSERT_EQUAL(std::string("HEAD\r\n\r\n0\r\n\r\n"), drain(response));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RequestBodyTest);
@@ -0,0 +1,114 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <set>
+#include "request_cases.h"
+#include "http_parser.h"
+
+class RequestCasesTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(RequestCasesTest);
+
+    CPPUNIT_TEST(testSerialize);
+    CPPUNIT_TEST(testValidCaseParses);
+    CPPUNIT_TEST(testCatalogShapes);
+    CPPUNIT_TEST(testDripCases);
+    CPPUNIT_TEST(testSelect);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static const RequestCase& find(const std::vector<RequestCase>& cases, const std::string& name) {
+        for (const RequestCase& request_case : cases) {
+            if (request_case.name == name) {
+                return request_case;
+            }
+        }
+        CPPUNIT_FAIL("No case " + name);
+        return cases.front();
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testSerialize() {
+        RequestTemplate request = RequestTemplate::get("example.com", "/a?b=1");
+        CPPUNIT_ASSERT_EQUAL(std::string("GET /a?b=1 HTTP/1.1\r\nHost: example.com\r\n"
+                                         "User-Agent: stitch-client\r\n\r\n"),
+                             request.serialize());
+
+        request.version.clear();
+        request.line_end = "\n";
+        request.headers.clear();
+        request.body = "x";
+        CPPUNIT_ASSERT_EQUAL(std::string("GET /a?b=1\n\nx"), request.serialize());
+    }
+
+    void testValidCaseParses() {
+        std::vector<RequestCase> cases = RequestCases::catalog("example.com", "/p");
+        const RequestCase& valid = find(cases, "valid");
+        HttpParser parser;
+        CPPUNIT_ASSERT(parser.parse(valid.bytes.data(), valid.bytes.size()) ==
+                       HttpParser::ParseResult::COMPLETE);
+        CPPUNIT_ASSERT_EQUAL(std::string("/p"), parser.getRequest().path);
+        CPPUNIT_ASSERT_EQUAL(std::string("example.com"), parser.getRequest().getHeader("Host"));
+    }
+
+    void testCatalogShapes() {
+        std::vector<RequestCase> cases = RequestCases::catalog("h", "/", 1000);
+        std::set<std::string> names;
+        for (const RequestCase& request_case : cases) {
+            CPPUNIT_ASSERT(names.insert(request_case.name).second);
+            CPPUNIT_ASSERT(!request_case.summary.empty());
+        }
+
+        CPPUNIT_ASSERT(find(cases, "bad_method").bytes.find("G@T / HTTP/1.1\r\n") == 0);
+        CPPUNIT_ASSERT(find(cases, "missing_version").bytes.find("GET /\r\n") == 0);
+        CPPUNIT_ASSERT(find(cases, "extra_spaces").bytes.find("GET   / HTTP/1.1\r\n") == 0);
+        CPPUNIT_ASSERT(find(cases, "oversized_uri").bytes.size() > 1000);
+        CPPUNIT_ASSERT(find(cases, "oversized_header").bytes.size() > 1000);
+        CPPUNIT_ASSERT(find(cases, "bare_cr").bytes.find("a\rX-Injected: 1\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(find(cases, "nul_in_header").bytes.find(std::string("a\0b", 3)) !=
+                       std::string::npos);
+        CPPUNIT_ASSERT(find(cases, "missing_host").bytes.find("Host:") == std::string::npos);
+
+        const std::string& cl_te = find(cases, "cl_te").bytes;
+        CPPUNIT_ASSERT(cl_te.find("Content-Length: 6\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\nG") !=
+                       std::string::npos);
+        const std::string& duplicate_cl = find(cases, "duplicate_cl").bytes;
+        CPPUNIT_ASSERT(duplicate_cl.find("Content-Length: 5\r\nContent-Length: 6\r\n") !=
+                       std::string::npos);
+
+        // Every complete request ends its head, whatever else is wrong
+        for (const RequestCase& request_case : cases) {
+            CPPUNIT_ASSERT(request_case.drip ||
+                           request_case.bytes.find("\r\n\r\n") != std::string::npos);
+        }
+    }
+
+    void testDripCases() {
+        std::vector<RequestCase> cases = RequestCases::catalog("h", "/");
+        const RequestCase& slowloris = find(cases, "slowloris");
+        CPPUNIT_ASSERT(slowloris.drip);
+        CPPUNIT_ASSERT(slowloris.bytes.find("\r\n\r\n") == std::string::npos);
+        CPPUNIT_ASSERT(!slowloris.drip_repeat.empty());
+
+        const RequestCase& slow_post = find(cases, "slow_post");
+        CPPUNIT_ASSERT(slow_post.drip);
+        CPPUNIT_ASSERT(slow_post.bytes.find("\r\n\r\n") == slow_post.bytes.size() - 4);
+    }
+
+    void testSelect() {
+        std::vector<RequestCase> all = RequestCases::catalog("h", "/");
+        std::vector<RequestCase> selected;
+        std::string error;
+        CPPUNIT_ASSERT(RequestCases::select(all, "cl_te,valid", selected, error));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), selected.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("cl_te"), selected[0].name);
+        CPPUNIT_ASSERT_EQUAL(std::string("valid"), selected[1].name);
+
+        CPPUNIT_ASSERT(!RequestCases::select(all, "valid,nope", selected, error));
+        CPPUNIT_ASSERT(error.find("nope") != std::string::npos);
+        CPPUNIT_ASSERT(!RequestCases::select(all, ",", selected, error));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RequestCasesTest);
@@ -30,6 +30,20 @@ class ResponseGeneratorTest : public CppUnit::TestFixture {
     CPPUNIT_TEST(testStatusLineFormat);
     CPPUNIT_TEST(testHeaderFormat);
     CPPUNIT_TEST(testResponseTermination);
+    CPPUNIT_TEST(testSyntheticBodyHeaders);
+    CPPUNIT_TEST(testSeededBodyAdvertisesPattern);
+    CPPUNIT_TEST(testChunkedSerialization);
+
+    // Range requests
+    CPPUNIT_TEST(testSingleRange);
+    CPPUNIT_TEST(testMultipleRanges);
+    CPPUNIT_TEST(testUnsatisfiableRange);
+    CPPUNIT_TEST(testRangeFaults);
+
+    // Content-Encoding
+    CPPUNIT_TEST(testEncodedBody);
+    CPPUNIT_TEST(testEncodingFaults);
+    CPPUNIT_TEST(testHeaderFlood);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -154,7 +168,9 @@ public:
         CPPUNIT_ASSERT(response.malform_chunking);
 
         std::string serialized = generator->serialize(response);
-        CPPUNIT_ASSERT(!serialized.empty());
+        CPPUNIT_ASSERT(serialized.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find("\r\n\r\ng17\r\nMalformed chunking test\r\n") !=
+                       std::string::npos);
     }
 
     void testGenerateFromErrorCommand() {
@@ -215,6 +231,232 @@ public:
         // Response should have \r\n\r\n between headers and body
         CPPUNIT_ASSERT(serialized.find("\r\n\r\n") != std::string::npos);
     }
+
+    void testSyntheticBodyHeaders() {
+        TestCommand cmd;
+        cmd.body_size = uint64_t(1) << 40;
+
+        HttpResponse response = generator->generate(cmd);
+        std::string head = generator->serializeHead(response);
+
+        CPPUNIT_ASSERT(head.find("Content-Length: 1099511627776\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(head.size() >= 4 && head.compare(head.size() - 4, 4, "\r\n\r\n") == 0);
+        CPPUNIT_ASSERT(generator->streamBody(response)->length() == cmd.body_size);
+    }
+
+    void testSeededBodyAdvertisesPattern() {
+        TestCommand cmd;
+        cmd.body_size = 1000;
+        cmd.body_seeded = true;
+        cmd.body_seed = 42;
+
+        std::string serialized = generator->serialize(generator->generate(cmd));
+        CPPUNIT_ASSERT(serialized.find("X-Stitch-Pattern: seed=42; offset=0; length=1000\r\n") !=
+                       std::string::npos);
+
+        std::string body = serialized.substr(serialized.find("\r\n\r\n") + 4);
+        PatternVerifier verifier(42);
+        CPPUNIT_ASSERT(verifier.update(body.data(), body.size()));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1000), verifier.bytesChecked());
+    }
+
+    void testChunkedSerialization() {
+        TestCommand cmd;
+        cmd.chunks.parseSizes("1");
+
+        std::string serialized = generator->serialize(generator->generate(cmd));
+        CPPUNIT_ASSERT(serialized.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find("\r\n\r\n1\r\nO\r\n1\r\nK\r\n0\r\n\r\n") !=
+                       std::string::npos);
+    }
+
+    static std::string bodyOf(const std::string& serialized) {
+        return serialized.substr(serialized.find("\r\n\r\n") + 4);
+    }
+
+    static std::string patternBytes(uint64_t seed, uint64_t offset, size_t length) {
+        std::string bytes(length, '\0');
+        BodyPattern(seed).fill(offset, &bytes[0], length);
+        return bytes;
+    }
+
+    void testSingleRange() {
+        TestCommand cmd;
+        cmd.body_size = uint64_t(1) << 40;
+        cmd.body_seeded = true;
+        cmd.body_seed = 5;
+
+        // Far into a body that is never generated in full
+        HttpResponse response = generator->generate(cmd, "bytes=1000000000-1000000099");
+        std::string serialized = generator->serialize(response);
+        CPPUNIT_ASSERT_EQUAL(206, response.status_code);
+        CPPUNIT_ASSERT(serialized.find("HTTP/1.1 206 Partial Content\r\n") == 0);
+        CPPUNIT_ASSERT(serialized.find(
+            "Content-Range: bytes 1000000000-1000000099/1099511627776\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find("Content-Length: 100\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find(
+            "X-Stitch-Pattern: seed=5; offset=1000000000; length=100\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(bodyOf(serialized) == patternBytes(5, 1000000000, 100));
+
+        // Without a Range header the body says it can be asked for in parts
+        std::string full = generator->serializeHead(generator->generate(cmd));
+        CPPUNIT_ASSERT(full.find("Accept-Ranges: bytes\r\n") != std::string::npos);
+    }
+
+    void testMultipleRanges() {
+        TestCommand cmd;
+        cmd.body_size = 1000;
+        cmd.body_seeded = true;
+        cmd.body_seed = 9;
+
+        HttpResponse response = generator->generate(cmd, "bytes=0-9,-5");
+        std::string serialized = generator->serialize(response);
+        std::string boundary = "STITCH_BYTERANGES_5f3a9c1e";
+        std::string expected =
+            "--" + boundary + "\r\nContent-Type: application/octet-stream\r\n"
+            "Content-Range: bytes 0-9/1000\r\n\r\n" + patternBytes(9, 0, 10) +
+            "\r\n--" + boundary + "\r\nContent-Type: application/octet-stream\r\n"
+            "Content-Range: bytes 995-999/1000\r\n\r\n" + patternBytes(9, 995, 5) +
+            "\r\n--" + boundary + "--\r\n";
+
+        CPPUNIT_ASSERT_EQUAL(206, response.status_code);
+        CPPUNIT_ASSERT(serialized.find("Content-Type: multipart/byteranges; boundary=" + boundary +
+                                       "\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find("Content-Length: " + std::to_string(expected.size()) +
+                                       "\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find("X-Stitch-Pattern") == std::string::npos);
+        CPPUNIT_ASSERT(bodyOf(serialized) == expected);
+    }
+
+    void testUnsatisfiableRange() {
+        TestCommand cmd;
+        cmd.body_size = 1000;
+
+        HttpResponse response = generator->generate(cmd, "bytes=1000-");
+        std::string serialized = generator->serialize(response);
+        CPPUNIT_ASSERT_EQUAL(416, response.status_code);
+        CPPUNIT_ASSERT(serialized.find("Content-Range: bytes */1000\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(std::string("Range Not Satisfiable"), bodyOf(serialized));
+
+        // Bodies from body= cannot seek and ignore ranges
+        TestCommand plain;
+        CPPUNIT_ASSERT_EQUAL(200, generator->generate(plain, "bytes=0-0").status_code);
+    }
+
+    void testRangeFaults() {
+        TestCommand cmd;
+        cmd.body_size = 1000;
+
+        cmd.range_fault = RangeFault::IGNORE;
+        CPPUNIT_ASSERT_EQUAL(200, generator->generate(cmd, "bytes=0-9").status_code);
+
+        // Bytes 10-19 go out labelled 11-20
+        cmd.range_fault = RangeFault::WRONG_RANGE;
+        HttpResponse wrong = generator->generate(cmd, "bytes=10-19");
+        std::string serialized = generator->serialize(wrong);
+        CPPUNIT_ASSERT(serialized.find("Content-Range: bytes 11-20/1000\r\n") != std::string::npos);
+        std::string whole = bodyOf(generator->serialize(generator->generate(cmd)));
+        CPPUNIT_ASSERT(bodyOf(serialized) == whole.substr(10, 10));
+
+        // The second part starts halfway into the first
+        cmd.range_fault = RangeFault::OVERLAP;
+        HttpResponse overlap = generator->generate(cmd, "bytes=0-9,10-19");
+        CPPUNIT_ASSERT_EQUAL(size_t(2), overlap.ranges.size());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(5), overlap.ranges[1].first);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(19), overlap.ranges[1].last);
+        CPPUNIT_ASSERT(generator->serialize(overlap).find("Content-Range: bytes 5-19/1000\r\n") !=
+                       std::string::npos);
+
+        cmd.range_fault = RangeFault::MULTIPART;
+        HttpResponse multipart = generator->generate(cmd, "bytes=0-9");
+        CPPUNIT_ASSERT_EQUAL(size_t(1), multipart.part_heads.size());
+        CPPUNIT_ASSERT(generator->serializeHead(multipart).find("multipart/byteranges") !=
+                       std::string::npos);
+    }
+
+    void testEncodedBody() {
+        TestCommand cmd;
+        cmd.body_size = 1000;
+        cmd.encoding = ContentEncoding::GZIP;
+
+        // Without a compressed body the response is sent as it is
+        HttpResponse response = generator->generate(cmd, "bytes=0-9");
+        CPPUNIT_ASSERT(response.encoding == ContentEncoding::GZIP);
+        CPPUNIT_ASSERT(response.ranges.empty());
+        CPPUNIT_ASSERT(generator->serializeHead(response).find("Content-Encoding") ==
+                       std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(std::string("pattern:1000"), ResponseGenerator::bodyKey(response));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1000), ResponseGenerator::rawBodyLength(response));
+
+        response.encoded = std::make_shared<const std::string>("compressed");
+        std::string serialized = generator->serialize(response);
+        CPPUNIT_ASSERT(serialized.find("Content-Encoding: gzip\r\n") != std::string::npos);
+        CPPUNIT_ASSERT(serialized.find("Content-Length: 10\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(std::string("compressed"), bodyOf(serialized));
+
+        // Error responses are never encoded
+        cmd.behavior = BehaviorType::ERROR_RESPONSE;
+        cmd.status_code = 503;
+        CPPUNIT_ASSERT(generator->generate(cmd).encoding == ContentEncoding::IDENTITY);
+    }
+
+    void testEncodingFaults() {
+        TestCommand cmd;
+        cmd.body_size = 1000;
+        cmd.encoding = ContentEncoding::GZIP;
+        auto encoded = std::make_shared<const std::string>("0123456789abcdef");
+
+        cmd.encoding_fault = EncodingFault::TRUNCATE;
+        HttpResponse response = generator->generate(cmd);
+        response.encoded = encoded;
+        std::string serialized = generator->serialize(response);
+        CPPUNIT_ASSERT(serialized.find("Content-Length: 8\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(std::string("01234567"), bodyOf(serialized));
+
+        cmd.encoding_fault = EncodingFault::CORRUPT;
+        response = generator->generate(cmd);
+        response.encoded = encoded;
+        CPPUNIT_ASSERT_EQUAL(std::string("0123456799abcdef"), bodyOf(generator->serialize(response)));
+        CPPUNIT_ASSERT_EQUAL(std::string("0123456789abcdef"), *encoded);
+
+        // gzip's CRC-32 starts 8 bytes from the end
+        cmd.encoding_fault = EncodingFault::CHECKSUM;
+        response = generator->generate(cmd);
+        response.encoded = encoded;
+        CPPUNIT_ASSERT_EQUAL(std::string("0123456799abcdef"), bodyOf(generator->serialize(response)));
+
+        cmd.encoding_fault = EncodingFault::MISLABEL;
+        response = generator->generate(cmd);
+        response.encoded = encoded;
+        serialized = generator->serialize(response);
+        CPPUNIT_ASSERT(serialized.find("Content-Encoding: deflate\r\n") != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL(*encoded, bodyOf(serialized));
+    }
+
+    void testHeaderFlood() {
+        TestCommand cmd;
+        cmd.body_content = "hi";
+        cmd.headers.emplace_back("Set-Cookie", "a=1");
+        cmd.duplicate_headers = 2;
+        cmd.header_count = 2;
+        cmd.header_size = 3;
+        HttpResponse response = generator->generate(cmd);
+
+        std::string serialized = generator->serialize(response);
+        std::string flood = "Set-Cookie: a=1\r\nSet-Cookie: a=1\r\n"
+                            "X-Stitch-Fill-000000: tuv\r\n"
+                            "X-Stitch-Fill-000001: tuv\r\n\r\nhi";
+        CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n") + flood,
+                             serialized);
+        CPPUNIT_ASSERT(generator->streamHead(response)->length() == serialized.size() - 2);
+
+        // Duplicates without h. headers repeat a marker
+        TestCommand dup;
+        dup.duplicate_headers = 3;
+        serialized = generator->serializeHead(generator->generate(dup));
+        CPPUNIT_ASSERT(serialized.find("X-Stitch-Duplicate: 1\r\nX-Stitch-Duplicate: 1\r\n"
+                                       "X-Stitch-Duplicate: 1\r\n\r\n") != std::string::npos);
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(ResponseGeneratorTest);
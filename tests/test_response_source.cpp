@@ -0,0 +1,377 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "response_source.h"
+
+class ResponseSourceTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ResponseSourceTest);
+
+    CPPUNIT_TEST(testStringSource);
+    CPPUNIT_TEST(testPartialConsume);
+    CPPUNIT_TEST(testPatternSourceIsSeekable);
+    CPPUNIT_TEST(testPatternSourceLargeBody);
+    CPPUNIT_TEST(testSeededPatternSource);
+    CPPUNIT_TEST(testFileSource);
+    CPPUNIT_TEST(testFileSourceShrunkFile);
+    CPPUNIT_TEST(testChunkedEncoding);
+    CPPUNIT_TEST(testChunkedEmptyBody);
+    CPPUNIT_TEST(testChunkPlanParsing);
+    CPPUNIT_TEST(testChunkedListSizes);
+    CPPUNIT_TEST(testChunkedRandomSizes);
+    CPPUNIT_TEST(testChunkedFaults);
+    CPPUNIT_TEST(testChunkedTrailerBomb);
+    CPPUNIT_TEST(testChunkedByteAtATime);
+    CPPUNIT_TEST(testChunkedPeekSpansChunks);
+    CPPUNIT_TEST(testConcatSource);
+    CPPUNIT_TEST(testHeaderFlood);
+    CPPUNIT_TEST(testHeaderFloodAnySplit);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    // Pull everything out of a source, max_bytes at a time
+    static std::string drain(ResponseSource& source, size_t max_bytes = SIZE_MAX,
+                             size_t max_segments = ResponseSource::MAX_SEGMENTS) {
+        std::string result;
+        struct iovec segments[ResponseSource::MAX_SEGMENTS];
+        while (!source.done()) {
+            size_t count = source.peek(segments, max_segments, max_bytes);
+            if (count == 0) {
+                break;
+            }
+            size_t bytes = 0;
+            for (size_t i = 0; i < count; ++i) {
+                result.append(static_cast<const char*>(segments[i].iov_base), segments[i].iov_len);
+                bytes += segments[i].iov_len;
+            }
+            CPPUNIT_ASSERT(bytes <= max_bytes);
+            source.consume(bytes);
+        }
+        return result;
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testStringSource() {
+        StringSource source("Hello World");
+        CPPUNIT_ASSERT_EQUAL(uint64_t(11), source.length());
+        CPPUNIT_ASSERT_EQUAL(std::string("Hello World"), drain(source, 3));
+        CPPUNIT_ASSERT(source.done());
+    }
+
+    void testPartialConsume() {
+        StringSource source("abcdef");
+        struct iovec segment;
+        CPPUNIT_ASSERT_EQUAL(size_t(1), source.peek(&segment, 1, 100));
+        source.consume(2);
+        CPPUNIT_ASSERT_EQUAL(std::string("cdef"), drain(source));
+    }
+
+    void testPatternSourceIsSeekable() {
+        PatternSource whole(1000);
+        std::string body = drain(whole, 7);
+        CPPUNIT_ASSERT_EQUAL(size_t(1000), body.size());
+
+        PatternSource tail(500, 500);
+        CPPUNIT_ASSERT_EQUAL(body.substr(500), drain(tail));
+        for (size_t i = 0; i < body.size(); ++i) {
+            CPPUNIT_ASSERT_EQUAL(PatternSource::byteAt(i), body[i]);
+        }
+    }
+
+    void testPatternSourceLargeBody() {
+        // Describing 1 GiB must not allocate it
+        PatternSource source(uint64_t(1) << 30);
+        struct iovec segments[ResponseSource::MAX_SEGMENTS];
+        size_t count = source.peek(segments, ResponseSource::MAX_SEGMENTS, SIZE_MAX);
+        CPPUNIT_ASSERT_EQUAL(ResponseSource::MAX_SEGMENTS, count);
+
+        uint64_t skipped = 0;
+        while (!source.done()) {
+            count = source.peek(segments, ResponseSource::MAX_SEGMENTS, SIZE_MAX);
+            for (size_t i = 0; i < count; ++i) {
+                skipped += segments[i].iov_len;
+                source.consume(segments[i].iov_len);
+            }
+        }
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1) << 30, skipped);
+    }
+
+    void testSeededPatternSource() {
+        std::string expected(300000, '\0');
+        BodyPattern(11).fill(0, &expected[0], expected.size());
+
+        SeededPatternSource source(11, 300000);
+        CPPUNIT_ASSERT(source.length() == expected.size());
+        CPPUNIT_ASSERT_EQUAL(expected, drain(source, 10007));
+
+        SeededPatternSource tail(11, 1000, 299000);
+        CPPUNIT_ASSERT_EQUAL(expected.substr(299000), drain(tail));
+    }
+
+    void testFileSource() {
+        char path[] = "/tmp/stitch_sourceXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        std::string content(200000, '\0');
+        for (size_t i = 0; i < content.size(); ++i) {
+            content[i] = static_cast<char>('a' + i % 26);
+        }
+        CPPUNIT_ASSERT(write(fd, content.data(), content.size()) ==
+                       static_cast<ssize_t>(content.size()));
+
+        FileSource range(fd, 1000, 150000);
+        CPPUNIT_ASSERT_EQUAL(content.substr(1000, 150000), drain(range, 40000));
+        CPPUNIT_ASSERT(!range.failed());
+
+        // sendfile() hand-off: consuming past the buffered window moves the
+        // next peek() to the right place
+        FileSource mixed(fd, 1000, 150000);
+        struct iovec segment;
+        CPPUNIT_ASSERT_EQUAL(size_t(1), mixed.peek(&segment, 1, 1));
+        mixed.consume(1);
+
+        int file_fd = -1;
+        uint64_t offset = 0;
+        size_t length = 0;
+        CPPUNIT_ASSERT(mixed.peekFile(file_fd, offset, length, 100000));
+        CPPUNIT_ASSERT_EQUAL(fd, file_fd);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1001), offset);
+        CPPUNIT_ASSERT_EQUAL(size_t(100000), length);
+        mixed.consume(100000);
+        CPPUNIT_ASSERT_EQUAL(content.substr(101001, 49999), drain(mixed));
+        CPPUNIT_ASSERT(!mixed.peekFile(file_fd, offset, length, 100000));
+
+        close(fd);
+        std::remove(path);
+    }
+
+    void testFileSourceShrunkFile() {
+        char path[] = "/tmp/stitch_sourceXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        CPPUNIT_ASSERT_EQUAL(ssize_t(5), write(fd, "short", 5));
+
+        FileSource source(fd, 0, 100);
+        CPPUNIT_ASSERT_EQUAL(std::string("short"), drain(source));
+        CPPUNIT_ASSERT(source.failed());
+        CPPUNIT_ASSERT(!source.done());
+
+        close(fd);
+        std::remove(path);
+    }
+
+    static ChunkPlan fixedPlan(size_t size, ChunkPlan::Fault fault = ChunkPlan::Fault::NONE) {
+        ChunkPlan plan;
+        plan.parseSizes(std::to_string(size));
+        plan.fault = fault;
+        return plan;
+    }
+
+    void testChunkedEncoding() {
+        ChunkedSource source(std::make_unique<StringSource>("Hello World!"), fixedPlan(5));
+        std::string expected = "5\r\nHello\r\n5\r\n Worl\r\n2\r\nd!\r\n0\r\n\r\n";
+        CPPUNIT_ASSERT(source.length() == expected.size());
+        CPPUNIT_ASSERT_EQUAL(expected, drain(source));
+    }
+
+    void testChunkedEmptyBody() {
+        ChunkedSource source(std::make_unique<StringSource>(""), fixedPlan(5));
+        CPPUNIT_ASSERT_EQUAL(std::string("0\r\n\r\n"), drain(source));
+    }
+
+    void testChunkPlanParsing() {
+        ChunkPlan plan;
+        CPPUNIT_ASSERT(!plan.active());
+        CPPUNIT_ASSERT(plan.parseSizes("512-65536"));
+        CPPUNIT_ASSERT(plan.mode == ChunkPlan::Mode::RANDOM);
+        CPPUNIT_ASSERT_EQUAL(size_t(512), plan.min_size);
+        CPPUNIT_ASSERT_EQUAL(size_t(65536), plan.max_size);
+        CPPUNIT_ASSERT(plan.parseSizes("100,7,4096"));
+        CPPUNIT_ASSERT(plan.mode == ChunkPlan::Mode::LIST);
+        CPPUNIT_ASSERT_EQUAL(size_t(3), plan.sizes.size());
+
+        CPPUNIT_ASSERT(!plan.parseSizes("0"));
+        CPPUNIT_ASSERT(!plan.parseSizes("9-3"));
+        CPPUNIT_ASSERT(!plan.parseSizes("1,,2"));
+        CPPUNIT_ASSERT(!plan.parseSizes("abc"));
+
+        ChunkPlan::Fault fault = ChunkPlan::Fault::NONE;
+        CPPUNIT_ASSERT(ChunkPlan::parseFault("trailer_bomb", fault));
+        CPPUNIT_ASSERT(fault == ChunkPlan::Fault::TRAILER_BOMB);
+        CPPUNIT_ASSERT(!ChunkPlan::parseFault("bogus", fault));
+    }
+
+    void testChunkedListSizes() {
+        ChunkPlan plan;
+        plan.parseSizes("1,3");
+        ChunkedSource source(std::make_unique<StringSource>("abcdefghi"), plan);
+        std::string expected = "1\r\na\r\n3\r\nbcd\r\n1\r\ne\r\n3\r\nfgh\r\n"
+                               "1\r\ni\r\n0\r\n\r\n";
+        CPPUNIT_ASSERT(source.length() == expected.size());
+        CPPUNIT_ASSERT_EQUAL(expected, drain(source));
+    }
+
+    void testChunkedRandomSizes() {
+        ChunkPlan plan;
+        plan.parseSizes("1-300");
+        plan.seed = 42;
+        ChunkedSource source(std::make_unique<PatternSource>(100000), plan);
+        ChunkedSource same_seed(std::make_unique<PatternSource>(100000), plan);
+        std::string body = drain(source);
+        CPPUNIT_ASSERT(source.length() == body.size());
+        CPPUNIT_ASSERT_EQUAL(body, drain(same_seed, 7, 3));
+
+        // Every size line is within the range and the data adds up
+        uint64_t total = 0;
+        size_t pos = 0;
+        while (true) {
+            size_t line_end = body.find("\r\n", pos);
+            CPPUNIT_ASSERT(line_end != std::string::npos);
+            size_t size = std::stoul(body.substr(pos, line_end - pos), nullptr, 16);
+            if (size == 0) {
+                break;
+            }
+            CPPUNIT_ASSERT(size <= 300);
+            total += size;
+            pos = line_end + 2 + size + 2;
+        }
+        CPPUNIT_ASSERT(total == 100000);
+    }
+
+    void testChunkedFaults() {
+        struct Case {
+            ChunkPlan::Fault fault;
+            const char* expected;
+        };
+        const Case cases[] = {
+            {ChunkPlan::Fault::BAD_HEX,         "3\r\nabc\r\ng3\r\ndef\r\n1\r\ng\r\n0\r\n\r\n"},
+            {ChunkPlan::Fault::MISSING_CRLF,    "3\r\nabc\r\n3\r\ndef1\r\ng\r\n0\r\n\r\n"},
+            {ChunkPlan::Fault::LENGTH_MISMATCH, "3\r\nabc\r\n4\r\ndef\r\n1\r\ng\r\n0\r\n\r\n"},
+            {ChunkPlan::Fault::TRUNCATED_LAST,  "3\r\nabc\r\n3\r\ndef\r\n1\r\ng\r\n"},
+        };
+        for (const Case& c : cases) {
+            ChunkPlan plan = fixedPlan(3, c.fault);
+            plan.fault_chunk = 1;
+            ChunkedSource source(std::make_unique<StringSource>("abcdefg"), plan);
+            std::string body = drain(source);
+            CPPUNIT_ASSERT_EQUAL(std::string(c.expected), body);
+            CPPUNIT_ASSERT(source.length() == body.size());
+        }
+    }
+
+    void testChunkedTrailerBomb() {
+        ChunkPlan plan = fixedPlan(8, ChunkPlan::Fault::TRAILER_BOMB);
+        plan.trailer_bytes = 200000;
+        ChunkedSource source(std::make_unique<StringSource>("abc"), plan);
+        std::string body = drain(source);
+
+        CPPUNIT_ASSERT(source.length() == body.size());
+        CPPUNIT_ASSERT(body.compare(0, 12, "3\r\nabc\r\n0\r\nX") == 0);
+        CPPUNIT_ASSERT(body.compare(body.size() - 4, 4, "\r\n\r\n") == 0);
+        // Whole 64-byte fields, at least trailer_bytes of them
+        size_t trailers = body.size() - 11 - 2;
+        CPPUNIT_ASSERT_EQUAL(size_t(0), trailers % 64);
+        CPPUNIT_ASSERT(trailers >= 200000 && trailers < 200064);
+    }
+
+    void testChunkedByteAtATime() {
+        ChunkPlan plan;
+        plan.parseSizes("16,1,40");
+        ChunkedSource source(std::make_unique<PatternSource>(1000), plan);
+        ChunkedSource reference(std::make_unique<PatternSource>(1000), plan);
+        CPPUNIT_ASSERT_EQUAL(drain(reference), drain(source, 1, 2));
+    }
+
+    void testChunkedPeekSpansChunks() {
+        ChunkedSource source(std::make_unique<PatternSource>(1 << 20), fixedPlan(1024));
+        struct iovec segments[ResponseSource::MAX_SEGMENTS];
+        size_t count = source.peek(segments, ResponseSource::MAX_SEGMENTS, SIZE_MAX);
+
+        // Size line, data and CRLF per chunk, several chunks per peek
+        CPPUNIT_ASSERT(count >= 3 * 8);
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            bytes += segments[i].iov_len;
+        }
+        CPPUNIT_ASSERT(bytes > 8 * 1024);
+    }
+
+    void testConcatSource() {
+        ConcatSource source;
+        source.append(std::make_unique<StringSource>("HTTP/1.1 200 OK\r\n\r\n"));
+        source.append(std::make_unique<StringSource>(""));
+        source.append(std::make_unique<PatternSource>(10));
+        source.append(std::make_unique<StringSource>("!"));
+
+        std::string expected = "HTTP/1.1 200 OK\r\n\r\n";
+        for (uint64_t i = 0; i < 10; ++i) {
+            expected += PatternSource::byteAt(i);
+        }
+        expected += "!";
+
+        CPPUNIT_ASSERT(source.length() == expected.size());
+        CPPUNIT_ASSERT_EQUAL(expected, drain(source));
+
+        ConcatSource small_steps;
+        small_steps.append(std::make_unique<StringSource>("abc"));
+        small_steps.append(std::make_unique<StringSource>("def"));
+        CPPUNIT_ASSERT_EQUAL(std::string("abcdef"), drain(small_steps, 2));
+    }
+
+    // What HeaderFloodSource should send, built the slow way
+    static std::string floodReference(const std::string& lines, uint64_t repeats, uint64_t count,
+                                      uint64_t value_size) {
+        std::string expected;
+        for (uint64_t i = 0; i < repeats; ++i) {
+            expected += lines;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            char name[48];
+            snprintf(name, sizeof(name), "X-Stitch-Fill-%06llu: ",
+                     static_cast<unsigned long long>(i));
+            expected += name;
+            for (uint64_t j = HeaderFloodSource::MAX_VALUE_SIZE - value_size;
+                 j < HeaderFloodSource::MAX_VALUE_SIZE; ++j) {
+                expected += static_cast<char>('a' + j % 26);
+            }
+            expected += "\r\n";
+        }
+        return expected;
+    }
+
+    void testHeaderFlood() {
+        HeaderFloodSource source("Set-Cookie: a=1\r\n", 3, 2, 5);
+        std::string expected = "Set-Cookie: a=1\r\nSet-Cookie: a=1\r\nSet-Cookie: a=1\r\n"
+                               "X-Stitch-Fill-000000: rstuv\r\n"
+                               "X-Stitch-Fill-000001: rstuv\r\n";
+        CPPUNIT_ASSERT(source.length() == expected.size());
+        CPPUNIT_ASSERT_EQUAL(expected, drain(source));
+
+        // Large floods cost nothing to set up and are still exact
+        HeaderFloodSource big("X-A: 1\r\n", 50000, HeaderFloodSource::MAX_COUNT, 100);
+        std::string reference = floodReference("X-A: 1\r\n", 50000,
+                                               HeaderFloodSource::MAX_COUNT, 100);
+        CPPUNIT_ASSERT(big.length() == reference.size());
+        CPPUNIT_ASSERT(drain(big) == reference);
+
+        HeaderFloodSource empty("", 10, 0, 32);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), empty.length());
+        CPPUNIT_ASSERT(empty.done());
+    }
+
+    void testHeaderFloodAnySplit() {
+        std::string reference = floodReference("Via: x\r\nVia: y\r\n", 700, 300, 1000);
+        for (size_t max_bytes : {1u, 7u, 23u, 4096u, 100000u}) {
+            for (size_t max_segments : {1u, 3u, 64u}) {
+                HeaderFloodSource source("Via: x\r\nVia: y\r\n", 700, 300, 1000);
+                CPPUNIT_ASSERT(drain(source, max_bytes, max_segments) == reference);
+            }
+        }
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ResponseSourceTest);
@@ -0,0 +1,124 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <thread>
+#include "runtime_config.h"
+
+class RuntimeConfigTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(RuntimeConfigTest);
+
+    CPPUNIT_TEST(testPublishSwapsSnapshot);
+    CPPUNIT_TEST(testPinnedSnapshotOutlivesSwap);
+    CPPUNIT_TEST(testUnpinOutOfOrder);
+    CPPUNIT_TEST(testConcurrentSwaps);
+    CPPUNIT_TEST(testToJson);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    static std::unique_ptr<ConfigSnapshot> withChaos(const std::string& spec) {
+        auto snapshot = std::make_unique<ConfigSnapshot>();
+        auto chaos = std::make_shared<ChaosMix>();
+        CPPUNIT_ASSERT(chaos->parse(spec));
+        snapshot->chaos_spec = spec;
+        snapshot->chaos = std::move(chaos);
+        return snapshot;
+    }
+
+public:
+    void testPublishSwapsSnapshot() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), config.generation());
+
+        config.publish(withChaos("close:1"));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), config.generation());
+        CPPUNIT_ASSERT_EQUAL(std::string("close:1"), config.current().chaos_spec);
+
+        // The loop has not announced it moved on, so the old one is kept
+        CPPUNIT_ASSERT_EQUAL(size_t(1), config.retired());
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(1), config.reclaim());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), config.retired());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), config.swaps());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), config.reclaimed());
+    }
+
+    void testPinnedSnapshotOutlivesSwap() {
+        RuntimeConfig config(withChaos("normal:1"));
+        const ConfigSnapshot* pinned = config.pin();
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), pinned->generation);
+
+        config.publish(withChaos("close:1"));
+        config.publish(withChaos("timeout:1"));
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(0), config.reclaim());
+        CPPUNIT_ASSERT_EQUAL(std::string("normal:1"), pinned->chaos_spec);
+
+        // New requests see the latest; generation 2 is still kept, as
+        // reclamation only goes by the oldest pin
+        const ConfigSnapshot* latest = config.pin();
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), latest->generation);
+
+        config.unpin(1);
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(2), config.reclaim());
+        config.unpin(3);
+    }
+
+    void testUnpinOutOfOrder() {
+        RuntimeConfig config(std::make_unique<ConfigSnapshot>());
+        config.pin();
+        config.publish(std::make_unique<ConfigSnapshot>());
+        config.pin();
+        config.pin();
+        config.publish(std::make_unique<ConfigSnapshot>());
+
+        // Generation 2 is done first, but 1 still holds everything back
+        config.unpin(2);
+        config.unpin(2);
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(0), config.reclaim());
+
+        config.unpin(1);
+        config.quiesce();
+        CPPUNIT_ASSERT_EQUAL(size_t(2), config.reclaim());
+    }
+
+    void testConcurrentSwaps() {
+        RuntimeConfig config(withChaos("normal:1"));
+        std::atomic<bool> done(false);
+
+        // A writer swapping as fast as it can while the reader pins,
+        // reads and unpins the way connections do
+        std::thread writer([&config, &done]() {
+            for (int i = 0; i < 2000; i++) {
+                config.publish(withChaos(i % 2 == 0 ? "close:1" : "timeout:1"));
+            }
+            done = true;
+        });
+        size_t reads = 0;
+        while (!done || reads == 0) {
+            const ConfigSnapshot* snapshot = config.pin();
+            CPPUNIT_ASSERT(snapshot->chaos && snapshot->chaos->size() == 1);
+            config.unpin(snapshot->generation);
+            config.quiesce();
+            reads++;
+        }
+        writer.join();
+
+        config.quiesce();
+        config.reclaim();
+        CPPUNIT_ASSERT_EQUAL(size_t(0), config.retired());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2000), config.reclaimed());
+    }
+
+    void testToJson() {
+        ConfigSnapshot snapshot;
+        snapshot.generation = 4;
+        snapshot.has_default = true;
+        snapshot.default_query = "behavior=slow&h.X-Note=\"hi\"";
+        CPPUNIT_ASSERT_EQUAL(
+            std::string("{\"generation\":4,\"default\":\"behavior=slow&h.X-Note=\\\"hi\\\"\","
+                        "\"chaos\":null,\"scenario_routes\":0}"),
+            snapshot.toJson());
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RuntimeConfigTest);
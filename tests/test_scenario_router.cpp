@@ -0,0 +1,208 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include "scenario_router.h"
+
+class ScenarioRouterTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ScenarioRouterTest);
+
+    CPPUNIT_TEST(testLoadRoutes);
+    CPPUNIT_TEST(testLongestPrefixWins);
+    CPPUNIT_TEST(testQueryStringIgnored);
+    CPPUNIT_TEST(testNoMatch);
+    CPPUNIT_TEST(testMethodConstraint);
+    CPPUNIT_TEST(testHeaderConstraintFallsBack);
+    CPPUNIT_TEST(testSplitEdges);
+    CPPUNIT_TEST(testPreserializedResponse);
+    CPPUNIT_TEST(testNoResponseForClose);
+    CPPUNIT_TEST(testInvalidDocuments);
+    CPPUNIT_TEST(testEmpiricalDistributionRoute);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    ScenarioRouter* router;
+
+    static HttpRequest makeRequest(const std::string& method, const std::string& path) {
+        HttpRequest request;
+        request.method = method;
+        request.path = path;
+        request.http_version = "HTTP/1.1";
+        return request;
+    }
+
+    // A cache with histogram "api" loaded
+    static void loadHistogram(LatencyDistributionCache& distributions) {
+        char path[] = "/tmp/stitch_histXXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+        {
+            std::ofstream file(path);
+            file << "10 50\n100 50\n";
+        }
+        bool loaded = distributions.addHistogram("api", path);
+        std::remove(path);
+        CPPUNIT_ASSERT(loaded);
+    }
+
+public:
+    void setUp() {
+        router = new ScenarioRouter();
+    }
+
+    void tearDown() {
+        delete router;
+    }
+
+    void testLoadRoutes() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": [{\"prefix\": \"/a\", \"behavior\": \"error\", \"code\": 503}]}"));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), router->size());
+
+        const ScenarioRoute* route = router->resolve(makeRequest("GET", "/a/b"));
+        CPPUNIT_ASSERT(route != nullptr);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE, route->command.behavior);
+        CPPUNIT_ASSERT_EQUAL(503, route->command.status_code);
+    }
+
+    void testLongestPrefixWins() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": ["
+            " {\"prefix\": \"/\", \"behavior\": \"timeout\"},"
+            " {\"prefix\": \"/api\", \"behavior\": \"error\"},"
+            " {\"prefix\": \"/api/slow\", \"behavior\": \"slow\", \"delay\": 10}"
+            "]}"));
+
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::SLOW_RESPONSE,
+            router->resolve(makeRequest("GET", "/api/slow/x"))->command.behavior);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE,
+            router->resolve(makeRequest("GET", "/api/sl"))->command.behavior);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::TIMEOUT,
+            router->resolve(makeRequest("GET", "/other"))->command.behavior);
+    }
+
+    void testQueryStringIgnored() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": [{\"prefix\": \"/abc\", \"behavior\": \"close\"}]}"));
+
+        CPPUNIT_ASSERT(router->resolve(makeRequest("GET", "/abc?x=1")) != nullptr);
+        CPPUNIT_ASSERT(router->resolve(makeRequest("GET", "/ab?c")) == nullptr);
+    }
+
+    void testNoMatch() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": [{\"prefix\": \"/abc\", \"behavior\": \"close\"}]}"));
+
+        CPPUNIT_ASSERT(router->resolve(makeRequest("GET", "/ab")) == nullptr);
+        CPPUNIT_ASSERT(router->resolve(makeRequest("GET", "/x")) == nullptr);
+    }
+
+    void testMethodConstraint() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": ["
+            " {\"prefix\": \"/u\", \"method\": \"POST\", \"behavior\": \"close\"},"
+            " {\"prefix\": \"/u\", \"behavior\": \"error\"}"
+            "]}"));
+
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::CLOSE_IMMEDIATELY,
+            router->resolve(makeRequest("POST", "/u"))->command.behavior);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE,
+            router->resolve(makeRequest("GET", "/u"))->command.behavior);
+    }
+
+    void testHeaderConstraintFallsBack() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": ["
+            " {\"prefix\": \"/\", \"behavior\": \"error\"},"
+            " {\"prefix\": \"/h\", \"headers\": {\"X-Mode\": \"break\"}, \"behavior\": \"close\"}"
+            "]}"));
+
+        HttpRequest request = makeRequest("GET", "/h/1");
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE,
+            router->resolve(request)->command.behavior);
+
+        request.headers["x-mode"] = "break";
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::CLOSE_IMMEDIATELY,
+            router->resolve(request)->command.behavior);
+    }
+
+    void testSplitEdges() {
+        // Shared prefixes force edge splits in both insertion orders
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": ["
+            " {\"prefix\": \"/team\", \"behavior\": \"close\"},"
+            " {\"prefix\": \"/test\", \"behavior\": \"timeout\"},"
+            " {\"prefix\": \"/te\", \"behavior\": \"error\"}"
+            "]}"));
+
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::CLOSE_IMMEDIATELY,
+            router->resolve(makeRequest("GET", "/team"))->command.behavior);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::TIMEOUT,
+            router->resolve(makeRequest("GET", "/testing"))->command.behavior);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::ERROR_RESPONSE,
+            router->resolve(makeRequest("GET", "/tex"))->command.behavior);
+        CPPUNIT_ASSERT(router->resolve(makeRequest("GET", "/t")) == nullptr);
+    }
+
+    void testPreserializedResponse() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": [{\"prefix\": \"/e\", \"behavior\": \"error\","
+            " \"code\": 502, \"reason\": \"Bad Gateway\"}]}"));
+
+        const ScenarioRoute* route = router->resolve(makeRequest("GET", "/e"));
+        CPPUNIT_ASSERT(route->has_response);
+        CPPUNIT_ASSERT_EQUAL(502, route->response_status);
+        CPPUNIT_ASSERT(route->response.find("HTTP/1.1 502 Bad Gateway\r\n") == 0);
+    }
+
+    void testNoResponseForClose() {
+        CPPUNIT_ASSERT(router->loadString(
+            "{\"routes\": ["
+            " {\"prefix\": \"/c\", \"behavior\": \"close\"},"
+            " {\"prefix\": \"/n\", \"preserialize\": false}"
+            "]}"));
+
+        CPPUNIT_ASSERT(!router->resolve(makeRequest("GET", "/c"))->has_response);
+        CPPUNIT_ASSERT(!router->resolve(makeRequest("GET", "/n"))->has_response);
+    }
+
+    void testInvalidDocuments() {
+        CPPUNIT_ASSERT(!router->loadString("not json"));
+        CPPUNIT_ASSERT(!router->loadString("{\"routes\": {}}"));
+        CPPUNIT_ASSERT(!router->loadString("{\"routes\": [{\"behavior\": \"close\"}]}"));
+        CPPUNIT_ASSERT(!router->loadString("{\"routes\": [{\"prefix\": \"nope\"}]}"));
+        CPPUNIT_ASSERT(!router->loadString(
+            "{\"routes\": [{\"prefix\": \"/\", \"behavior\": \"error\", \"code\": 999}]}"));
+        CPPUNIT_ASSERT(!router->getErrorMessage().empty());
+        CPPUNIT_ASSERT(!router->loadString(
+            "{\"routes\": [{\"prefix\": \"/\", \"script\": \"status,jump\"}]}"));
+        CPPUNIT_ASSERT(router->getErrorMessage().find("Unknown script step: jump") !=
+                       std::string::npos);
+        CPPUNIT_ASSERT(!router->loadFile("/nonexistent/scenario.json"));
+    }
+
+    void testEmpiricalDistributionRoute() {
+        LatencyDistributionCache distributions;
+        loadHistogram(distributions);
+        std::string scenario =
+            "{\"routes\": [{\"prefix\": \"/api\", \"behavior\": \"slow\","
+            " \"dist\": \"empirical\", \"hist\": \"api\"}]}";
+
+        CPPUNIT_ASSERT(router->loadString(scenario, &distributions));
+        const ScenarioRoute* route = router->resolve(makeRequest("GET", "/api/x"));
+        CPPUNIT_ASSERT(route != nullptr);
+        CPPUNIT_ASSERT(route->command.delay_distribution != nullptr);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), distributions.size());
+
+        // Without the histogram the route is rejected, not served with delay=
+        CPPUNIT_ASSERT(!router->loadString(scenario));
+        CPPUNIT_ASSERT(router->getErrorMessage().find("route 0: dist=") == 0);
+        LatencyDistributionCache empty;
+        CPPUNIT_ASSERT(!router->loadString(scenario, &empty));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ScenarioRouterTest);
@@ -0,0 +1,430 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include "socket_manager.h"
+
+class SocketManagerTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SocketManagerTest);
+
+    CPPUNIT_TEST(testParseAddress);
+    CPPUNIT_TEST(testParseErrors);
+    CPPUNIT_TEST(testListenersOfEachFamily);
+    CPPUNIT_TEST(testStaleUnixSocketReplaced);
+    CPPUNIT_TEST(testLiveUnixSocketKept);
+    CPPUNIT_TEST(testAcceptBatch);
+    CPPUNIT_TEST(testPauseAccepting);
+    CPPUNIT_TEST(testListenOptions);
+    CPPUNIT_TEST(testReadListenDrops);
+    CPPUNIT_TEST(testAddressOfSocket);
+    CPPUNIT_TEST(testAdoptAndRelease);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    std::string path_;
+
+    static ListenAddress parse(const std::string& text) {
+        ListenAddress address;
+        std::string error;
+        CPPUNIT_ASSERT_MESSAGE(error, ListenAddress::parse(text, address, error));
+        return address;
+    }
+
+    static bool parseFails(const std::string& text) {
+        ListenAddress address;
+        std::string error;
+        bool ok = ListenAddress::parse(text, address, error);
+        return !ok && !error.empty();
+    }
+
+    // Port of a bound IP listener
+    static int boundPort(int fd) {
+        struct sockaddr_storage addr;
+        socklen_t length = sizeof(addr);
+        CPPUNIT_ASSERT_EQUAL(0, getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length));
+        if (addr.ss_family == AF_INET6) {
+            return ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+        }
+        return ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+    }
+
+    static struct sockaddr_in loopback(int fd) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(boundPort(fd)));
+        return addr;
+    }
+
+    static int connectTo(const struct sockaddr* addr, socklen_t length) {
+        int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+        CPPUNIT_ASSERT(fd >= 0);
+        CPPUNIT_ASSERT_EQUAL(0, connect(fd, addr, length));
+        return fd;
+    }
+
+    static int connectUnix(const std::string& path, bool abstract) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.data(), path.length());
+        socklen_t length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) +
+                                                  path.length() + (abstract ? 0 : 1));
+        if (abstract) {
+            addr.sun_path[0] = '\0';
+        }
+        return connectTo(reinterpret_cast<struct sockaddr*>(&addr), length);
+    }
+
+    // Accepts one connection and returns the listener it came from; then
+    // drains the listeners as the event loop does, so the next call starts
+    // over at listener 0
+    static size_t acceptOne(SocketManager& manager) {
+        size_t listener = SIZE_MAX;
+        int fd = manager.acceptConnection(&listener);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+        CPPUNIT_ASSERT_EQUAL(-1, manager.acceptConnection());
+        return listener;
+    }
+
+public:
+    void setUp() {
+        path_ = "/tmp/stitch_test_" + std::to_string(getpid()) + ".sock";
+        unlink(path_.c_str());
+    }
+
+    void tearDown() {
+        unlink(path_.c_str());
+    }
+
+    void testParseAddress() {
+        ListenAddress address = parse("127.0.0.1:8080");
+        CPPUNIT_ASSERT_EQUAL(AF_INET, address.family);
+        CPPUNIT_ASSERT_EQUAL(std::string("127.0.0.1"), address.host);
+        CPPUNIT_ASSERT_EQUAL(8080, address.port);
+
+        address = parse(":9000");
+        CPPUNIT_ASSERT_EQUAL(AF_INET, address.family);
+        CPPUNIT_ASSERT_EQUAL(std::string("0.0.0.0:9000"), address.toString());
+
+        address = parse("[::1]:8443");
+        CPPUNIT_ASSERT_EQUAL(AF_INET6, address.family);
+        CPPUNIT_ASSERT_EQUAL(std::string("::1"), address.host);
+        CPPUNIT_ASSERT_EQUAL(std::string("[::1]:8443"), address.toString());
+        CPPUNIT_ASSERT_EQUAL(std::string("[::]:80"), parse("[]:80").toString());
+
+        address = parse("unix:/run/stitch.sock");
+        CPPUNIT_ASSERT_EQUAL(AF_UNIX, address.family);
+        CPPUNIT_ASSERT_EQUAL(std::string("/run/stitch.sock"), address.host);
+        CPPUNIT_ASSERT_EQUAL(std::string("unix:/run/stitch.sock"), address.toString());
+        CPPUNIT_ASSERT_EQUAL(std::string("@stitch"), parse("unix:@stitch").host);
+    }
+
+    void testParseErrors() {
+        CPPUNIT_ASSERT(parseFails("8080"));
+        CPPUNIT_ASSERT(parseFails("127.0.0.1:"));
+        CPPUNIT_ASSERT(parseFails("127.0.0.1:65536"));
+        CPPUNIT_ASSERT(parseFails("127.0.0.1:http"));
+        CPPUNIT_ASSERT(parseFails("localhost:8080"));
+        CPPUNIT_ASSERT(parseFails("::1:8080"));
+        CPPUNIT_ASSERT(parseFails("[127.0.0.1]:8080"));
+        CPPUNIT_ASSERT(parseFails("unix:"));
+        CPPUNIT_ASSERT(parseFails("unix:" + std::string(sizeof(sockaddr_un::sun_path), 'a')));
+    }
+
+    void testListenersOfEachFamily() {
+        SocketManager manager;
+        CPPUNIT_ASSERT(manager.bind(parse("127.0.0.1:0")));
+        CPPUNIT_ASSERT(manager.bind(parse("[::1]:0")));
+        CPPUNIT_ASSERT(manager.bind(parse("unix:" + path_)));
+        std::string abstract = "@stitch_test_" + std::to_string(getpid());
+        CPPUNIT_ASSERT(manager.bind(parse("unix:" + abstract)));
+        CPPUNIT_ASSERT(manager.listen());
+        CPPUNIT_ASSERT_EQUAL(size_t(4), manager.listenerCount());
+
+        struct stat status;
+        CPPUNIT_ASSERT_EQUAL(0, stat(path_.c_str(), &status));
+        CPPUNIT_ASSERT(S_ISSOCK(status.st_mode));
+
+        struct sockaddr_in v4;
+        memset(&v4, 0, sizeof(v4));
+        v4.sin_family = AF_INET;
+        v4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        v4.sin_port = htons(static_cast<uint16_t>(boundPort(manager.getListenFd(0))));
+        struct sockaddr_in6 v6;
+        memset(&v6, 0, sizeof(v6));
+        v6.sin6_family = AF_INET6;
+        v6.sin6_addr = in6addr_loopback;
+        v6.sin6_port = htons(static_cast<uint16_t>(boundPort(manager.getListenFd(1))));
+
+        // Each connection is reported with the listener it arrived on
+        int client = connectUnix(path_, false);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), acceptOne(manager));
+        close(client);
+        client = connectTo(reinterpret_cast<struct sockaddr*>(&v6), sizeof(v6));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), acceptOne(manager));
+        close(client);
+        client = connectUnix(abstract, true);
+        CPPUNIT_ASSERT_EQUAL(size_t(3), acceptOne(manager));
+        close(client);
+        client = connectTo(reinterpret_cast<struct sockaddr*>(&v4), sizeof(v4));
+        CPPUNIT_ASSERT_EQUAL(size_t(0), acceptOne(manager));
+        close(client);
+
+        // The socket file goes with the listener
+        manager.closeAll();
+        CPPUNIT_ASSERT(stat(path_.c_str(), &status) != 0);
+    }
+
+    void testStaleUnixSocketReplaced() {
+        // A socket file nobody listens on, as a crashed server leaves
+        int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path_.data(), path_.length());
+        CPPUNIT_ASSERT_EQUAL(0, bind(stale, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+        close(stale);
+
+        SocketManager manager;
+        CPPUNIT_ASSERT_MESSAGE(manager.getErrorMessage(), manager.bind(parse("unix:" + path_)));
+        CPPUNIT_ASSERT(manager.listen());
+        int client = connectUnix(path_, false);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), acceptOne(manager));
+        close(client);
+    }
+
+    void testLiveUnixSocketKept() {
+        SocketManager first;
+        CPPUNIT_ASSERT(first.bind(parse("unix:" + path_)));
+        CPPUNIT_ASSERT(first.listen());
+
+        SocketManager second;
+        CPPUNIT_ASSERT(!second.bind(parse("unix:" + path_)));
+        CPPUNIT_ASSERT(second.getErrorMessage().find(path_) != std::string::npos);
+
+        // The first server still gets its connections, after the probe that
+        // found it alive (a connection that closes without a request)
+        int client = connectUnix(path_, false);
+        int probe = first.acceptConnection();
+        CPPUNIT_ASSERT(probe >= 0);
+        close(probe);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), acceptOne(first));
+        close(client);
+    }
+
+    void testAcceptBatch() {
+        SocketManager manager;
+        CPPUNIT_ASSERT(manager.bind(parse("127.0.0.1:0")));
+        manager.setAcceptBatch(2);
+        CPPUNIT_ASSERT(manager.listen());
+        struct sockaddr_in addr = loopback(manager.getListenFd());
+
+        int clients[5];
+        for (int& client : clients) {
+            client = connectTo(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        }
+
+        // Two per round; the queue is sampled when a batch leaves some behind
+        size_t rounds[3] = {0, 0, 0};
+        for (size_t& taken : rounds) {
+            int fd;
+            while ((fd = manager.acceptConnection()) >= 0) {
+                CPPUNIT_ASSERT(fcntl(fd, F_GETFL) & O_NONBLOCK);
+                CPPUNIT_ASSERT(fcntl(fd, F_GETFD) & FD_CLOEXEC);
+                close(fd);
+                taken++;
+            }
+            CPPUNIT_ASSERT_EQUAL(taken == 2, manager.acceptBacklogged());
+            CPPUNIT_ASSERT_EQUAL(taken == 2, manager.acceptPending());
+        }
+        CPPUNIT_ASSERT_EQUAL(size_t(2), rounds[0]);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), rounds[1]);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), rounds[2]);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(5), manager.accepted());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), manager.acceptErrors());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), manager.peakAcceptQueue());
+
+        for (int client : clients) {
+            close(client);
+        }
+    }
+
+    void testPauseAccepting() {
+        SocketManager manager;
+        CPPUNIT_ASSERT(manager.bind(parse("127.0.0.1:0")));
+        manager.setAcceptBatch(1);
+        CPPUNIT_ASSERT(manager.listen());
+        CPPUNIT_ASSERT(manager.initEpoll());
+        struct sockaddr_in addr = loopback(manager.getListenFd());
+        int clients[2];
+        for (int& client : clients) {
+            client = connectTo(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        }
+
+        // A batch leaves one behind, which waits while paused
+        CPPUNIT_ASSERT_EQUAL(1, manager.waitForEvents(0));
+        int fd = manager.acceptConnection();
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+        manager.pauseAccepting();
+        CPPUNIT_ASSERT(manager.acceptPaused());
+        CPPUNIT_ASSERT_EQUAL(-1, manager.acceptConnection());
+        CPPUNIT_ASSERT(!manager.acceptBacklogged());
+        CPPUNIT_ASSERT(!manager.acceptPending());
+        int third = connectTo(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        CPPUNIT_ASSERT_EQUAL(0, manager.waitForEvents(0));
+
+        // Resuming takes what queued up meanwhile without waiting
+        manager.resumeAccepting();
+        CPPUNIT_ASSERT(!manager.acceptPaused());
+        CPPUNIT_ASSERT(manager.acceptBacklogged());
+        size_t taken = 0;
+        for (int round = 0; round < 3; round++) {
+            while ((fd = manager.acceptConnection()) >= 0) {
+                close(fd);
+                taken++;
+            }
+        }
+        CPPUNIT_ASSERT_EQUAL(size_t(2), taken);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), manager.accepted());
+
+        close(third);
+        for (int client : clients) {
+            close(client);
+        }
+    }
+
+    void testListenOptions() {
+        SocketManager manager;
+        CPPUNIT_ASSERT(manager.bind(parse("127.0.0.1:0")));
+        CPPUNIT_ASSERT(manager.bind(parse("unix:" + path_)));
+        manager.setDeferAccept(5);
+        manager.setFastOpen(16);
+        CPPUNIT_ASSERT_MESSAGE(manager.getErrorMessage(), manager.listen(32));
+
+        int value = 0;
+        socklen_t length = sizeof(value);
+        CPPUNIT_ASSERT_EQUAL(0, getsockopt(manager.getListenFd(), IPPROTO_TCP, TCP_FASTOPEN,
+                                           &value, &length));
+        CPPUNIT_ASSERT_EQUAL(16, value);
+        length = sizeof(value);
+        CPPUNIT_ASSERT_EQUAL(0, getsockopt(manager.getListenFd(), IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                                           &value, &length));
+        CPPUNIT_ASSERT(value > 0);
+
+        // With a deferred accept, a connection that sends nothing waits in
+        // the kernel; one that sends is handed over
+        struct sockaddr_in addr = loopback(manager.getListenFd());
+        int silent = connectTo(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        CPPUNIT_ASSERT_EQUAL(-1, manager.acceptConnection());
+        int talking = connectTo(reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        CPPUNIT_ASSERT_EQUAL(ssize_t(1), send(talking, "G", 1, 0));
+        int fd = -1;
+        for (int i = 0; i < 100 && fd < 0; ++i) {
+            fd = manager.acceptConnection();
+            if (fd < 0) {
+                usleep(1000);
+            }
+        }
+        CPPUNIT_ASSERT(fd >= 0);
+        char byte;
+        CPPUNIT_ASSERT_EQUAL(ssize_t(1), recv(fd, &byte, 1, 0));
+        close(fd);
+        close(talking);
+        CPPUNIT_ASSERT_EQUAL(-1, manager.acceptConnection());
+
+        // The Unix listener is untouched by the TCP options
+        int client = connectUnix(path_, false);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), acceptOne(manager));
+        close(client);
+        close(silent);
+    }
+
+    void testReadListenDrops() {
+        uint64_t overflows = UINT64_MAX;
+        uint64_t drops = UINT64_MAX;
+        CPPUNIT_ASSERT(SocketManager::readListenDrops(overflows, drops));
+        CPPUNIT_ASSERT(overflows != UINT64_MAX);
+        CPPUNIT_ASSERT(drops >= overflows);
+    }
+
+    void testAddressOfSocket() {
+        CPPUNIT_ASSERT(parse("[::0]:80") == parse("[::]:80"));
+        CPPUNIT_ASSERT(parse(":80") == parse("0.0.0.0:80"));
+        CPPUNIT_ASSERT(!(parse("[::1]:80") == parse("[::]:80")));
+        CPPUNIT_ASSERT(!(parse("127.0.0.1:80") == parse("127.0.0.1:81")));
+        CPPUNIT_ASSERT(!(parse("unix:/a") == parse("unix:@a")));
+
+        SocketManager manager;
+        CPPUNIT_ASSERT(manager.bind(parse("127.0.0.1:0")));
+        CPPUNIT_ASSERT(manager.bind(parse("[::1]:0")));
+        CPPUNIT_ASSERT(manager.bind(parse("unix:" + path_)));
+        std::string abstract = "@stitch_test_" + std::to_string(getpid());
+        CPPUNIT_ASSERT(manager.bind(parse("unix:" + abstract)));
+
+        ListenAddress address;
+        std::string error;
+        CPPUNIT_ASSERT(ListenAddress::fromSocket(manager.getListenFd(0), address, error));
+        CPPUNIT_ASSERT_EQUAL("127.0.0.1:" + std::to_string(boundPort(manager.getListenFd(0))),
+                             address.toString());
+        CPPUNIT_ASSERT(ListenAddress::fromSocket(manager.getListenFd(1), address, error));
+        CPPUNIT_ASSERT_EQUAL("[::1]:" + std::to_string(boundPort(manager.getListenFd(1))),
+                             address.toString());
+        CPPUNIT_ASSERT(ListenAddress::fromSocket(manager.getListenFd(2), address, error));
+        CPPUNIT_ASSERT(address == parse("unix:" + path_));
+        CPPUNIT_ASSERT(ListenAddress::fromSocket(manager.getListenFd(3), address, error));
+        CPPUNIT_ASSERT(address == parse("unix:" + abstract));
+
+        CPPUNIT_ASSERT(!ListenAddress::fromSocket(-1, address, error));
+        CPPUNIT_ASSERT(!error.empty());
+    }
+
+    void testAdoptAndRelease() {
+        SocketManager first;
+        CPPUNIT_ASSERT(first.bind(parse("127.0.0.1:0")));
+        CPPUNIT_ASSERT(first.bind(parse("unix:" + path_)));
+        CPPUNIT_ASSERT(first.listen());
+
+        // The same sockets, as another process would be handed them
+        SocketManager second;
+        CPPUNIT_ASSERT(second.adopt(dup(first.getListenFd(0)), true));
+        CPPUNIT_ASSERT(second.adopt(dup(first.getListenFd(1)), true));
+        CPPUNIT_ASSERT(second.listen());
+        CPPUNIT_ASSERT_EQUAL(size_t(2), second.listenerCount());
+
+        int datagram = socket(AF_INET, SOCK_DGRAM, 0);
+        CPPUNIT_ASSERT(!second.adopt(datagram, true));
+        CPPUNIT_ASSERT(!second.getErrorMessage().empty());
+        close(datagram);
+
+        // Releasing leaves the socket file to the new owner
+        struct sockaddr_in v4 = loopback(first.getListenFd(0));
+        first.releaseListeners();
+        CPPUNIT_ASSERT_EQUAL(size_t(0), first.listenerCount());
+        struct stat status;
+        CPPUNIT_ASSERT_EQUAL(0, stat(path_.c_str(), &status));
+
+        int client = connectTo(reinterpret_cast<struct sockaddr*>(&v4), sizeof(v4));
+        CPPUNIT_ASSERT_EQUAL(size_t(0), acceptOne(second));
+        close(client);
+        client = connectUnix(path_, false);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), acceptOne(second));
+        close(client);
+
+        second.closeAll();
+        CPPUNIT_ASSERT(stat(path_.c_str(), &status) != 0);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SocketManagerTest);
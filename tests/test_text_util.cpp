@@ -0,0 +1,54 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include "text_util.h"
+
+class TextUtilTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TextUtilTest);
+
+    CPPUNIT_TEST(testTrim);
+    CPPUNIT_TEST(testParseUnsigned);
+    CPPUNIT_TEST(testParseUnsignedLimits);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void testTrim() {
+        CPPUNIT_ASSERT_EQUAL(std::string("a b"), trim(" \ta b\t "));
+        CPPUNIT_ASSERT_EQUAL(std::string(""), trim(" \t "));
+        CPPUNIT_ASSERT_EQUAL(std::string("x\r\n"), trim(" x\r\n"));
+        CPPUNIT_ASSERT_EQUAL(std::string("x"), trim("\r\n x\r\n", " \t\r\n"));
+    }
+
+    void testParseUnsigned() {
+        uint64_t value = 7;
+        CPPUNIT_ASSERT(parseUnsigned("0", value));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), value);
+        CPPUNIT_ASSERT(parseUnsigned("00123", value));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(123), value);
+
+        CPPUNIT_ASSERT(!parseUnsigned("", value));
+        CPPUNIT_ASSERT(!parseUnsigned("-1", value));
+        CPPUNIT_ASSERT(!parseUnsigned("+1", value));
+        CPPUNIT_ASSERT(!parseUnsigned(" 1", value));
+        CPPUNIT_ASSERT(!parseUnsigned("1x", value));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(123), value);
+    }
+
+    void testParseUnsignedLimits() {
+        uint64_t value = 0;
+        CPPUNIT_ASSERT(parseUnsigned("18446744073709551615", value));
+        CPPUNIT_ASSERT_EQUAL(UINT64_MAX, value);
+        CPPUNIT_ASSERT(!parseUnsigned("18446744073709551616", value));
+        CPPUNIT_ASSERT(!parseUnsigned("99999999999999999999", value));
+
+        // Leading zeros do not count against the limit
+        CPPUNIT_ASSERT(parseUnsigned("000000000000000000000042", value));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(42), value);
+
+        CPPUNIT_ASSERT(parseUnsigned("1000", value, 1000));
+        CPPUNIT_ASSERT(!parseUnsigned("1001", value, 1000));
+        CPPUNIT_ASSERT(!parseUnsigned("10000", value, 1000));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TextUtilTest);
@@ -0,0 +1,99 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include "timeouts.h"
+
+class TimeoutsTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TimeoutsTest);
+
+    CPPUNIT_TEST(testExpireInDeadlineOrder);
+    CPPUNIT_TEST(testRestartMovesToBack);
+    CPPUNIT_TEST(testStopAndSwitchCause);
+    CPPUNIT_TEST(testDisabledCause);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    using Clock = std::chrono::steady_clock;
+    using ms = std::chrono::milliseconds;
+
+public:
+    void testExpireInDeadlineOrder() {
+        Timeouts timeouts(ms(100), ms(50), ms(200));
+        Clock::time_point now = Clock::now();
+        Timeouts::Entry idle[3];
+        Timeouts::Entry header;
+        for (int i = 0; i < 3; i++) {
+            timeouts.start(idle[i], TimeoutCause::IDLE, now + ms(i * 10));
+        }
+        timeouts.start(header, TimeoutCause::HEADER, now);
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == now + ms(50));
+
+        CPPUNIT_ASSERT_EQUAL(size_t(0), timeouts.expire(now + ms(49)));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), timeouts.expire(now + ms(50)));
+        CPPUNIT_ASSERT(header.expired && !header.linked);
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == now + ms(100));
+
+        CPPUNIT_ASSERT_EQUAL(size_t(2), timeouts.expire(now + ms(110)));
+        CPPUNIT_ASSERT(idle[0].expired && idle[1].expired && !idle[2].expired);
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == now + ms(120));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), timeouts.expired(TimeoutCause::IDLE));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), timeouts.expired(TimeoutCause::HEADER));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), timeouts.expired(TimeoutCause::BODY));
+    }
+
+    void testRestartMovesToBack() {
+        Timeouts timeouts(ms(0), ms(0), ms(100));
+        Clock::time_point now = Clock::now();
+        Timeouts::Entry first;
+        Timeouts::Entry second;
+        timeouts.start(first, TimeoutCause::BODY, now);
+        timeouts.start(second, TimeoutCause::BODY, now + ms(10));
+
+        // A read restarts the clock: first now expires after second
+        timeouts.start(first, TimeoutCause::BODY, now + ms(20));
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == now + ms(110));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), timeouts.expire(now + ms(115)));
+        CPPUNIT_ASSERT(second.expired && !first.expired);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), timeouts.expire(now + ms(120)));
+        CPPUNIT_ASSERT(first.expired);
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == Clock::time_point::max());
+    }
+
+    void testStopAndSwitchCause() {
+        Timeouts timeouts(ms(100), ms(100), ms(100));
+        Clock::time_point now = Clock::now();
+        Timeouts::Entry entries[3];
+        for (Timeouts::Entry& entry : entries) {
+            timeouts.start(entry, TimeoutCause::IDLE, now);
+        }
+
+        // Unlinking from the middle, the front and the back
+        timeouts.stop(entries[1]);
+        timeouts.start(entries[0], TimeoutCause::HEADER, now + ms(5));
+        timeouts.stop(entries[2]);
+        timeouts.stop(entries[2]);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), timeouts.expire(now + ms(1000)));
+        CPPUNIT_ASSERT(entries[0].expired);
+        CPPUNIT_ASSERT(entries[0].cause == TimeoutCause::HEADER);
+        CPPUNIT_ASSERT(!entries[1].expired && !entries[2].expired);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), timeouts.expired(TimeoutCause::IDLE));
+
+        // Starting again clears the mark
+        timeouts.start(entries[0], TimeoutCause::IDLE, now);
+        CPPUNIT_ASSERT(!entries[0].expired);
+        timeouts.stop(entries[0]);
+    }
+
+    void testDisabledCause() {
+        Timeouts timeouts(ms(0), ms(100), ms(100));
+        Clock::time_point now = Clock::now();
+        Timeouts::Entry entry;
+        timeouts.start(entry, TimeoutCause::HEADER, now);
+        timeouts.start(entry, TimeoutCause::IDLE, now);
+        CPPUNIT_ASSERT(!entry.linked);
+        CPPUNIT_ASSERT(timeouts.nextDeadline() == Clock::time_point::max());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), timeouts.expire(now + std::chrono::hours(1)));
+        CPPUNIT_ASSERT_EQUAL(std::string("header"),
+                             std::string(Timeouts::causeName(TimeoutCause::HEADER)));
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TimeoutsTest);
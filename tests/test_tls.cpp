@@ -0,0 +1,276 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "tls.h"
+#include "connection_handler.h"
+
+#ifdef STITCH_HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#endif
+
+class TlsTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TlsTest);
+
+    CPPUNIT_TEST(testHandshakeFaultNames);
+    CPPUNIT_TEST(testLoadErrors);
+#ifdef STITCH_HAVE_OPENSSL
+    CPPUNIT_TEST(testRequestOverTls);
+    CPPUNIT_TEST(testNoCloseNotify);
+    CPPUNIT_TEST(testSessionResumed);
+    CPPUNIT_TEST(testStalledHandshake);
+#endif
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    char dir[32];
+
+public:
+    void setUp() {
+        // OpenSSL writes with write(); main() runs with SIGPIPE ignored too
+        signal(SIGPIPE, SIG_IGN);
+        snprintf(dir, sizeof(dir), "/tmp/stitch_tlsXXXXXX");
+        CPPUNIT_ASSERT(mkdtemp(dir) != nullptr);
+    }
+
+    void tearDown() {
+        std::string path = dir;
+        unlink((path + "/cert.pem").c_str());
+        unlink((path + "/key.pem").c_str());
+        rmdir(dir);
+    }
+
+    void testHandshakeFaultNames() {
+        CPPUNIT_ASSERT(TlsContext::handshakeFault("stall-handshake.example.com") ==
+                       HandshakeFault::STALL);
+        CPPUNIT_ASSERT(TlsContext::handshakeFault("Reset-Handshake.test") == HandshakeFault::RESET);
+        CPPUNIT_ASSERT(TlsContext::handshakeFault("reset-handshake") == HandshakeFault::RESET);
+        CPPUNIT_ASSERT(TlsContext::handshakeFault("example.stall-handshake.com") ==
+                       HandshakeFault::NONE);
+        CPPUNIT_ASSERT(TlsContext::handshakeFault("") == HandshakeFault::NONE);
+    }
+
+    void testLoadErrors() {
+        TlsContext context;
+        CPPUNIT_ASSERT(!context.load("/nonexistent/cert.pem", "/nonexistent/key.pem"));
+        CPPUNIT_ASSERT(!context.getErrorMessage().empty());
+        if (TlsContext::available()) {
+            CPPUNIT_ASSERT(context.getErrorMessage().find("/nonexistent/cert.pem") !=
+                           std::string::npos);
+        }
+    }
+
+#ifdef STITCH_HAVE_OPENSSL
+private:
+    // A fresh self-signed P-256 certificate and key in dir
+    void makeCertificate() {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        CPPUNIT_ASSERT(key != nullptr);
+        X509* cert = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        CPPUNIT_ASSERT(X509_sign(cert, key, EVP_sha256()) > 0);
+
+        std::string path = dir;
+        FILE* cert_file = fopen((path + "/cert.pem").c_str(), "w");
+        FILE* key_file = fopen((path + "/key.pem").c_str(), "w");
+        CPPUNIT_ASSERT(cert_file != nullptr && key_file != nullptr);
+        PEM_write_X509(cert_file, cert);
+        PEM_write_PrivateKey(key_file, key, nullptr, nullptr, 0, nullptr, nullptr);
+        fclose(cert_file);
+        fclose(key_file);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+
+    void loadContext(TlsContext& context) {
+        makeCertificate();
+        std::string path = dir;
+        CPPUNIT_ASSERT_MESSAGE(context.getErrorMessage(),
+                               context.load(path + "/cert.pem", path + "/key.pem"));
+    }
+
+    // One request over TLS on a socketpair: handshake, send, then read
+    // until the server closes. Returns the response; close_notify says
+    // whether the stream ended with one.
+    std::string exchange(TlsContext& context, SSL_CTX* client_ctx, const std::string& request,
+                         SSL_SESSION** session, bool& close_notify, bool& reused) {
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ConnectionHandler handler(fds[1], nullptr, &context);
+        SSL* ssl = SSL_new(client_ctx);
+        SSL_set_fd(ssl, fds[0]);
+        if (*session != nullptr) {
+            SSL_set_session(ssl, *session);
+        }
+
+        bool sent = false;
+        std::string received;
+        close_notify = false;
+        for (int i = 0; i < 2000; ++i) {
+            if (!handler.shouldClose()) {
+                handler.onReadable();
+                handler.onWritable();
+                handler.onTimer();
+            } else if (handler.getState() != ConnectionState::CLOSED) {
+                handler.closeConnection();
+            }
+
+            if (!SSL_is_init_finished(ssl)) {
+                SSL_connect(ssl);
+                continue;
+            }
+            if (!sent) {
+                CPPUNIT_ASSERT(SSL_write(ssl, request.data(), static_cast<int>(request.size())) ==
+                               static_cast<int>(request.size()));
+                sent = true;
+            }
+            char buffer[4096];
+            int n = SSL_read(ssl, buffer, sizeof(buffer));
+            if (n > 0) {
+                received.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            int error = SSL_get_error(ssl, n);
+            if (error != SSL_ERROR_WANT_READ) {
+                close_notify = error == SSL_ERROR_ZERO_RETURN;
+                break;
+            }
+            usleep(1000);
+        }
+        ERR_clear_error();
+
+        // Answer close_notify, or OpenSSL marks the session not resumable
+        if (close_notify) {
+            SSL_shutdown(ssl);
+        }
+        reused = SSL_session_reused(ssl) == 1;
+        if (*session == nullptr) {
+            *session = SSL_get1_session(ssl);
+        }
+        SSL_free(ssl);
+        ::close(fds[0]);
+        if (handler.getState() != ConnectionState::CLOSED) {
+            handler.closeConnection();
+        }
+        return received;
+    }
+
+public:
+    void testRequestOverTls() {
+        TlsContext context;
+        loadContext(context);
+        SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+        SSL_SESSION* session = nullptr;
+        bool close_notify;
+        bool reused;
+
+        std::string response = exchange(context, client_ctx,
+                                        "GET /?size=100000 HTTP/1.1\r\n\r\n", &session,
+                                        close_notify, reused);
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK\r\n") == 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(100000), response.size() - (response.find("\r\n\r\n") + 4));
+        CPPUNIT_ASSERT(close_notify);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), context.handshakes());
+
+        // Faults count plaintext bytes, as they do without TLS
+        response = exchange(context, client_ctx,
+                            "GET /?size=1000&fault=close&fault_at=100 HTTP/1.1\r\n\r\n", &session,
+                            close_notify, reused);
+        CPPUNIT_ASSERT_EQUAL(size_t(100), response.size());
+
+        SSL_SESSION_free(session);
+        SSL_CTX_free(client_ctx);
+    }
+
+    void testNoCloseNotify() {
+        TlsContext context;
+        loadContext(context);
+        SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+        SSL_SESSION* session = nullptr;
+        bool close_notify;
+        bool reused;
+
+        std::string response = exchange(context, client_ctx,
+                                        "GET /?size=10&tls_fault=no_close_notify HTTP/1.1\r\n\r\n",
+                                        &session, close_notify, reused);
+        CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK\r\n") == 0);
+        CPPUNIT_ASSERT(!close_notify);
+
+        SSL_SESSION_free(session);
+        SSL_CTX_free(client_ctx);
+    }
+
+    void testSessionResumed() {
+        for (int tls_version : {TLS1_2_VERSION, TLS1_3_VERSION}) {
+            TlsContext context;
+            loadContext(context);
+            SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+            SSL_CTX_set_max_proto_version(client_ctx, tls_version);
+            SSL_SESSION* session = nullptr;
+            bool close_notify;
+            bool reused;
+
+            exchange(context, client_ctx, "GET / HTTP/1.1\r\n\r\n", &session, close_notify, reused);
+            CPPUNIT_ASSERT(!reused);
+            CPPUNIT_ASSERT(session != nullptr);
+            std::string response = exchange(context, client_ctx, "GET / HTTP/1.1\r\n\r\n",
+                                            &session, close_notify, reused);
+            CPPUNIT_ASSERT(response.find("HTTP/1.1 200 OK\r\n") == 0);
+            CPPUNIT_ASSERT(reused);
+            CPPUNIT_ASSERT_EQUAL(uint64_t(2), context.handshakes());
+            CPPUNIT_ASSERT_EQUAL(uint64_t(1), context.resumed());
+
+            SSL_SESSION_free(session);
+            SSL_CTX_free(client_ctx);
+        }
+    }
+
+    void testStalledHandshake() {
+        TlsContext context;
+        loadContext(context);
+        SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+        int fds[2];
+        CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+        ConnectionHandler handler(fds[1], nullptr, &context);
+        SSL* ssl = SSL_new(client_ctx);
+        SSL_set_fd(ssl, fds[0]);
+        static char server_name[] = "stall-handshake.test";
+        SSL_ctrl(ssl, SSL_CTRL_SET_TLSEXT_HOSTNAME, TLSEXT_NAMETYPE_host_name, server_name);
+
+        for (int i = 0; i < 20; ++i) {
+            CPPUNIT_ASSERT_EQUAL(-1, SSL_connect(ssl));
+            handler.onReadable();
+            handler.onWritable();
+        }
+        CPPUNIT_ASSERT(handler.getState() == ConnectionState::HANDSHAKING);
+        CPPUNIT_ASSERT(!handler.shouldClose());
+        char byte;
+        CPPUNIT_ASSERT(recv(fds[0], &byte, 1, 0) < 0);
+
+        // The client giving up ends it
+        SSL_free(ssl);
+        ERR_clear_error();
+        ::close(fds[0]);
+        handler.onReadable();
+        CPPUNIT_ASSERT(handler.shouldClose());
+        handler.closeConnection();
+        SSL_CTX_free(client_ctx);
+    }
+#endif
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TlsTest);
@@ -0,0 +1,219 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "traffic_log.h"
+
+class TrafficLogTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TrafficLogTest);
+
+    CPPUNIT_TEST(testEncodeDecodeRoundTrip);
+    CPPUNIT_TEST(testDecodeRejectsTruncatedRecord);
+    CPPUNIT_TEST(testRecordAndReplayFile);
+    CPPUNIT_TEST(testReplayStopsAtPartialTail);
+    CPPUNIT_TEST(testReplayRejectsForeignFile);
+    CPPUNIT_TEST(testRecorderFlushesLargeVolumes);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    char path[32];
+
+    std::string readFile() {
+        std::ifstream file(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& content) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << content;
+    }
+
+public:
+    void setUp() {
+        snprintf(path, sizeof(path), "/tmp/stitch_logXXXXXX");
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+    }
+
+    void tearDown() {
+        std::remove(path);
+    }
+
+    void testEncodeDecodeRoundTrip() {
+        TrafficRecord record;
+        record.sequence = 300;
+        record.arrival_us = 1500000;
+        record.parse_us = 42;
+        record.command.behavior = BehaviorType::SLOW_RESPONSE;
+        record.command.status_code = -1;
+        record.command.delay_ms = 20;
+        record.command.delay_us = 20437;
+        record.command.bytes_before_close = 1u << 20;
+        record.command.reason_phrase = "Slow";
+        record.command.body_content = std::string("a\0b", 3);
+        record.command.chunks.parseSizes("100,7");
+        record.command.chunks.fault = ChunkPlan::Fault::MISSING_CRLF;
+        record.command.chunks.fault_chunk = 5;
+        record.command.range_fault = RangeFault::WRONG_RANGE;
+        record.command.encoding = ContentEncoding::DEFLATE;
+        record.command.encoding_fault = EncodingFault::MISLABEL;
+        record.command.headers.emplace_back("Set-Cookie", "a=1");
+        record.command.duplicate_headers = 4;
+        record.command.header_count = 100;
+        record.command.header_size = 8192;
+        record.command.request_body = RequestBodyMode::ECHO;
+        record.command.read_rate = 1000;
+        record.command.sndbuf = 65536;
+        record.command.nodelay = 0;
+        std::string error;
+        record.command.script = BehaviorScript::compile("status,wait:5,reset", error);
+        record.request = "GET /?behavior=slow HTTP/1.1\r\n\r\n";
+
+        std::string encoded;
+        TrafficLog::encode(record, 1000000, encoded);
+
+        TrafficRecord decoded;
+        size_t offset = 0;
+        CPPUNIT_ASSERT(TrafficLog::decode(encoded.data(), encoded.size(), offset, 1000000, decoded));
+        CPPUNIT_ASSERT_EQUAL(encoded.size(), offset);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(300), decoded.sequence);
+        CPPUNIT_ASSERT_EQUAL(int64_t(1500000), decoded.arrival_us);
+        CPPUNIT_ASSERT_EQUAL(int64_t(42), decoded.parse_us);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::SLOW_RESPONSE, decoded.command.behavior);
+        CPPUNIT_ASSERT_EQUAL(-1, decoded.command.status_code);
+        CPPUNIT_ASSERT_EQUAL(20, decoded.command.delay_ms);
+        CPPUNIT_ASSERT_EQUAL(int64_t(20437), decoded.command.delay_us);
+        CPPUNIT_ASSERT_EQUAL(size_t(1u << 20), decoded.command.bytes_before_close);
+        CPPUNIT_ASSERT_EQUAL(std::string("Slow"), decoded.command.reason_phrase);
+        CPPUNIT_ASSERT_EQUAL(std::string("a\0b", 3), decoded.command.body_content);
+        CPPUNIT_ASSERT(decoded.command.chunks.mode == ChunkPlan::Mode::LIST);
+        CPPUNIT_ASSERT(decoded.command.chunks.sizes == record.command.chunks.sizes);
+        CPPUNIT_ASSERT(decoded.command.chunks.fault == ChunkPlan::Fault::MISSING_CRLF);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(5), decoded.command.chunks.fault_chunk);
+        CPPUNIT_ASSERT(decoded.command.range_fault == RangeFault::WRONG_RANGE);
+        CPPUNIT_ASSERT(decoded.command.encoding == ContentEncoding::DEFLATE);
+        CPPUNIT_ASSERT(decoded.command.encoding_fault == EncodingFault::MISLABEL);
+        CPPUNIT_ASSERT(decoded.command.headers == record.command.headers);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(4), decoded.command.duplicate_headers);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(100), decoded.command.header_count);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(8192), decoded.command.header_size);
+        CPPUNIT_ASSERT(decoded.command.request_body == RequestBodyMode::ECHO);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1000), decoded.command.read_rate);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(65536), decoded.command.sndbuf);
+        CPPUNIT_ASSERT_EQUAL(0, decoded.command.nodelay);
+        CPPUNIT_ASSERT(decoded.command.script != nullptr);
+        CPPUNIT_ASSERT_EQUAL(std::string("status,wait:5,reset"), decoded.command.script->source());
+        CPPUNIT_ASSERT_EQUAL(record.request, decoded.request);
+    }
+
+    void testDecodeRejectsTruncatedRecord() {
+        TrafficRecord record;
+        record.request = "GET / HTTP/1.1\r\n\r\n";
+        std::string encoded;
+        TrafficLog::encode(record, 0, encoded);
+
+        for (size_t cut = 0; cut < encoded.size(); ++cut) {
+            TrafficRecord decoded;
+            size_t offset = 0;
+            CPPUNIT_ASSERT(!TrafficLog::decode(encoded.data(), cut, offset, 0, decoded));
+            CPPUNIT_ASSERT_EQUAL(size_t(0), offset);
+        }
+    }
+
+    void testRecordAndReplayFile() {
+        TrafficRecorder recorder;
+        CPPUNIT_ASSERT(recorder.open(path));
+
+        TestCommand error;
+        error.behavior = BehaviorType::ERROR_RESPONSE;
+        error.status_code = 503;
+        recorder.record("GET /a HTTP/1.1\r\n\r\n", 10, error);
+
+        TestCommand close;
+        close.behavior = BehaviorType::CLOSE_IMMEDIATELY;
+        recorder.record("GET /b HTTP/1.1\r\n\r\n", 20, close);
+        recorder.close();
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), recorder.count());
+
+        TrafficReplayer replay;
+        CPPUNIT_ASSERT(replay.open(path));
+
+        TrafficRecord record;
+        CPPUNIT_ASSERT(replay.next(record));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(0), record.sequence);
+        CPPUNIT_ASSERT_EQUAL(503, record.command.status_code);
+        CPPUNIT_ASSERT_EQUAL(std::string("GET /a HTTP/1.1\r\n\r\n"), record.request);
+        int64_t first_arrival = record.arrival_us;
+
+        CPPUNIT_ASSERT(replay.next(record));
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), record.sequence);
+        CPPUNIT_ASSERT_EQUAL(BehaviorType::CLOSE_IMMEDIATELY, record.command.behavior);
+        CPPUNIT_ASSERT(record.arrival_us >= first_arrival);
+
+        CPPUNIT_ASSERT(!replay.next(record));
+        CPPUNIT_ASSERT(replay.exhausted());
+        CPPUNIT_ASSERT_EQUAL(uint64_t(2), replay.consumed());
+    }
+
+    void testReplayStopsAtPartialTail() {
+        TrafficRecorder recorder;
+        CPPUNIT_ASSERT(recorder.open(path));
+        TestCommand cmd;
+        recorder.record("GET /first HTTP/1.1\r\n\r\n", 0, cmd);
+        recorder.record("GET /second HTTP/1.1\r\n\r\n", 0, cmd);
+        recorder.close();
+
+        // Simulate a crash in the middle of the last write
+        std::string content = readFile();
+        writeFile(content.substr(0, content.size() - 5));
+
+        TrafficReplayer replay;
+        CPPUNIT_ASSERT(replay.open(path));
+        TrafficRecord record;
+        CPPUNIT_ASSERT(replay.next(record));
+        CPPUNIT_ASSERT_EQUAL(std::string("GET /first HTTP/1.1\r\n\r\n"), record.request);
+        CPPUNIT_ASSERT(!replay.next(record));
+        CPPUNIT_ASSERT(replay.exhausted());
+    }
+
+    void testReplayRejectsForeignFile() {
+        writeFile("not a traffic log at all");
+        TrafficReplayer replay;
+        CPPUNIT_ASSERT(!replay.open(path));
+        CPPUNIT_ASSERT(!replay.getErrorMessage().empty());
+
+        writeFile("");
+        CPPUNIT_ASSERT(!replay.open(path));
+        CPPUNIT_ASSERT(!replay.open("/nonexistent/stitch.log"));
+    }
+
+    void testRecorderFlushesLargeVolumes() {
+        TrafficRecorder recorder;
+        CPPUNIT_ASSERT(recorder.open(path));
+
+        TestCommand cmd;
+        std::string request = "GET /" + std::string(1000, 'x') + " HTTP/1.1\r\n\r\n";
+        const int count = 200;
+        for (int i = 0; i < count; ++i) {
+            recorder.record(request, i, cmd);
+        }
+
+        // More than one buffer's worth reached the file before close()
+        CPPUNIT_ASSERT(readFile().size() >= TrafficRecorder::BUFFER_SIZE);
+        recorder.close();
+
+        TrafficReplayer replay;
+        CPPUNIT_ASSERT(replay.open(path));
+        TrafficRecord record;
+        int replayed = 0;
+        while (replay.next(record)) {
+            CPPUNIT_ASSERT_EQUAL(int64_t(replayed), record.parse_us);
+            ++replayed;
+        }
+        CPPUNIT_ASSERT_EQUAL(count, replayed);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TrafficLogTest);
@@ -0,0 +1,206 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include "upstream.h"
+
+class UpstreamTest : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(UpstreamTest);
+
+    CPPUNIT_TEST(testForwardHead);
+    CPPUNIT_TEST(testParseResponse);
+    CPPUNIT_TEST(testParseByteAtATime);
+    CPPUNIT_TEST(testInterimResponsesSkipped);
+    CPPUNIT_TEST(testKeepAlive);
+    CPPUNIT_TEST(testBadResponses);
+    CPPUNIT_TEST(testPoolConfigure);
+    CPPUNIT_TEST(testPoolReusesIdleConnections);
+
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static UpstreamResponse::ParseResult parse(UpstreamResponse& response, const std::string& data) {
+        response.reset();
+        return response.parse(data.data(), data.size());
+    }
+
+    // A loopback listener on a free port
+    static int listenLoopback(int& port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        CPPUNIT_ASSERT(fd >= 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CPPUNIT_ASSERT_EQUAL(0, bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+        CPPUNIT_ASSERT_EQUAL(0, listen(fd, 8));
+        socklen_t length = sizeof(addr);
+        CPPUNIT_ASSERT_EQUAL(0, getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length));
+        port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+public:
+    void setUp() {}
+    void tearDown() {}
+
+    void testForwardHead() {
+        std::string head = "POST /a?b=1 HTTP/1.1\r\n"
+                           "Host: example.com\r\n"
+                           "Connection: keep-alive, X-Hop\r\n"
+                           "Keep-Alive: timeout=5\r\n"
+                           "X-Hop: 1\r\n"
+                           "Expect: 100-continue\r\n"
+                           "Content-Length: 3\r\n"
+                           "\r\n";
+        CPPUNIT_ASSERT_EQUAL(std::string("POST /a?b=1 HTTP/1.1\r\n"
+                                         "Host: example.com\r\n"
+                                         "Content-Length: 3\r\n"
+                                         "\r\n"),
+                             UpstreamRequest::forwardHead(head.data(), head.size()));
+    }
+
+    void testParseResponse() {
+        UpstreamResponse response;
+        CPPUNIT_ASSERT(response.empty());
+        std::string data = "HTTP/1.1 404 Not Found\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Set-Cookie: a=1\r\n"
+                           "Set-Cookie: b=2\r\n"
+                           "Content-Length:  5 \r\n"
+                           "Connection: keep-alive\r\n"
+                           "\r\n"
+                           "he";
+        CPPUNIT_ASSERT(parse(response, data) == UpstreamResponse::ParseResult::COMPLETE);
+        CPPUNIT_ASSERT_EQUAL(404, response.getStatusCode());
+        CPPUNIT_ASSERT_EQUAL(std::string("Not Found"), response.getReasonPhrase());
+        CPPUNIT_ASSERT_EQUAL(std::string("Content-Type: text/plain\r\n"
+                                         "Set-Cookie: a=1\r\n"
+                                         "Set-Cookie: b=2\r\n"),
+                             response.getHeaderLines());
+        CPPUNIT_ASSERT_EQUAL(std::string("5"), response.getContentLength());
+        CPPUNIT_ASSERT(response.getTransferEncoding().empty());
+        CPPUNIT_ASSERT_EQUAL(std::string("he"), response.getBodyStart());
+
+        // Later bytes are body too
+        CPPUNIT_ASSERT(response.parse("llo", 3) == UpstreamResponse::ParseResult::COMPLETE);
+        CPPUNIT_ASSERT_EQUAL(std::string("hello"), response.getBodyStart());
+
+        CPPUNIT_ASSERT(parse(response, "HTTP/1.1 200 \r\nTransfer-Encoding: gzip\r\n"
+                                       "Transfer-Encoding: chunked\r\n\r\n") ==
+                       UpstreamResponse::ParseResult::COMPLETE);
+        CPPUNIT_ASSERT(response.getReasonPhrase().empty());
+        CPPUNIT_ASSERT_EQUAL(std::string("gzip, chunked"), response.getTransferEncoding());
+    }
+
+    void testParseByteAtATime() {
+        UpstreamResponse response;
+        std::string data = "HTTP/1.0 200 OK\nServer: x\n\nbody";
+        UpstreamResponse::ParseResult result = UpstreamResponse::ParseResult::INCOMPLETE;
+        for (char c : data) {
+            result = response.parse(&c, 1);
+            CPPUNIT_ASSERT(result != UpstreamResponse::ParseResult::ERROR);
+        }
+        CPPUNIT_ASSERT(result == UpstreamResponse::ParseResult::COMPLETE);
+        CPPUNIT_ASSERT_EQUAL(std::string("Server: x\r\n"), response.getHeaderLines());
+        CPPUNIT_ASSERT_EQUAL(std::string("body"), response.getBodyStart());
+    }
+
+    void testInterimResponsesSkipped() {
+        UpstreamResponse response;
+        CPPUNIT_ASSERT(parse(response, "HTTP/1.1 100 Continue\r\n\r\n") ==
+                       UpstreamResponse::ParseResult::INCOMPLETE);
+        CPPUNIT_ASSERT(!response.empty());
+        std::string rest = "HTTP/1.1 103 Early Hints\r\nLink: </a>\r\n\r\n"
+                           "HTTP/1.1 201 Created\r\n\r\n";
+        CPPUNIT_ASSERT(response.parse(rest.data(), rest.size()) ==
+                       UpstreamResponse::ParseResult::COMPLETE);
+        CPPUNIT_ASSERT_EQUAL(201, response.getStatusCode());
+        CPPUNIT_ASSERT(response.getHeaderLines().empty());
+    }
+
+    void testKeepAlive() {
+        UpstreamResponse response;
+        parse(response, "HTTP/1.1 200 OK\r\n\r\n");
+        CPPUNIT_ASSERT(response.keepAlive());
+        parse(response, "HTTP/1.1 200 OK\r\nConnection: Close\r\n\r\n");
+        CPPUNIT_ASSERT(!response.keepAlive());
+        parse(response, "HTTP/1.0 200 OK\r\n\r\n");
+        CPPUNIT_ASSERT(!response.keepAlive());
+        parse(response, "HTTP/1.0 200 OK\r\nConnection: keep-alive\r\n\r\n");
+        CPPUNIT_ASSERT(response.keepAlive());
+    }
+
+    void testBadResponses() {
+        UpstreamResponse response;
+        for (const char* data : {"HTTP/2 200 OK\r\n\r\n", "HTTP/1.1 2000 OK\r\n\r\n",
+                                 "HTTP/1.1 20x OK\r\n\r\n", "HTTP/1.1 101 Switching\r\n\r\n",
+                                 "HTTP/1.1 200 OK\r\nNo colon\r\n\r\n",
+                                 "HTTP/1.1 200 OK\r\nA: 1\r\n folded\r\n\r\n",
+                                 "HTTP/1.1 200 OK\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n"}) {
+            CPPUNIT_ASSERT(parse(response, data) == UpstreamResponse::ParseResult::ERROR);
+            CPPUNIT_ASSERT(!response.getErrorMessage().empty());
+        }
+
+        std::string endless = "HTTP/1.1 200 OK\r\nX: " + std::string(UpstreamResponse::MAX_HEAD, 'a');
+        CPPUNIT_ASSERT(parse(response, endless) == UpstreamResponse::ParseResult::ERROR);
+    }
+
+    void testPoolConfigure() {
+        UpstreamPool pool;
+        CPPUNIT_ASSERT(pool.acquire() < 0);
+        CPPUNIT_ASSERT(!pool.configure("localhost"));
+        CPPUNIT_ASSERT(!pool.configure(":80"));
+        CPPUNIT_ASSERT(!pool.configure("localhost:http"));
+        CPPUNIT_ASSERT(!pool.getErrorMessage().empty());
+        CPPUNIT_ASSERT(pool.configure("127.0.0.1:8080"));
+        CPPUNIT_ASSERT(pool.configure("[::1]:8080"));
+        CPPUNIT_ASSERT_EQUAL(std::string("[::1]:8080"), pool.getAddress());
+    }
+
+    void testPoolReusesIdleConnections() {
+        int port;
+        int listener = listenLoopback(port);
+        UpstreamPool pool(1);
+        CPPUNIT_ASSERT(pool.configure("127.0.0.1:" + std::to_string(port)));
+        std::vector<int> watched;
+        pool.setWatcher([&watched](int fd) { watched.push_back(fd); });
+
+        bool reused = true;
+        int first = pool.acquire(&reused);
+        CPPUNIT_ASSERT(first >= 0);
+        CPPUNIT_ASSERT(!reused);
+        int second = pool.acquire();
+        CPPUNIT_ASSERT(second >= 0);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), watched.size());
+        int first_peer = accept(listener, nullptr, nullptr);
+        int second_peer = accept(listener, nullptr, nullptr);
+        CPPUNIT_ASSERT(first_peer >= 0 && second_peer >= 0);
+
+        // One idle connection is kept; the other goes
+        pool.release(first);
+        pool.release(second);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), pool.idle());
+        CPPUNIT_ASSERT_EQUAL(first, pool.acquire(&reused));
+        CPPUNIT_ASSERT(reused);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1), pool.reuses());
+
+        // One the backend has closed is not handed out again
+        pool.release(first);
+        ::close(first_peer);
+        usleep(10000);
+        int third = pool.acquire(&reused);
+        CPPUNIT_ASSERT(third >= 0);
+        CPPUNIT_ASSERT(!reused);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(3), pool.connects());
+        CPPUNIT_ASSERT_EQUAL(size_t(0), pool.idle());
+
+        pool.discard(third);
+        ::close(second_peer);
+        ::close(listener);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(UpstreamTest);